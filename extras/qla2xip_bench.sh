@@ -0,0 +1,124 @@
+#!/bin/bash
+#
+# Host-only benchmark of the IP over FC path (qla_ip.c/qla2xip.c) on a pair
+# of software-emulated ISP24xx adapters, see qla_ip_emu.c.  Requires a
+# qla2xxx built with CONFIG_SCSI_QLA_IP_EMU and the pktgen module.
+#
+# The second adapter is moved into a network namespace so traffic crosses
+# the emulated link rather than the local loopback.  Throughput is measured
+# with kernel pktgen, latency with ping; the IP driver's ethtool statistics
+# are dumped afterwards.
+#
+
+NS=qla2xip_bench
+ADDR0=192.168.250.1
+ADDR1=192.168.250.2
+
+DURATION=10
+PKT_SIZE=1500
+COUNT=1000
+
+help() {
+	cat <<-END
+	$0	benchmark the IP driver on emulated adapters
+
+	$0  [ -t seconds ] [ -s packet-size ] [ -c ping-count ]
+
+	-t	pktgen duration (default $DURATION)
+	-s	pktgen packet size (default $PKT_SIZE)
+	-c	number of ping round trips (default $COUNT)
+	END
+	exit
+}
+
+while getopts "t:s:c:h" opt; do
+	case $opt in
+		t ) DURATION=$OPTARG ;;
+		s ) PKT_SIZE=$OPTARG ;;
+		c ) COUNT=$OPTARG ;;
+		* ) help ;;
+	esac
+done
+
+# Emulated adapter N has the Ethernet address 02:00:51:4c:00:0N
+netdev() {
+	local mac=$(printf "02:00:51:4c:00:%02x" $1)
+	local dev
+
+	for dev in /sys/class/net/*; do
+		if [ "$(cat $dev/address)" = "$mac" ]; then
+			basename $dev
+			return
+		fi
+	done
+}
+
+pgset() {
+	echo "$2" > /proc/net/pktgen/$1 || exit 1
+}
+
+cleanup() {
+	ip netns del $NS 2>/dev/null
+	rmmod pktgen 2>/dev/null
+	rmmod qla2xip 2>/dev/null
+	rmmod qla2xxx 2>/dev/null
+}
+
+if [ $(id -u) -ne 0 ]; then
+	echo "$0: must be run as root"
+	exit 1
+fi
+
+cleanup
+trap cleanup EXIT
+
+modprobe qla2xxx ql2xipemu=2 || exit 1
+modprobe qla2xip || exit 1
+modprobe pktgen || exit 1
+sleep 1
+
+FC0=$(netdev 0)
+FC1=$(netdev 1)
+if [ -z "$FC0" -o -z "$FC1" ]; then
+	echo "$0: emulated adapters not found"
+	exit 1
+fi
+MAC1=$(cat /sys/class/net/$FC1/address)
+
+ip netns add $NS
+ip link set $FC1 netns $NS
+ip addr add $ADDR0/24 dev $FC0
+ip link set $FC0 up
+ip netns exec $NS ip addr add $ADDR1/24 dev $FC1
+ip netns exec $NS ip link set $FC1 up
+ip netns exec $NS ip link set lo up
+sleep 1
+
+echo "=== Latency: $COUNT round trips $FC0 -> $FC1"
+ping -q -i 0 -c $COUNT $ADDR1 | tail -2
+
+echo "=== Throughput: $PKT_SIZE byte packets $FC0 -> $FC1, $DURATION s"
+THREAD=kpktgend_0
+pgset $THREAD "rem_device_all"
+pgset $THREAD "add_device $FC0"
+pgset $FC0 "count 0"
+pgset $FC0 "pkt_size $PKT_SIZE"
+pgset $FC0 "clone_skb 0"
+pgset $FC0 "delay 0"
+pgset $FC0 "dst $ADDR1"
+pgset $FC0 "dst_mac $MAC1"
+
+echo "start" > /proc/net/pktgen/pgctrl &
+PGCTRL=$!
+sleep $DURATION
+echo "stop" > /proc/net/pktgen/pgctrl
+wait $PGCTRL
+
+grep -A2 "^Result" /proc/net/pktgen/$FC0
+echo "--- received by $FC1"
+ip netns exec $NS ip -s link show $FC1 | sed -n '3,4p'
+
+echo "=== Statistics $FC0"
+ethtool -S $FC0
+echo "=== Statistics $FC1"
+ip netns exec $NS ethtool -S $FC1
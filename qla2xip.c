@@ -34,10 +34,22 @@ static const char *qla_version = "2.00.00b1-j1";
 #include <linux/delay.h>
 #include <linux/mm.h>
 #include <linux/moduleparam.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/tcp.h>
+#include <net/ip.h>
+#include <net/tcp.h>
+#include <linux/bpf.h>
+#include <linux/bpf_trace.h>
+#include <linux/llist.h>
+#include <linux/hash.h>
+#include <linux/pkt_sched.h>
+#include <net/page_pool/helpers.h>
+#include <net/xdp.h>
 //#include <asm/system.h>
 #include <asm/io.h>
 #include <asm/irq.h>
 #include <asm/byteorder.h>
+#include <asm/unaligned.h>
 #include <asm/uaccess.h>
 
 #include "qla_def.h"
@@ -47,6 +59,12 @@ static const char *qla_version = "2.00.00b1-j1";
 /* Module command line parameters */
 static int mtu = DEFAULT_MTU_SIZE;
 static int buffers = DEFAULT_RECEIVE_BUFFERS;
+static int small_buffers = DEFAULT_SMALL_BUFFERS;
+static int send_packets = DEFAULT_SEND_PACKETS;
+static int header_split = DEFAULT_HEADER_SPLIT;
+static int tx_queues;
+static int rx_add_mark = RECEIVE_BUFFERS_ADD_MARK;
+static int rx_low_mark = RECEIVE_BUFFERS_LOW_MARK;
 
 module_param(mtu, int, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(mtu,
@@ -60,6 +78,41 @@ MODULE_PARM_DESC(buffers,
 		 "(min=" __MODULE_STRING(MIN_RECEIVE_BUFFERS)
 		 " max=" __MODULE_STRING(MAX_RECEIVE_BUFFERS) ")");
 
+module_param(small_buffers, int, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(small_buffers,
+		 "Number of small receive buffers for ARP/ACK sized frames, "
+		 "if the SCSI driver supports a second buffer pool, "
+		 "0 disables (max=" __MODULE_STRING(MAX_RECEIVE_BUFFERS)
+		 " less buffers)");
+
+module_param(send_packets, int, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(send_packets,
+		 "Maximum number of outstanding send packets "
+		 "(min=" __MODULE_STRING(MIN_SEND_PACKETS)
+		 " max=" __MODULE_STRING(MAX_SEND_PACKETS) ")");
+
+module_param(header_split, int, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(header_split,
+		 "Size of the receive header buffer, 0 disables header/data "
+		 "split (max=" __MODULE_STRING(MAX_HEADER_SPLIT) ")");
+
+module_param(tx_queues, int, S_IRUGO);
+MODULE_PARM_DESC(tx_queues,
+		 "Number of transmit queues, 0 for one per online CPU "
+		 "(max=" __MODULE_STRING(QLA_IP_MAX_TX_QUEUES) ")");
+
+module_param(rx_add_mark, int, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(rx_add_mark,
+		 "Number of replenished receive buffers passed to the "
+		 "firmware at once (min=1 max="
+		 __MODULE_STRING(MAX_RECEIVE_BUFFERS) ")");
+
+module_param(rx_low_mark, int, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(rx_low_mark,
+		 "Pass replenished receive buffers to the firmware at once "
+		 "when it holds this many or fewer "
+		 "(max=" __MODULE_STRING(MAX_RECEIVE_BUFFERS) ")");
+
 /* Backdoor entry points into qla2x00 driver */
 extern int qla2x00_ip_inquiry(uint16_t, struct bd_inquiry *);
 
@@ -124,51 +177,138 @@ qla2xip_display_dev_info(struct net_device *dev)
 }
 
 /**
- * qla2xip_allocate_buffers() - Allocates and initializes network structures.
- * @dev: The device to initialize
+ * qla2xip_tx_dest_inc() - Account a send_cb sent to a destination.
+ * @txq: The transmit queue
+ * @dest: The destination index
+ */
+static inline void
+qla2xip_tx_dest_inc(struct qla2xip_txq *txq, uint16_t dest)
+{
+	if (atomic_inc_return(&txq->dests[dest].inflight) == 1)
+		atomic_inc(&txq->dests_busy);
+}
+
+/**
+ * qla2xip_tx_dest_dec() - Account a send_cb of a destination returned.
+ * @txq: The transmit queue
+ * @dest: The destination index
+ */
+static inline void
+qla2xip_tx_dest_dec(struct qla2xip_txq *txq, uint16_t dest)
+{
+	if (atomic_dec_and_test(&txq->dests[dest].inflight))
+		atomic_dec(&txq->dests_busy);
+}
+
+/**
+ * qla2xip_tx_purge() - Drop the packets held back on a transmit queue.
+ * @txq: The transmit queue
+ */
+static void
+qla2xip_tx_purge(struct qla2xip_txq *txq)
+{
+	struct qla2xip_tx_dest *dest, *next;
+
+	if (!txq->dests)
+		return;
+
+	/* Only backlogged destinations are on the active list */
+	list_for_each_entry_safe(dest, next, &txq->active, active) {
+		__skb_queue_purge(&dest->backlog);
+		list_del_init(&dest->active);
+		dest->deficit = 0;
+	}
+	txq->active_cnt = 0;
+	WRITE_ONCE(txq->backlog_full, 0);
+}
+
+/**
+ * qla2xip_free_txq() - Releases the send_cb ring of a transmit queue.
+ * @qdev: The device's private structure
+ * @txq: The transmit queue
+ * @count: The number of send_cbs in the ring
+ */
+static void
+qla2xip_free_txq(struct qla2xip_private *qdev, struct qla2xip_txq *txq,
+    uint16_t count)
+{
+	if (txq->scb_header)
+		dma_free_coherent(&qdev->pdev->dev,
+		    count * sizeof(struct qla2xip_scb_header),
+		    txq->scb_header, txq->scb_header_dma);
+	qla2xip_tx_purge(txq);
+	kfree(txq->dest_hash);
+	kfree(txq->dests);
+	kfree(txq->send_q);
+	kfree(txq->send_buffers);
+	txq->scb_header = NULL;
+	txq->dest_hash = NULL;
+	txq->dests = NULL;
+	txq->send_q = NULL;
+	txq->send_buffers = NULL;
+}
+
+/**
+ * qla2xip_alloc_txq() - Allocates and initializes a transmit queue's ring.
+ * @qdev: The device's private structure
+ * @txq: The transmit queue to fill in
+ * @queue: The transmit queue number
+ * @count: The number of send_cbs to allocate
+ *
+ * The ring is built in @txq without touching its lock, so a replacement
+ * ring may be prepared while the transmit queue is still running.
  *
  * Returns 0 on success.
  */
 static int
-qla2xip_allocate_buffers(struct net_device *dev)
+qla2xip_alloc_txq(struct qla2xip_private *qdev, struct qla2xip_txq *txq,
+    uint16_t queue, uint16_t count)
 {
-	struct qla2xip_private *qdev = netdev_priv(dev);
 	int i;
-	struct sk_buff *skb;
 	struct send_cb *scb;
-	struct buffer_cb *bcb;
 	struct packet_header *packethdr;
-	unsigned long iter;
-
-	/*
-	 * Allocate/initialize queue of send control blocks for sending packets
-	 * to the SCSI driver.
-	 */
 
-	if ((PAGE_SIZE / sizeof(struct packet_header)) < MAX_SEND_PACKETS) {
-		printk(KERN_ERR
-		       "%s: Unable to allocate space for packets %lx/%x\n",
-		       qla_name, PAGE_SIZE / sizeof(struct packet_header),
-		       MAX_SEND_PACKETS);
+	INIT_LIST_HEAD(&txq->active);
+	txq->active_cnt = 0;
+	txq->backlog_full = 0;
+	atomic_set(&txq->dests_busy, 0);
+
+	txq->send_buffers = kcalloc(count, sizeof(struct send_cb), GFP_KERNEL);
+	txq->send_q = kcalloc(count + 1, sizeof(struct send_cb *), GFP_KERNEL);
+	txq->scb_header = dma_alloc_coherent(&qdev->pdev->dev,
+	    count * sizeof(struct qla2xip_scb_header), &txq->scb_header_dma,
+	    GFP_KERNEL);
+	txq->dests = kcalloc(count, sizeof(struct qla2xip_tx_dest),
+	    GFP_KERNEL);
+	txq->dest_hash = kcalloc(QLA2XIP_TX_DEST_HASH,
+	    sizeof(struct hlist_head), GFP_KERNEL);
+	if (!txq->send_buffers || !txq->send_q || !txq->scb_header ||
+	    !txq->dests || !txq->dest_hash) {
+		qla2xip_free_txq(qdev, txq, count);
 		return 1;
 	}
 
-	qdev->scb_header = pci_alloc_consistent(qdev->pdev, PAGE_SIZE,
-						&qdev->scb_header_dma);
-	if (!qdev->scb_header) {
-		printk(KERN_ERR
-		       "%s: Failed to allocate send_cb headers\n", qla_name);
-		return 1;
+	txq->send_q_in = 0;
+	txq->send_q_out = 0;
+
+	/* A destination in use holds a send_cb or is backlogged */
+	txq->dests_cnt = count;
+	txq->dests_next = 0;
+	for (i = 0; i < count; i++) {
+		INIT_HLIST_NODE(&txq->dests[i].node);
+		__skb_queue_head_init(&txq->dests[i].backlog);
+		INIT_LIST_HEAD(&txq->dests[i].active);
 	}
 
-	for (i = 0, iter = 0; i < MAX_SEND_PACKETS;
-	     i++, iter += sizeof(struct packet_header)) {
-		scb = &qdev->send_buffers[i];
+	for (i = 0; i < count; i++) {
+		scb = &txq->send_buffers[i];
 
 		scb->qdev = qdev;
-		scb->header = (struct packet_header *)
-		    (((__u8 *) qdev->scb_header) + iter);
-		scb->header_dma = qdev->scb_header_dma + iter;
+		scb->queue = queue;
+		scb->header = &txq->scb_header[i].packethdr;
+		scb->header_dma = txq->scb_header_dma +
+		    i * sizeof(struct qla2xip_scb_header);
+		scb->header_len = sizeof(struct packet_header);
 
 		/* Build Network and SNAP headers */
 		packethdr = (struct packet_header *)scb->header;
@@ -185,644 +325,3382 @@ qla2xip_allocate_buffers(struct net_device *dev)
 		packethdr->snaph.protid[2] = SNAP_OUI;
 
 		/* Add send control block to send control block ring */
-		qdev->send_q[i] = scb;
-		qdev->send_q_in++;
+		txq->send_q[i] = scb;
+		txq->send_q_in++;
 	}
 
-	/*
-	 * Allocate/initialize queue of buffers for receiving packets from the
-	 * SCSI driver
-	 * */
-	for (i = 0; i < qdev->max_receive_buffers; i++) {
-		/* Initialize receive buffer control block */
-		bcb = &qdev->receive_buffers[i];
-		bcb->handle = i;
+	return 0;
+}
 
-		/* Allocate data buffer */
-		skb = dev_alloc_skb(qdev->receive_buff_data_size);
-		if (skb == NULL) {
+/**
+ * qla2xip_free_send_cbs() - Releases the send_cb rings.
+ * @qdev: The device's private structure
+ */
+static void
+qla2xip_free_send_cbs(struct qla2xip_private *qdev)
+{
+	int i;
+
+	for (i = 0; i < qdev->dev->num_tx_queues; i++)
+		qla2xip_free_txq(qdev, &qdev->txq[i], qdev->max_send_packets);
+	qdev->max_send_packets = 0;
+}
+
+/**
+ * qla2xip_swap_txq() - Installs a new send_cb ring on a transmit queue.
+ * @txq: The transmit queue
+ * @new: The new ring, returned holding the old one
+ *
+ * The caller holds the netdev queue's xmit lock.
+ */
+static void
+qla2xip_swap_txq(struct qla2xip_txq *txq, struct qla2xip_txq *new)
+{
+	qla2xip_tx_purge(txq);
+	swap(txq->send_q, new->send_q);
+	swap(txq->send_q_in, new->send_q_in);
+	swap(txq->send_q_out, new->send_q_out);
+	swap(txq->send_buffers, new->send_buffers);
+	swap(txq->scb_header, new->scb_header);
+	swap(txq->scb_header_dma, new->scb_header_dma);
+	swap(txq->dests, new->dests);
+	swap(txq->dest_hash, new->dest_hash);
+	swap(txq->dests_cnt, new->dests_cnt);
+	swap(txq->dests_next, new->dests_next);
+}
+
+/**
+ * qla2xip_alloc_send_cbs() - Allocates and initializes the send_cb rings.
+ * @qdev: The device's private structure
+ * @count: The number of send_cbs to allocate per transmit queue
+ *
+ * A ring is allocated for every transmit queue of the net_device, as the
+ * number of queues granted by the SCSI driver is only known once IP is
+ * enabled.
+ *
+ * Returns 0 on success.
+ */
+static int
+qla2xip_alloc_send_cbs(struct qla2xip_private *qdev, uint16_t count)
+{
+	int i;
+
+	qdev->max_send_packets = count;
+	for (i = 0; i < qdev->dev->num_tx_queues; i++) {
+		spin_lock_init(&qdev->txq[i].lock);
+		if (qla2xip_alloc_txq(qdev, &qdev->txq[i], i, count)) {
 			printk(KERN_ERR
-			       "%s: Failed to allocate buffer_cb skb\n",
-			       qla_name);
+			       "%s: Failed to allocate %d send_cbs\n",
+			       qla_name, count);
+			qla2xip_free_send_cbs(qdev);
 			return 1;
 		}
-
-		bcb->skb = skb;
-		bcb->skb_data = skb->data;
-		bcb->skb_data_dma = pci_map_single(qdev->pdev,
-						   skb->data, skb->len,
-						   PCI_DMA_FROMDEVICE);
-		/* Add receive buffer to receive buffer queue */
-		qdev->receive_q_in->handle = bcb->handle;
-		qdev->receive_q_in->data_addr_low = LSD(bcb->skb_data_dma);
-		qdev->receive_q_in->data_addr_high = MSD(bcb->skb_data_dma);
-		qdev->receive_q_in++;
-		qdev->receive_q_add_cnt++;
 	}
 
 	return 0;
 }
 
 /**
- * qla2xip_deallocate_buffers() - Deallocate network structures.
- * @dev: The device to uninitialize
+ * qla2xip_header_split() - Effective header/data split size.
+ * @qdev: The device's private structure
  *
- * The device structure @dev is freed within this routine.
+ * An XDP program sees a frame as a single buffer, so header/data split is
+ * disabled while one is attached.
+ *
+ * Returns the split header size, 0 if header/data split is disabled.
  */
-static void
-qla2xip_deallocate_buffers(struct net_device *dev)
+static uint16_t
+qla2xip_header_split(struct qla2xip_private *qdev)
 {
-	struct qla2xip_private *qdev = netdev_priv(dev);
-	int i;
-	struct send_cb *scb;
-	struct buffer_cb *bcb;
+	return qdev->xdp_prog ? 0 : qdev->header_size;
+}
 
-	/*
-	 * Deallocate queue of control blocks for sending packets to SCSI driver
-	 */
-	pci_free_consistent(qdev->pdev, sizeof(struct packet_header),
-			    qdev->scb_header, qdev->scb_header_dma);
-	for (i = 0; i < MAX_SEND_PACKETS; i++) {
-		scb = &qdev->send_buffers[i];
-		scb->header = NULL;
-		scb->header_dma = 0;
+/**
+ * qla2xip_rx_page_order() - Determine the receive buffer allocation order.
+ * @qdev: The device's private structure
+ *
+ * The firmware describes a received sequence with at most IP_RCV_BUFFERS
+ * buffer handles, the first of which only holds @header_size bytes when
+ * header/data split is enabled.  Use the smallest pages that still fit an
+ * MTU sized sequence; in a single order-0 buffer if an XDP program is
+ * attached, see QLA2XIP_XDP_MAX_MTU.
+ *
+ * Returns the page allocation order.
+ */
+static uint16_t
+qla2xip_rx_page_order(struct qla2xip_private *qdev)
+{
+	uint32_t frame_size;
+	uint32_t data_buffers;
+	uint16_t header_size;
+	uint16_t order;
+
+	frame_size = qdev->mtu + sizeof(struct packet_header);
+	header_size = qla2xip_header_split(qdev);
+	data_buffers = qdev->xdp_prog ? 1 : IP_RCV_BUFFERS;
+	if (header_size) {
+		frame_size -= min_t(uint32_t, frame_size, header_size);
+		data_buffers--;
 	}
 
-	/*
-	 * Deallocate queue of buffers for receiving packets from SCSI driver
-	 */
-	for (i = 0; i < qdev->max_receive_buffers; i++) {
-		bcb = &qdev->receive_buffers[i];
-		if (bcb->skb) {
-			pci_unmap_single(qdev->pdev,
-					 bcb->skb_data_dma,
-					 bcb->skb->len, PCI_DMA_FROMDEVICE);
-			dev_kfree_skb_any(bcb->skb);
-			bcb->skb = NULL;
-		}
-	}
+	order = 0;
+	while (QLA2XIP_RX_BUF_SIZE(order) * data_buffers < frame_size)
+		order++;
 
-	/* Free dev and private structure */
-	kfree(dev);
+	return order;
 }
 
 /**
- * qla2xip_get_send_cb() - Retrieves the next available send control block.
+ * qla2xip_alloc_rx_pool() - Creates the receive buffer page pool.
  * @qdev: The device's private structure
  *
- * This routine assumes calls to qla2xip_send() are serialized and does NOT use
- * a spinlock to update the @send_q_out pointer.
+ * The page pool owns the DMA mapping of each page, so pages recycled by the
+ * network stack come back already mapped.  With an XDP program attached the
+ * pages are mapped bidirectionally, as XDP_TX sends them as they are.
  *
- * Returns the next available send_cb structure from the send queue, else NULL.
+ * Returns 0 on success.
  */
-static struct send_cb *
-qla2xip_get_send_cb(struct qla2xip_private *qdev)
+static int
+qla2xip_alloc_rx_pool(struct qla2xip_private *qdev)
 {
-	struct send_cb *scb;
+	struct page_pool_params pp_params = { 0 };
+	struct page_pool *pool;
+
+	qdev->rx_page_order = qla2xip_rx_page_order(qdev);
+	qdev->receive_buff_data_size = min_t(uint32_t,
+	    QLA2XIP_RX_BUF_SIZE(qdev->rx_page_order), U16_MAX);
+
+	pp_params.flags = PP_FLAG_DMA_MAP | PP_FLAG_DMA_SYNC_DEV;
+	pp_params.order = qdev->rx_page_order;
+	pp_params.pool_size = qdev->max_receive_buffers;
+	pp_params.nid = NUMA_NO_NODE;
+	pp_params.dev = &qdev->pdev->dev;
+	pp_params.dma_dir = qdev->xdp_prog ? DMA_BIDIRECTIONAL : DMA_FROM_DEVICE;
+	pp_params.offset = QLA2XIP_RX_HEADROOM;
+	pp_params.max_len = qdev->receive_buff_data_size;
+
+	pool = page_pool_create(&pp_params);
+	if (IS_ERR(pool)) {
+		printk(KERN_ERR
+		       "%s: Failed to create receive page pool\n", qla_name);
+		return 1;
+	}
+	qdev->rx_page_pool = pool;
+	qdev->rx_dma_dir = pp_params.dma_dir;
 
-	scb = NULL;
-	if (qdev->send_q_in != qdev->send_q_out) {
-		scb = qdev->send_q[qdev->send_q_out];
-		if (qdev->send_q_out == MAX_SEND_PACKETS)
-			qdev->send_q_out = 0;
-		else
-			qdev->send_q_out++;
+	/* XDP frames are returned to the page pool */
+	if (xdp_rxq_info_reg_mem_model(&qdev->xdp_rxq, MEM_TYPE_PAGE_POOL,
+	    pool)) {
+		printk(KERN_ERR
+		       "%s: Failed to register receive page pool\n", qla_name);
+		return 1;
 	}
-	return scb;
+
+	return 0;
 }
 
 /**
- * qla2xip_free_send_cb() - Returns the send control block to the free queue.
- * @scb: The send_cb to return to the free queue
+ * qla2xip_attach_rx_page() - Make a page pool page a buffer_cb's buffer.
+ * @qdev: The device's private structure
+ * @bcb: The buffer_cb to update
+ * @page: The (DMA mapped) page pool page
  */
 static void
-qla2xip_free_send_cb(struct send_cb *scb)
+qla2xip_attach_rx_page(struct qla2xip_private *qdev, struct buffer_cb *bcb,
+    struct page *page)
 {
-	struct qla2xip_private *qdev = scb->qdev;
+	bcb->page = page;
+	bcb->skb_data = page_address(page) + QLA2XIP_RX_HEADROOM;
+	bcb->skb_data_dma = page_pool_get_dma_addr(page) + QLA2XIP_RX_HEADROOM;
+}
 
-	spin_lock(&qdev->lock);
+/**
+ * qla2xip_post_receive_buffer() - Queue a receive buffer for the RISC.
+ * @qdev: The device's private structure
+ * @bcb: The buffer_cb to return to the free receive buffer ring
+ *
+ * The buffer is handed to the SCSI driver on the next call to the
+ * ip_add_buffers_routine.  Only the NAPI poll routine (or the device's
+ * setup, with the IP connection down) produces onto the ring.
+ */
+static void
+qla2xip_post_receive_buffer(struct qla2xip_private *qdev,
+    struct buffer_cb *bcb)
+{
+	struct bd_rx_ring *ring = &qdev->rx_ring[bcb->pool_id];
 
-	/* Return send control block to free queue */
-	qdev->send_q[qdev->send_q_in] = scb;
-	if (qdev->send_q_in == MAX_SEND_PACKETS)
-		qdev->send_q_in = 0;
-	else
-		qdev->send_q_in++;
+	ring->handles[ring->prod & (BD_RX_RING_SIZE - 1)] = bcb->handle;
 
-	spin_unlock(&qdev->lock);
+	/* Publish the buffer_cb and its handle before the producer index */
+	smp_store_release(&ring->prod, ring->prod + 1);
 }
 
 /**
- * qla2xip_notify() - Notification callback routine.
- * @dev: The device context
- * @type: The asyncronous event
+ * qla2xip_rx_ring_pending() - Count receive buffers not yet passed on.
+ * @qdev: The device's private structure
  *
- * This callback routine is used to by the SCSI driver to notify the network
- * driver of an asyncronous event.
+ * Returns the number of buffers pushed onto the free receive buffer rings
+ * since the last call to qla2xip_add_receive_buffers().
  */
-static void
-qla2xip_notify(struct net_device *dev, uint32_t type)
+static uint32_t
+qla2xip_rx_ring_pending(struct qla2xip_private *qdev)
 {
-	/* Switch on event type */
-	switch (type) {
-	case NOTIFY_EVENT_RESET_DETECTED:
-		printk(KERN_INFO
-		       "%s: %s - Reset detected\n", qla_name, dev->name);
-		break;
+	uint32_t pending;
+	int i;
 
-	case NOTIFY_EVENT_LINK_DOWN:
-		printk(KERN_INFO
-		       "%s: %s - Link down detected\n", qla_name, dev->name);
-		break;
+	for (pending = 0, i = 0; i < BD_RX_POOLS; i++)
+		pending += qdev->rx_ring[i].prod - qdev->rx_ring_added[i];
 
-	case NOTIFY_EVENT_LINK_UP:
-		printk(KERN_INFO
-		       "%s: %s - Link up detected\n", qla_name, dev->name);
-		break;
+	return pending;
+}
 
-	default:
-		printk(KERN_INFO
-		       "%s: %s - Unsupported notification type %x\n",
-		       qla_name, dev->name, type);
-		break;
-	}
+/**
+ * qla2xip_add_receive_buffers() - Pass free receive buffers to the RISC.
+ * @qdev: The device's private structure
+ */
+static void
+qla2xip_add_receive_buffers(struct qla2xip_private *qdev)
+{
+	uint32_t pending = qla2xip_rx_ring_pending(qdev);
+	int i;
+
+	qdev->ip_add_buffers_routine(qdev->ha, (uint16_t)pending, 0);
+
+	qdev->receive_q_cnt += pending;
+	for (i = 0; i < BD_RX_POOLS; i++)
+		qdev->rx_ring_added[i] = qdev->rx_ring[i].prod;
 }
 
 /**
- * qla2xip_send_completion() - Send completion callback routine.
- * @scb: The send_cb that was sent
+ * qla2xip_small_buffers() - Effective number of small receive buffers.
+ * @qdev: The device's private structure
  *
- * This callback routine is used to by the SCSI driver to notify the network
- * driver of a send completion on the specified @scb.
+ * Small buffers need a SCSI driver offering a second firmware buffer pool,
+ * and are not used while an XDP program is attached, as XDP only runs on
+ * page pool pages.
  *
- * Note: this routine is called from an IRQ context.
+ * Returns the number of small receive buffers to allocate.
  */
-static void
-qla2xip_send_completion(struct send_cb *scb)
+static uint16_t
+qla2xip_small_buffers(struct qla2xip_private *qdev)
 {
-	struct qla2xip_private *qdev = scb->qdev;
-	struct net_device *dev = qdev->dev;
+	if (qdev->xdp_prog || !test_bit(BDI_RX_POOLS, &qdev->options))
+		return 0;
 
-	/* Interrogate completion status from firmware */
-	switch (scb->comp_status) {
-	case SCB_CS_COMPLETE:
-		qdev->stats.tx_packets++;
-		qdev->stats.tx_bytes += (scb->skb->len +
-					 sizeof(struct packet_header));
-		break;
+	return qdev->max_small_buffers;
+}
 
-	case SCB_CS_INCOMPLETE:
-	case SCB_CS_ABORTED:
-		qdev->stats.tx_errors++;
-		qdev->stats.tx_aborted_errors++;
-		printk(KERN_WARNING
-		       "%s: Unsuccessful send-completion status "
-		       "(%x)\n", qla_name, scb->comp_status);
-		break;
+/**
+ * qla2xip_alloc_rx_small() - Allocates the small receive buffers.
+ * @qdev: The device's private structure
+ *
+ * Small buffers follow the large ones in the buffer_cb array.  They are
+ * carved from pages mapped once for the lifetime of the buffers, as received
+ * frames are copied out of them.
+ *
+ * Returns 0 on success.
+ */
+static int
+qla2xip_alloc_rx_small(struct qla2xip_private *qdev)
+{
+	int i;
+	uint16_t per_page = PAGE_SIZE / QLA2XIP_SMALL_BUF_SIZE;
+	uint32_t offset;
+	struct qla2xip_rx_chunk *chunk;
+	struct buffer_cb *bcb;
 
-	case SCB_CS_RESET:
-	case SCB_CS_TIMEOUT:
-	case SCB_CS_PORT_UNAVAILABLE:
-	case SCB_CS_PORT_LOGGED_OUT:
-	case SCB_CS_PORT_CONFIG_CHG:
-		qdev->stats.tx_errors++;
-		qdev->stats.tx_carrier_errors++;
-		printk(KERN_WARNING
-		       "%s: Unsuccessful send-completion status "
-		       "(%x)\n", qla_name, scb->comp_status);
-		break;
+	qdev->rx_small_cnt = qla2xip_small_buffers(qdev);
+	if (!qdev->rx_small_cnt)
+		return 0;
 
-	case SCB_CS_FW_RESOURCE_UNAVAILABLE:
-		qdev->stats.tx_errors++;
-		qdev->stats.tx_fifo_errors++;
-		printk(KERN_WARNING
-		       "%s: Unsuccessful send-completion status "
-		       "(%x)\n", qla_name, scb->comp_status);
-		break;
+	qdev->rx_small_chunks = kcalloc(DIV_ROUND_UP(qdev->rx_small_cnt,
+	    per_page), sizeof(struct qla2xip_rx_chunk), GFP_KERNEL);
+	if (!qdev->rx_small_chunks)
+		return 1;
 
-	default:
-		printk(KERN_ERR
-		       "%s: Unknown send-completion status returned "
-		       "(%x)\n", qla_name, scb->comp_status);
-		break;
+	for (i = 0; i < qdev->rx_small_cnt; i++) {
+		chunk = &qdev->rx_small_chunks[i / per_page];
+		if (i % per_page == 0) {
+			chunk->page = alloc_page(GFP_KERNEL);
+			if (!chunk->page)
+				return 1;
+			chunk->dma = dma_map_page(&qdev->pdev->dev,
+			    chunk->page, 0, PAGE_SIZE, DMA_FROM_DEVICE);
+			if (dma_mapping_error(&qdev->pdev->dev, chunk->dma)) {
+				__free_page(chunk->page);
+				return 1;
+			}
+			qdev->rx_small_nchunks++;
+		}
 
+		/* Initialize receive buffer control block */
+		bcb = &qdev->receive_buffers[qdev->max_receive_buffers + i];
+		bcb->handle = qdev->max_receive_buffers + i;
+		bcb->pool_id = BD_POOL_SMALL;
+		bcb->state = 0;
+		bcb->page = NULL;
+		offset = (i % per_page) * QLA2XIP_SMALL_BUF_SIZE;
+		bcb->skb_data = page_address(chunk->page) + offset;
+		bcb->skb_data_dma = chunk->dma + offset;
+		qla2xip_post_receive_buffer(qdev, bcb);
 	}
 
-	/* Free resources */
-	dev_kfree_skb_irq(scb->skb);
-	qla2xip_free_send_cb(scb);
+	return 0;
+}
+
+/**
+ * qla2xip_free_rx_small() - Releases the small receive buffers.
+ * @qdev: The device's private structure
+ */
+static void
+qla2xip_free_rx_small(struct qla2xip_private *qdev)
+{
+	int i;
+	struct qla2xip_rx_chunk *chunk;
 
-	/* Start queueing of packets if stopped */
-	netif_wake_queue(dev);
+	for (i = 0; i < qdev->rx_small_nchunks; i++) {
+		chunk = &qdev->rx_small_chunks[i];
+		dma_unmap_page(&qdev->pdev->dev, chunk->dma, PAGE_SIZE,
+		    DMA_FROM_DEVICE);
+		__free_page(chunk->page);
+	}
+	kfree(qdev->rx_small_chunks);
+	qdev->rx_small_chunks = NULL;
+	qdev->rx_small_nchunks = 0;
+	qdev->rx_small_cnt = 0;
 }
 
 /**
- * qla2xip_receive_packets() - Receive packet callback routine.
- * @dev: The device context
- * @bcb: The buffer_cb that was received
+ * qla2xip_alloc_rx_buffers() - Allocates the receive buffer pool.
+ * @qdev: The device's private structure
  *
- * This callback routine is used to by the SCSI driver to notify the network
- * driver of a received packet.
+ * The (large) receive buffers are sized for the current @mtu, followed by
+ * any small buffers, and all are queued for the SCSI driver; the receive
+ * queue state is reset.
+ *
+ * Returns 0 on success.
+ */
+static int
+qla2xip_alloc_rx_buffers(struct qla2xip_private *qdev)
+{
+	int i;
+	struct page *page;
+	struct buffer_cb *bcb;
+
+	for (i = 0; i < BD_RX_POOLS; i++) {
+		qdev->rx_ring[i].prod = 0;
+		qdev->rx_ring[i].cons = 0;
+		qdev->rx_ring_added[i] = 0;
+	}
+	qdev->receive_q_cnt = 0;
+	qdev->rx_done_in = 0;
+	qdev->rx_done_out = 0;
+
+	if (qla2xip_alloc_rx_pool(qdev))
+		return 1;
+
+	for (i = 0; i < qdev->max_receive_buffers; i++) {
+		/* Initialize receive buffer control block */
+		bcb = &qdev->receive_buffers[i];
+		bcb->handle = i;
+		bcb->pool_id = BD_POOL_LARGE;
+		bcb->state = 0;
+
+		/* Allocate data buffer */
+		page = page_pool_alloc_pages(qdev->rx_page_pool, GFP_KERNEL);
+		if (page == NULL) {
+			printk(KERN_ERR
+			       "%s: Failed to allocate buffer_cb page\n",
+			       qla_name);
+			return 1;
+		}
+		qla2xip_attach_rx_page(qdev, bcb, page);
+		qla2xip_post_receive_buffer(qdev, bcb);
+	}
+
+	return qla2xip_alloc_rx_small(qdev);
+}
+
+/**
+ * qla2xip_free_rx_buffers() - Releases the receive buffer pool.
+ * @qdev: The device's private structure
+ *
+ * The SCSI driver (firmware) must no longer reference the buffers.
+ */
+static void
+qla2xip_free_rx_buffers(struct qla2xip_private *qdev)
+{
+	int i;
+	struct buffer_cb *bcb;
+
+	qla2xip_free_rx_small(qdev);
+	for (i = 0; i < qdev->max_receive_buffers; i++) {
+		bcb = &qdev->receive_buffers[i];
+		if (bcb->page) {
+			page_pool_put_full_page(qdev->rx_page_pool, bcb->page,
+						false);
+			bcb->page = NULL;
+		}
+	}
+	if (qdev->rx_page_pool) {
+		xdp_rxq_info_unreg_mem_model(&qdev->xdp_rxq);
+		page_pool_destroy(qdev->rx_page_pool);
+		qdev->rx_page_pool = NULL;
+	}
+}
+
+/**
+ * qla2xip_alloc_stats() - Allocate the per-CPU statistics.
+ * @qdev: The device's private structure
+ *
+ * Returns 0 on success.
+ */
+static int
+qla2xip_alloc_stats(struct qla2xip_private *qdev)
+{
+	struct qla2xip_pcpu_stats *stats;
+	int cpu, i;
+
+	qdev->stats = alloc_percpu(struct qla2xip_pcpu_stats);
+	if (!qdev->stats)
+		return 1;
+
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(qdev->stats, cpu);
+		u64_stats_init(&stats->rx.syncp);
+		u64_stats_init(&stats->event.syncp);
+		for (i = 0; i < QLA_IP_MAX_TX_QUEUES; i++) {
+			u64_stats_init(&stats->tx[i].syncp);
+			u64_stats_init(&stats->comp[i].syncp);
+		}
+	}
+	atomic_long_set(&qdev->tx_timeouts, 0);
+
+	return 0;
+}
+
+/**
+ * qla2xip_allocate_buffers() - Allocates and initializes network structures.
+ * @dev: The device to initialize
+ *
+ * Returns 0 on success.
+ */
+static int
+qla2xip_allocate_buffers(struct net_device *dev)
+{
+	struct qla2xip_private *qdev = netdev_priv(dev);
+
+	if (qla2xip_alloc_stats(qdev))
+		return 1;
+
+	/*
+	 * Allocate/initialize queue of send control blocks for sending packets
+	 * to the SCSI driver.
+	 */
+	if (qla2xip_alloc_send_cbs(qdev, qdev->max_send_packets))
+		return 1;
+
+	if (xdp_rxq_info_reg(&qdev->xdp_rxq, dev, 0, qdev->napi.napi_id))
+		return 1;
+	init_llist_head(&qdev->xdp_done);
+
+	qdev->receive_buffers = kcalloc(qdev->max_receive_buffers +
+	    qdev->max_small_buffers, sizeof(struct buffer_cb), GFP_KERNEL);
+	qdev->rx_done_q = kcalloc(MAX_RECEIVE_BUFFERS + 1,
+	    sizeof(struct buffer_cb *), GFP_KERNEL);
+	if (!qdev->receive_buffers || !qdev->rx_done_q)
+		return 1;
+
+	/*
+	 * Allocate/initialize queue of buffers for receiving packets from the
+	 * SCSI driver
+	 */
+	return qla2xip_alloc_rx_buffers(qdev);
+}
+
+/**
+ * qla2xip_deallocate_buffers() - Deallocate network structures.
+ * @dev: The device to uninitialize
+ *
+ * The device structure @dev is freed within this routine.
+ */
+static void
+qla2xip_deallocate_buffers(struct net_device *dev)
+{
+	struct qla2xip_private *qdev = netdev_priv(dev);
+
+	/*
+	 * Deallocate queue of control blocks for sending packets to SCSI driver
+	 */
+	qla2xip_free_send_cbs(qdev);
+
+	/*
+	 * Deallocate queue of buffers for receiving packets from SCSI driver
+	 */
+	qla2xip_free_rx_buffers(qdev);
+	kfree(qdev->receive_buffers);
+	kfree(qdev->rx_done_q);
+
+	if (xdp_rxq_info_is_reg(&qdev->xdp_rxq))
+		xdp_rxq_info_unreg(&qdev->xdp_rxq);
+	if (qdev->xdp_prog)
+		bpf_prog_put(qdev->xdp_prog);
+
+	free_percpu(qdev->stats);
+	netif_napi_del(&qdev->napi);
+
+	/* Free dev and private structure */
+	free_netdev(dev);
+}
+
+/**
+ * qla2xip_send_cbs_free() - Number of send_cbs in a free queue.
+ * @qdev: The device's private structure
+ * @txq: The transmit queue
+ */
+static uint16_t
+qla2xip_send_cbs_free(struct qla2xip_private *qdev, struct qla2xip_txq *txq)
+{
+	if (txq->send_q_in >= txq->send_q_out)
+		return txq->send_q_in - txq->send_q_out;
+	return qdev->max_send_packets + 1 - (txq->send_q_out - txq->send_q_in);
+}
+
+/**
+ * qla2xip_get_send_cb() - Retrieves the next available send control block.
+ * @qdev: The device's private structure
+ * @txq: The transmit queue
+ *
+ * This routine assumes calls to qla2xip_send() are serialized per transmit
+ * queue and does NOT use a spinlock to update the @send_q_out pointer.
+ *
+ * Returns the next available send_cb structure from the send queue, else NULL.
+ */
+static struct send_cb *
+qla2xip_get_send_cb(struct qla2xip_private *qdev, struct qla2xip_txq *txq)
+{
+	struct send_cb *scb;
+
+	scb = NULL;
+	if (txq->send_q_in != txq->send_q_out) {
+		scb = txq->send_q[txq->send_q_out];
+		if (txq->send_q_out == qdev->max_send_packets)
+			txq->send_q_out = 0;
+		else
+			txq->send_q_out++;
+	}
+	return scb;
+}
+
+/**
+ * qla2xip_free_send_cb() - Returns the send control block to the free queue.
+ * @scb: The send_cb to return to the free queue
+ *
+ * Send completions free send_cbs with interrupts disabled, other callers
+ * run with interrupts enabled.
+ */
+static void
+qla2xip_free_send_cb(struct send_cb *scb)
+{
+	struct qla2xip_private *qdev = scb->qdev;
+	struct qla2xip_txq *txq = &qdev->txq[scb->queue];
+	unsigned long flags;
+
+	spin_lock_irqsave(&txq->lock, flags);
+
+	/* Return send control block to free queue */
+	txq->send_q[txq->send_q_in] = scb;
+	if (txq->send_q_in == qdev->max_send_packets)
+		txq->send_q_in = 0;
+	else
+		txq->send_q_in++;
+
+	spin_unlock_irqrestore(&txq->lock, flags);
+}
+
+/**
+ * qla2xip_unmap_send_cb() - Unmap the skb data of a send_cb.
+ * @qdev: The device's private structure
+ * @scb: The send_cb to unmap
+ */
+static void
+qla2xip_unmap_send_cb(struct qla2xip_private *qdev, struct send_cb *scb)
+{
+	int i;
+
+	i = 0;
+	if (scb->flags & SCB_HEAD_MAPPED) {
+		dma_unmap_single(&qdev->pdev->dev, scb->dseg[0].address,
+				 scb->dseg[0].length, DMA_TO_DEVICE);
+		i++;
+	}
+	for (; i < scb->dseg_count; i++)
+		dma_unmap_page(&qdev->pdev->dev, scb->dseg[i].address,
+			       scb->dseg[i].length, DMA_TO_DEVICE);
+	scb->dseg_count = 0;
+	scb->flags &= ~SCB_HEAD_MAPPED;
+}
+
+/**
+ * qla2xip_map_send_cb() - DMA map the skb data of a send_cb.
+ * @qdev: The device's private structure
+ * @scb: The send_cb whose skb is to be mapped
+ *
+ * The linear skb data and each page fragment is mapped into its own data
+ * segment, so fragmented skbs are sent without being linearized.
+ *
+ * Returns 0 on success.
+ */
+static int
+qla2xip_map_send_cb(struct qla2xip_private *qdev, struct send_cb *scb)
+{
+	struct sk_buff *skb = scb->skb;
+	unsigned int headlen;
+	dma_addr_t addr;
+	int i;
+
+	scb->dseg_count = 0;
+
+	headlen = skb_headlen(skb);
+	if (headlen) {
+		addr = dma_map_single(&qdev->pdev->dev, skb->data, headlen,
+				      DMA_TO_DEVICE);
+		if (dma_mapping_error(&qdev->pdev->dev, addr))
+			return 1;
+
+		scb->dseg[0].address = addr;
+		scb->dseg[0].length = headlen;
+		scb->dseg_count++;
+		scb->flags |= SCB_HEAD_MAPPED;
+	}
+
+	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
+		const skb_frag_t *frag = &skb_shinfo(skb)->frags[i];
+
+		addr = skb_frag_dma_map(&qdev->pdev->dev, frag, 0,
+					skb_frag_size(frag), DMA_TO_DEVICE);
+		if (dma_mapping_error(&qdev->pdev->dev, addr)) {
+			qla2xip_unmap_send_cb(qdev, scb);
+			return 1;
+		}
+
+		scb->dseg[scb->dseg_count].address = addr;
+		scb->dseg[scb->dseg_count].length = skb_frag_size(frag);
+		scb->dseg_count++;
+	}
+
+	return 0;
+}
+
+/**
+ * qla2xip_tso_put() - Drop a reference to a TSO owner send_cb.
+ * @qdev: The device's private structure
+ * @owner: The send_cb owning the skb and its DMA mapping
+ *
+ * The skb is released once the last of its segments has completed.
+ */
+static void
+qla2xip_tso_put(struct qla2xip_private *qdev, struct send_cb *owner)
+{
+	if (!atomic_dec_and_test(&owner->tso_refs))
+		return;
+
+	qla2xip_unmap_send_cb(qdev, owner);
+	dev_kfree_skb_any(owner->skb);
+	qla2xip_free_send_cb(owner);
+}
+
+/**
+ * qla2xip_notify() - Notification callback routine.
+ * @dev: The device context
+ * @type: The asyncronous event
+ *
+ * This callback routine is used to by the SCSI driver to notify the network
+ * driver of an asyncronous event.
+ *
+ * Note: receive buffer events are notified with interrupts disabled.
+ */
+static void
+qla2xip_notify(struct net_device *dev, uint32_t type)
+{
+	struct qla2xip_private *qdev = netdev_priv(dev);
+	struct qla2xip_event_stats *stats = &this_cpu_ptr(qdev->stats)->event;
+
+	/* Switch on event type */
+	switch (type) {
+	case NOTIFY_EVENT_RESET_DETECTED:
+		printk(KERN_INFO
+		       "%s: %s - Reset detected\n", qla_name, dev->name);
+		break;
+
+	case NOTIFY_EVENT_LINK_DOWN:
+		printk(KERN_INFO
+		       "%s: %s - Link down detected\n", qla_name, dev->name);
+		break;
+
+	case NOTIFY_EVENT_LINK_UP:
+		printk(KERN_INFO
+		       "%s: %s - Link up detected\n", qla_name, dev->name);
+		break;
+
+	case NOTIFY_EVENT_RCV_BUFFERS_LOW:
+		/* Hand back any receive buffers waiting for a batch */
+		QLA2XIP_STATS_INC(stats, rcv_buffers_low);
+		napi_schedule(&qdev->napi);
+		break;
+
+	case NOTIFY_EVENT_OUT_OF_BUFFERS:
+		QLA2XIP_STATS_INC(stats, out_of_buffers);
+		napi_schedule(&qdev->napi);
+		break;
+
+	default:
+		printk(KERN_INFO
+		       "%s: %s - Unsupported notification type %x\n",
+		       qla_name, dev->name, type);
+		break;
+	}
+}
+
+/**
+ * qla2xip_send_completion() - Send completion callback routine.
+ * @scb: The send_cb that was sent
+ *
+ * This callback routine is used to by the SCSI driver to notify the network
+ * driver of a send completion on the specified @scb.
+ *
+ * Note: this routine is called with interrupts disabled, under the SCSI
+ * driver lock of the send_cb's transmit queue, which serializes the queue's
+ * completions.  They normally arrive from the qla24xx_rsp_poll() softirq of
+ * the queue's response queue; the INTx/MSI handler runs in hard IRQ context,
+ * and send_cbs failed before reaching the firmware, see
+ * qla2x00_ip_fail_send(), and the emulated firmware complete from process
+ * context.
+ */
+static void
+qla2xip_send_completion(struct send_cb *scb)
+{
+	struct qla2xip_private *qdev = scb->qdev;
+	struct net_device *dev = qdev->dev;
+	uint16_t queue = scb->queue;
+	struct qla2xip_txq *txq = &qdev->txq[queue];
+	struct netdev_queue *nq = netdev_get_tx_queue(dev, queue);
+	struct qla2xip_comp_stats *stats =
+	    &this_cpu_ptr(qdev->stats)->comp[queue];
+
+	u64_stats_update_begin(&stats->syncp);
+	if (scb->flags & SCB_ARP_CONVERTED)
+		stats->arp_converted++;
+
+	/* Interrogate completion status from firmware */
+	switch (scb->comp_status) {
+	case SCB_CS_COMPLETE:
+		stats->packets++;
+		stats->bytes += scb->len;
+		break;
+
+	case SCB_CS_INCOMPLETE:
+	case SCB_CS_ABORTED:
+		stats->cs_aborted++;
+		break;
+
+	case SCB_CS_RESET:
+		stats->cs_reset++;
+		break;
+
+	case SCB_CS_TIMEOUT:
+		stats->cs_timeout++;
+		break;
+
+	case SCB_CS_PORT_UNAVAILABLE:
+		stats->cs_port_unavailable++;
+		break;
+
+	case SCB_CS_PORT_LOGGED_OUT:
+		stats->cs_port_logged_out++;
+		break;
+
+	case SCB_CS_PORT_CONFIG_CHG:
+		stats->cs_port_config_chg++;
+		break;
+
+	case SCB_CS_FW_RESOURCE_UNAVAILABLE:
+		stats->cs_fw_resource++;
+		break;
+
+	default:
+		stats->cs_unknown++;
+		break;
+
+	}
+	u64_stats_update_end(&stats->syncp);
+
+	if (scb->comp_status != SCB_CS_COMPLETE && net_ratelimit())
+		printk(KERN_WARNING
+		       "%s: Unsuccessful send-completion status (%x)\n",
+		       qla_name, scb->comp_status);
+
+	/* XDP_TX frames are returned to the page pool from the NAPI poll */
+	if (scb->xdpf) {
+		llist_add(&scb->xdp_node, &qdev->xdp_done);
+		napi_schedule(&qdev->napi);
+		return;
+	}
+
+	/* Free resources */
+	qla2xip_tx_dest_dec(txq, scb->tx_dest);
+	netdev_tx_completed_queue(nq, 1, scb->len);
+	if (scb->tso_owner) {
+		struct send_cb *owner = scb->tso_owner;
+
+		/* TSO segment, its owner holds the skb and mapping */
+		qla2xip_free_send_cb(scb);
+		qla2xip_tso_put(qdev, owner);
+	} else {
+		qla2xip_unmap_send_cb(qdev, scb);
+		dev_kfree_skb_irq(scb->skb);
+		qla2xip_free_send_cb(scb);
+	}
+
+	/*
+	 * Restart queueing of packets once enough send_cbs are free, a full
+	 * destination backlog is woken from qla2xip_tx_drain()
+	 */
+	smp_mb();
+	if (netif_tx_queue_stopped(nq) && !READ_ONCE(txq->backlog_full) &&
+	    qla2xip_send_cbs_free(qdev, txq) >= SEND_CBS_WAKE_MARK(qdev))
+		netif_tx_wake_queue(nq);
+
+	/* Send held back packets from the NAPI poll */
+	if (READ_ONCE(txq->active_cnt) || READ_ONCE(txq->tso.owner)) {
+		set_bit(queue, &qdev->tx_drain_pending);
+		napi_schedule(&qdev->napi);
+	}
+}
+
+/**
+ * qla2xip_receive_packets() - Receive packet callback routine.
+ * @dev: The device context
+ * @bcb: The buffer_cb that was received
+ *
+ * This callback routine is used to by the SCSI driver to notify the network
+ * driver of a received packet.
+ *
+ * The @bcb is only queued here; the packet is passed to the stack, and the
+ * receive buffers are replenished, from qla2xip_poll().
+ *
+ * Note: this routine is called with interrupts disabled while the SCSI
+ * driver processes its base response queue: from the qla24xx_rsp_poll()
+ * softirq, the INTx/MSI handler or the emulated firmware's work.
+ * Note: the SCSI driver serializes calls to this routine under its
+ * hardware_lock, hence a spinlock is not used.
+ */
+static void
+qla2xip_receive_packets(struct net_device *dev, struct buffer_cb *bcb)
+{
+	struct qla2xip_private *qdev = netdev_priv(dev);
+	uint16_t rx_done_in;
+
+	rx_done_in = qdev->rx_done_in;
+	qdev->rx_done_q[rx_done_in] = bcb;
+	if (rx_done_in == MAX_RECEIVE_BUFFERS)
+		rx_done_in = 0;
+	else
+		rx_done_in++;
+
+	/* Publish queue entry before moving the in-pointer */
+	smp_wmb();
+	qdev->rx_done_in = rx_done_in;
+
+	napi_schedule(&qdev->napi);
+}
+
+/**
+ * qla2xip_get_rx_done() - Retrieves the next received buffer_cb.
+ * @qdev: The device's private structure
+ *
+ * Returns the next buffer_cb queued by qla2xip_receive_packets(), else NULL.
+ */
+static struct buffer_cb *
+qla2xip_get_rx_done(struct qla2xip_private *qdev)
+{
+	struct buffer_cb *bcb;
+
+	if (qdev->rx_done_out == READ_ONCE(qdev->rx_done_in))
+		return NULL;
+
+	/* Read queue entry after reading the in-pointer */
+	smp_rmb();
+	bcb = qdev->rx_done_q[qdev->rx_done_out];
+	if (qdev->rx_done_out == MAX_RECEIVE_BUFFERS)
+		qdev->rx_done_out = 0;
+	else
+		qdev->rx_done_out++;
+
+	return bcb;
+}
+
+/**
+ * qla2xip_lro_flush() - Pass the aggregated packet to the network stack.
+ * @qdev: The device's private structure
+ *
+ * The IP header of the aggregate is rewritten for its new length, the TCP
+ * checksum is left as is since every segment was verified on arrival.
+ *
+ * Note: this routine is called from the NAPI poll context.
+ */
+static void
+qla2xip_lro_flush(struct qla2xip_private *qdev)
+{
+	struct qla2xip_lro *lro = &qdev->lro;
+	struct sk_buff *skb = lro->skb;
+	struct qla2xip_rx_stats *stats;
+
+	if (!skb)
+		return;
+	lro->skb = NULL;
+
+	if (lro->segs > 1) {
+		lro->iph->tot_len = htons(skb->len);
+		ip_send_check(lro->iph);
+		skb_shinfo(skb)->gso_size = lro->mss;
+		skb_shinfo(skb)->gso_segs = lro->segs;
+		skb_shinfo(skb)->gso_type = SKB_GSO_TCPV4;
+
+		stats = &this_cpu_ptr(qdev->stats)->rx;
+		u64_stats_update_begin(&stats->syncp);
+		stats->lro_aggregated++;
+		stats->lro_merged += lro->segs;
+		u64_stats_update_end(&stats->syncp);
+	}
+
+	netif_receive_skb(skb);
+}
+
+/**
+ * qla2xip_lro_parse() - Check whether a packet may be aggregated.
+ * @skb: The received packet, data at the IP header
+ *
+ * Only plain TCP/IPv4 data segments qualify: no IP options or fragments, no
+ * TCP flags other than ACK and PSH, and no TCP options other than an aligned
+ * timestamp.  The headers must be in the linear area.  The TCP checksum of
+ * an aggregate is never verified by the stack, so it is verified here.
+ *
+ * Returns the length of the IP and TCP headers, else 0.
+ */
+static unsigned int
+qla2xip_lro_parse(struct sk_buff *skb)
+{
+	struct iphdr *iph;
+	struct tcphdr *th;
+	unsigned int ip_len, hdr_len;
+
+	if (skb->protocol != htons(ETH_P_IP) ||
+	    skb_headlen(skb) < sizeof(struct iphdr) + sizeof(struct tcphdr))
+		return 0;
+
+	iph = (struct iphdr *)skb->data;
+	if (iph->version != 4 || iph->ihl != 5 ||
+	    iph->protocol != IPPROTO_TCP ||
+	    (iph->frag_off & htons(IP_MF | IP_OFFSET)) ||
+	    ip_fast_csum((u8 *)iph, iph->ihl))
+		return 0;
+
+	ip_len = ntohs(iph->tot_len);
+	th = (struct tcphdr *)(iph + 1);
+	hdr_len = sizeof(struct iphdr) + th->doff * 4;
+	if (ip_len != skb->len || ip_len <= hdr_len ||
+	    skb_headlen(skb) < hdr_len)
+		return 0;
+
+	if ((tcp_flag_word(th) & (TCP_FLAG_CWR | TCP_FLAG_ECE | TCP_FLAG_URG |
+	    TCP_FLAG_RST | TCP_FLAG_SYN | TCP_FLAG_FIN)) || !th->ack)
+		return 0;
+	if (th->doff != 5 &&
+	    (th->doff != 5 + TCPOLEN_TSTAMP_ALIGNED / 4 ||
+	     *(__be32 *)(th + 1) != htonl((TCPOPT_NOP << 24) |
+	     (TCPOPT_NOP << 16) | (TCPOPT_TIMESTAMP << 8) | TCPOLEN_TIMESTAMP)))
+		return 0;
+
+	if (skb->ip_summed != CHECKSUM_UNNECESSARY) {
+		if (csum_tcpudp_magic(iph->saddr, iph->daddr,
+		    ip_len - sizeof(struct iphdr), IPPROTO_TCP,
+		    skb_checksum(skb, sizeof(struct iphdr),
+		    ip_len - sizeof(struct iphdr), 0)))
+			return 0;
+		skb->ip_summed = CHECKSUM_UNNECESSARY;
+	}
+
+	return hdr_len;
+}
+
+/**
+ * qla2xip_lro_receive() - Aggregate a received packet.
+ * @qdev: The device's private structure
+ * @skb: The received packet, data at the IP header
+ *
+ * A segment continuing the aggregated flow is chained to it, otherwise the
+ * aggregate is flushed and the segment starts a new one.  Packets that do not
+ * qualify are passed up directly, after the aggregate to keep flow order.
+ *
+ * Note: this routine is called from the NAPI poll context.
+ */
+static void
+qla2xip_lro_receive(struct qla2xip_private *qdev, struct sk_buff *skb)
+{
+	struct qla2xip_lro *lro = &qdev->lro;
+	struct iphdr *iph;
+	struct tcphdr *th;
+	unsigned int hdr_len, payload;
+
+	hdr_len = qla2xip_lro_parse(skb);
+	if (!hdr_len) {
+		qla2xip_lro_flush(qdev);
+		netif_receive_skb(skb);
+		return;
+	}
+
+	iph = (struct iphdr *)skb->data;
+	th = (struct tcphdr *)(iph + 1);
+	payload = skb->len - hdr_len;
+
+	if (lro->skb && iph->saddr == lro->iph->saddr &&
+	    iph->daddr == lro->iph->daddr &&
+	    th->source == lro->th->source && th->dest == lro->th->dest &&
+	    th->doff == lro->th->doff && ntohl(th->seq) == lro->next_seq &&
+	    ether_addr_equal(eth_hdr(skb)->h_source,
+	    eth_hdr(lro->skb)->h_source) &&
+	    lro->skb->len + payload <= QLA2XIP_LRO_MAX_SIZE &&
+	    lro->segs < QLA2XIP_LRO_MAX_SEGS) {
+		/* Latest acknowledgement, window and timestamps */
+		lro->th->ack_seq = th->ack_seq;
+		lro->th->window = th->window;
+		lro->th->psh |= th->psh;
+		if (th->doff != 5)
+			memcpy(lro->th + 1, th + 1, TCPOLEN_TSTAMP_ALIGNED);
+
+		/* Chain the payload */
+		skb_pull(skb, hdr_len);
+		if (lro->last)
+			lro->last->next = skb;
+		else
+			skb_shinfo(lro->skb)->frag_list = skb;
+		lro->last = skb;
+		lro->skb->len += skb->len;
+		lro->skb->data_len += skb->len;
+		lro->skb->truesize += skb->truesize;
+
+		lro->next_seq += payload;
+		lro->mss = max_t(uint16_t, lro->mss, payload);
+		lro->segs++;
+	} else {
+		qla2xip_lro_flush(qdev);
+
+		lro->skb = skb;
+		lro->last = NULL;
+		lro->iph = iph;
+		lro->th = th;
+		lro->next_seq = ntohl(th->seq) + payload;
+		lro->mss = payload;
+		lro->segs = 1;
+	}
+
+	/* The sender wants its data delivered now */
+	if (lro->th->psh)
+		qla2xip_lro_flush(qdev);
+}
+
+/**
+ * qla2xip_xdp_tx() - Send a received frame back out for XDP_TX.
+ * @qdev: The device's private structure
+ * @xdp: The frame, starting with its Ethernet header
+ *
+ * The frame's page is sent as it is, behind a send_cb's packet_header, on
+ * the transmit queue of the current CPU.  qla2xip_send() serializes a queue
+ * with its xmit lock, which is taken here as well.  The request queue is
+ * flushed once by qla2xip_poll().
+ *
+ * Returns 0 if the frame was queued.
+ */
+static int
+qla2xip_xdp_tx(struct qla2xip_private *qdev, struct xdp_buff *xdp)
+{
+	int cpu = smp_processor_id();
+	uint16_t queue = cpu % qdev->num_tx_queues;
+	struct netdev_queue *nq = netdev_get_tx_queue(qdev->dev, queue);
+	struct qla2xip_txq *txq = &qdev->txq[queue];
+	struct xdp_frame *xdpf;
+	struct send_cb *scb;
+	struct ethhdr *eth;
+	struct page *page;
+	dma_addr_t dma;
+	uint32_t len;
+	int rval;
+
+	if (xdp->data_end - xdp->data <= sizeof(struct ethhdr))
+		return -EINVAL;
+
+	xdpf = xdp_convert_buff_to_frame(xdp);
+	if (!xdpf)
+		return -EOVERFLOW;
+
+	eth = xdpf->data;
+	len = xdpf->len - sizeof(struct ethhdr);
+	page = virt_to_head_page(xdpf->data);
+	dma = page_pool_get_dma_addr(page) +
+	    ((void *)eth - page_address(page)) + sizeof(struct ethhdr);
+
+	rval = -ENOSPC;
+	__netif_tx_lock(nq, cpu);
+	if (netif_xmit_frozen_or_stopped(nq))
+		goto out;
+
+	scb = qla2xip_get_send_cb(qdev, txq);
+	if (!scb)
+		goto out;
+
+	scb->header->networkh.d.na.naa = NAA_IEEE_MAC_TYPE;
+	scb->header->networkh.d.na.unused = 0;
+	memcpy(scb->header->networkh.d.na.addr, eth->h_dest, ETH_ALEN);
+	scb->header->snaph.ethertype = eth->h_proto;
+
+	dma_sync_single_for_device(&qdev->pdev->dev, dma, len,
+	    DMA_BIDIRECTIONAL);
+
+	scb->skb = NULL;
+	scb->xdpf = xdpf;
+	scb->tso_owner = NULL;
+	scb->flags = SCB_DEFER_DOORBELL;
+	scb->header_len = sizeof(struct packet_header);
+	scb->len = scb->header_len + len;
+	scb->dseg[0].address = dma;
+	scb->dseg[0].length = len;
+	scb->dseg_count = 1;
+
+	if (qdev->ip_send_packet_routine(qdev->ha, scb) !=
+	    QL_STATUS_SUCCESS) {
+		scb->xdpf = NULL;
+		qla2xip_free_send_cb(scb);
+		goto out;
+	}
+	__set_bit(queue, &qdev->xdp_tx_pending);
+	txq_trans_update(nq);
+	rval = 0;
+out:
+	__netif_tx_unlock(nq);
+	return rval;
+}
+
+/**
+ * qla2xip_xdp_tx_clean() - Release completed XDP_TX frames.
+ * @qdev: The device's private structure
+ * @napi: called from the NAPI poll
+ *
+ * Note: must not run concurrently with qla2xip_poll().
+ */
+static void
+qla2xip_xdp_tx_clean(struct qla2xip_private *qdev, int napi)
+{
+	struct llist_node *done;
+	struct send_cb *scb, *next;
+	struct netdev_queue *nq;
+	int i;
+
+	done = llist_del_all(&qdev->xdp_done);
+	if (!done)
+		return;
+
+	llist_for_each_entry_safe(scb, next, done, xdp_node) {
+		if (napi)
+			xdp_return_frame_rx_napi(scb->xdpf);
+		else
+			xdp_return_frame(scb->xdpf);
+		scb->xdpf = NULL;
+		qla2xip_free_send_cb(scb);
+	}
+
+	/* Restart queueing of packets once enough send_cbs are free */
+	smp_mb();
+	for (i = 0; i < qdev->num_tx_queues; i++) {
+		nq = netdev_get_tx_queue(qdev->dev, i);
+		if (netif_tx_queue_stopped(nq) &&
+		    qla2xip_send_cbs_free(qdev, &qdev->txq[i]) >=
+		    SEND_CBS_WAKE_MARK(qdev))
+			netif_tx_wake_queue(nq);
+	}
+}
+
+/**
+ * qla2xip_rx_xdp() - Run the XDP program on a received frame.
+ * @qdev: The device's private structure
+ * @prog: The XDP program
+ * @bcb: The buffer_cb holding the frame, converted to Ethernet
+ * @data_off: Offset of the frame in the page, updated by the program
+ * @data_len: Length of the frame, updated by the program
+ * @new_page: Returned replacement page if the frame's page was given away
+ *
+ * Note: this routine is called from the NAPI poll context.
+ *
+ * Returns XDP_PASS if the frame is to be passed to the network stack, else
+ * the frame was consumed.
+ */
+static uint32_t
+qla2xip_rx_xdp(struct qla2xip_private *qdev, struct bpf_prog *prog,
+    struct buffer_cb *bcb, unsigned int *data_off, unsigned int *data_len,
+    struct page **new_page)
+{
+	struct qla2xip_rx_stats *stats = &this_cpu_ptr(qdev->stats)->rx;
+	struct xdp_buff xdp;
+	uint32_t act;
+	int err;
+
+	*new_page = NULL;
+
+	/* Cannot happen with the receive buffers sized for XDP */
+	if (bcb->linked_bcb_cnt != 1) {
+		QLA2XIP_STATS_INC(stats, xdp_errors);
+		return XDP_DROP;
+	}
+
+	xdp_init_buff(&xdp, PAGE_SIZE << qdev->rx_page_order, &qdev->xdp_rxq);
+	xdp_prepare_buff(&xdp, page_address(bcb->page), *data_off, *data_len,
+	    false);
+
+	act = bpf_prog_run_xdp(prog, &xdp);
+
+	*data_off = xdp.data - xdp.data_hard_start;
+	*data_len = xdp.data_end - xdp.data;
+
+	switch (act) {
+	case XDP_PASS:
+		return act;
+
+	case XDP_TX:
+	case XDP_REDIRECT:
+		/* The frame's page is given away, the buffer needs a new one */
+		*new_page = page_pool_dev_alloc_pages(qdev->rx_page_pool);
+		if (!*new_page)
+			break;
+
+		if (act == XDP_TX) {
+			err = qla2xip_xdp_tx(qdev, &xdp);
+			if (!err)
+				QLA2XIP_STATS_INC(stats, xdp_tx);
+		} else {
+			err = xdp_do_redirect(qdev->dev, &xdp, prog);
+			if (!err) {
+				qdev->xdp_redirect = 1;
+				QLA2XIP_STATS_INC(stats, xdp_redirect);
+			}
+		}
+		if (!err)
+			return act;
+
+		page_pool_recycle_direct(qdev->rx_page_pool, *new_page);
+		*new_page = NULL;
+		break;
+
+	default:
+		bpf_warn_invalid_xdp_action(qdev->dev, prog, act);
+		fallthrough;
+	case XDP_ABORTED:
+		trace_xdp_exception(qdev->dev, prog, act);
+		break;
+
+	case XDP_DROP:
+		QLA2XIP_STATS_INC(stats, xdp_drop);
+		return act;
+	}
+
+	QLA2XIP_STATS_INC(stats, xdp_errors);
+	return XDP_DROP;
+}
+
+/**
+ * qla2xip_mc_hash() - Multicast filter hash of an Ethernet address.
+ * @addr: The multicast address
+ *
+ * Returns the filter bit of @addr, the top bits of its Ethernet CRC.
+ */
+static inline uint32_t
+qla2xip_mc_hash(const uint8_t *addr)
+{
+	return ether_crc(ETH_ALEN, addr) >> (32 - QLA2XIP_MC_HASH_BITS);
+}
+
+/**
+ * qla2xip_rx_filter() - Apply the multicast filter to a received packet.
+ * @qdev: The device's private structure
+ * @stats: The receive statistics
+ * @packethdr: The received network and SNAP headers
+ *
+ * FC has no multicast, so multicast packets are sent as FC broadcasts and
+ * reach every node.  Those of groups not joined are dropped here, before
+ * any XDP program runs or skb is allocated.
+ *
+ * Returns 1 if the packet should be received.
+ */
+static inline int
+qla2xip_rx_filter(struct qla2xip_private *qdev,
+    struct qla2xip_rx_stats *stats, struct packet_header *packethdr)
+{
+	uint8_t *addr = packethdr->networkh.d.na.addr;
+
+	if (!is_multicast_ether_addr(addr))
+		return 1;
+
+	if (!is_broadcast_ether_addr(addr) && !READ_ONCE(qdev->mc_all) &&
+	    !test_bit(qla2xip_mc_hash(addr), qdev->mc_filter)) {
+		QLA2XIP_STATS_INC(stats, mc_filtered);
+		return 0;
+	}
+
+	QLA2XIP_STATS_INC(stats, multicast);
+	return 1;
+}
+
+/**
+ * qla2xip_rx_small() - Process a packet received in a small buffer.
+ * @qdev: The device's private structure
+ * @bcb: The received buffer_cb
+ *
+ * Small buffers hold ARP and TCP ACK sized frames.  The frame is copied into
+ * a new skb, converting its headers on the way, so the buffer goes straight
+ * back to the firmware.
+ *
+ * Note: this routine is called from the NAPI poll context.
+ */
+static void
+qla2xip_rx_small(struct qla2xip_private *qdev, struct buffer_cb *bcb)
+{
+	struct net_device *dev = qdev->dev;
+	struct qla2xip_rx_stats *stats = &this_cpu_ptr(qdev->stats)->rx;
+	struct packet_header *packethdr;
+	struct buffer_cb *nbcb;
+	struct sk_buff *skb;
+	struct ethhdr *eth;
+	uint16_t linked_bcb_cnt;
+	int i;
+
+	linked_bcb_cnt = bcb->linked_bcb_cnt;
+	if (linked_bcb_cnt != 1 ||
+	    bcb->rec_data_size < sizeof(struct packet_header)) {
+		QLA2XIP_STATS_INC(stats, length_errors);
+		goto repost;
+	}
+
+	dma_sync_single_for_cpu(&qdev->pdev->dev, bcb->skb_data_dma,
+	    bcb->rec_data_size, DMA_FROM_DEVICE);
+
+	packethdr = (struct packet_header *)bcb->skb_data;
+	if (!qla2xip_rx_filter(qdev, stats, packethdr))
+		goto sync;
+
+	skb = napi_alloc_skb(&qdev->napi, bcb->rec_data_size -
+	    sizeof(struct packet_header) + sizeof(struct ethhdr));
+	if (!skb) {
+		QLA2XIP_STATS_INC(stats, dropped);
+		goto sync;
+	}
+
+	/* Convert Network and SNAP headers into Ethernet header */
+	eth = skb_put(skb, sizeof(struct ethhdr));
+	eth->h_proto = packethdr->snaph.ethertype;
+	memcpy(eth->h_source, packethdr->networkh.s.na.addr, ETH_ALEN);
+	memcpy(eth->h_dest, packethdr->networkh.d.na.addr, ETH_ALEN);
+	skb_put_data(skb, bcb->skb_data + sizeof(struct packet_header),
+	    bcb->rec_data_size - sizeof(struct packet_header));
+
+	skb->protocol = eth_type_trans(skb, dev);
+
+	u64_stats_update_begin(&stats->syncp);
+	stats->packets++;
+	stats->bytes += bcb->packet_size;
+	stats->small_buffer++;
+	u64_stats_update_end(&stats->syncp);
+
+	/* Indicate receive packet */
+	qla2xip_lro_flush(qdev);
+	napi_gro_receive(&qdev->napi, skb);
+
+sync:
+	dma_sync_single_for_device(&qdev->pdev->dev, bcb->skb_data_dma,
+	    bcb->rec_data_size, DMA_FROM_DEVICE);
+
+repost:
+	/* Return buffers to receive buffer queue */
+	nbcb = bcb;
+	for (i = 0; i < linked_bcb_cnt; i++) {
+		qla2xip_post_receive_buffer(qdev, nbcb);
+		nbcb = nbcb->next_bcb;
+	}
+
+	/* Update (RISC) free buffer count */
+	qdev->receive_q_cnt -= linked_bcb_cnt;
+}
+
+/**
+ * qla2xip_rx_packet() - Pass a received packet to the network stack.
+ * @qdev: The device's private structure
+ * @bcb: The buffer_cb that was received
+ *
+ * The skb is built around the page of the first buffer_cb, any linked
+ * buffer_cbs are added as page fragments.  A split header is instead copied
+ * into a small skb head, so a pool page does not back a few header bytes,
+ * and its buffer goes straight back to the firmware.  Every other buffer_cb
+ * is given a fresh page from the page pool; if none is available the packet
+ * is dropped and its pages reused, so the receive buffer pool never shrinks.
+ *
+ * Packets are aggregated by the driver if NETIF_F_LRO is enabled, else by
+ * GRO.  The two are not mixed to keep the packets of a flow in order.
+ *
+ * An attached XDP program runs on the frame, converted to Ethernet, before
+ * any skb is built.
+ *
+ * Note: this routine is called from the NAPI poll context.
+ */
+static void
+qla2xip_rx_packet(struct qla2xip_private *qdev, struct buffer_cb *bcb)
+{
+	struct net_device *dev = qdev->dev;
+	struct page_pool *pool = qdev->rx_page_pool;
+	struct qla2xip_rx_stats *stats = &this_cpu_ptr(qdev->stats)->rx;
+	struct page *new_pages[IP_RCV_BUFFERS];
+	struct bpf_prog *xdp_prog;
+	unsigned int truesize;
+	unsigned int data_off, data_len;
+	int i, hdr_adj;
+	int reuse, split;
+	struct ethhdr *eth;
+	struct sk_buff *skb;
+	struct buffer_cb *nbcb;
+	struct packet_header *packethdr;
+	uint16_t linked_bcb_cnt;
+
+	/* TODO: Interrogate firmware completion status */
+
+	if (bcb->pool_id == BD_POOL_SMALL) {
+		qla2xip_rx_small(qdev, bcb);
+		return;
+	}
+
+	linked_bcb_cnt = bcb->linked_bcb_cnt;
+	truesize = PAGE_SIZE << qdev->rx_page_order;
+	hdr_adj = sizeof(struct packet_header) - sizeof(struct ethhdr);
+	reuse = 1;
+	split = (bcb->comp_status & IPREC_STATUS_SPLIT_BUFFER) ? 1 : 0;
+
+	/* Make received data visible to the CPU */
+	nbcb = bcb;
+	for (i = 0; i < linked_bcb_cnt; i++) {
+		dma_sync_single_range_for_cpu(&qdev->pdev->dev,
+		    page_pool_get_dma_addr(nbcb->page), QLA2XIP_RX_HEADROOM,
+		    nbcb->rec_data_size, qdev->rx_dma_dir);
+		nbcb = nbcb->next_bcb;
+	}
+
+	if (bcb->rec_data_size < sizeof(struct packet_header)) {
+		QLA2XIP_STATS_INC(stats, length_errors);
+		goto repost;
+	}
+
+	packethdr = (struct packet_header *)bcb->skb_data;
+	if (!qla2xip_rx_filter(qdev, stats, packethdr))
+		goto repost;
+
+	/* Convert Network and SNAP headers into Ethernet header */
+	eth = (struct ethhdr *)(bcb->skb_data + hdr_adj);
+
+	eth->h_proto = packethdr->snaph.ethertype;
+	memcpy(eth->h_source, packethdr->networkh.s.na.addr, ETH_ALEN);
+	memcpy(eth->h_dest, packethdr->networkh.d.na.addr, ETH_ALEN);
+
+	data_off = QLA2XIP_RX_HEADROOM + hdr_adj;
+	data_len = bcb->rec_data_size - hdr_adj;
+
+	xdp_prog = READ_ONCE(qdev->xdp_prog);
+	if (xdp_prog && qla2xip_rx_xdp(qdev, xdp_prog, bcb, &data_off,
+	    &data_len, &new_pages[0]) != XDP_PASS) {
+		reuse = !new_pages[0];
+		goto repost;
+	}
+
+	/* Replacement buffers are needed before the pages are given away */
+	for (i = split; i < linked_bcb_cnt; i++) {
+		new_pages[i] = page_pool_dev_alloc_pages(pool);
+		if (!new_pages[i])
+			break;
+	}
+	if (i < linked_bcb_cnt)
+		goto drop;
+
+	if (split) {
+		skb = napi_alloc_skb(&qdev->napi, data_len);
+		if (!skb)
+			goto drop;
+		skb_put_data(skb, bcb->skb_data + hdr_adj, data_len);
+	} else {
+		skb = build_skb(page_address(bcb->page), truesize);
+		if (!skb)
+			goto drop;
+		skb_reserve(skb, data_off);
+		skb_put(skb, data_len);
+	}
+	skb_mark_for_recycle(skb);
+
+	/* Add (split) data buffers without copying */
+	nbcb = bcb->next_bcb;
+	for (i = 1; i < linked_bcb_cnt; i++) {
+		skb_add_rx_frag(skb, i - 1, nbcb->page, QLA2XIP_RX_HEADROOM,
+				nbcb->rec_data_size, truesize);
+		nbcb = nbcb->next_bcb;
+	}
+
+	skb->protocol = eth_type_trans(skb, dev);
+
+	u64_stats_update_begin(&stats->syncp);
+	stats->packets++;
+	stats->bytes += bcb->packet_size;
+	if (linked_bcb_cnt > 1)
+		stats->multi_buffer++;
+	u64_stats_update_end(&stats->syncp);
+
+	/* Indicate receive packet */
+	if (dev->features & NETIF_F_LRO) {
+		qla2xip_lro_receive(qdev, skb);
+	} else {
+		qla2xip_lro_flush(qdev);
+		napi_gro_receive(&qdev->napi, skb);
+	}
+	reuse = 0;
+	goto repost;
+
+drop:
+	/* Keep the buffer pool intact, reuse the packet's pages */
+	while (i-- > split)
+		page_pool_recycle_direct(pool, new_pages[i]);
+	if (net_ratelimit())
+		printk(KERN_ERR
+		       "%s: %s - Failed to allocate receive buffer, "
+		       "packet dropped\n", qla_name, dev->name);
+	QLA2XIP_STATS_INC(stats, dropped);
+
+repost:
+	/* Return buffers to receive buffer queue */
+	nbcb = bcb;
+	for (i = 0; i < linked_bcb_cnt; i++) {
+		struct buffer_cb *next_bcb = nbcb->next_bcb;
+
+		if (reuse || i < split)
+			dma_sync_single_range_for_device(&qdev->pdev->dev,
+			    page_pool_get_dma_addr(nbcb->page),
+			    QLA2XIP_RX_HEADROOM, nbcb->rec_data_size,
+			    qdev->rx_dma_dir);
+		else
+			qla2xip_attach_rx_page(qdev, nbcb, new_pages[i]);
+		qla2xip_post_receive_buffer(qdev, nbcb);
+		nbcb = next_bcb;
+	}
+
+	/* Update (RISC) free buffer count */
+	qdev->receive_q_cnt -= linked_bcb_cnt;
+}
+
+static void qla2xip_tx_drain_pending(struct qla2xip_private *qdev);
+
+/**
+ * qla2xip_poll() - NAPI poll routine.
+ * @napi: The device's NAPI context
+ * @budget: Maximum number of packets to process
+ *
+ * Passes up to @budget queued packets to the network stack, then hands all
+ * replenished receive buffers to the SCSI driver in a single batch.  XDP_TX
+ * frames are released once sent, and flushed to the firmware once queued.
+ * Packets held back for their destination are sent as completions free
+ * its quota.
+ *
+ * Returns the number of packets processed.
+ */
+static int
+qla2xip_poll(struct napi_struct *napi, int budget)
+{
+	struct qla2xip_private *qdev =
+	    container_of(napi, struct qla2xip_private, napi);
+	struct buffer_cb *bcb;
+	uint32_t added;
+	int work_done;
+	int queue;
+
+	qla2xip_xdp_tx_clean(qdev, 1);
+	if (qdev->tx_drain_pending)
+		qla2xip_tx_drain_pending(qdev);
+
+	for (work_done = 0; work_done < budget; work_done++) {
+		bcb = qla2xip_get_rx_done(qdev);
+		if (!bcb)
+			break;
+
+		qla2xip_rx_packet(qdev, bcb);
+	}
+	qla2xip_lro_flush(qdev);
+
+	if (qdev->xdp_tx_pending) {
+		for_each_set_bit(queue, &qdev->xdp_tx_pending,
+		    QLA_IP_MAX_TX_QUEUES)
+			qdev->ip_flush_packets_routine(qdev->ha, queue);
+		qdev->xdp_tx_pending = 0;
+	}
+	if (qdev->xdp_redirect) {
+		qdev->xdp_redirect = 0;
+		xdp_do_flush();
+	}
+
+	/*
+	 * Pass receive buffers to SCSI driver, always flushing the remainder
+	 * before going idle.
+	 */
+	added = qla2xip_rx_ring_pending(qdev);
+	if (added &&
+	    (added >= qdev->rx_add_mark ||
+	     qdev->receive_q_cnt <= qdev->rx_low_mark ||
+	     work_done < budget))
+		qla2xip_add_receive_buffers(qdev);
+
+	if (work_done < budget) {
+		napi_complete_done(napi, work_done);
+
+		/*
+		 * Catch any buffer_cb, XDP_TX completion or held back packets
+		 * queued before NAPI was re-armed
+		 */
+		smp_mb();
+		if (qdev->rx_done_out != READ_ONCE(qdev->rx_done_in) ||
+		    !llist_empty(&qdev->xdp_done) ||
+		    READ_ONCE(qdev->tx_drain_pending))
+			napi_schedule(napi);
+	}
+
+	return work_done;
+}
+
+/**
+ * qla2xip_open() - Prepares a networking interface for use.
+ * @dev: The device to open
+ *
+ * Returns 0.
+ */
+static int
+qla2xip_open(struct net_device *dev)
+{
+	struct qla2xip_private *qdev = netdev_priv(dev);
+
+	napi_enable(&qdev->napi);
+	qla2xip_reset_tx_queues(dev);
+	netif_tx_start_all_queues(dev);
+
+	/* Process any packets received while the interface was down */
+	napi_schedule(&qdev->napi);
+	return 0;
+}
+
+/**
+ * qla2xip_close() - Shutdown a networking interface.
+ * @dev: The device to shutdown
+ *
+ * Returns 0.
+ */
+static int
+qla2xip_close(struct net_device *dev)
+{
+	struct qla2xip_private *qdev = netdev_priv(dev);
+	int i;
+
+	netif_tx_stop_all_queues(dev);
+	napi_disable(&qdev->napi);
+	qla2xip_xdp_tx_clean(qdev, 0);
+
+	/* Drop the packets held back for their destinations */
+	qdev->tx_drain_pending = 0;
+	for (i = 0; i < qdev->num_tx_queues; i++) {
+		qla2xip_tx_purge(&qdev->txq[i]);
+		if (qdev->txq[i].tso.owner) {
+			qla2xip_tso_put(qdev, qdev->txq[i].tso.owner);
+			qdev->txq[i].tso.owner = NULL;
+		}
+	}
+	return 0;
+}
+
+/**
+ * qla2xip_tso_segment() - Build a TSO segment send_cb.
+ * @owner: The send_cb owning the skb and its DMA mapping
+ * @scb: The segment's send_cb
+ * @index: The segment number
+ * @offset: Offset of the segment's payload in the skb
+ * @len: Length of the segment's payload
+ *
+ * The IP and TCP headers of the skb are copied behind the segment's
+ * packet_header and fixed up for the segment, the TCP checksum is computed
+ * in software.  The payload data segments point into the owner's mapping.
+ */
+static void
+qla2xip_tso_segment(struct send_cb *owner, struct send_cb *scb,
+    unsigned int index, unsigned int offset, unsigned int len)
+{
+	struct sk_buff *skb = owner->skb;
+	struct qla2xip_scb_header *hdr =
+	    container_of(scb->header, struct qla2xip_scb_header, packethdr);
+	unsigned int hdr_len, tcp_len, pos;
+	struct iphdr *iph;
+	struct tcphdr *th;
+	__wsum csum;
+	int i;
+
+	tcp_len = tcp_hdrlen(skb);
+	hdr_len = skb_transport_offset(skb) + tcp_len;
+
+	/* Network and SNAP headers */
+	memcpy(scb->header->networkh.d.na.addr,
+	       owner->header->networkh.d.na.addr, ETH_ALEN);
+	scb->header->networkh.d.na.naa = NAA_IEEE_MAC_TYPE;
+	scb->header->networkh.d.na.unused = 0;
+	scb->header->snaph.ethertype = owner->header->snaph.ethertype;
+
+	/* IP and TCP headers */
+	memcpy(hdr->tso_hdr, skb->data, hdr_len);
+	iph = (struct iphdr *)hdr->tso_hdr;
+	th = (struct tcphdr *)(hdr->tso_hdr + skb_transport_offset(skb));
+
+	iph->tot_len = htons(hdr_len + len);
+	iph->id = htons(ntohs(ip_hdr(skb)->id) + index);
+	ip_send_check(iph);
+
+	th->seq = htonl(ntohl(tcp_hdr(skb)->seq) +
+	    index * skb_shinfo(skb)->gso_size);
+	if (index)
+		th->cwr = 0;
+	if (offset + len < skb->len) {
+		th->fin = 0;
+		th->psh = 0;
+	}
+	th->check = 0;
+	csum = csum_partial(th, tcp_len, skb_checksum(skb, offset, len, 0));
+	th->check = csum_tcpudp_magic(iph->saddr, iph->daddr, tcp_len + len,
+	    IPPROTO_TCP, csum);
+
+	scb->skb = skb;
+	scb->flags = 0;
+	scb->tso_owner = owner;
+	scb->header_len = sizeof(struct packet_header) + hdr_len;
+	scb->len = scb->header_len + len;
+
+	/* Payload data segments */
+	scb->dseg_count = 0;
+	pos = 0;
+	for (i = 0; i < owner->dseg_count && len; i++) {
+		unsigned int start, count;
+
+		if (offset >= pos + owner->dseg[i].length) {
+			pos += owner->dseg[i].length;
+			continue;
+		}
+
+		start = offset - pos;
+		count = min(len, owner->dseg[i].length - start);
+		scb->dseg[scb->dseg_count].address =
+		    owner->dseg[i].address + start;
+		scb->dseg[scb->dseg_count].length = count;
+		scb->dseg_count++;
+
+		offset += count;
+		len -= count;
+		pos += owner->dseg[i].length;
+	}
+}
+
+/**
+ * qla2xip_tso_post() - Post the remaining segments of a TSO packet.
+ * @qdev: The device's private structure
+ * @queue: The transmit queue
+ * @more: More packets follow, the doorbell may be deferred
+ *
+ * Posts the segments of the transmit queue's TSO packet, from txq->tso.index
+ * on.  A full request ring is normal under load, so the packet then stays on
+ * the queue with the segments not yet posted; they are posted before any
+ * other packet of the queue, by qla2xip_send() or from the NAPI poll once
+ * send completions have made room.  Any other failure drops the segments
+ * left.
+ *
+ * Note: called under the netdev queue's xmit lock.
+ *
+ * Returns QL_STATUS_RESOURCE_ERROR if segments are left to post.
+ */
+static int
+qla2xip_tso_post(struct qla2xip_private *qdev, uint16_t queue, bool more)
+{
+	struct qla2xip_txq *txq = &qdev->txq[queue];
+	struct qla2xip_tso *tso = &txq->tso;
+	struct netdev_queue *nq = netdev_get_tx_queue(qdev->dev, queue);
+	struct qla2xip_tx_stats *stats = &this_cpu_ptr(qdev->stats)->tx[queue];
+	struct send_cb *owner = tso->owner;
+	struct send_cb *scb;
+	uint16_t first = tso->index;
+	unsigned int len;
+	int status;
+
+	status = QL_STATUS_SUCCESS;
+	for (; tso->index < tso->segs; tso->index++) {
+		/* XDP_TX may have taken the send_cbs counted for the packet */
+		scb = qla2xip_get_send_cb(qdev, txq);
+		if (!scb) {
+			status = QL_STATUS_RESOURCE_ERROR;
+			break;
+		}
+		len = min(tso->mss, owner->skb->len - tso->offset);
+		qla2xip_tso_segment(owner, scb, tso->index, tso->offset, len);
+		scb->tx_dest = tso->dest;
+		if (tso->index + 1 < tso->segs ||
+		    (more && !netif_xmit_stopped(nq)))
+			scb->flags |= SCB_DEFER_DOORBELL;
+
+		/* The completion may run before the send returns */
+		atomic_inc(&owner->tso_refs);
+		qla2xip_tx_dest_inc(txq, tso->dest);
+		status = qdev->ip_send_packet_routine(qdev->ha, scb);
+		if (status != QL_STATUS_SUCCESS) {
+			qla2xip_tx_dest_dec(txq, tso->dest);
+			atomic_dec(&owner->tso_refs);
+			qla2xip_free_send_cb(scb);
+			break;
+		}
+		netdev_tx_sent_queue(nq, scb->len);
+		tso->offset += len;
+	}
+	if (tso->index != first)
+		txq_trans_update(nq);
+
+	if (tso->index < tso->segs) {
+		/* Ring the doorbell for the segments posted */
+		qdev->ip_flush_packets_routine(qdev->ha, queue);
+		if (status == QL_STATUS_RESOURCE_ERROR)
+			return status;
+
+		if (net_ratelimit())
+			printk(KERN_ERR
+			       "%s: %s - Unable to send TSO segment %d of %d\n",
+			       qla_name, qdev->dev->name, tso->index,
+			       tso->segs);
+		QLA2XIP_STATS_INC(stats, errors);
+	} else {
+		QLA2XIP_STATS_INC(stats, tso);
+	}
+
+	WRITE_ONCE(tso->owner, NULL);
+	qla2xip_tso_put(qdev, owner);
+	return QL_STATUS_SUCCESS;
+}
+
+/**
+ * qla2xip_send_tso() - Transmit a TCP segmentation offload packet.
+ * @qdev: The device's private structure
+ * @skb: The GSO packet to transmit
+ * @queue: The transmit queue
+ * @dest: The destination index of the transmit queue
+ * @more: More packets follow, the doorbell may be deferred
+ *
+ * The firmware only segments an IP_COMMAND sequence into FC frames, so the
+ * packet is cut into MTU sized TCP/IP datagrams here.  The skb is DMA mapped
+ * once by an owner send_cb which is never passed to the SCSI driver; each
+ * segment gets its own send_cb with its own headers and data segments into
+ * that mapping.  The segments are posted as one batch with a single request
+ * queue doorbell.  qla2xip_features_check() guarantees enough send_cbs for
+ * the segments can become free.  If the request ring fills up partway, the
+ * queue is stopped and the remaining segments are posted later, see
+ * qla2xip_tso_post().
+ *
+ * Returns NETDEV_TX_OK if the packet was consumed, else NETDEV_TX_BUSY.
+ */
+static netdev_tx_t
+qla2xip_send_tso(struct qla2xip_private *qdev, struct sk_buff *skb,
+    uint16_t queue, uint16_t dest, bool more)
+{
+	struct net_device *dev = qdev->dev;
+	struct qla2xip_txq *txq = &qdev->txq[queue];
+	struct netdev_queue *nq = netdev_get_tx_queue(dev, queue);
+	struct qla2xip_tx_stats *stats = &this_cpu_ptr(qdev->stats)->tx[queue];
+	struct qla2xip_tso *tso = &txq->tso;
+	unsigned int mss, hdr_len;
+	uint16_t segs;
+	struct send_cb *owner;
+	struct ethhdr *eth;
+
+	mss = skb_shinfo(skb)->gso_size;
+	hdr_len = skb_transport_offset(skb) + tcp_hdrlen(skb);
+	segs = DIV_ROUND_UP(skb->len - hdr_len, mss);
+
+	/* An owner plus one send_cb per segment */
+	if (qla2xip_send_cbs_free(qdev, txq) < segs + 1) {
+		QLA2XIP_STATS_INC(stats, scb_exhausted);
+		netif_tx_stop_queue(nq);
+		qdev->ip_flush_packets_routine(qdev->ha, queue);
+
+		/* Completion may have freed send_cbs meanwhile */
+		smp_mb();
+		if (qla2xip_send_cbs_free(qdev, txq) >=
+		    SEND_CBS_WAKE_MARK(qdev))
+			netif_tx_start_queue(nq);
+		return NETDEV_TX_BUSY;
+	}
+
+	owner = qla2xip_get_send_cb(qdev, txq);
+	eth = (struct ethhdr *)skb->data;
+	memcpy(owner->header->networkh.d.na.addr, eth->h_dest, ETH_ALEN);
+	owner->header->snaph.ethertype = eth->h_proto;
+	skb_pull(skb, sizeof(struct ethhdr));
+
+	owner->skb = skb;
+	owner->flags = 0;
+	owner->tso_owner = NULL;
+	if (qla2xip_map_send_cb(qdev, owner)) {
+		qla2xip_free_send_cb(owner);
+		qdev->ip_flush_packets_routine(qdev->ha, queue);
+		dev_kfree_skb_any(skb);
+		QLA2XIP_STATS_INC(stats, dropped);
+		return NETDEV_TX_OK;
+	}
+	atomic_set(&owner->tso_refs, 1);
+
+	tso->offset = hdr_len - sizeof(struct ethhdr);
+	tso->mss = mss;
+	tso->index = 0;
+	tso->segs = segs;
+	tso->dest = dest;
+	WRITE_ONCE(tso->owner, owner);
+	if (qla2xip_tso_post(qdev, queue, more) == QL_STATUS_RESOURCE_ERROR) {
+		if (tso->index == 0) {
+			/* ISP too busy now, try later */
+			WRITE_ONCE(tso->owner, NULL);
+			qla2xip_unmap_send_cb(qdev, owner);
+			qla2xip_free_send_cb(owner);
+			skb_push(skb, sizeof(struct ethhdr));
+			QLA2XIP_STATS_INC(stats, busy);
+			if (qla2xip_send_cbs_free(qdev, txq) !=
+			    qdev->max_send_packets)
+				netif_tx_stop_queue(nq);
+			return NETDEV_TX_BUSY;
+		}
+
+		/* The rest follows once the posted segments complete */
+		QLA2XIP_STATS_INC(stats, busy);
+		netif_tx_stop_queue(nq);
+		return NETDEV_TX_OK;
+	}
+
+	if (qla2xip_send_cbs_free(qdev, txq) < SEND_CBS_STOP_MARK) {
+		QLA2XIP_STATS_INC(stats, stopped);
+		netif_tx_stop_queue(nq);
+		qdev->ip_flush_packets_routine(qdev->ha, queue);
+
+		/* Completion may have freed send_cbs meanwhile */
+		smp_mb();
+		if (qla2xip_send_cbs_free(qdev, txq) >=
+		    SEND_CBS_WAKE_MARK(qdev))
+			netif_tx_start_queue(nq);
+	}
+	return NETDEV_TX_OK;
+}
+
+/**
+ * qla2xip_features_check() - Per packet offload features.
+ * @skb: The packet to transmit
+ * @dev: The device to transmit the packet on
+ * @features: The features the stack would use
+ *
+ * TSO is left to software GSO for packets with headers too large for a
+ * send_cb, or with more segments than send_cbs are woken for.
+ *
+ * Returns the offload features usable for @skb.
+ */
+static netdev_features_t
+qla2xip_features_check(struct sk_buff *skb, struct net_device *dev,
+    netdev_features_t features)
+{
+	struct qla2xip_private *qdev = netdev_priv(dev);
+	unsigned int hdr_len;
+
+	if (!skb_is_gso(skb))
+		return features;
+
+	hdr_len = skb_transport_offset(skb) + tcp_hdrlen(skb);
+	if (!(skb_shinfo(skb)->gso_type & SKB_GSO_TCPV4) ||
+	    hdr_len - sizeof(struct ethhdr) > QLA2XIP_TSO_MAX_HDR ||
+	    hdr_len > skb_headlen(skb) ||
+	    skb_shinfo(skb)->gso_segs + 1 > SEND_CBS_WAKE_MARK(qdev))
+		features &= ~NETIF_F_GSO_MASK;
+
+	return features;
+}
+
+/**
+ * qla2xip_send_packet() - Pass a packet to the SCSI driver.
+ * @qdev: The device's private structure
+ * @skb: The buffer to transmit
+ * @queue: The transmit queue
+ * @dest: The destination index of the transmit queue
+ * @more: More packets follow, the doorbell may be deferred
+ *
+ * Each transmit queue has its own send_cb ring and maps onto its own SCSI
+ * driver IP transmit queue.  A queue is stopped once fewer than
+ * SEND_CBS_STOP_MARK send_cbs remain and woken from qla2xip_send_completion()
+ * at SEND_CBS_WAKE_MARK, so the out-of-send_cbs case below should only be
+ * hit if the ISP request ring itself is full.
+ *
+ * Returns NETDEV_TX_OK if the buffer was consumed, else NETDEV_TX_BUSY.
+ */
+static netdev_tx_t
+qla2xip_send_packet(struct qla2xip_private *qdev, struct sk_buff *skb,
+    uint16_t queue, uint16_t dest, bool more)
+{
+	struct net_device *dev = qdev->dev;
+	struct qla2xip_txq *txq = &qdev->txq[queue];
+	struct netdev_queue *nq = netdev_get_tx_queue(dev, queue);
+	struct qla2xip_tx_stats *stats = &this_cpu_ptr(qdev->stats)->tx[queue];
+	int status;
+	struct ethhdr *eth;
+	struct send_cb *scb;
+	struct packet_header *packethdr;
+
+	if (skb_is_gso(skb))
+		return qla2xip_send_tso(qdev, skb, queue, dest, more);
+
+	/* Checksum in software, the FC link only protects the frames */
+	if (skb->ip_summed == CHECKSUM_PARTIAL && skb_checksum_help(skb)) {
+		dev_kfree_skb_any(skb);
+		QLA2XIP_STATS_INC(stats, dropped);
+		return NETDEV_TX_OK;
+	}
+
+	/* Get next available send control block */
+	scb = qla2xip_get_send_cb(qdev, txq);
+	if (!scb) {
+		/* Out of send control blocks, pause queueing of packets */
+		QLA2XIP_STATS_INC(stats, scb_exhausted);
+		netif_tx_stop_queue(nq);
+		qdev->ip_flush_packets_routine(qdev->ha, queue);
+		return NETDEV_TX_BUSY;
+	}
+
+	/* Finish building Network and SNAP headers */
+	eth = (struct ethhdr *)skb->data;
+	packethdr = scb->header;
+
+	packethdr->networkh.d.na.naa = NAA_IEEE_MAC_TYPE;
+	packethdr->networkh.d.na.unused = 0;
+	memcpy(packethdr->networkh.d.na.addr, eth->h_dest, ETH_ALEN);
+	packethdr->snaph.ethertype = eth->h_proto;
+
+	/* Skip over ethernet header */
+	skb_pull(skb, sizeof(struct ethhdr));
+
+	/*
+	 * Pass send packet to SCSI driver, deferring the request queue
+	 * doorbell while the stack has more packets queued for us.
+	 */
+	scb->skb = skb;
+	scb->header_len = sizeof(struct packet_header);
+	scb->len = skb->len + sizeof(struct packet_header);
+	scb->flags = 0;
+	scb->tso_owner = NULL;
+	scb->tx_dest = dest;
+	if (qla2xip_map_send_cb(qdev, scb)) {
+		qla2xip_free_send_cb(scb);
+		qdev->ip_flush_packets_routine(qdev->ha, queue);
+		dev_kfree_skb_any(skb);
+		QLA2XIP_STATS_INC(stats, dropped);
+		return NETDEV_TX_OK;
+	}
+	if (more && !netif_xmit_stopped(nq))
+		scb->flags |= SCB_DEFER_DOORBELL;
+
+	/* The completion may run before the send returns */
+	qla2xip_tx_dest_inc(txq, dest);
+	status = qdev->ip_send_packet_routine(qdev->ha, scb);
+	if (status == QL_STATUS_SUCCESS) {
+		/* Packet successfully sent to ISP */
+		netdev_tx_sent_queue(nq, scb->len);
+		txq_trans_update(nq);
+
+		if (qla2xip_send_cbs_free(qdev, txq) < SEND_CBS_STOP_MARK) {
+			QLA2XIP_STATS_INC(stats, stopped);
+			netif_tx_stop_queue(nq);
+			qdev->ip_flush_packets_routine(qdev->ha, queue);
+
+			/* Completion may have freed send_cbs meanwhile */
+			smp_mb();
+			if (qla2xip_send_cbs_free(qdev, txq) >=
+			    SEND_CBS_WAKE_MARK(qdev))
+				netif_tx_start_queue(nq);
+		}
+		return NETDEV_TX_OK;
+	}
+
+	/* Free send control block, and post any deferred packets */
+	qla2xip_tx_dest_dec(txq, dest);
+	qla2xip_unmap_send_cb(qdev, scb);
+	qla2xip_free_send_cb(scb);
+	qdev->ip_flush_packets_routine(qdev->ha, queue);
+
+	if (status == QL_STATUS_RESOURCE_ERROR) {
+		/* ISP too busy now, try later */
+		skb_push(skb, sizeof(struct ethhdr));
+		QLA2XIP_STATS_INC(stats, busy);
+
+		/*
+		 * Only stop the queue if there is a send completion
+		 * outstanding to restart it.
+		 */
+		if (qla2xip_send_cbs_free(qdev, txq) != qdev->max_send_packets)
+			netif_tx_stop_queue(nq);
+		return NETDEV_TX_BUSY;
+	}
+
+	/* Error, don't send packet */
+	if (net_ratelimit())
+		printk(KERN_ERR
+		       "%s: %s - Unable to send packet -- Bad error "
+		       "occured!!!\n", qla_name, dev->name);
+	dev_kfree_skb(skb);
+	QLA2XIP_STATS_INC(stats, errors);
+	return NETDEV_TX_OK;
+}
+
+/**
+ * qla2xip_tx_dest_hash() - Destination hash bucket of an Ethernet address.
+ * @addr: The destination address
+ *
+ * The first two bytes of the address are those of the NAA, its port name
+ * varies in the last four.
+ */
+static inline uint16_t
+qla2xip_tx_dest_hash(const uint8_t *addr)
+{
+	return hash_32(get_unaligned((const u32 *)&addr[2]),
+	    QLA2XIP_TX_DEST_BITS);
+}
+
+/**
+ * qla2xip_tx_dest_idle() - Check whether a destination may be reused.
+ * @txq: The transmit queue
+ * @dest: The destination
+ *
+ * Only sends take send_cbs for a destination, so one without send_cbs,
+ * backlog or a TSO packet being posted stays idle under the xmit lock.
+ */
+static inline int
+qla2xip_tx_dest_idle(struct qla2xip_txq *txq, struct qla2xip_tx_dest *dest)
+{
+	return !atomic_read(&dest->inflight) && list_empty(&dest->active) &&
+	    !(txq->tso.owner && &txq->dests[txq->tso.dest] == dest);
+}
+
+/**
+ * qla2xip_tx_dest_limited() - Check whether a destination is over its quota.
+ * @qdev: The device's private structure
+ * @txq: The transmit queue
+ * @dest: The destination
+ *
+ * The quota only applies while other destinations hold send_cbs or have
+ * packets held back; a lone destination may use the whole ring.
+ */
+static inline int
+qla2xip_tx_dest_limited(struct qla2xip_private *qdev, struct qla2xip_txq *txq,
+    struct qla2xip_tx_dest *dest)
+{
+	if (atomic_read(&dest->inflight) < QLA2XIP_TX_DEST_QUOTA(qdev))
+		return 0;
+
+	/* The destination itself holds send_cbs, and may be backlogged */
+	return atomic_read(&txq->dests_busy) > 1 ||
+	    txq->active_cnt > !list_empty(&dest->active);
+}
+
+/**
+ * qla2xip_tx_dest_get() - Look up the destination of an Ethernet address.
+ * @txq: The transmit queue
+ * @addr: The destination address
+ *
+ * Each address, and so each remote port, has a destination of its own; an
+ * unknown address takes over an idle destination, tried round robin.
+ *
+ * Note: called under the netdev queue's xmit lock.
+ *
+ * Returns the destination, or NULL if every destination is in use.
+ */
+static struct qla2xip_tx_dest *
+qla2xip_tx_dest_get(struct qla2xip_txq *txq, const uint8_t *addr)
+{
+	struct hlist_head *head = &txq->dest_hash[qla2xip_tx_dest_hash(addr)];
+	struct qla2xip_tx_dest *dest;
+	uint16_t i;
+
+	hlist_for_each_entry(dest, head, node) {
+		if (ether_addr_equal_unaligned(dest->addr, addr))
+			return dest;
+	}
+
+	for (i = 0; i < txq->dests_cnt; i++) {
+		dest = &txq->dests[txq->dests_next];
+		if (++txq->dests_next == txq->dests_cnt)
+			txq->dests_next = 0;
+		if (!qla2xip_tx_dest_idle(txq, dest))
+			continue;
+
+		hlist_del_init(&dest->node);
+		memcpy(dest->addr, addr, ETH_ALEN);
+		dest->deficit = 0;
+		hlist_add_head(&dest->node, head);
+		return dest;
+	}
+
+	return NULL;
+}
+
+/**
+ * qla2xip_tx_hold() - Hold back a packet behind its destination.
+ * @txq: The transmit queue
+ * @dest: The packet's destination
+ * @skb: The packet
+ * @stats: The transmit queue's statistics
+ *
+ * Control packets are held ahead of the destination's other packets.  A
+ * backlog reaching QLA2XIP_TX_DEST_BACKLOG is counted in backlog_full, for
+ * the caller to stop the queue until qla2xip_tx_drain() has sent from it.
+ */
+static void
+qla2xip_tx_hold(struct qla2xip_txq *txq, struct qla2xip_tx_dest *dest,
+    struct sk_buff *skb, struct qla2xip_tx_stats *stats)
+{
+	if (skb->priority == TC_PRIO_CONTROL)
+		__skb_queue_head(&dest->backlog, skb);
+	else
+		__skb_queue_tail(&dest->backlog, skb);
+	QLA2XIP_STATS_INC(stats, held);
+
+	if (skb_queue_len(&dest->backlog) == QLA2XIP_TX_DEST_BACKLOG) {
+		WRITE_ONCE(txq->backlog_full, txq->backlog_full + 1);
+		QLA2XIP_STATS_INC(stats, dest_stopped);
+	}
+
+	if (list_empty(&dest->active)) {
+		list_add_tail(&dest->active, &txq->active);
+		WRITE_ONCE(txq->active_cnt, txq->active_cnt + 1);
+	}
+}
+
+/**
+ * qla2xip_tx_drain() - Send the packets held back on a transmit queue.
+ * @qdev: The device's private structure
+ * @queue: The transmit queue
+ *
+ * Backlogged destinations are served deficit round robin: each visit adds
+ * QLA2XIP_TX_QUANTUM bytes of credit, so destinations share the send_cbs in
+ * proportion to bytes sent.  A destination over its quota of send_cbs is
+ * skipped until its completions arrive.  The packets sent are posted with a
+ * single request queue doorbell.  The segments left of a TSO packet by a full
+ * request ring are posted first.  The queue is woken once they are, no
+ * backlog is full and enough send_cbs are free.
+ *
+ * Note: the caller holds the netdev queue's xmit lock.
+ */
+static void
+qla2xip_tx_drain(struct qla2xip_private *qdev, uint16_t queue)
+{
+	struct qla2xip_txq *txq = &qdev->txq[queue];
+	struct netdev_queue *nq = netdev_get_tx_queue(qdev->dev, queue);
+	struct qla2xip_tx_dest *dest;
+	struct sk_buff *skb;
+	unsigned int len;
+	int i, sent, progress;
+
+	if (txq->tso.owner) {
+		if (qla2xip_tso_post(qdev, queue, false) ==
+		    QL_STATUS_RESOURCE_ERROR) {
+			/* No send completion left to retry from, poll again */
+			if (qla2xip_send_cbs_free(qdev, txq) + 1 >=
+			    qdev->max_send_packets) {
+				set_bit(queue, &qdev->tx_drain_pending);
+				napi_schedule(&qdev->napi);
+			}
+			return;
+		}
+	}
+
+	sent = 0;
+	do {
+		progress = 0;
+		for (i = txq->active_cnt; i > 0; i--) {
+			/* The queue may be stopped by a full backlog */
+			if (txq->tso.owner || !qla2xip_send_cbs_free(qdev, txq))
+				goto out;
+
+			dest = list_first_entry(&txq->active,
+			    struct qla2xip_tx_dest, active);
+			list_move_tail(&dest->active, &txq->active);
+			if (qla2xip_tx_dest_limited(qdev, txq, dest))
+				continue;
+
+			progress = 1;
+			dest->deficit += QLA2XIP_TX_QUANTUM(qdev);
+			while ((skb = skb_peek(&dest->backlog)) &&
+			    skb->len <= dest->deficit &&
+			    !qla2xip_tx_dest_limited(qdev, txq, dest)) {
+				if (skb_queue_len(&dest->backlog) ==
+				    QLA2XIP_TX_DEST_BACKLOG)
+					WRITE_ONCE(txq->backlog_full,
+					    txq->backlog_full - 1);
+				__skb_unlink(skb, &dest->backlog);
+				len = skb->len;
+
+				/* Ring the doorbell once, below */
+				if (qla2xip_send_packet(qdev, skb, queue,
+				    dest - txq->dests, true) != NETDEV_TX_OK) {
+					__skb_queue_head(&dest->backlog, skb);
+					if (skb_queue_len(&dest->backlog) ==
+					    QLA2XIP_TX_DEST_BACKLOG)
+						WRITE_ONCE(txq->backlog_full,
+						    txq->backlog_full + 1);
+					goto out;
+				}
+				dest->deficit -= len;
+				sent++;
+			}
+
+			if (skb_queue_empty(&dest->backlog)) {
+				dest->deficit = 0;
+				list_del_init(&dest->active);
+				WRITE_ONCE(txq->active_cnt,
+				    txq->active_cnt - 1);
+			}
+		}
+	} while (progress && txq->active_cnt);
+
+out:
+	if (sent)
+		qdev->ip_flush_packets_routine(qdev->ha, queue);
+
+	/* Completions do not wake a queue stopped by a full backlog */
+	if (netif_tx_queue_stopped(nq) && !txq->tso.owner &&
+	    !txq->backlog_full &&
+	    qla2xip_send_cbs_free(qdev, txq) >= SEND_CBS_WAKE_MARK(qdev))
+		netif_tx_wake_queue(nq);
+}
+
+/**
+ * qla2xip_tx_drain_pending() - Send held back packets after completions.
+ * @qdev: The device's private structure
+ *
+ * Note: this routine is called from the NAPI poll context.
+ */
+static void
+qla2xip_tx_drain_pending(struct qla2xip_private *qdev)
+{
+	struct netdev_queue *nq;
+	int queue;
+
+	for_each_set_bit(queue, &qdev->tx_drain_pending, QLA_IP_MAX_TX_QUEUES) {
+		if (!test_and_clear_bit(queue, &qdev->tx_drain_pending))
+			continue;
+
+		nq = netdev_get_tx_queue(qdev->dev, queue);
+		__netif_tx_lock(nq, smp_processor_id());
+		qla2xip_tx_drain(qdev, queue);
+		__netif_tx_unlock(nq);
+	}
+}
+
+/**
+ * qla2xip_send() - Transmit a socket buffer over an interface.
+ * @skb: The buffer to transmit
+ * @dev: The device to transmit the buffer on
+ *
+ * While other destinations compete, a destination, one remote port, may
+ * hold at most QLA2XIP_TX_DEST_QUOTA send_cbs of its transmit queue; further
+ * packets to it are held back until its completions return send_cbs.  A slow
+ * or logged out remote port, whose IP commands only complete on firmware
+ * timeout, so cannot take every send_cb from the other destinations.  The
+ * queue is stopped once a destination has QLA2XIP_TX_DEST_BACKLOG packets
+ * held back.  The FC IP command has no class of service or CS_CTL priority
+ * to map packets onto, control packets are instead sent ahead of the other
+ * packets held for their destination.
+ *
+ * Returns NETDEV_TX_OK if the buffer was consumed, else NETDEV_TX_BUSY.
+ */
+static netdev_tx_t
+qla2xip_send(struct sk_buff *skb, struct net_device *dev)
+{
+	struct qla2xip_private *qdev = netdev_priv(dev);
+	uint16_t queue;
+	struct qla2xip_txq *txq;
+	struct qla2xip_tx_dest *dest;
+	netdev_tx_t status;
+	bool xmit_more = netdev_xmit_more();
+
+	queue = skb_get_queue_mapping(skb);
+	if (queue >= qdev->num_tx_queues)
+		queue %= qdev->num_tx_queues;
+	txq = &qdev->txq[queue];
+
+	/* The rest of a TSO packet goes first */
+	if (unlikely(txq->tso.owner)) {
+		qla2xip_tx_drain(qdev, queue);
+		if (txq->tso.owner) {
+			netif_tx_stop_queue(netdev_get_tx_queue(dev, queue));
+			return NETDEV_TX_BUSY;
+		}
+	}
+
+	dest = qla2xip_tx_dest_get(txq, ((struct ethhdr *)skb->data)->h_dest);
+	if (unlikely(!dest)) {
+		/* Every destination holds send_cbs, wait for a completion */
+		QLA2XIP_STATS_INC(&this_cpu_ptr(qdev->stats)->tx[queue], busy);
+		qdev->ip_flush_packets_routine(qdev->ha, queue);
+		if (qla2xip_send_cbs_free(qdev, txq) != qdev->max_send_packets)
+			netif_tx_stop_queue(netdev_get_tx_queue(dev, queue));
+		return NETDEV_TX_BUSY;
+	}
+
+	/* Keep the destination's packets in order behind its backlog */
+	if (!skb_queue_empty(&dest->backlog) ||
+	    qla2xip_tx_dest_limited(qdev, txq, dest)) {
+		qla2xip_tx_hold(txq, dest, skb,
+		    &this_cpu_ptr(qdev->stats)->tx[queue]);
+
+		/* Completions may have freed the quota meanwhile */
+		smp_mb();
+		qla2xip_tx_drain(qdev, queue);
+		if (txq->backlog_full)
+			netif_tx_stop_queue(netdev_get_tx_queue(dev, queue));
+		if (!xmit_more || txq->backlog_full)
+			qdev->ip_flush_packets_routine(qdev->ha, queue);
+		return NETDEV_TX_OK;
+	}
+
+	status = qla2xip_send_packet(qdev, skb, queue, dest - txq->dests,
+	    xmit_more);
+	if (status == NETDEV_TX_OK && txq->active_cnt)
+		qla2xip_tx_drain(qdev, queue);
+	return status;
+}
+
+/**
+ * qla2xip_fold_stats() - Add a per-CPU statistics group to a total.
+ * @sum: The total, a statistics group of the same type
+ * @stats: The per-CPU statistics group
+ * @syncp: The group's u64_stats_sync
+ * @count: Number of counters in the group
+ */
+static void
+qla2xip_fold_stats(void *sum, const void *stats,
+    const struct u64_stats_sync *syncp, unsigned int count)
+{
+	u64 value[QLA2XIP_STATS_MAX];
+	unsigned int start, i;
+
+	do {
+		start = u64_stats_fetch_begin(syncp);
+		memcpy(value, stats, count * sizeof(u64));
+	} while (u64_stats_fetch_retry(syncp, start));
+
+	for (i = 0; i < count; i++)
+		((u64 *)sum)[i] += value[i];
+}
+
+#define QLA2XIP_FOLD_STATS(sum, stats)					\
+	qla2xip_fold_stats(sum, stats, &(stats)->syncp,			\
+	    QLA2XIP_STATS_COUNT(typeof(*(stats))))
+
+/**
+ * qla2xip_sum_stats() - Sum the per-CPU statistics of a device.
+ * @qdev: The device's private structure
+ * @queue: The transmit queue to sum, or -1 for all queues
+ * @rx: Returned receive statistics, may be NULL
+ * @event: Returned SCSI driver event statistics, may be NULL
+ * @tx: Returned send statistics
+ * @comp: Returned send completion statistics
+ */
+static void
+qla2xip_sum_stats(struct qla2xip_private *qdev, int queue,
+    struct qla2xip_rx_stats *rx, struct qla2xip_event_stats *event,
+    struct qla2xip_tx_stats *tx, struct qla2xip_comp_stats *comp)
+{
+	struct qla2xip_pcpu_stats *stats;
+	int cpu, i;
+
+	if (rx)
+		memset(rx, 0, sizeof(struct qla2xip_rx_stats));
+	if (event)
+		memset(event, 0, sizeof(struct qla2xip_event_stats));
+	memset(tx, 0, sizeof(struct qla2xip_tx_stats));
+	memset(comp, 0, sizeof(struct qla2xip_comp_stats));
+
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(qdev->stats, cpu);
+		if (rx)
+			QLA2XIP_FOLD_STATS(rx, &stats->rx);
+		if (event)
+			QLA2XIP_FOLD_STATS(event, &stats->event);
+
+		for (i = 0; i < QLA_IP_MAX_TX_QUEUES; i++) {
+			if (queue >= 0 && i != queue)
+				continue;
+			QLA2XIP_FOLD_STATS(tx, &stats->tx[i]);
+			QLA2XIP_FOLD_STATS(comp, &stats->comp[i]);
+		}
+	}
+}
+
+/**
+ * qla2xip_get_stats64() - Retrieves networking statistics.
+ * @dev: The device to interrogate
+ * @stats: The returned statistics
+ */
+static void
+qla2xip_get_stats64(struct net_device *dev, struct rtnl_link_stats64 *stats)
+{
+	struct qla2xip_private *qdev = netdev_priv(dev);
+	struct qla2xip_rx_stats rx;
+	struct qla2xip_tx_stats tx;
+	struct qla2xip_comp_stats comp;
+
+	qla2xip_sum_stats(qdev, -1, &rx, NULL, &tx, &comp);
+
+	stats->rx_packets = rx.packets;
+	stats->rx_bytes = rx.bytes;
+	stats->rx_length_errors = rx.length_errors;
+	stats->rx_errors = rx.length_errors;
+	stats->rx_dropped = rx.dropped;
+	stats->multicast = rx.multicast;
+
+	stats->tx_packets = comp.packets;
+	stats->tx_bytes = comp.bytes;
+	stats->tx_dropped = tx.dropped;
+	stats->tx_aborted_errors = comp.cs_aborted + tx.errors;
+	stats->tx_carrier_errors = comp.cs_reset + comp.cs_timeout +
+	    comp.cs_port_unavailable + comp.cs_port_logged_out +
+	    comp.cs_port_config_chg;
+	stats->tx_fifo_errors = comp.cs_fw_resource + tx.scb_exhausted +
+	    tx.busy;
+	stats->tx_errors = stats->tx_aborted_errors +
+	    stats->tx_carrier_errors + comp.cs_fw_resource + comp.cs_unknown;
+}
+
+/**
+ * qla2xip_wait_send_idle() - Wait for all outstanding send_cbs to complete.
+ * @qdev: The device's private structure
+ *
+ * The transmit queues must be stopped by the caller.
+ *
+ * Returns 0 if all send_cbs were returned to the free queues.
+ */
+static int
+qla2xip_wait_send_idle(struct qla2xip_private *qdev)
+{
+	int i;
+	unsigned long wait_until = jiffies + 10 * HZ;
+
+	for (i = 0; i < qdev->num_tx_queues; i++) {
+		while (qla2xip_send_cbs_free(qdev, &qdev->txq[i]) !=
+		    qdev->max_send_packets) {
+			if (time_after(jiffies, wait_until))
+				return 1;
+			msleep(10);
+
+			/* NAPI is disabled while the interface is down */
+			if (!netif_running(qdev->dev))
+				qla2xip_xdp_tx_clean(qdev, 0);
+		}
+	}
+	return 0;
+}
+
+/**
+ * qla2xip_reset_tx_queues() - Reset the BQL state of all transmit queues.
+ * @dev: The device to reset
+ */
+static void
+qla2xip_reset_tx_queues(struct net_device *dev)
+{
+	int i;
+
+	for (i = 0; i < dev->num_tx_queues; i++)
+		netdev_tx_reset_queue(netdev_get_tx_queue(dev, i));
+}
+
+/**
+ * qla2xip_set_xps() - Spread the online CPUs over the transmit queues.
+ * @dev: The device to configure
+ *
+ * Each CPU transmits on a fixed queue, and so on a fixed ISP request queue,
+ * keeping the per-queue locks of the SCSI driver uncontended.
+ */
+static void
+qla2xip_set_xps(struct net_device *dev)
+{
+	struct qla2xip_private *qdev = netdev_priv(dev);
+	cpumask_var_t mask;
+	uint16_t queue;
+	int cpu, i;
+
+	if (qdev->num_tx_queues < 2)
+		return;
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+		return;
+
+	for (queue = 0; queue < qdev->num_tx_queues; queue++) {
+		cpumask_clear(mask);
+		i = 0;
+		for_each_online_cpu(cpu) {
+			if (i++ % qdev->num_tx_queues == queue)
+				cpumask_set_cpu(cpu, mask);
+		}
+		netif_set_xps_queue(dev, mask, queue);
+	}
+
+	free_cpumask_var(mask);
+}
+
+/**
+ * qla2xip_enable_ip() - Enable the IP connection with the SCSI driver.
+ * @dev: The device to enable
+ * @enable_data: bd_enable buffer to pass the device parameters in
+ *
+ * The SCSI driver initializes the firmware for IP with the current MTU and
+ * receive buffer geometry, after which all receive buffers are passed to it.
+ *
+ * Returns 1 if the IP connection was successfully enabled.
+ */
+static int
+qla2xip_enable_ip(struct net_device *dev, struct bd_enable *enable_data)
+{
+	struct qla2xip_private *qdev = netdev_priv(dev);
+
+	memset(enable_data, 0, sizeof(struct bd_enable));
+	enable_data->length = BDE_LENGTH;
+	enable_data->version = BDE_VERSION;
+	set_bit(BDE_NOTIFY_ROUTINE, &enable_data->options);
+	enable_data->mtu = qdev->mtu;
+	enable_data->header_size = qla2xip_header_split(qdev);
+	enable_data->max_send_packets = qdev->max_send_packets;
+	enable_data->tx_queues = qdev->dev->num_tx_queues;
+	enable_data->receive_buffers = qdev->receive_buffers;
+	enable_data->rx_ring = qdev->rx_ring;
+	enable_data->max_receive_buffers = qdev->max_receive_buffers +
+	    qdev->rx_small_cnt;
+	enable_data->receive_buff_data_size = qdev->receive_buff_data_size;
+	if (qdev->rx_small_cnt)
+		enable_data->small_buff_data_size = QLA2XIP_SMALL_BUF_SIZE;
+	enable_data->notify_routine = qla2xip_notify;
+	enable_data->notify_context = dev;
+	enable_data->send_completion_routine = qla2xip_send_completion;
+	enable_data->receive_packets_routine = qla2xip_receive_packets;
+	enable_data->receive_packets_context = dev;
+
+	if (!qdev->ip_enable_routine(qdev->ha, enable_data))
+		return 0;
+
+	/* Only use the transmit queues the SCSI driver could set up */
+	qdev->num_tx_queues = min_t(uint16_t, enable_data->tx_queues,
+	    qdev->dev->num_tx_queues);
+	netif_set_real_num_tx_queues(qdev->dev, qdev->num_tx_queues);
+
+	/* Restore interrupt coalescing */
+	if (!qdev->ip_set_coalesce_routine(qdev->ha, &qdev->coal))
+		memset(&qdev->coal, 0, sizeof(struct bd_coalesce));
+
+	/*
+	 * Pass receive buffers to SCSI driver
+	 */
+	qla2xip_add_receive_buffers(qdev);
+
+	return 1;
+}
+
+/**
+ * qla2xip_reinit_ip() - Re-initialize the firmware IP support.
+ * @dev: The device to re-initialize
+ * @enable_data: bd_enable buffer used to re-enable the IP connection
+ *
+ * The IP connection must be quiesced by the caller.  IP support is disabled
+ * in the firmware, the receive buffer pool is rebuilt for the current MTU and
+ * IP support is re-enabled.
+ *
+ * Returns 0 on success.
+ */
+static int
+qla2xip_reinit_ip(struct net_device *dev, struct bd_enable *enable_data)
+{
+	struct qla2xip_private *qdev = netdev_priv(dev);
+
+	/* Firmware must release the current receive buffers first */
+	qdev->ip_disable_routine(qdev->ha);
+	qla2xip_free_rx_buffers(qdev);
+
+	if (qla2xip_alloc_rx_buffers(qdev)) {
+		qla2xip_free_rx_buffers(qdev);
+		return 1;
+	}
+	if (!qla2xip_enable_ip(dev, enable_data))
+		return 1;
+
+	return 0;
+}
+
+/**
+ * qla2xip_reconfigure() - Rebuild the receive path for a new configuration.
+ * @dev: The device to update
+ * @new_mtu: The new MTU value
+ * @prog: The new XDP program, or NULL
  *
- * The routine will double-buffer any linked buffer_cbs if the packet spans
- * multiple sequence buffers.
+ * The firmware's IP MTU and receive buffer geometry are fixed at
+ * initialization, so the transmit and receive paths are quiesced and the
+ * firmware's IP support is re-initialized with a receive buffer pool sized
+ * for @new_mtu and laid out for @prog.  The previous MTU and program are
+ * restored should that fail.
  *
- * Note: this routine is called from an IRQ context.
- * Note: the SCSI driver will serialize calls to this routine, hence a spinlock
- * is not used.
+ * Returns 0 if the configuration was successfully updated.
  */
-static void
-qla2xip_receive_packets(struct net_device *dev, struct buffer_cb *bcb)
+static int
+qla2xip_reconfigure(struct net_device *dev, uint32_t new_mtu,
+    struct bpf_prog *prog)
 {
 	struct qla2xip_private *qdev = netdev_priv(dev);
-	int pkt_len;
-	struct ethhdr *eth;
-	struct sk_buff *skb;
-	struct packet_header *packethdr;
-
-	/* TODO: Interrogate firmware completion status */
+	struct bd_enable *enable_data;
+	struct bpf_prog *old_prog;
+	uint32_t old_mtu;
+	int running;
+	int rval;
 
-	pkt_len = bcb->packet_size -
-	    (sizeof(struct packet_header) - sizeof(struct ethhdr));
+	enable_data = kmalloc(sizeof(struct bd_enable), GFP_KERNEL);
+	if (!enable_data)
+		return -ENOMEM;
 
-	/* Convert Network and SNAP headers into Ethernet header */
-	packethdr = (struct packet_header *)bcb->skb_data;
-	eth = (struct ethhdr *)(bcb->skb_data +
-				(sizeof(struct packet_header) -
-				 sizeof(struct ethhdr)));
+	/* Quiesce the IP path */
+	running = netif_running(dev);
+	netif_tx_disable(dev);
+	if (qla2xip_wait_send_idle(qdev)) {
+		printk(KERN_WARNING
+		       "%s: %s - Timed out waiting for send completions\n",
+		       qla_name, dev->name);
+		rval = -EBUSY;
+		goto done;
+	}
+	if (running)
+		napi_disable(&qdev->napi);
 
-	eth->h_proto = packethdr->snaph.ethertype;
-	memcpy(eth->h_source, packethdr->networkh.s.na.addr, ETH_ALEN);
-	memcpy(eth->h_dest, packethdr->networkh.d.na.addr, ETH_ALEN);
+	old_mtu = qdev->mtu;
+	old_prog = qdev->xdp_prog;
+	qdev->mtu = new_mtu;
+	WRITE_ONCE(qdev->xdp_prog, prog);
 
-	if (bcb->linked_bcb_cnt == 1) {
-		/*
-		 * Packet is in single receive buffer, no need to double buffer
-		 */
-		skb = bcb->skb;
-		pci_unmap_single(qdev->pdev,
-				 bcb->skb_data_dma, skb->len,
-				 PCI_DMA_FROMDEVICE);
-		skb->dev = dev;
-
-		/* Adjust buffer pointer and length */
-		skb_reserve(skb, sizeof(struct packet_header) -
-			    sizeof(struct ethhdr));
-		skb_put(skb, pkt_len);
-		skb->protocol = eth_type_trans(skb, dev);
-
-		/* Indicate receive packet */
-		netif_rx(skb);
-		dev->last_rx = jiffies;
-
-		qdev->stats.rx_packets++;
-		qdev->stats.rx_bytes += bcb->packet_size;
-
-		/* Preallocate replacement receive buffer */
-		skb = dev_alloc_skb(qdev->receive_buff_data_size);
-		if (skb) {
-			bcb->skb = skb;
-			bcb->skb_data = skb->data;
-			bcb->skb_data_dma = pci_map_single(qdev->pdev,
-							   skb->data, skb->len,
-							   PCI_DMA_FROMDEVICE);
-
-			/* Add receive buffer to receive buffer queue */
-			qdev->receive_q_in->handle = bcb->handle;
-			qdev->receive_q_in->data_addr_low =
-			    LSD(bcb->skb_data_dma);
-			qdev->receive_q_in->data_addr_high =
-			    MSD(bcb->skb_data_dma);
-			qdev->receive_q_in++;
-			if (qdev->receive_q_in == qdev->receive_q_end)
-				qdev->receive_q_in = qdev->receive_q;
-			qdev->receive_q_add_cnt++;
-		} else {
+	rval = 0;
+	if (qla2xip_reinit_ip(dev, enable_data)) {
+		printk(KERN_WARNING
+		       "%s: %s - Unable to re-initialize IP for MTU %d, "
+		       "restoring MTU %d\n",
+		       qla_name, dev->name, new_mtu, old_mtu);
+		rval = -ENOMEM;
+
+		qdev->mtu = old_mtu;
+		WRITE_ONCE(qdev->xdp_prog, old_prog);
+		if (qla2xip_reinit_ip(dev, enable_data)) {
 			printk(KERN_ERR
-			       "%s: %s - Failed to allocate buffer_cb skb, "
-			       "buffer pool has been reduced!\n",
-			       qla_name, dev->name);
-			bcb->skb = NULL;
+			       "%s: %s - Unable to re-initialize IP, "
+			       "interface disabled\n", qla_name, dev->name);
+			netif_carrier_off(dev);
+			rval = -EIO;
 		}
-	} else {
-		int i;
-		int buffer_len;
-		struct buffer_cb *nbcb;
+	}
+	dev->mtu = qdev->mtu;
+	if (qdev->xdp_prog != old_prog && old_prog)
+		bpf_prog_put(old_prog);
+
+	if (running)
+		napi_enable(&qdev->napi);
+done:
+	qla2xip_reset_tx_queues(dev);
+	if (running && rval != -EIO)
+		netif_tx_wake_all_queues(dev);
+	kfree(enable_data);
+	return rval;
+}
 
-		/*
-		 * Incoming packet was broken into multiple receive buffers.
-		 * This is probably due to a MTU mismatch between systems.
-		 * Must double buffer packet into single buffer for Linux
-		 */
-		skb = dev_alloc_skb(pkt_len + 2);
-		if (skb) {
-			skb->dev = dev;
-			skb_reserve(skb, 2);
-
-			/* Move 1st buffer with ethernet header */
-			buffer_len = bcb->rec_data_size -
-			    (sizeof(struct packet_header) -
-			     sizeof(struct ethhdr));
-			memcpy(skb_put(skb, buffer_len), eth, buffer_len);
-
-			/* Move rest of receive buffers */
-			nbcb = bcb;
-			for (i = 1; i < bcb->linked_bcb_cnt; i++) {
-				nbcb = nbcb->next_bcb;
-				buffer_len = nbcb->rec_data_size;
-				memcpy(skb_put(skb, buffer_len),
-				       nbcb->skb_data, buffer_len);
-			}
+/**
+ * qla2xip_change_mtu() - Set the MTU of a device.
+ * @dev: The device to update
+ * @new_mtu: The new MTU value
+ *
+ * Returns 0 if the MTU was successfully updated.
+ */
+static int
+qla2xip_change_mtu(struct net_device *dev, int new_mtu)
+{
+	struct qla2xip_private *qdev = netdev_priv(dev);
 
-			skb->protocol = eth_type_trans(skb, dev);
+	if ((new_mtu > MAX_MTU_SIZE) || (new_mtu < MIN_MTU_SIZE))
+		return -EINVAL;
+	if (new_mtu == qdev->mtu)
+		return 0;
+	if (qdev->xdp_prog && new_mtu > QLA2XIP_XDP_MAX_MTU) {
+		netdev_err(dev, "MTU %d too large for XDP, max %lu\n", new_mtu,
+		    (unsigned long)QLA2XIP_XDP_MAX_MTU);
+		return -EINVAL;
+	}
 
-			/* Indicate receive packet */
-			netif_rx(skb);
-			dev->last_rx = jiffies;
+	return qla2xip_reconfigure(dev, new_mtu, qdev->xdp_prog);
+}
 
-			qdev->stats.rx_packets++;
-			qdev->stats.rx_bytes += bcb->packet_size;
-		} else {
-			/* Failed to allocate buffer, drop packet */
-			printk(KERN_ERR
-			       "%s: %s - Failed to allocate buffer_cb skb, "
-			       "packet dropped, buffer pool has been "
-			       "reduced!\n", qla_name, dev->name);
-			qdev->stats.rx_dropped++;
-		}
+/**
+ * qla2xip_xdp_setup() - Attach or detach an XDP program.
+ * @dev: The device to update
+ * @prog: The new XDP program, or NULL to detach
+ * @extack: Netlink extended ack for error reporting
+ *
+ * Attaching the first or detaching the last program changes the receive
+ * buffer geometry, see qla2xip_header_split(), and so re-initializes the
+ * firmware's IP support.  A program is replaced in place.  XDP needs each
+ * frame in a single order-0 page, a program is refused while the MTU is
+ * larger than QLA2XIP_XDP_MAX_MTU.
+ *
+ * Returns 0 if the program was successfully set.
+ */
+static int
+qla2xip_xdp_setup(struct net_device *dev, struct bpf_prog *prog,
+    struct netlink_ext_ack *extack)
+{
+	struct qla2xip_private *qdev = netdev_priv(dev);
+	struct bpf_prog *old_prog;
 
-		/* Return buffers to receive buffer queue */
-		nbcb = bcb;
-		for (i = 0; i < bcb->linked_bcb_cnt;
-		    i++, nbcb = nbcb->next_bcb) {
-			qdev->receive_q_in->handle = nbcb->handle;
-			qdev->receive_q_in->data_addr_low =
-			    LSD(nbcb->skb_data_dma);
-			qdev->receive_q_in->data_addr_high =
-			    MSD(nbcb->skb_data_dma);
-			qdev->receive_q_in++;
-			if (qdev->receive_q_in == qdev->receive_q_end)
-				qdev->receive_q_in = qdev->receive_q;
-		}
-		qdev->receive_q_add_cnt += bcb->linked_bcb_cnt;
+	if (prog && qdev->mtu > QLA2XIP_XDP_MAX_MTU) {
+		NL_SET_ERR_MSG_MOD(extack, "MTU too large for XDP");
+		return -EINVAL;
 	}
 
-	/* Update (RISC) free buffer count */
-	qdev->receive_q_cnt -= bcb->linked_bcb_cnt;
+	/* IP support is already disabled while the device is unregistered */
+	if (!!prog == !!qdev->xdp_prog || dev->reg_state != NETREG_REGISTERED) {
+		old_prog = xchg(&qdev->xdp_prog, prog);
+		if (old_prog)
+			bpf_prog_put(old_prog);
+		return 0;
+	}
 
-	/* Pass receive buffers to SCSI driver */
-	if (qdev->receive_q_add_cnt >= RECEIVE_BUFFERS_ADD_MARK ||
-	    qdev->receive_q_cnt <= RECEIVE_BUFFERS_LOW_MARK) {
-		qdev->ip_add_buffers_routine(qdev->ha,
-					     qdev->receive_q_add_cnt, 1);
+	return qla2xip_reconfigure(dev, qdev->mtu, prog);
+}
 
-		qdev->receive_q_cnt += qdev->receive_q_add_cnt;
-		qdev->receive_q_add_cnt = 0;
+/**
+ * qla2xip_bpf() - BPF control routine.
+ * @dev: The device
+ * @bpf: The BPF command
+ *
+ * Returns 0 on success.
+ */
+static int
+qla2xip_bpf(struct net_device *dev, struct netdev_bpf *bpf)
+{
+	switch (bpf->command) {
+	case XDP_SETUP_PROG:
+		return qla2xip_xdp_setup(dev, bpf->prog, bpf->extack);
+	default:
+		return -EINVAL;
 	}
 }
 
 /**
- * qla2xip_open() - Prepares a networking interface for use.
- * @dev: The device to open
+ * qla2xip_set_multicast_list() - Update the multicast filter.
+ * @dev: The device to update
  *
- * Returns 0.
+ * Rebuilds the hashed filter from the device's multicast list; promiscuous
+ * and all-multicast modes accept every group.  The receive path reads the
+ * filter locklessly, a packet racing an update may be filtered either way.
  */
-static int
-qla2xip_open(struct net_device *dev)
+static void
+qla2xip_set_multicast_list(struct net_device *dev)
 {
-	netif_start_queue(dev);
-	return 0;
+	int i;
+	struct qla2xip_private *qdev = netdev_priv(dev);
+	struct netdev_hw_addr *ha;
+	DECLARE_BITMAP(filter, QLA2XIP_MC_FILTER_SIZE);
+
+	bitmap_zero(filter, QLA2XIP_MC_FILTER_SIZE);
+	netdev_for_each_mc_addr(ha, dev)
+		__set_bit(qla2xip_mc_hash(ha->addr), filter);
+
+	for (i = 0; i < BITS_TO_LONGS(QLA2XIP_MC_FILTER_SIZE); i++)
+		WRITE_ONCE(qdev->mc_filter[i], filter[i]);
+	WRITE_ONCE(qdev->mc_all, !!(dev->flags & (IFF_PROMISC | IFF_ALLMULTI)));
 }
 
 /**
- * qla2xip_close() - Shutdown a networking interface.
- * @dev: The device to shutdown
+ * qla2xip_set_mac_address() - Set the MAC address of a device.
+ * @dev: The device to update
+ * @p: The new MAC address
  *
- * Returns 0.
+ * Returns 0 if the MAC address was successfully updated.
  */
 static int
-qla2xip_close(struct net_device *dev)
+qla2xip_set_mac_address(struct net_device *dev, void *p)
 {
-	netif_stop_queue(dev);
+	/* TODO: complete interface */
 	return 0;
 }
 
 /**
- * qla2xip_send() - Transmit a socket buffer over an interface.
- * @skb: The buffer to transmit
- * @dev: The device to transmit the buffer on
- *
- * Returns 0 if the buffer was sent, else 1.
+ * qla2xip_tx_timeout() - Transmission timeout handler.
+ * @dev: The device that timed-out
+ * @txqueue: The transmit queue that timed-out
  */
-static int
-qla2xip_send(struct sk_buff *skb, struct net_device *dev)
+static void
+qla2xip_tx_timeout(struct net_device *dev, unsigned int txqueue)
 {
 	struct qla2xip_private *qdev = netdev_priv(dev);
 	int status;
-	struct ethhdr *eth;
-	struct send_cb *scb;
-	struct packet_header *packethdr;
 
-	/* Get next available send control block */
-	scb = qla2xip_get_send_cb(qdev);
-	if (scb) {
-		/* Finish building Network and SNAP headers */
-		eth = (struct ethhdr *)skb->data;
-		packethdr = scb->header;
-
-		packethdr->networkh.d.na.naa = NAA_IEEE_MAC_TYPE;
-		packethdr->networkh.d.na.unused = 0;
-		memcpy(packethdr->networkh.d.na.addr, eth->h_dest, ETH_ALEN);
-		packethdr->snaph.ethertype = eth->h_proto;
-
-		/* Skip over ethernet header */
-		skb_pull(skb, sizeof(struct ethhdr));
-
-		/* Pass send packet to SCSI driver */
-		dev->trans_start = jiffies;
-		scb->skb = skb;
-		status = qdev->ip_send_packet_routine(qdev->ha, scb);
-		if (status == QL_STATUS_SUCCESS) {
-			/* Packet successfully sent to ISP */
-			/* Move up */
-			/*dev->trans_start = jiffies; */
-			return 0;
-		} else if (status == QL_STATUS_RESOURCE_ERROR) {
-			/* ISP too busy now, try later */
-			printk(KERN_WARNING
-			       "%s: %s - Unable to send packet -- Resource "
-			       "error...Try again.\n", qla_name, dev->name);
-			/* Free send control block */
-			qla2xip_free_send_cb(scb);
-			qdev->stats.tx_errors++;
-			qdev->stats.tx_fifo_errors++;
-			netif_stop_queue(dev);
-			return 1;
-		} else {
-			/* Error, don't send packet */
-			printk(KERN_ERR
-			       "%s: %s - Unable to send packet -- Bad error "
-			       "occured!!!\n", qla_name, dev->name);
-			/* Free send control block */
-			qla2xip_free_send_cb(scb);
-			dev_kfree_skb(skb);
-			qdev->stats.tx_errors++;
-			qdev->stats.tx_aborted_errors++;
-			return 0;
-		}
-	} else {
-		/* Out of send control blocks, pause queueing of packets */
-		printk(KERN_WARNING
-		       "%s: %s - Unable to send packet -- Out of send "
-		       "control blocks!!!\n", qla_name, dev->name);
-		qdev->stats.tx_errors++;
-		qdev->stats.tx_fifo_errors++;
-		netif_stop_queue(dev);
-		return 1;
-	}
+	printk(KERN_ERR
+	       "%s: %s - Transmission timed out, cable problem?\n",
+	       qla_name, dev->name);
+	printk(KERN_DEBUG
+	       "%s: %s - Transmission timed out, cable problem?\n",
+	       qla_name, dev->name);
+
+	/* Call SCSI driver to perform any internal cleanup */
+	status = qdev->ip_tx_timeout_routine(qdev->ha);
+
+	atomic_long_inc(&qdev->tx_timeouts);
+	netif_trans_update(dev);
+	netif_tx_wake_all_queues(dev);
 }
 
 /**
- * qla2xip_get_stats() - Retrieves networking statistics.
+ * qla2xip_get_drvinfo() - ethtool driver information.
  * @dev: The device to interrogate
- *
- * Returns a pointer to the net_device_stats structure of the @dev.
+ * @info: The returned driver information
  */
-static struct net_device_stats *
-qla2xip_get_stats(struct net_device *dev)
+static void
+qla2xip_get_drvinfo(struct net_device *dev, struct ethtool_drvinfo *info)
 {
 	struct qla2xip_private *qdev = netdev_priv(dev);
 
-	return &qdev->stats;
+	strscpy(info->driver, qla_name, sizeof(info->driver));
+	strscpy(info->version, qla_version, sizeof(info->version));
+	strscpy(info->bus_info, pci_name(qdev->pdev), sizeof(info->bus_info));
 }
 
 /**
- * qla2xip_change_mtu() - Set the MTU of a device.
+ * qla2xip_get_ringparam() - ethtool ring sizes.
+ * @dev: The device to interrogate
+ * @ring: The returned ring parameters
+ * @kring: The returned extended ring parameters
+ * @extack: Netlink extended ACK
+ */
+static void
+qla2xip_get_ringparam(struct net_device *dev, struct ethtool_ringparam *ring,
+    struct kernel_ethtool_ringparam *kring, struct netlink_ext_ack *extack)
+{
+	struct qla2xip_private *qdev = netdev_priv(dev);
+
+	ring->rx_max_pending = MAX_RECEIVE_BUFFERS;
+	if (test_bit(BDI_RX_POOLS, &qdev->options))
+		ring->rx_mini_max_pending = MAX_RECEIVE_BUFFERS;
+	ring->tx_max_pending = MAX_SEND_PACKETS;
+	ring->rx_pending = qdev->max_receive_buffers;
+	ring->rx_mini_pending = qdev->rx_small_cnt;
+	ring->tx_pending = qdev->max_send_packets;
+}
+
+/**
+ * qla2xip_set_ringparam() - ethtool ring resize.
  * @dev: The device to update
- * @new_mtu: The new MTU value
+ * @ring: The requested ring parameters
+ * @kring: The requested extended ring parameters
+ * @extack: Netlink extended ACK
  *
- * Returns 0 if the MTU was successfully updated.
+ * Only the transmit ring (number of outstanding send_cbs per queue) may be
+ * resized.  The new send_cb rings are allocated first; the transmit queues
+ * are then quiesced while the SCSI driver's handle tables are resized and
+ * the rings swapped.  On failure the old rings stay in service.
+ *
+ * Returns 0 if the ring was successfully resized.
  */
 static int
-qla2xip_change_mtu(struct net_device *dev, int new_mtu)
+qla2xip_set_ringparam(struct net_device *dev, struct ethtool_ringparam *ring,
+    struct kernel_ethtool_ringparam *kring, struct netlink_ext_ack *extack)
 {
-	if ((new_mtu > MAX_MTU_SIZE) || (new_mtu < MIN_MTU_SIZE))
+	struct qla2xip_private *qdev = netdev_priv(dev);
+	struct qla2xip_txq *new;
+	struct netdev_queue *nq;
+	uint16_t new_count, free_count;
+	int i, rval;
+
+	if (ring->rx_mini_pending != qdev->rx_small_cnt ||
+	    ring->rx_jumbo_pending ||
+	    ring->rx_pending != qdev->max_receive_buffers)
 		return -EINVAL;
+	if (ring->tx_pending < MIN_SEND_PACKETS ||
+	    ring->tx_pending > MAX_SEND_PACKETS)
+		return -EINVAL;
+	if (ring->tx_pending == qdev->max_send_packets)
+		return 0;
+
+	new_count = free_count = ring->tx_pending;
+	new = kcalloc(dev->num_tx_queues, sizeof(struct qla2xip_txq),
+	    GFP_KERNEL);
+	if (!new)
+		return -ENOMEM;
+	for (i = 0; i < dev->num_tx_queues; i++) {
+		if (qla2xip_alloc_txq(qdev, &new[i], i, new_count)) {
+			printk(KERN_ERR
+			       "%s: %s - Failed to allocate %d send_cbs\n",
+			       qla_name, dev->name, new_count);
+			rval = -ENOMEM;
+			goto free_new;
+		}
+	}
+
+	netif_tx_disable(dev);
+	if (qla2xip_wait_send_idle(qdev)) {
+		printk(KERN_WARNING
+		       "%s: %s - Timed out waiting for send completions\n",
+		       qla_name, dev->name);
+		rval = -EBUSY;
+		goto done;
+	}
+	if (!qdev->ip_set_send_packets_routine(qdev->ha, new_count)) {
+		rval = -EBUSY;
+		goto done;
+	}
 
-	return -EOPNOTSUPP;
+	for (i = 0; i < dev->num_tx_queues; i++) {
+		nq = netdev_get_tx_queue(dev, i);
+		__netif_tx_lock_bh(nq);
+		qla2xip_swap_txq(&qdev->txq[i], &new[i]);
+		__netif_tx_unlock_bh(nq);
+	}
+	free_count = qdev->max_send_packets;
+	qdev->max_send_packets = new_count;
+	dev->tx_queue_len = new_count;
+	rval = 0;
+done:
+	qla2xip_reset_tx_queues(dev);
+	if (netif_running(dev))
+		netif_tx_wake_all_queues(dev);
+free_new:
+	while (i--)
+		qla2xip_free_txq(qdev, &new[i], free_count);
+	kfree(new);
+	return rval;
 }
 
 /**
- * qla2xip_set_multicast_list() - Add a device to a multicast group.
- * @dev: The device to add
+ * qla2xip_get_coalesce() - ethtool interrupt coalescing parameters.
+ * @dev: The device to interrogate
+ * @ec: The returned coalescing parameters
+ * @kec: The returned extended coalescing parameters
+ * @extack: Netlink extended ACK
+ *
+ * Returns 0.
  */
-static void
-qla2xip_set_multicast_list(struct net_device *dev)
+static int
+qla2xip_get_coalesce(struct net_device *dev, struct ethtool_coalesce *ec,
+    struct kernel_ethtool_coalesce *kec, struct netlink_ext_ack *extack)
 {
-	/* TODO: complete interface */
-	return;
+	struct qla2xip_private *qdev = netdev_priv(dev);
+
+	ec->tx_coalesce_usecs = qdev->coal.tx_usecs;
+	ec->tx_max_coalesced_frames = qdev->coal.tx_frames;
+	ec->use_adaptive_tx_coalesce =
+	    test_bit(BDC_ADAPTIVE_TX, &qdev->coal.options);
+
+	return 0;
 }
 
 /**
- * qla2xip_ethtool_ioctl() - Interface for ethtool IOCTLs.
- * @dev: The device to interrogate
- * @useraddr: The user-space IOCTL data
+ * qla2xip_set_coalesce() - ethtool interrupt coalescing update.
+ * @dev: The device to update
+ * @ec: The requested coalescing parameters
+ * @kec: The requested extended coalescing parameters
+ * @extack: Netlink extended ACK
  *
- * Interface example from drivers/net/3c59x.c.
+ * tx-usecs holds off the send completion interrupts (with adaptive-tx, it
+ * bounds a hold-off that follows the packet rate), and tx-frames sets how
+ * many frames an interrupt must service before it is held off.  The SCSI
+ * driver moderates the MSI-X vectors of its IP transmit queue pairs; without
+ * them coalescing is not supported.  Receive interrupts share their vector
+ * with SCSI I/O completions and are never held off.
  *
- * Returns 0 if the ethtool IOCTL succeeded.
+ * Returns 0 if the parameters were applied.
  */
 static int
-qla2xip_ethtool_ioctl(struct net_device *dev, void *useraddr)
+qla2xip_set_coalesce(struct net_device *dev, struct ethtool_coalesce *ec,
+    struct kernel_ethtool_coalesce *kec, struct netlink_ext_ack *extack)
 {
 	struct qla2xip_private *qdev = netdev_priv(dev);
-	u32 ethcmd;
-	struct ethtool_drvinfo info = { ETHTOOL_GDRVINFO };
-
-	if (copy_from_user(&ethcmd, useraddr, sizeof(ethcmd)))
-		return -EFAULT;
-
-	switch (ethcmd) {
-	case ETHTOOL_GDRVINFO:
-		strcpy(info.driver, qla_name);
-		strcpy(info.version, qla_version);
-		strcpy(info.bus_info, pci_name(qdev->pdev));
-		if (copy_to_user(useraddr, &info, sizeof(info)))
-			return -EFAULT;
-		return 0;
-	}
-	return -EOPNOTSUPP;
+	struct bd_coalesce coal;
+
+	if (ec->tx_coalesce_usecs > MAX_COALESCE_USECS ||
+	    ec->tx_max_coalesced_frames > qdev->max_send_packets)
+		return -EINVAL;
+
+	memset(&coal, 0, sizeof(struct bd_coalesce));
+	coal.tx_usecs = ec->tx_coalesce_usecs;
+	coal.tx_frames = ec->tx_max_coalesced_frames;
+	if (ec->use_adaptive_tx_coalesce)
+		set_bit(BDC_ADAPTIVE_TX, &coal.options);
+
+	if (!qdev->ip_set_coalesce_routine(qdev->ha, &coal))
+		return -EOPNOTSUPP;
+	qdev->coal = coal;
+
+	return 0;
 }
 
 /**
- * qla2xip_do_ioctl() - Interface for private networking IOCTLs.
+ * qla2xip_get_link_ksettings() - ethtool link settings.
  * @dev: The device to interrogate
- * @useraddr: The IOCTL interface request
+ * @cmd: The returned link settings
  *
- * Note: currently only a small subset of ethtool support IOCTLs are
- * implemented.
+ * The link speed is the FC port speed reported by the SCSI driver.
  *
- * Returns 0 if the IOCTL succeeded.
+ * Returns 0.
  */
 static int
-qla2xip_do_ioctl(struct net_device *dev, struct ifreq *rq, int cmd)
+qla2xip_get_link_ksettings(struct net_device *dev,
+    struct ethtool_link_ksettings *cmd)
 {
 	struct qla2xip_private *qdev = netdev_priv(dev);
-	int retval;
 
-	/* TODO: Complete interface */
-	qdev = qdev;
-	switch (cmd) {
-	case SIOCETHTOOL:
-		retval = qla2xip_ethtool_ioctl(dev, (void *)rq->ifr_data);
-		break;
+	ethtool_link_ksettings_zero_link_mode(cmd, supported);
+	ethtool_link_ksettings_add_link_mode(cmd, supported, FIBRE);
+	ethtool_link_ksettings_zero_link_mode(cmd, advertising);
+	ethtool_link_ksettings_add_link_mode(cmd, advertising, FIBRE);
 
-	default:
-		retval = -EOPNOTSUPP;
+	cmd->base.port = PORT_FIBRE;
+	cmd->base.autoneg = AUTONEG_DISABLE;
+	cmd->base.speed = SPEED_UNKNOWN;
+	cmd->base.duplex = DUPLEX_UNKNOWN;
+	if (!netif_carrier_ok(dev))
+		return 0;
+
+	switch (qdev->link_speed) {
+	case BDI_1GBIT_PORTSPEED:
+		cmd->base.speed = SPEED_1000;
+		break;
+	case BDI_2GBIT_PORTSPEED:
+		cmd->base.speed = 2000;
+		break;
+	case BDI_4GBIT_PORTSPEED:
+		cmd->base.speed = 4000;
+		break;
+	case BDI_8GBIT_PORTSPEED:
+		cmd->base.speed = 8000;
+		break;
+	case BDI_10GBIT_PORTSPEED:
+		cmd->base.speed = SPEED_10000;
 		break;
 	}
-	return retval;
+	cmd->base.duplex = DUPLEX_FULL;
+
+	return 0;
 }
 
+/* ethtool statistics, see struct qla2xip_pcpu_stats */
+struct qla2xip_stat {
+	char name[ETH_GSTRING_LEN];
+	unsigned int offset;
+};
+
+#define QLA2XIP_STAT(name, type, member) { name, offsetof(type, member) }
+
+static const struct qla2xip_stat qla2xip_rx_stat_table[] = {
+	QLA2XIP_STAT("rx_packets", struct qla2xip_rx_stats, packets),
+	QLA2XIP_STAT("rx_bytes", struct qla2xip_rx_stats, bytes),
+	QLA2XIP_STAT("rx_length_errors", struct qla2xip_rx_stats,
+	    length_errors),
+	QLA2XIP_STAT("rx_dropped", struct qla2xip_rx_stats, dropped),
+	QLA2XIP_STAT("rx_multi_buffer", struct qla2xip_rx_stats,
+	    multi_buffer),
+	QLA2XIP_STAT("rx_small_buffer", struct qla2xip_rx_stats,
+	    small_buffer),
+	QLA2XIP_STAT("rx_multicast", struct qla2xip_rx_stats, multicast),
+	QLA2XIP_STAT("rx_mc_filtered", struct qla2xip_rx_stats,
+	    mc_filtered),
+	QLA2XIP_STAT("rx_lro_aggregated", struct qla2xip_rx_stats,
+	    lro_aggregated),
+	QLA2XIP_STAT("rx_lro_merged", struct qla2xip_rx_stats, lro_merged),
+	QLA2XIP_STAT("rx_xdp_drop", struct qla2xip_rx_stats, xdp_drop),
+	QLA2XIP_STAT("rx_xdp_tx", struct qla2xip_rx_stats, xdp_tx),
+	QLA2XIP_STAT("rx_xdp_redirect", struct qla2xip_rx_stats, xdp_redirect),
+	QLA2XIP_STAT("rx_xdp_errors", struct qla2xip_rx_stats, xdp_errors),
+};
+
+static const struct qla2xip_stat qla2xip_event_stat_table[] = {
+	QLA2XIP_STAT("rx_buffers_low", struct qla2xip_event_stats,
+	    rcv_buffers_low),
+	QLA2XIP_STAT("rx_out_of_buffers", struct qla2xip_event_stats,
+	    out_of_buffers),
+};
+
+static const struct qla2xip_stat qla2xip_tx_stat_table[] = {
+	QLA2XIP_STAT("dropped", struct qla2xip_tx_stats, dropped),
+	QLA2XIP_STAT("send_cb_exhausted", struct qla2xip_tx_stats,
+	    scb_exhausted),
+	QLA2XIP_STAT("busy", struct qla2xip_tx_stats, busy),
+	QLA2XIP_STAT("errors", struct qla2xip_tx_stats, errors),
+	QLA2XIP_STAT("stopped", struct qla2xip_tx_stats, stopped),
+	QLA2XIP_STAT("tso", struct qla2xip_tx_stats, tso),
+	QLA2XIP_STAT("held", struct qla2xip_tx_stats, held),
+	QLA2XIP_STAT("dest_stopped", struct qla2xip_tx_stats, dest_stopped),
+};
+
+static const struct qla2xip_stat qla2xip_comp_stat_table[] = {
+	QLA2XIP_STAT("packets", struct qla2xip_comp_stats, packets),
+	QLA2XIP_STAT("bytes", struct qla2xip_comp_stats, bytes),
+	QLA2XIP_STAT("arp_converted", struct qla2xip_comp_stats,
+	    arp_converted),
+	QLA2XIP_STAT("cs_aborted", struct qla2xip_comp_stats, cs_aborted),
+	QLA2XIP_STAT("cs_reset", struct qla2xip_comp_stats, cs_reset),
+	QLA2XIP_STAT("cs_timeout", struct qla2xip_comp_stats, cs_timeout),
+	QLA2XIP_STAT("cs_port_unavailable", struct qla2xip_comp_stats,
+	    cs_port_unavailable),
+	QLA2XIP_STAT("cs_port_logged_out", struct qla2xip_comp_stats,
+	    cs_port_logged_out),
+	QLA2XIP_STAT("cs_port_config_chg", struct qla2xip_comp_stats,
+	    cs_port_config_chg),
+	QLA2XIP_STAT("cs_fw_resource", struct qla2xip_comp_stats,
+	    cs_fw_resource),
+	QLA2XIP_STAT("cs_unknown", struct qla2xip_comp_stats, cs_unknown),
+};
+
+#define QLA2XIP_GLOBAL_STATS	(ARRAY_SIZE(qla2xip_rx_stat_table) + \
+				 ARRAY_SIZE(qla2xip_event_stat_table) + 1)
+#define QLA2XIP_QUEUE_STATS	(ARRAY_SIZE(qla2xip_tx_stat_table) + \
+				 ARRAY_SIZE(qla2xip_comp_stat_table))
+
 /**
- * qla2xip_set_mac_address() - Set the MAC address of a device.
- * @dev: The device to update
- * @p: The new MAC address
+ * qla2xip_get_sset_count() - ethtool string set sizes.
+ * @dev: The device to interrogate
+ * @sset: The string set
  *
- * Returns 0 if the MAC address was successfully updated.
+ * Returns the number of statistics, per transmit queue counters included.
  */
 static int
-qla2xip_set_mac_address(struct net_device *dev, void *p)
+qla2xip_get_sset_count(struct net_device *dev, int sset)
 {
-	/* TODO: complete interface */
-	return 0;
+	struct qla2xip_private *qdev = netdev_priv(dev);
+
+	switch (sset) {
+	case ETH_SS_STATS:
+		return QLA2XIP_GLOBAL_STATS +
+		    qdev->num_tx_queues * QLA2XIP_QUEUE_STATS;
+	default:
+		return -EOPNOTSUPP;
+	}
 }
 
 /**
- * qla2xip_tx_timeout() - Transmission timeout handler.
- * @dev: The device that timed-out
+ * qla2xip_get_strings() - ethtool statistics names.
+ * @dev: The device to interrogate
+ * @sset: The string set
+ * @data: The returned names
  */
 static void
-qla2xip_tx_timeout(struct net_device *dev)
+qla2xip_get_strings(struct net_device *dev, u32 sset, u8 *data)
 {
 	struct qla2xip_private *qdev = netdev_priv(dev);
-	int status;
+	int i, queue;
 
-	printk(KERN_ERR
-	       "%s: %s - Transmission timed out, cable problem?\n",
-	       qla_name, dev->name);
-	printk(KERN_DEBUG
-	       "%s: %s - Transmission timed out, cable problem?\n",
-	       qla_name, dev->name);
+	if (sset != ETH_SS_STATS)
+		return;
 
-	/* Call SCSI driver to perform any internal cleanup */
-	status = qdev->ip_tx_timeout_routine(qdev->ha);
+	for (i = 0; i < ARRAY_SIZE(qla2xip_rx_stat_table); i++) {
+		strscpy(data, qla2xip_rx_stat_table[i].name, ETH_GSTRING_LEN);
+		data += ETH_GSTRING_LEN;
+	}
+	for (i = 0; i < ARRAY_SIZE(qla2xip_event_stat_table); i++) {
+		strscpy(data, qla2xip_event_stat_table[i].name,
+		    ETH_GSTRING_LEN);
+		data += ETH_GSTRING_LEN;
+	}
+	strscpy(data, "tx_timeouts", ETH_GSTRING_LEN);
+	data += ETH_GSTRING_LEN;
+
+	for (queue = 0; queue < qdev->num_tx_queues; queue++) {
+		for (i = 0; i < ARRAY_SIZE(qla2xip_tx_stat_table); i++) {
+			snprintf(data, ETH_GSTRING_LEN, "tx%d_%s", queue,
+			    qla2xip_tx_stat_table[i].name);
+			data += ETH_GSTRING_LEN;
+		}
+		for (i = 0; i < ARRAY_SIZE(qla2xip_comp_stat_table); i++) {
+			snprintf(data, ETH_GSTRING_LEN, "tx%d_%s", queue,
+			    qla2xip_comp_stat_table[i].name);
+			data += ETH_GSTRING_LEN;
+		}
+	}
+}
 
-	qdev->stats.rx_dropped++;
-	dev->trans_start = jiffies;
-	netif_wake_queue(dev);
+/**
+ * qla2xip_get_ethtool_stats() - ethtool statistics.
+ * @dev: The device to interrogate
+ * @estats: Unused
+ * @data: The returned statistics, in qla2xip_get_strings() order
+ */
+static void
+qla2xip_get_ethtool_stats(struct net_device *dev,
+    struct ethtool_stats *estats, u64 *data)
+{
+	struct qla2xip_private *qdev = netdev_priv(dev);
+	struct qla2xip_rx_stats rx;
+	struct qla2xip_event_stats event;
+	struct qla2xip_tx_stats tx;
+	struct qla2xip_comp_stats comp;
+	int i, queue;
+
+	qla2xip_sum_stats(qdev, 0, &rx, &event, &tx, &comp);
+
+	for (i = 0; i < ARRAY_SIZE(qla2xip_rx_stat_table); i++)
+		*data++ = *(u64 *)((char *)&rx +
+		    qla2xip_rx_stat_table[i].offset);
+	for (i = 0; i < ARRAY_SIZE(qla2xip_event_stat_table); i++)
+		*data++ = *(u64 *)((char *)&event +
+		    qla2xip_event_stat_table[i].offset);
+	*data++ = atomic_long_read(&qdev->tx_timeouts);
+
+	for (queue = 0; queue < qdev->num_tx_queues; queue++) {
+		if (queue)
+			qla2xip_sum_stats(qdev, queue, NULL, NULL, &tx, &comp);
+
+		for (i = 0; i < ARRAY_SIZE(qla2xip_tx_stat_table); i++)
+			*data++ = *(u64 *)((char *)&tx +
+			    qla2xip_tx_stat_table[i].offset);
+		for (i = 0; i < ARRAY_SIZE(qla2xip_comp_stat_table); i++)
+			*data++ = *(u64 *)((char *)&comp +
+			    qla2xip_comp_stat_table[i].offset);
+	}
 }
 
+static const struct ethtool_ops qla2xip_ethtool_ops = {
+	.supported_coalesce_params = ETHTOOL_COALESCE_TX_USECS |
+	    ETHTOOL_COALESCE_TX_MAX_FRAMES | ETHTOOL_COALESCE_USE_ADAPTIVE_TX,
+	.get_drvinfo = qla2xip_get_drvinfo,
+	.get_link = ethtool_op_get_link,
+	.get_link_ksettings = qla2xip_get_link_ksettings,
+	.get_sset_count = qla2xip_get_sset_count,
+	.get_strings = qla2xip_get_strings,
+	.get_ethtool_stats = qla2xip_get_ethtool_stats,
+	.get_ringparam = qla2xip_get_ringparam,
+	.set_ringparam = qla2xip_set_ringparam,
+	.get_coalesce = qla2xip_get_coalesce,
+	.set_coalesce = qla2xip_set_coalesce,
+};
+
 /* Chain of configured device structures (just for module unload)*/
 static struct net_device *root_dev;
 
@@ -831,11 +3709,13 @@ static const struct net_device_ops qla2xip_netdev_ops = {
 	.ndo_open = qla2xip_open,
 	.ndo_stop = qla2xip_close,
 	.ndo_start_xmit = qla2xip_send,
-	.ndo_get_stats = qla2xip_get_stats,
+	.ndo_features_check = qla2xip_features_check,
+	.ndo_get_stats64 = qla2xip_get_stats64,
+	.ndo_set_rx_mode = qla2xip_set_multicast_list,
 	.ndo_set_mac_address = qla2xip_set_mac_address,
 	.ndo_change_mtu = qla2xip_change_mtu,
-	.ndo_do_ioctl = qla2xip_do_ioctl,
 	.ndo_tx_timeout = qla2xip_tx_timeout,
+	.ndo_bpf = qla2xip_bpf,
 };
 
 /**
@@ -905,7 +3785,9 @@ qla2xip_init(void)
 		 * Allocate the ethernet device and update needed fields.
 		 * Post-register when allocations complete.
 		 */
-		dev = alloc_etherdev(sizeof(struct qla2xip_private));
+		dev = alloc_etherdev_mq(sizeof(struct qla2xip_private),
+		    tx_queues > 0 ? min(tx_queues, QLA_IP_MAX_TX_QUEUES) :
+		    min_t(int, num_online_cpus(), QLA_IP_MAX_TX_QUEUES));
 		if (dev == NULL) {
 			printk(KERN_ERR
 			       "%s: Failed to allocate net-device structure\n",
@@ -918,10 +3800,11 @@ qla2xip_init(void)
 
 		qdev->dev = dev;
 		spin_lock_init(&qdev->lock);
+		netif_napi_add(dev, &qdev->napi, qla2xip_poll);
 
 		/* Set driver entry points */
 		dev->netdev_ops = &qla2xip_netdev_ops; // FOO
-		// FOO dev->set_multicast_list = qla2xip_set_multicast_list;
+		dev->ethtool_ops = &qla2xip_ethtool_ops;
 
 		/* Update interface name */
 		strcpy(dev->name, "fc%d");
@@ -929,10 +3812,6 @@ qla2xip_init(void)
 		/* Save Inquiry data from SCSI driver */
 		qdev->options = inq_data->options;
 		qdev->ha = inq_data->ha;
-		qdev->receive_q = (struct risc_rec_entry *)inq_data->risc_rec_q;
-		qdev->receive_q_size = inq_data->risc_rec_q_size;
-		qdev->receive_q_in = qdev->receive_q;
-		qdev->receive_q_end = &qdev->receive_q[qdev->receive_q_size];
 
 		qdev->link_speed = inq_data->link_speed;
 		memcpy(qdev->port_name, inq_data->port_name, WWN_SIZE);
@@ -943,10 +3822,17 @@ qla2xip_init(void)
 		qdev->ip_add_buffers_routine = inq_data->ip_add_buffers_routine;
 		qdev->ip_send_packet_routine = inq_data->ip_send_packet_routine;
 		qdev->ip_tx_timeout_routine = inq_data->ip_tx_timeout_routine;
+		qdev->ip_set_send_packets_routine =
+		    inq_data->ip_set_send_packets_routine;
+		qdev->ip_flush_packets_routine =
+		    inq_data->ip_flush_packets_routine;
+		qdev->ip_set_coalesce_routine =
+		    inq_data->ip_set_coalesce_routine;
 
 		/* Validate and set parameters */
 		qdev->mtu = mtu;
 		qdev->max_receive_buffers = buffers;
+		qdev->max_send_packets = send_packets;
 
 		if (qdev->mtu > MAX_MTU_SIZE)
 			qdev->mtu = MAX_MTU_SIZE;
@@ -958,14 +3844,35 @@ qla2xip_init(void)
 		if (qdev->max_receive_buffers < MIN_RECEIVE_BUFFERS)
 			qdev->max_receive_buffers = MIN_RECEIVE_BUFFERS;
 
-		qdev->receive_buff_data_size = qdev->mtu +
-		    sizeof(struct packet_header);
-		qdev->header_size = DEFAULT_HEADER_SPLIT;
+		qdev->max_small_buffers = clamp(small_buffers, 0,
+		    MAX_RECEIVE_BUFFERS - qdev->max_receive_buffers);
+
+		qdev->rx_add_mark = clamp(rx_add_mark, 1, MAX_RECEIVE_BUFFERS);
+		qdev->rx_low_mark = clamp(rx_low_mark, 0, MAX_RECEIVE_BUFFERS);
+
+		if (send_packets > MAX_SEND_PACKETS)
+			qdev->max_send_packets = MAX_SEND_PACKETS;
+		if (send_packets < MIN_SEND_PACKETS)
+			qdev->max_send_packets = MIN_SEND_PACKETS;
+
+		qdev->header_size = header_split;
+		if (header_split > MAX_HEADER_SPLIT)
+			qdev->header_size = MAX_HEADER_SPLIT;
+		if (header_split > 0 &&
+		    header_split < sizeof(struct packet_header))
+			qdev->header_size = sizeof(struct packet_header);
+		if (header_split < 0)
+			qdev->header_size = 0;
 
 		/* TODO: Update ARP header type */
 		/*dev->type = ARPHRD_FCFABRIC; */
 		dev->mtu = qdev->mtu;
-		dev->tx_queue_len = MAX_SEND_PACKETS;
+		dev->min_mtu = MIN_MTU_SIZE;
+		dev->max_mtu = MAX_MTU_SIZE;
+		dev->tx_queue_len = qdev->max_send_packets;
+		dev->hw_features = NETIF_F_SG | NETIF_F_HW_CSUM | NETIF_F_TSO;
+		dev->features |= dev->hw_features;
+		dev->hw_features |= NETIF_F_LRO;	/* off until enabled */
 		if (test_bit(BDI_64BIT_ADDRESSING, &qdev->options))
 			dev->features |= NETIF_F_HIGHDMA;
 
@@ -973,12 +3880,9 @@ qla2xip_init(void)
 		 * The Ethernet address is the last 6 bytes of the adapter
 		 * portname
 		 */
-		memcpy(dev->dev_addr, &qdev->port_name[2], ETH_ALEN);
-		/* TODO: Why do we need this? */
-		/*      dev->dev_addr[6] = qdev->port_name[6 + 2]; */
+		eth_hw_addr_set(dev, &qdev->port_name[2]);
 
 		dev->irq = qdev->pdev->irq;
-		dev->flags &= ~IFF_MULTICAST;
 		dev->flags |= IFF_NOTRAILERS;
 
 		/* Allocate and initialize data buffers */
@@ -993,23 +3897,7 @@ qla2xip_init(void)
 		}
 
 		/* Enable connection to SCSI driver */
-		memset(enable_data, 0, sizeof(struct bd_enable));
-		enable_data->length = BDE_LENGTH;
-		enable_data->version = BDE_VERSION;
-		set_bit(BDE_NOTIFY_ROUTINE, &enable_data->options);
-		enable_data->mtu = qdev->mtu;
-		enable_data->header_size = qdev->header_size;
-		enable_data->receive_buffers = qdev->receive_buffers;
-		enable_data->max_receive_buffers = qdev->max_receive_buffers;
-		enable_data->receive_buff_data_size =
-		    qdev->receive_buff_data_size;
-		enable_data->notify_routine = qla2xip_notify;
-		enable_data->notify_context = dev;
-		enable_data->send_completion_routine = qla2xip_send_completion;
-		enable_data->receive_packets_routine = qla2xip_receive_packets;
-		enable_data->receive_packets_context = dev;
-
-		rval = qdev->ip_enable_routine(qdev->ha, enable_data);
+		rval = qla2xip_enable_ip(dev, enable_data);
 		if (!rval) {
 			/*
 			 * Connection to SCSI driver failed return resources
@@ -1020,14 +3908,6 @@ qla2xip_init(void)
 			break;
 		}
 
-		/*
-		 * Pass receive buffers to SCSI driver
-		 */
-		qdev->ip_add_buffers_routine(qdev->ha,
-					     qdev->receive_q_add_cnt, 0);
-		qdev->receive_q_cnt = qdev->receive_q_add_cnt;
-		qdev->receive_q_add_cnt = 0;
-
 		/* Register the device */
 		rval = register_netdev(dev);
 		if (rval) {
@@ -1037,6 +3917,7 @@ qla2xip_init(void)
 			break;
 		}
 
+		qla2xip_set_xps(dev);
 		qla2xip_display_dev_info(dev);
 
 		/*
@@ -19,15 +19,214 @@
 #define MIN_MTU_SIZE		100	/* Minimum MTU size */
 #define DEFAULT_MTU_SIZE	4096	/* Default MTU size */
 #define DEFAULT_BUFFER_SIZE	(DEFAULT_MTU_SIZE + sizeof(PACKET_HEADER))
-#define DEFAULT_RECEIVE_BUFFERS	32	/* Default number of receive buffers */
+#define DEFAULT_RECEIVE_BUFFERS	256	/* Default number of receive buffers */
+#define DEFAULT_SMALL_BUFFERS	256	/* Default number of small receive */
+					/*  buffers */
+#define QLA2XIP_SMALL_BUF_SIZE	256	/* Small receive buffer size */
+#define DEFAULT_SEND_PACKETS	256	/* Default number of send_cbs */
 
-#define RECEIVE_BUFFERS_LOW_MARK 16	/* Receive buffers low water mark */
-#define RECEIVE_BUFFERS_ADD_MARK 10	/* Receive buffers add mark */
-#define DEFAULT_HEADER_SPLIT	0	/* Default header split size (== 0) */
+#define RECEIVE_BUFFERS_LOW_MARK 16	/* Default receive buffers low water */
+					/*  mark */
+#define RECEIVE_BUFFERS_ADD_MARK 10	/* Default receive buffers add mark */
+#define SEND_CBS_STOP_MARK	1	/* Stop queue below this many free */
+					/*  send_cbs */
+#define SEND_CBS_WAKE_MARK(qdev) ((qdev)->max_send_packets / 4) /* Wake mark */
+#define QLA2XIP_TX_DEST_BITS	6	/* Destination hash buckets per */
+#define QLA2XIP_TX_DEST_HASH	(1 << QLA2XIP_TX_DEST_BITS) /*  transmit queue */
+#define QLA2XIP_TX_DEST_QUOTA(qdev) \
+	clamp_t(uint16_t, (qdev)->max_send_packets / 16, 1, 16) /* Max */
+					/*  send_cbs held by a destination */
+					/*  while others compete */
+#define QLA2XIP_TX_DEST_BACKLOG	128	/* Packets held back for a */
+					/*  destination that stop the queue */
+#define QLA2XIP_TX_QUANTUM(qdev) ((qdev)->mtu + sizeof(struct ethhdr)) /* DRR */
+					/*  quantum in bytes */
+#define DEFAULT_HEADER_SPLIT	128	/* Default header split size */
+#define MAX_COALESCE_USECS	25500	/* Maximum interrupt hold-off */
+#define MAX_HEADER_SPLIT	256	/* Maximum header split size */
+#define QLA2XIP_LRO_MAX_SIZE	65535	/* Maximum aggregated IP packet */
+#define QLA2XIP_LRO_MAX_SEGS	64	/* Maximum segments per aggregate */
+#define QLA2XIP_TSO_MAX_HDR	120	/* Maximum IP and TCP header of a */
+					/*  TSO segment */
+#define QLA2XIP_MC_HASH_BITS	8	/* Multicast filter hash bits */
+#define QLA2XIP_MC_FILTER_SIZE	(1 << QLA2XIP_MC_HASH_BITS)
+
+/*
+ * Receive buffers are page pool pages laid out for build_skb(), with the
+ * headroom an XDP program may use
+ */
+#define QLA2XIP_RX_HEADROOM	XDP_PACKET_HEADROOM
+#define QLA2XIP_RX_TAILROOM	SKB_DATA_ALIGN(sizeof(struct skb_shared_info))
+#define QLA2XIP_RX_BUF_SIZE(order) \
+	((PAGE_SIZE << (order)) - QLA2XIP_RX_HEADROOM - QLA2XIP_RX_TAILROOM)
+
+/* Largest MTU whose frames fit the single order-0 buffer XDP requires */
+#define QLA2XIP_XDP_MAX_MTU \
+	(QLA2XIP_RX_BUF_SIZE(0) - sizeof(struct packet_header))
+
+/* Page holding small receive buffers */
+struct qla2xip_rx_chunk {
+	struct page *page;
+	dma_addr_t dma;
+};
 
 #define LSD(x)	((uint32_t)((uint64_t)(x)))
 #define MSD(x)	((uint32_t)((((uint64_t)(x)) >> 16) >> 16))
 
+/*
+ * Per-CPU statistics.  Each group has a single writer context, so the
+ * u64_stats_sync writers of a CPU never nest: receives are counted by the
+ * NAPI poll routine, sends by qla2xip_send() and send completions and
+ * SCSI driver events with interrupts disabled.  All counters must precede
+ * the syncp member, see qla2xip_fold_stats().
+ */
+struct qla2xip_rx_stats {
+	u64 packets;
+	u64 bytes;
+	u64 length_errors;
+	u64 dropped;		/*  no replacement buffer */
+	u64 multi_buffer;	/*  reassembled from several buffers */
+	u64 small_buffer;	/*  copied from a small buffer */
+	u64 multicast;		/*  multicast and broadcast accepted */
+	u64 mc_filtered;	/*  multicast of groups not joined */
+	u64 lro_aggregated;	/*  aggregated packets passed up */
+	u64 lro_merged;		/*  segments merged into them */
+	u64 xdp_drop;
+	u64 xdp_tx;
+	u64 xdp_redirect;
+	u64 xdp_errors;		/*  aborted, invalid action or failure */
+	struct u64_stats_sync syncp;
+};
+
+struct qla2xip_tx_stats {
+	u64 dropped;		/*  checksum or DMA mapping failure */
+	u64 scb_exhausted;	/*  no free send_cb */
+	u64 busy;		/*  SCSI driver request ring full */
+	u64 errors;
+	u64 stopped;		/*  queue stopped at SEND_CBS_STOP_MARK */
+	u64 tso;		/*  TSO packets segmented */
+	u64 held;		/*  held back over the destination quota */
+	u64 dest_stopped;	/*  queue stopped on a full backlog */
+	struct u64_stats_sync syncp;
+};
+
+struct qla2xip_comp_stats {
+	u64 packets;
+	u64 bytes;
+	u64 arp_converted;
+	u64 cs_aborted;		/*  SCB_CS_INCOMPLETE, SCB_CS_ABORTED */
+	u64 cs_reset;
+	u64 cs_timeout;
+	u64 cs_port_unavailable;
+	u64 cs_port_logged_out;
+	u64 cs_port_config_chg;
+	u64 cs_fw_resource;
+	u64 cs_unknown;
+	struct u64_stats_sync syncp;
+};
+
+struct qla2xip_event_stats {
+	u64 rcv_buffers_low;
+	u64 out_of_buffers;
+	struct u64_stats_sync syncp;
+};
+
+struct qla2xip_pcpu_stats {
+	struct qla2xip_rx_stats rx;
+	struct qla2xip_event_stats event;
+	struct qla2xip_tx_stats tx[QLA_IP_MAX_TX_QUEUES];
+	struct qla2xip_comp_stats comp[QLA_IP_MAX_TX_QUEUES];
+};
+
+#define QLA2XIP_STATS_COUNT(type)	(offsetof(type, syncp) / sizeof(u64))
+#define QLA2XIP_STATS_MAX		QLA2XIP_STATS_COUNT(struct qla2xip_comp_stats)
+
+#define QLA2XIP_STATS_ADD(stats, member, value)			\
+do {								\
+	u64_stats_update_begin(&(stats)->syncp);		\
+	(stats)->member += (value);				\
+	u64_stats_update_end(&(stats)->syncp);			\
+} while (0)
+#define QLA2XIP_STATS_INC(stats, member) QLA2XIP_STATS_ADD(stats, member, 1)
+
+/*
+ * Receive aggregation (NETIF_F_LRO) of consecutive in-order TCP segments of
+ * one flow from the same source N_Port.  The segments following the first
+ * are chained on its frag_list with their headers pulled.
+ */
+struct qla2xip_lro {
+	struct sk_buff *skb;	/* aggregated packet, NULL if none */
+	struct sk_buff *last;	/*  last skb on its frag_list */
+	struct iphdr *iph;	/*  its headers */
+	struct tcphdr *th;
+	uint32_t next_seq;	/*  sequence number expected next */
+	uint16_t mss;		/*  largest segment payload */
+	uint16_t segs;		/*  # segments aggregated */
+};
+
+/*
+ * Header pool entry of a send_cb, TSO segments carry their own IP and TCP
+ * headers after the packet_header
+ */
+struct qla2xip_scb_header {
+	struct packet_header packethdr;
+	uint8_t tso_hdr[QLA2XIP_TSO_MAX_HDR];
+};
+
+/*
+ * TSO packet being posted as segments
+ */
+struct qla2xip_tso {
+	struct send_cb *owner;	/*  owner send_cb, NULL if none */
+	unsigned int offset;	/*  payload offset of the next segment */
+	unsigned int mss;
+	uint16_t index;		/*  next segment */
+	uint16_t segs;		/*  # segments */
+	uint16_t dest;		/*  destination index */
+};
+
+/*
+ * Transmit destination, one remote port by its exact address.  A transmit
+ * queue has one per send_cb, idle ones are reused for new addresses.
+ */
+struct qla2xip_tx_dest {
+	struct hlist_node node;	/*  on its hash bucket */
+	uint8_t addr[ETH_ALEN];
+	struct sk_buff_head backlog;	/*  packets held over the quota */
+	struct list_head active;	/*  on the DRR list while backlogged */
+	atomic_t inflight;	/*  send_cbs sent, not yet completed */
+	int deficit;		/*  DRR byte credit */
+};
+
+/*
+ * Send control block ring of a transmit queue, mapped onto one of the SCSI
+ * driver's IP transmit queues
+ */
+struct qla2xip_txq {
+	spinlock_t lock;
+	struct send_cb **send_q;	/*  max_send_packets + 1 entries */
+	uint16_t send_q_in;	/*  free in-pointer */
+	uint16_t send_q_out;	/*  free out-pointer */
+	/* Send control block array */
+	struct send_cb *send_buffers;
+	struct qla2xip_scb_header *scb_header;
+	dma_addr_t scb_header_dma;
+
+	/* Destinations, under the netdev queue's xmit lock */
+	struct qla2xip_tx_dest *dests;	/*  dests_cnt entries */
+	struct hlist_head *dest_hash;	/*  QLA2XIP_TX_DEST_HASH buckets */
+	uint16_t dests_cnt;
+	uint16_t dests_next;	/*  next entry tried for reuse */
+	struct list_head active;	/*  backlogged destinations, DRR order */
+	int active_cnt;
+	int backlog_full;	/*  # backlogs at QLA2XIP_TX_DEST_BACKLOG */
+	atomic_t dests_busy;	/*  # destinations holding send_cbs */
+
+	/* TSO packet left part posted by a full request ring, see */
+	/*  qla2xip_tso_post(); under the netdev queue's xmit lock */
+	struct qla2xip_tso tso;
+};
+
 /*
  * Struct private for the QLogic IP adapter
  */
@@ -36,20 +235,19 @@ struct qla2xip_private {
 	struct net_device *next;
 	spinlock_t lock;
 
-	struct net_device_stats stats;	/* Device statistics */
+	struct qla2xip_pcpu_stats __percpu *stats;	/* Device statistics */
+	atomic_long_t tx_timeouts;
 	struct net_device *dev;	/* Parent NET device */
 
 	uint32_t mtu;		/* Maximum transfer unit */
 	uint16_t header_size;	/* Split header size */
 
-	/* Send control block queue */
-	struct send_cb *send_q[MAX_SEND_PACKETS + 1];
-	uint16_t send_q_in;	/*  free in-pointer */
-	uint16_t send_q_out;	/*  free out-pointer */
-	/* Send control block array */
-	struct send_cb send_buffers[MAX_SEND_PACKETS];
-	struct packet_header *scb_header;
-	dma_addr_t scb_header_dma;
+	/* Send control block rings, one per transmit queue */
+	struct qla2xip_txq txq[QLA_IP_MAX_TX_QUEUES];
+	uint16_t num_tx_queues;	/*  # granted by the SCSI driver */
+	uint16_t max_send_packets;	/*  maximum # send_cbs per queue */
+	unsigned long tx_drain_pending;	/*  queues with backlogged */
+					/*  destinations (NAPI poll) */
 
 	/* Inquiry data from SCSI driver */
 	unsigned long options;	/* QLA2X00 supported options */
@@ -64,17 +262,53 @@ struct qla2xip_private {
 	int (*ip_add_buffers_routine) (void *, uint16_t, int);
 	int (*ip_send_packet_routine) (void *, struct send_cb *);
 	int (*ip_tx_timeout_routine) (void *);
+	int (*ip_set_send_packets_routine) (void *, uint16_t);
+	void (*ip_flush_packets_routine) (void *, uint16_t);
+	int (*ip_set_coalesce_routine) (void *, struct bd_coalesce *);
+
+	/* Interrupt coalescing (ethtool -C) */
+	struct bd_coalesce coal;
+
+	/* Free receive buffer rings, shared with the SCSI driver */
+	struct bd_rx_ring rx_ring[BD_RX_POOLS];
+	uint32_t rx_ring_added[BD_RX_POOLS];	/*  producer index last */
+						/*   passed on */
+	uint16_t receive_q_cnt;	/*  buffers passed to the SCSI driver */
+	uint16_t rx_add_mark;	/*  pass on once this many are free */
+	uint16_t rx_low_mark;	/*  pass on at or below this many */
+
+	/* Received buffer_cbs queued (from IRQ) for the NAPI poll routine */
+	struct napi_struct napi;
+	struct qla2xip_lro lro;		/*  NAPI poll only */
+	struct buffer_cb **rx_done_q;	/*  MAX_RECEIVE_BUFFERS + 1 */
+	uint16_t rx_done_in;	/*  in-pointer (IRQ) */
+	uint16_t rx_done_out;	/*  out-pointer (NAPI) */
+
+	/* Page pool backing the receive buffers */
+	struct page_pool *rx_page_pool;
+	uint16_t rx_page_order;	/*  allocation order of each buffer */
+	enum dma_data_direction rx_dma_dir;
+
+	/* XDP */
+	struct bpf_prog *xdp_prog;
+	struct xdp_rxq_info xdp_rxq;
+	unsigned long xdp_tx_pending;	/*  queues to flush (NAPI poll) */
+	int xdp_redirect;	/*  redirects to flush (NAPI poll) */
+	struct llist_head xdp_done;	/*  completed XDP_TX send_cbs */
+
+	/* Multicast filter, hashed on the destination address */
+	DECLARE_BITMAP(mc_filter, QLA2XIP_MC_FILTER_SIZE);
+	int mc_all;		/*  accept all multicast */
 
-	/* RISC receive queue */
-	uint16_t receive_q_size;	/*  size */
-	struct risc_rec_entry *receive_q;	/*  pointer */
-	struct risc_rec_entry *receive_q_in;	/*  in-pointer */
-	struct risc_rec_entry *receive_q_end;	/*  end-pointer */
-	uint16_t receive_q_cnt;	/*  current buffer count */
-	uint16_t receive_q_add_cnt;	/*  buffers to be added */
+	/* Small receive buffers, carved from DMA mapped pages */
+	struct qla2xip_rx_chunk *rx_small_chunks;
+	uint16_t rx_small_nchunks;
+	uint16_t rx_small_cnt;	/*  # small buffers in use */
+	uint16_t max_small_buffers;	/*  maximum # small buffers */
 
-	struct buffer_cb receive_buffers[MAX_RECEIVE_BUFFERS];
-	uint16_t max_receive_buffers;	/*  maximum # receive buffers */
+	/* Large buffers first, then small buffers */
+	struct buffer_cb *receive_buffers;
+	uint16_t max_receive_buffers;	/*  maximum # (large) receive buffers */
 	uint32_t receive_buff_data_size;	/*  data size */
 };
 #endif
@@ -21,10 +21,12 @@
 #include <linux/spinlock.h>
 #include <linux/completion.h>
 #include <linux/interrupt.h>
+#include <linux/irq_poll.h>
 #include <linux/workqueue.h>
 #include <linux/firmware.h>
 #include <linux/aer.h>
 #include <linux/mutex.h>
+#include <linux/hashtable.h>
 
 #include <scsi/scsi.h>
 #include <scsi/scsi_host.h>
@@ -32,6 +34,7 @@
 #include <scsi/scsi_cmnd.h>
 #include <scsi/scsi_transport_fc.h>
 #include <scsi/scsi_bsg_fc.h>
+#include <linux/bsg-lib.h>
 
 #include "qla_bsg.h"
 #include "qla_nx.h"
@@ -362,6 +365,7 @@ struct srb_iocb {
 		} fxiocb;
 		struct {
 			uint32_t cmd_hndl;
+			uint16_t req_que_no;	/* queue of cmd_hndl */
 			__le16 comp_status;
 			struct completion comp;
 		} abt;
@@ -389,6 +393,7 @@ struct srb_iocb {
 typedef struct srb {
 	atomic_t ref_count;
 	struct fc_port *fcport;
+	struct qla_qpair *qpair;	/* NULL unless started on a qpair */
 	uint32_t handle;
 	uint16_t flags;
 	uint16_t type;
@@ -396,7 +401,7 @@ typedef struct srb {
 	int iocbs;
 	union {
 		struct srb_iocb iocb_cmd;
-		struct fc_bsg_job *bsg_job;
+		struct bsg_job *bsg_job;
 		struct srb_cmd scmd;
 	} u;
 	void (*done)(void *, void *, int);
@@ -407,6 +412,18 @@ typedef struct srb {
 #define SET_CMD_SP(sp, cmd) (sp->u.scmd.cmd = cmd)
 #define GET_CMD_CTX_SP(sp) (sp->u.scmd.ctx)
 
+/*
+ * scsi_cmnd private area (qla2xxx_driver_template.cmd_size).  The midlayer
+ * preallocates one per request for the full queue depth, so an FCP command
+ * gets its srb, and on ISP82xx its command type 6 context, without touching
+ * a mempool.
+ */
+struct qla_cmd_priv {
+	srb_t sp;
+	struct ct6_dsd ct6;
+	srb_t *cmd_sp;		/* &sp while the command is active, CMD_SP() */
+};
+
 #define GET_CMD_SENSE_LEN(sp) \
 	(sp->u.scmd.request_sense_length)
 #define SET_CMD_SENSE_LEN(sp, len) \
@@ -2028,6 +2045,8 @@ typedef struct {
 typedef struct fc_port {
 	struct list_head list;
 	struct scsi_qla_host *vha;
+	struct hlist_node ip_hash;	/* vha->ip.fcport_hash linkage */
+	uint16_t ip_pending_cnt;	/* IP packets awaiting login */
 
 	uint8_t node_name[WWN_SIZE];
 	uint8_t port_name[WWN_SIZE];
@@ -2707,6 +2726,7 @@ struct isp_operations {
 
 	int (*get_flash_version) (struct scsi_qla_host *, void *);
 	int (*start_scsi) (srb_t *);
+	int (*start_scsi_mq) (srb_t *);
 	int (*abort_isp) (struct scsi_qla_host *);
 	int (*iospace_config)(struct qla_hw_data*);
 	int (*initialize_adapter)(struct scsi_qla_host *);
@@ -2730,6 +2750,7 @@ struct scsi_qla_host;
 
 struct qla_msix_entry {
 	int have_irq;
+	int in_use;		/* owned by a base or multi-queue rsp_que */
 	uint32_t vector;
 	uint16_t entry;
 	struct rsp_que *rsp;
@@ -2838,6 +2859,18 @@ struct bidi_statistics {
 #define QLA_PRECONFIG_VPORTS 32
 #define QLA_MAX_VPORTS_QLA24XX	128
 #define QLA_MAX_VPORTS_QLA25XX	256
+
+/*
+ * Response queue entries processed per irq_poll pass; also bounds the SCSI
+ * completions a pass can defer, see qla24xx_rsp_poll().
+ */
+#define QLA_RSP_POLL_WEIGHT	64
+
+struct qla_rsp_compl {
+	srb_t *sp;
+	int res;
+};
+
 /* Response queue data structure */
 struct rsp_que {
 	dma_addr_t  dma;
@@ -2856,8 +2889,16 @@ struct rsp_que {
 	struct qla_hw_data *hw;
 	struct qla_msix_entry *msix;
 	struct req_que *req;
+	struct qla_qpair *qpair;
 	srb_t *status_srb; /* status continuation entry */
-	struct work_struct q_work;
+	spinlock_t *lock;		/* serializes response processing */
+	struct qla_ip_irq_mod *ip_mod;	/* IP transmit queue moderation */
+
+	struct irq_poll irqpoll;	/* MSI-X vector response processing */
+	uint32_t irqpoll_enabled:1;
+	uint32_t defer_compl:1;		/* completions go to compl[] */
+	uint16_t num_compl;
+	struct qla_rsp_compl compl[QLA_RSP_POLL_WEIGHT];
 
 	dma_addr_t  dma_fx00;
 	response_t *ring_fx00;
@@ -2883,7 +2924,9 @@ struct req_que {
 	uint16_t  qos;
 	uint16_t  vp_idx;
 	struct rsp_que *rsp;
+	struct qla_qpair *qpair;
 	srb_t **outstanding_cmds;
+	unsigned long *outstanding_map;	/* busy handles, bit 0 reserved */
 	uint32_t current_outstanding_cmd;
 	uint16_t num_outstanding_cmds;
 	int max_q_depth;
@@ -2894,6 +2937,35 @@ struct req_que {
 	uint8_t req_pkt[REQUEST_ENTRY_SIZE];
 };
 
+/*
+ * Queue pair: a request/response queue and its MSI-X vector, owned by one
+ * blk-mq hardware context.  qp_lock serializes the request queue and its
+ * outstanding commands as well as response queue processing, so I/O on
+ * different queue pairs does not contend for the hardware_lock.
+ */
+struct qla_qpair {
+	spinlock_t qp_lock;
+	atomic_t ref_count;		/* commands started on the qpair */
+
+	/*
+	 * online distills ha->flags.eeh_busy and
+	 * ha->flags.pci_channel_io_perm_failure, see qla2x00_do_dpc().
+	 */
+	uint32_t online:1;
+	uint32_t difdix_supported:1;
+	uint32_t delete_in_progress:1;
+
+	uint16_t id;			/* index in ha->queue_pair_map */
+	uint16_t vp_idx;
+
+	struct req_que *req;
+	struct rsp_que *rsp;
+	struct qla_msix_entry *msix;	/* &ha->msix_entries[x] */
+	struct qla_hw_data *hw;
+	struct scsi_qla_host *vha;
+	struct list_head qp_list_elem;	/* vha->qp_list */
+};
+
 /* Place holder for FW buffer parameters */
 struct qlfc_fw {
 	void *fw_buf;
@@ -3153,6 +3225,11 @@ struct qla_hw_data {
 	unsigned long rsp_qid_map[(QLA_MAX_QUEUES / 8) / sizeof(unsigned long)];
 	uint8_t 	max_req_queues;
 	uint8_t 	max_rsp_queues;
+	uint8_t		max_qpairs;
+	struct qla_qpair __rcu **queue_pair_map;	/* RCU, mq_lock */
+	struct qla_qpair *base_qpair;
+	unsigned long qpair_qid_map[(QLA_MAX_QUEUES / 8) /
+	    sizeof(unsigned long)];
 	struct qla_npiv_entry *npiv_info;
 	uint16_t	nvram_npiv_size;
 
@@ -3401,6 +3478,7 @@ struct qla_hw_data {
 #define MBX_UPDATE_FLASH_ACTIVE	3
 
 	struct mutex vport_lock;        /* Virtual port synchronization */
+	struct mutex mq_lock;		/* queue pair creation/deletion */
 	spinlock_t vport_slock; /* order is hardware_lock, then vport_slock */
 	struct completion mbx_cmd_comp; /* Serialize mbx access */
 	struct completion mbx_intr_comp;  /* Used for completion notification */
@@ -3565,7 +3643,6 @@ struct qla_hw_data {
 	struct qla_chip_state_84xx *cs84xx;
 	struct qla_statistics qla_stats;
 	struct isp_operations *isp_ops;
-	struct workqueue_struct *wq;
 	struct qlfc_fw fw_buf;
 
 	/* FCP_CMND priority support */
@@ -3575,7 +3652,6 @@ struct qla_hw_data {
 #define DSD_LIST_DMA_POOL_SIZE  512
 
 	struct dma_pool *fcp_cmnd_dma_pool;
-	mempool_t       *ctx_mempool;
 #define FCP_CMND_DMA_POOL_SIZE 512
 
 	unsigned long	nx_pcibase;		/* Base I/O address */
@@ -3698,6 +3774,7 @@ typedef struct scsi_qla_host {
 #define FX00_HOST_INFO_RESEND	26
 #define FX00_FW_INFO_UPDATE	27
 #define PROCESS_PUREX_IOCB	28
+#define QPAIR_ONLINE_CHECK_NEEDED	29
 
 	uint32_t	device_flags;
 #define SWITCH_FOUND		BIT_0
@@ -3766,6 +3843,7 @@ typedef struct scsi_qla_host {
 #define VP_ERR_ADAP_NORESOURCES	5
 	struct qla_hw_data *hw;
 	struct req_que *req;
+	struct list_head qp_list;	/* queue pairs created by this port */
 	int		fw_heartbeat_counter;
 	int		seconds_since_last_heartbeat;
 	struct fc_host_statistics fc_host_stat;
@@ -3783,24 +3861,22 @@ typedef struct scsi_qla_host {
 
 	struct {
         /* Data for IP support */
-#define MAX_SEND_PACKETS		32
-		u_long            ipreq_cnt;
-
 	        uint8_t         ip_port_name[WWN_SIZE];
 
-	        struct risc_rec_entry *risc_rec_q;
-		dma_addr_t      risc_rec_q_dma;
-	        uint16_t        rec_entries_in;
-	        uint16_t        rec_entries_out;
+	        /* Transmit queues, see struct qla_ip_txq */
+	        struct qla_ip_txq *txq;
+	        uint16_t        num_txqs;
 
-	        struct send_cb  *active_scb_q[MAX_SEND_PACKETS];
-	        uint32_t        current_scb_q_idx;
+	        /* Interrupt coalescing, see struct qla_ip_coalesce */
+	        struct qla_ip_coalesce *coal;
 
 	        uint32_t        mtu;
 	        uint16_t        header_size;
 	        uint16_t        max_receive_buffers;
 	        struct buffer_cb *receive_buffers;
+	        struct bd_rx_ring *rx_ring;	/* free receive buffers */
 	        uint32_t        receive_buff_data_size;
+	        uint16_t        small_buff_data_size;
 
 	        void            (*send_completion_routine)
 	                                (struct send_cb *scb);
@@ -3811,6 +3887,21 @@ typedef struct scsi_qla_host {
 	        void            (*notify_routine)
       	                          (void *context, uint32_t type);
 
+	        /* Logged in ports, hashed on the IEEE MAC of the port name */
+#define QLA_IP_FCPORT_HASH_BITS	8
+	        DECLARE_HASHTABLE(fcport_hash, QLA_IP_FCPORT_HASH_BITS);
+	        struct qla_ip_dest_cache __percpu *dest_cache;
+	        uint32_t        dest_gen;	/* bumped as ports are unhashed */
+
+	        /* Send packets awaiting a destination port login */
+	        struct list_head pending_q;
+	        uint16_t        pending_cnt;
+	        uint8_t         flush_active;	/* pending_q being sent */
+	        uint8_t         flush_again;	/*  and to be rescanned */
+
+	        /* Software-emulated adapter, see qla_ip_emu.c */
+	        struct qla_ip_emu *emu;
+
 		volatile struct {
 			uint32_t	enable_ip		:1;
 		} flags;
@@ -3865,6 +3956,21 @@ struct qla27xx_image_status {
 	atomic_dec(&__vha->vref_count);			     \
 } while (0)
 
+#define QLA_QPAIR_MARK_BUSY(__qpair, __bail) do {	     \
+	atomic_inc(&__qpair->ref_count);		     \
+	mb();						     \
+	if (__qpair->delete_in_progress) {		     \
+		atomic_dec(&__qpair->ref_count);	     \
+		__bail = 1;				     \
+	} else {					     \
+		__bail = 0;				     \
+	}						     \
+} while (0)
+
+#define QLA_QPAIR_MARK_NOT_BUSY(__qpair) do {		     \
+	atomic_dec(&__qpair->ref_count);		     \
+} while (0)
+
 /*
  * qla2x00 local function return status codes
  */
@@ -3909,7 +4015,8 @@ struct qla27xx_image_status {
 
 #define	QLA_DSDS_PER_IOCB	37
 
-#define CMD_SP(Cmnd)		((Cmnd)->SCp.ptr)
+#define CMD_SP(Cmnd)	\
+	(((struct qla_cmd_priv *)scsi_cmd_priv(Cmnd))->cmd_sp)
 
 #define QLA_SG_ALL	1024
 
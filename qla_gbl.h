@@ -88,6 +88,9 @@ extern int qla2xxx_mctp_dump(scsi_qla_host_t *);
 extern int
 qla2x00_alloc_outstanding_cmds(struct qla_hw_data *, struct req_que *);
 extern int qla2x00_init_rings(scsi_qla_host_t *);
+extern struct qla_qpair *qla2xxx_create_qpair(struct scsi_qla_host *,
+	int, int);
+extern int qla2xxx_delete_qpair(struct scsi_qla_host *, struct qla_qpair *);
 
 extern uint8_t qla27xx_find_valid_image(struct scsi_qla_host *vha);
 
@@ -122,6 +125,7 @@ extern int ql2xasynclogin;
 extern int ql2xmdcapmask;
 extern int ql2xmdenable;
 extern int ql2xfwholdabts;
+extern int ql2xmqsupport;
 
 extern int qla2x00_loop_reset(scsi_qla_host_t *);
 extern void qla2x00_abort_all_cmds(scsi_qla_host_t *, int);
@@ -173,8 +177,8 @@ extern void qla2x00_disable_board_on_pci_error(struct work_struct *);
  */
 extern struct scsi_host_template qla2xxx_driver_template;
 extern struct scsi_transport_template *qla2xxx_transport_vport_template;
-extern void qla2x00_timer(scsi_qla_host_t *);
-extern void qla2x00_start_timer(scsi_qla_host_t *, void *, unsigned long);
+extern void qla2x00_timer(struct timer_list *);
+extern void qla2x00_start_timer(scsi_qla_host_t *, unsigned long);
 extern void qla24xx_deallocate_vp_id(scsi_qla_host_t *);
 extern int qla24xx_disable_vp (scsi_qla_host_t *);
 extern int qla24xx_enable_vp (scsi_qla_host_t *);
@@ -190,6 +194,8 @@ extern int qla24xx_vport_create_req_sanity_check(struct fc_vport *);
 extern scsi_qla_host_t * qla24xx_create_vhost(struct fc_vport *);
 
 extern void qla2x00_sp_free_dma(void *, void *);
+extern void qla2xxx_qpair_sp_free_dma(void *, void *);
+extern void qla2xxx_qpair_sp_compl(void *, void *, int);
 extern char *qla2x00_get_fw_version_str(struct scsi_qla_host *, char *);
 
 extern void qla2x00_mark_device_lost(scsi_qla_host_t *, fc_port_t *, int, int);
@@ -221,6 +227,7 @@ int qla2x00_marker(struct scsi_qla_host *, struct req_que *, struct rsp_que *,
 						uint16_t, uint16_t, uint8_t);
 extern int qla2x00_start_sp(srb_t *);
 extern int qla24xx_dif_start_scsi(srb_t *);
+extern int qla2xxx_dif_start_scsi_mq(srb_t *);
 extern int qla2x00_start_bidir(srb_t *, struct scsi_qla_host *, uint32_t);
 extern unsigned long qla2x00_get_async_timeout(struct scsi_qla_host *);
 
@@ -570,7 +577,7 @@ extern size_t qla2x00_get_sym_node_name(scsi_qla_host_t *, uint8_t *, size_t);
  * Global Function Prototypes in qla_attr.c source file.
  */
 struct device_attribute;
-extern struct device_attribute *qla2x00_host_attrs[];
+extern const struct attribute_group *qla2x00_host_groups[];
 struct fc_function_template;
 extern struct fc_function_template qla2xxx_transport_functions;
 extern struct fc_function_template qla2xxx_transport_vport_functions;
@@ -591,16 +598,48 @@ extern int qla24xx_fcp_prio_cfg_valid(scsi_qla_host_t *,
 extern int qla2x00_dfs_setup(scsi_qla_host_t *);
 extern int qla2x00_dfs_remove(scsi_qla_host_t *);
 
+/*
+ * Global Function Prototypes in qla_ip.c source file.
+ */
+extern void qla2x00_ip_hash_fcport(scsi_qla_host_t *, fc_port_t *);
+extern void qla2x00_ip_unhash_fcport(scsi_qla_host_t *, fc_port_t *);
+extern void qla2x00_ip_unhash_fcports(scsi_qla_host_t *);
+extern void qla2x00_ip_fcport_online(scsi_qla_host_t *, fc_port_t *);
+extern void qla2x00_ip_timer(scsi_qla_host_t *);
+extern void qla2x00_ip_buffer_event(scsi_qla_host_t *, uint16_t);
+
+/*
+ * Global Function Prototypes in qla_ip_emu.c source file.
+ */
+#ifdef CONFIG_SCSI_QLA_IP_EMU
+extern int ql2xipemu;
+extern int qla2x00_ip_emu_init(void);
+extern void qla2x00_ip_emu_exit(void);
+extern scsi_qla_host_t *qla2x00_ip_emu_host(int);
+extern int qla2x00_ip_emu_mailbox(scsi_qla_host_t *, mbx_cmd_t *);
+extern void qla2x00_ip_emu_doorbell(scsi_qla_host_t *);
+#else
+static inline int qla2x00_ip_emu_init(void) { return 0; }
+static inline void qla2x00_ip_emu_exit(void) { }
+static inline scsi_qla_host_t *qla2x00_ip_emu_host(int index) { return NULL; }
+static inline int qla2x00_ip_emu_mailbox(scsi_qla_host_t *vha,
+	mbx_cmd_t *mcp) { return QLA_FUNCTION_FAILED; }
+static inline void qla2x00_ip_emu_doorbell(scsi_qla_host_t *vha) { }
+#endif
+
 /* Globa function prototypes for multi-q */
 extern int qla25xx_request_irq(struct rsp_que *);
+extern void qla24xx_rsp_poll_init(struct rsp_que *);
+extern void qla24xx_rsp_poll_disable(struct rsp_que *);
 extern int qla25xx_init_req_que(struct scsi_qla_host *, struct req_que *);
 extern int qla25xx_init_rsp_que(struct scsi_qla_host *, struct rsp_que *);
 extern int qla25xx_create_req_que(struct qla_hw_data *, uint16_t, uint8_t,
 	uint16_t, int, uint8_t);
 extern int qla25xx_create_rsp_que(struct qla_hw_data *, uint16_t, uint8_t,
-	uint16_t, int);
+	uint16_t, int, struct qla_qpair *);
 extern void qla2x00_init_response_q_entries(struct rsp_que *);
 extern int qla25xx_delete_req_que(struct scsi_qla_host *, struct req_que *);
+extern int qla25xx_delete_rsp_que(struct scsi_qla_host *, struct rsp_que *);
 extern int qla25xx_delete_queues(struct scsi_qla_host *);
 extern uint16_t qla24xx_rd_req_reg(struct qla_hw_data *, uint16_t);
 extern uint16_t qla25xx_rd_req_reg(struct qla_hw_data *, uint16_t);
@@ -674,7 +713,7 @@ extern int qla82xx_restart_isp(scsi_qla_host_t *);
 /* IOCB related functions */
 extern int qla82xx_start_scsi(srb_t *);
 extern void qla2x00_sp_free(void *, void *);
-extern void qla2x00_sp_timeout(unsigned long);
+extern void qla2x00_sp_timeout(struct timer_list *);
 extern void qla2x00_bsg_job_done(void *, void *, int);
 extern void qla2x00_bsg_sp_free(void *, void *);
 extern void qla2x00_start_iocbs(struct scsi_qla_host *, struct req_que *);
@@ -722,8 +761,8 @@ extern int qla82xx_read_temperature(scsi_qla_host_t *);
 extern int qla8044_read_temperature(scsi_qla_host_t *);
 
 /* BSG related functions */
-extern int qla24xx_bsg_request(struct fc_bsg_job *);
-extern int qla24xx_bsg_timeout(struct fc_bsg_job *);
+extern int qla24xx_bsg_request(struct bsg_job *);
+extern int qla24xx_bsg_timeout(struct bsg_job *);
 extern int qla84xx_reset_chip(scsi_qla_host_t *, uint16_t);
 extern int qla2x00_issue_iocb_timeout(scsi_qla_host_t *, void *,
 	dma_addr_t, size_t, uint32_t);
@@ -43,9 +43,9 @@ static int qla25xx_init_queues(struct qla_hw_data *);
 /* SRB Extensions ---------------------------------------------------------- */
 
 void
-qla2x00_sp_timeout(unsigned long __data)
+qla2x00_sp_timeout(struct timer_list *t)
 {
-	srb_t *sp = (srb_t *)__data;
+	srb_t *sp = from_timer(sp, t, u.iocb_cmd.timer);
 	struct srb_iocb *iocb;
 	fc_port_t *fcport = sp->fcport;
 	struct qla_hw_data *ha = fcport->vha->hw;
@@ -54,7 +54,7 @@ qla2x00_sp_timeout(unsigned long __data)
 
 	spin_lock_irqsave(&ha->hardware_lock, flags);
 	req = ha->req_q_map[0];
-	req->outstanding_cmds[sp->handle] = NULL;
+	qla2x00_clear_outstanding(req, sp->handle);
 	iocb = &sp->u.iocb_cmd;
 	iocb->timeout(sp);
 	sp->free(fcport->vha, sp);
@@ -383,6 +383,7 @@ qla24xx_async_abort_cmd(srb_t *cmd_sp)
 	sp->name = "abort";
 	qla2x00_init_timer(sp, qla2x00_get_async_timeout(vha));
 	abt_iocb->u.abt.cmd_hndl = cmd_sp->handle;
+	abt_iocb->u.abt.req_que_no = qla2x00_sp_req(cmd_sp)->id;
 	sp->done = qla24xx_abort_sp_done;
 	abt_iocb->timeout = qla24xx_abort_iocb_timeout;
 	init_completion(&abt_iocb->u.abt.comp);
@@ -415,14 +416,15 @@ qla24xx_async_abort_command(srb_t *sp)
 	fc_port_t	*fcport = sp->fcport;
 	struct scsi_qla_host *vha = fcport->vha;
 	struct qla_hw_data *ha = vha->hw;
-	struct req_que *req = vha->req;
+	struct req_que *req = qla2x00_sp_req(sp);
+	spinlock_t *lock = qla2x00_req_lock(ha, req);
 
-	spin_lock_irqsave(&ha->hardware_lock, flags);
+	spin_lock_irqsave(lock, flags);
 	for (handle = 1; handle < req->num_outstanding_cmds; handle++) {
 		if (req->outstanding_cmds[handle] == sp)
 			break;
 	}
-	spin_unlock_irqrestore(&ha->hardware_lock, flags);
+	spin_unlock_irqrestore(lock, flags);
 	if (handle == req->num_outstanding_cmds) {
 		/* Command not found. */
 		return QLA_FUNCTION_FAILED;
@@ -1789,6 +1791,20 @@ qla2x00_alloc_outstanding_cmds(struct qla_hw_data *ha, struct req_que *req)
 		}
 	}
 
+	req->outstanding_map = kcalloc(BITS_TO_LONGS(req->num_outstanding_cmds),
+	    sizeof(unsigned long), GFP_KERNEL);
+	if (!req->outstanding_map) {
+		ql_log(ql_log_fatal, NULL, 0x0196,
+		    "Failed to allocate memory for "
+		    "outstanding_map for req_que %p.\n", req);
+		kfree(req->outstanding_cmds);
+		req->outstanding_cmds = NULL;
+		req->num_outstanding_cmds = 0;
+		return QLA_FUNCTION_FAILED;
+	}
+	/* Handle 0 is never handed out. */
+	__set_bit(0, req->outstanding_map);
+
 	return QLA_SUCCESS;
 }
 
@@ -2194,7 +2210,7 @@ qla2x00_init_rings(scsi_qla_host_t *vha)
 {
 	int	rval;
 	unsigned long flags = 0;
-	int cnt, que;
+	int que;
 	struct qla_hw_data *ha = vha->hw;
 	struct req_que *req;
 	struct rsp_que *rsp;
@@ -2210,10 +2226,7 @@ qla2x00_init_rings(scsi_qla_host_t *vha)
 			continue;
 		req->out_ptr = (void *)(req->ring + req->length);
 		*req->out_ptr = 0;
-		for (cnt = 1; cnt < req->num_outstanding_cmds; cnt++)
-			req->outstanding_cmds[cnt] = NULL;
-
-		req->current_outstanding_cmd = 1;
+		qla2x00_reset_outstanding(req);
 
 		/* Initialize firmware. */
 		req->ring_ptr  = req->ring;
@@ -3234,6 +3247,7 @@ qla2x00_configure_local_loop(scsi_qla_host_t *vha)
 		if (!found) {
 			/* New device, add to fcports list. */
 			list_add_tail(&new_fcport->list, &vha->vp_fcports);
+			qla2x00_ip_hash_fcport(vha, new_fcport);
 
 			/* Allocate a new replacement fcport. */
 			fcport = new_fcport;
@@ -3367,6 +3381,7 @@ qla2x00_update_fcport(scsi_qla_host_t *vha, fc_port_t *fcport)
 	qla2x00_iidma_fcport(vha, fcport);
 	qla24xx_update_fcport_fcp_prio(vha, fcport);
 	qla2x00_reg_remote_port(vha, fcport);
+	qla2x00_ip_fcport_online(vha, fcport);
 }
 
 /*
@@ -3552,6 +3567,7 @@ qla2x00_configure_fabric(scsi_qla_host_t *vha)
 			qla2x00_fabric_dev_login(vha, fcport, &next_loopid);
 
 			list_move_tail(&fcport->list, &vha->vp_fcports);
+			qla2x00_ip_hash_fcport(vha, fcport);
 		}
 	} while (0);
 
@@ -6587,3 +6603,153 @@ qla24xx_update_all_fcp_prio(scsi_qla_host_t *vha)
 
 	return ret;
 }
+
+/**
+ * qla2xxx_create_qpair() - Create a request/response queue pair.
+ * @vha: HA context the queue pair belongs to
+ * @qos: request queue QoS
+ * @vp_idx: vport index of the request queue
+ *
+ * The response queue takes a free MSI-X vector of its own; with managed
+ * affinity, qla2xxx_map_queues() maps the CPUs of that vector onto the queue
+ * pair.
+ *
+ * Returns the queue pair, NULL on failure.
+ */
+struct qla_qpair *
+qla2xxx_create_qpair(struct scsi_qla_host *vha, int qos, int vp_idx)
+{
+	int rsp_id = 0;
+	int req_id = 0;
+	struct qla_hw_data *ha = vha->hw;
+	uint16_t qpair_id = 0;
+	struct qla_qpair *qpair = NULL;
+
+	if (!ql2xmqsupport || !ha->queue_pair_map)
+		return NULL;
+
+	if (!(ha->fw_attributes & BIT_6) || !ha->flags.msix_enabled) {
+		ql_log(ql_log_warn, vha, 0x0183,
+		    "FW/Driver is not multi-queue capable.\n");
+		return NULL;
+	}
+
+	qpair = kzalloc(sizeof(struct qla_qpair), GFP_KERNEL);
+	if (qpair == NULL) {
+		ql_log(ql_log_warn, vha, 0x0184,
+		    "Failed to allocate memory for queue pair.\n");
+		return NULL;
+	}
+
+	spin_lock_init(&qpair->qp_lock);
+	atomic_set(&qpair->ref_count, 0);
+	qpair->hw = ha;
+	qpair->vha = vha;
+	qpair->vp_idx = vp_idx;
+
+	/* Assign available queue pair id */
+	mutex_lock(&ha->mq_lock);
+	qpair_id = find_first_zero_bit(ha->qpair_qid_map, ha->max_qpairs);
+	if (qpair_id >= ha->max_qpairs) {
+		mutex_unlock(&ha->mq_lock);
+		ql_log(ql_log_warn, vha, 0x0186,
+		    "No resources to create additional queue pair.\n");
+		goto fail_qid_map;
+	}
+	set_bit(qpair_id, ha->qpair_qid_map);
+	qpair->id = qpair_id;
+	mutex_unlock(&ha->mq_lock);
+
+	/* Create response queue first */
+	rsp_id = qla25xx_create_rsp_que(ha, 0, vp_idx, 0, -1, qpair);
+	if (!rsp_id) {
+		ql_log(ql_log_warn, vha, 0x0187,
+		    "Failed to create response queue.\n");
+		goto fail_rsp;
+	}
+	qpair->rsp = ha->rsp_q_map[rsp_id];
+	qpair->msix = qpair->rsp->msix;
+
+	req_id = qla25xx_create_req_que(ha, 0, vp_idx, 0, rsp_id, qos);
+	if (!req_id) {
+		ql_log(ql_log_warn, vha, 0x0194,
+		    "Failed to create request queue.\n");
+		goto fail_req;
+	}
+	qpair->req = ha->req_q_map[req_id];
+	qpair->req->qpair = qpair;
+	qpair->rsp->req = qpair->req;
+
+	if (IS_T10_PI_CAPABLE(ha) && ql2xenabledif &&
+	    (ha->fw_attributes & BIT_4))
+		qpair->difdix_supported = 1;
+
+	qpair->online = 1;
+
+	mutex_lock(&ha->mq_lock);
+	list_add_tail(&qpair->qp_list_elem, &vha->qp_list);
+	rcu_assign_pointer(ha->queue_pair_map[qpair_id], qpair);
+	mutex_unlock(&ha->mq_lock);
+
+	ql_dbg(ql_dbg_multiq, vha, 0xc00d,
+	    "Queue pair %d created, req %d rsp %d vector %d.\n",
+	    qpair->id, req_id, rsp_id, qpair->msix->vector);
+
+	return qpair;
+
+fail_req:
+	qla25xx_delete_rsp_que(vha, qpair->rsp);
+fail_rsp:
+	mutex_lock(&ha->mq_lock);
+	clear_bit(qpair_id, ha->qpair_qid_map);
+	mutex_unlock(&ha->mq_lock);
+fail_qid_map:
+	kfree(qpair);
+	return NULL;
+}
+
+/**
+ * qla2xxx_delete_qpair() - Delete a queue pair created by
+ * qla2xxx_create_qpair().
+ * @vha: HA context the queue pair belongs to
+ * @qpair: queue pair
+ *
+ * New commands are refused, and commands started on the queue pair are
+ * waited for, before its queues are deleted from the firmware.  The RCU grace
+ * period lets qla2xxx_queuecommand() calls that found the queue pair in
+ * ha->queue_pair_map finish, so the reference count covers every command.
+ * A queue pair that fails to delete stays out of ha->queue_pair_map.
+ *
+ * Returns QLA_SUCCESS, or the mailbox status if a queue could not be deleted.
+ */
+int
+qla2xxx_delete_qpair(struct scsi_qla_host *vha, struct qla_qpair *qpair)
+{
+	int ret;
+	struct qla_hw_data *ha = qpair->hw;
+
+	mutex_lock(&ha->mq_lock);
+	RCU_INIT_POINTER(ha->queue_pair_map[qpair->id], NULL);
+	mutex_unlock(&ha->mq_lock);
+
+	qpair->delete_in_progress = 1;
+	synchronize_rcu();
+	while (atomic_read(&qpair->ref_count))
+		msleep(500);
+
+	ret = qla25xx_delete_req_que(vha, qpair->req);
+	if (ret != QLA_SUCCESS)
+		return ret;
+	ret = qla25xx_delete_rsp_que(vha, qpair->rsp);
+	if (ret != QLA_SUCCESS)
+		return ret;
+
+	mutex_lock(&ha->mq_lock);
+	clear_bit(qpair->id, ha->qpair_qid_map);
+	list_del(&qpair->qp_list_elem);
+	mutex_unlock(&ha->mq_lock);
+
+	kfree(qpair);
+
+	return QLA_SUCCESS;
+}
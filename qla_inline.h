@@ -235,13 +235,145 @@ qla2x00_rel_sp(scsi_qla_host_t *vha, srb_t *sp)
 	QLA_VHA_MARK_NOT_BUSY(vha);
 }
 
+/*
+ * FCP command srbs live in the scsi_cmnd private area, see struct
+ * qla_cmd_priv.  Only the srb header and u.scmd are cleared; the much larger
+ * srb_iocb member of the union is never used by a SCSI command.
+ */
+static inline srb_t *
+qla2x00_init_cmd_sp(struct scsi_cmnd *cmd, fc_port_t *fcport,
+    struct qla_qpair *qpair)
+{
+	srb_t *sp = &((struct qla_cmd_priv *)scsi_cmd_priv(cmd))->sp;
+
+	memset(sp, 0, offsetof(srb_t, u));
+	memset(&sp->u.scmd, 0, sizeof(sp->u.scmd));
+	atomic_set(&sp->ref_count, 1);
+	sp->fcport = fcport;
+	sp->qpair = qpair;
+	sp->type = SRB_SCSI_CMD;
+	sp->iocbs = 1;
+	sp->u.scmd.cmd = cmd;
+	CMD_SP(cmd) = (void *)sp;
+	return sp;
+}
+
+static inline srb_t *
+qla2x00_get_cmd_sp(scsi_qla_host_t *vha, fc_port_t *fcport,
+    struct scsi_cmnd *cmd)
+{
+	uint8_t bail;
+
+	QLA_VHA_MARK_BUSY(vha, bail);
+	if (unlikely(bail))
+		return NULL;
+
+	return qla2x00_init_cmd_sp(cmd, fcport, NULL);
+}
+
+static inline void
+qla2x00_rel_cmd_sp(scsi_qla_host_t *vha, srb_t *sp)
+{
+	QLA_VHA_MARK_NOT_BUSY(vha);
+}
+
+static inline srb_t *
+qla2xxx_get_qpair_sp(struct qla_qpair *qpair, fc_port_t *fcport,
+    struct scsi_cmnd *cmd)
+{
+	uint8_t bail;
+
+	QLA_QPAIR_MARK_BUSY(qpair, bail);
+	if (unlikely(bail))
+		return NULL;
+
+	return qla2x00_init_cmd_sp(cmd, fcport, qpair);
+}
+
+static inline void
+qla2xxx_rel_qpair_sp(struct qla_qpair *qpair, srb_t *sp)
+{
+	QLA_QPAIR_MARK_NOT_BUSY(qpair);
+}
+
+static inline struct ct6_dsd *
+qla2x00_cmd_ct6(srb_t *sp)
+{
+	return &container_of(sp, struct qla_cmd_priv, sp)->ct6;
+}
+
+/*
+ * Request queue a SCSI command was started on, and the lock serializing its
+ * outstanding commands.
+ */
+static inline struct req_que *
+qla2x00_sp_req(srb_t *sp)
+{
+	return sp->qpair ? sp->qpair->req : sp->fcport->vha->req;
+}
+
+static inline spinlock_t *
+qla2x00_req_lock(struct qla_hw_data *ha, struct req_que *req)
+{
+	return req->qpair ? &req->qpair->qp_lock : &ha->hardware_lock;
+}
+
+/*
+ * Outstanding command handles.  Busy slots of req->outstanding_cmds are
+ * mirrored in req->outstanding_map so a free handle is found with a word-wide
+ * bit search instead of walking the array.  Handles are still handed out
+ * round-robin after the last one used; handle 0 is never valid.  Callers hold
+ * the request queue lock.
+ */
+static inline uint32_t
+qla2x00_alloc_handle(struct req_que *req)
+{
+	uint32_t handle;
+
+	handle = find_next_zero_bit(req->outstanding_map,
+	    req->num_outstanding_cmds, req->current_outstanding_cmd + 1);
+	if (handle >= req->num_outstanding_cmds)
+		handle = find_next_zero_bit(req->outstanding_map,
+		    req->num_outstanding_cmds, 1);
+	if (handle >= req->num_outstanding_cmds)
+		return 0;
+	return handle;
+}
+
+static inline void
+qla2x00_set_outstanding(struct req_que *req, uint32_t handle, srb_t *sp)
+{
+	req->current_outstanding_cmd = handle;
+	req->outstanding_cmds[handle] = sp;
+	__set_bit(handle, req->outstanding_map);
+	sp->handle = handle;
+}
+
+static inline void
+qla2x00_clear_outstanding(struct req_que *req, uint32_t handle)
+{
+	req->outstanding_cmds[handle] = NULL;
+	__clear_bit(handle, req->outstanding_map);
+}
+
+static inline void
+qla2x00_reset_outstanding(struct req_que *req)
+{
+	req->current_outstanding_cmd = 1;
+	if (!req->outstanding_cmds)
+		return;
+
+	memset(req->outstanding_cmds, 0,
+	    sizeof(srb_t *) * req->num_outstanding_cmds);
+	bitmap_zero(req->outstanding_map, req->num_outstanding_cmds);
+	__set_bit(0, req->outstanding_map);
+}
+
 static inline void
 qla2x00_init_timer(srb_t *sp, unsigned long tmo)
 {
-	init_timer(&sp->u.iocb_cmd.timer);
+	timer_setup(&sp->u.iocb_cmd.timer, qla2x00_sp_timeout, 0);
 	sp->u.iocb_cmd.timer.expires = jiffies + tmo * HZ;
-	sp->u.iocb_cmd.timer.data = (unsigned long)sp;
-	sp->u.iocb_cmd.timer.function = qla2x00_sp_timeout;
 	add_timer(&sp->u.iocb_cmd.timer);
 	sp->free = qla2x00_sp_free;
 	if ((IS_QLAFX00(sp->fcport->vha->hw)) &&
@@ -7,6 +7,7 @@
 #include <linux/if_ether.h>
 #include <linux/if_arp.h>
 #include <linux/ip.h>
+#include <linux/jhash.h>
 #include "qla_def.h"
 #include "qla_ip.h"
 
@@ -14,10 +15,9 @@ int qla2x00_mailbox_command(scsi_qla_host_t *vha, mbx_cmd_t *mcp);
 void qla2x00_isp_cmd(scsi_qla_host_t *vha);
 void * qla2x00_req_pkt(scsi_qla_host_t *vha);
 
+static void qla2x00_ip_flush_pending(scsi_qla_host_t *, fc_port_t *, int);
 
 
-#define BROADCAST_4G		0x7ff
-
 extern struct list_head qla_hostlist;
 extern rwlock_t qla_hostlist_lock;
 int include_me = 1;
@@ -110,9 +110,9 @@ qla2x00_ip_initialize(scsi_qla_host_t *ha)
 	}
 
 	/* Setup IP initialization control block */
-	ipinit_cb = pci_alloc_consistent(ha->pdev,
-					 sizeof(struct ip_init_cb),
-					 &ipinit_cb_dma);
+	ipinit_cb = dma_alloc_coherent(&ha->pdev->dev,
+				       sizeof(struct ip_init_cb),
+				       &ipinit_cb_dma, GFP_KERNEL);
 	if (ipinit_cb) {
 		memset(ipinit_cb, 0, sizeof(struct ip_init_cb));
 		ipinit_cb->version = IPICB_VERSION;
@@ -175,8 +175,8 @@ qla2x00_ip_initialize(scsi_qla_host_t *ha)
 				       __func__, status, mcp->mb[0]));
 			status = 0;
 		}
-		pci_free_consistent(ha->pdev, sizeof(struct ip_init_cb),
-				    ipinit_cb, ipinit_cb_dma);
+		dma_free_coherent(&ha->pdev->dev, sizeof(struct ip_init_cb),
+				  ipinit_cb, ipinit_cb_dma);
 
 	} else {
 		DEBUG12(printk("%s: memory allocation error\n", __func__));
@@ -189,64 +189,152 @@ qla2x00_ip_initialize(scsi_qla_host_t *ha)
 
 #endif
 
+/**
+ * qla2x00_ip_rx_pools() - Check for small receive buffer pool support.
+ * @ha: SCSI driver HA context
+ *
+ * The firmware is told the size of each receive buffer pool in the IP
+ * initialization control block.  The 24xx firmware interface only documents
+ * the (large) receive_buffer_size, so a small buffer pool is only offered on
+ * software-emulated adapters, whose firmware honours small_buffer_size.
+ *
+ * Returns 1 if a small receive buffer pool is supported.
+ */
+static int
+qla2x00_ip_rx_pools(scsi_qla_host_t *ha)
+{
+	return ha->ip.emu != NULL;
+}
+
+/**
+ * qla2x00_ip_mailbox_command() - Issue an IP mailbox command.
+ * @ha: SCSI driver HA context
+ * @mcp: mailbox command
+ *
+ * The commands of a software-emulated adapter are executed by its emulated
+ * firmware, see qla_ip_emu.c.
+ *
+ * Returns QLA_SUCCESS if the command completed.
+ */
+static int
+qla2x00_ip_mailbox_command(scsi_qla_host_t *ha, mbx_cmd_t *mcp)
+{
+	if (ha->ip.emu)
+		return qla2x00_ip_emu_mailbox(ha, mcp);
+
+	return qla2x00_mailbox_command(ha, mcp);
+}
+
+/**
+ * qla24xx_add_buffers() - Load free receive buffers into the firmware pools.
+ * @ha: SCSI driver HA context
+ * @unused: unused, the buffers are taken from the free receive buffer rings
+ * @ha_locked: the hardware_lock is already held
+ *
+ * This routine is called by the IP driver once it has pushed replenished
+ * buffers onto the free receive buffer rings.  Each pool's ring is drained
+ * into IP Load Pool IOCBs for that pool, IP_POOL_BUFFERS per IOCB, and the
+ * doorbell is rung once for the batch.  Buffers that do not fit on the
+ * request queue stay on their ring for the next call.
+ */
 static void
 qla24xx_add_buffers(scsi_qla_host_t *ha, uint16_t unused, int ha_locked)
 {
-	int i;
+	int i, pool;
+	uint16_t cnt;
+	uint16_t req_cnt;
+	uint32_t prod[BD_RX_POOLS];
+	uint32_t cons, count;
 	unsigned long flags = 0;
-	struct buffer_cb *bcbs;
-	struct ip_load_pool_24xx *pkt = NULL;
-	struct risc_rec_entry *rentry = NULL;
-
-	flags = 0;
-	unused = 0;
+	struct bd_rx_ring *ring;
+	struct req_que *req = ha->req;
+	struct buffer_cb *bcb;
+	struct ip_load_pool_24xx *pkt;
+	struct risc_rec_entry *rentry;
 
 	if (!ha_locked)
 		spin_lock_irqsave(&ha->hw->hardware_lock, flags);
 
-	bcbs = ha->ip.receive_buffers;
-	i = 0; /* Need to initalize out of while */
-	while (1) {
-		for (; i < ha->ip.max_receive_buffers; i++, bcbs++)
-			if (!test_and_set_bit(BCB_RISC_OWNS_BUFFER,
-			    &bcbs->state))
-				break;
+	if (!ha->ip.rx_ring)
+		goto done;
 
-		if (i == ha->ip.max_receive_buffers)
-			break;
+	/* Read the handles after the producer indices */
+	req_cnt = 0;
+	for (pool = 0; pool < BD_RX_POOLS; pool++) {
+		ring = &ha->ip.rx_ring[pool];
+		prod[pool] = smp_load_acquire(&ring->prod);
+		req_cnt += DIV_ROUND_UP(prod[pool] - ring->cons,
+		    IP_POOL_BUFFERS);
+	}
+	if (!req_cnt)
+		goto done;
+
+	/* Reserve request queue entries for the whole batch */
+	if (req->cnt < req_cnt + 2) {
+		cnt = (uint16_t)RD_REG_DWORD_RELAXED(req->req_q_out);
+		if (req->ring_index < cnt)
+			req->cnt = cnt - req->ring_index;
+		else
+			req->cnt = req->length - (req->ring_index - cnt);
+	}
+	if (req->cnt < req_cnt + 2) {
+		if (req->cnt <= 2) {
+			ql_dbg(ql_dbg_disc, ha, 0x0, "%s(%ld): failed to "
+			    "allocate IP resource IOCB.\n", __func__,
+			    ha->host_no);
+			goto done;
+		}
+		req_cnt = req->cnt - 2;
+	}
 
-		if (!pkt) {
-			pkt = qla2x00_req_pkt(ha);
-			if (!pkt) {
-				ql_dbg(ql_dbg_disc, ha, 0x0, "%s(%ld): failed to allocate "
-				    "IP resource IOCB.\n", __func__,
-				    ha->host_no);
-				clear_bit(BCB_RISC_OWNS_BUFFER, &bcbs->state);
-				break;
-			}
+	for (pool = 0; pool < BD_RX_POOLS && req_cnt; pool++) {
+		ring = &ha->ip.rx_ring[pool];
+		cons = ring->cons;
+		count = min_t(uint32_t, prod[pool] - cons,
+		    req_cnt * IP_POOL_BUFFERS);
+
+		while (count) {
+			pkt = (struct ip_load_pool_24xx *)req->ring_ptr;
+			memset(pkt, 0, REQUEST_ENTRY_SIZE);
 			pkt->entry_type = IP_LOAD_POOL_24XX;
+			pkt->entry_count = 1;
+			pkt->pool_id = cpu_to_le16(pool);
+
 			rentry = pkt->buffers;
+			for (i = 0; i < IP_POOL_BUFFERS && count;
+			    i++, count--) {
+				bcb = &ha->ip.receive_buffers[ring->handles[
+				    cons++ & (BD_RX_RING_SIZE - 1)]];
+				set_bit(BCB_RISC_OWNS_BUFFER, &bcb->state);
+
+				rentry->handle = bcb->handle;
+				rentry->data_addr_low =
+				    cpu_to_le32(LSD(bcb->skb_data_dma));
+				rentry->data_addr_high =
+				    cpu_to_le32(MSD(bcb->skb_data_dma));
+				rentry++;
+			}
+			pkt->buffer_count = cpu_to_le16(i);
+
+			/* Adjust ring index. */
+			req->ring_index++;
+			if (req->ring_index == req->length) {
+				req->ring_index = 0;
+				req->ring_ptr = req->ring;
+			} else
+				req->ring_ptr++;
+			req->cnt--;
+			req_cnt--;
 		}
-		ha->ip.rec_entries_in++;
-
-		rentry->handle = bcbs->handle;
-		rentry->data_addr_low = cpu_to_le32(LSD(bcbs->skb_data_dma));
-		rentry->data_addr_high = cpu_to_le32(MSD(bcbs->skb_data_dma));
-		rentry++;
-
-		pkt->buffer_count++;
-		if (pkt->buffer_count == IP_POOL_BUFFERS) {
-			wmb();
-			qla2x00_isp_cmd(ha);
-			pkt = NULL;
-		}
+		WRITE_ONCE(ring->cons, cons);
 	}
+	wmb();
 
-	if (pkt) {
-		wmb();
-		qla2x00_isp_cmd(ha);
-	}
+	/* Set chip new ring index. */
+	WRT_REG_DWORD(req->req_q_in, req->ring_index);
+	RD_REG_DWORD_RELAXED(req->req_q_in);	/* PCI Posting. */
 
+done:
 	if (!ha_locked)
 		spin_unlock_irqrestore(&ha->hw->hardware_lock, flags);
 }
@@ -271,8 +359,8 @@ qla24xx_ip_initialize(scsi_qla_host_t *ha)
 	}
 
 	/* Setup IP initialization control block */
-	ipinit_cb = pci_alloc_consistent(ha->hw->pdev,
-	    sizeof(struct ip_init_cb_24xx), &ipinit_cb_dma);
+	ipinit_cb = dma_alloc_coherent(&ha->hw->pdev->dev,
+	    sizeof(struct ip_init_cb_24xx), &ipinit_cb_dma, GFP_KERNEL);
 	if (ipinit_cb) {
 		memset(ipinit_cb, 0, sizeof(struct ip_init_cb_24xx));
 		ipinit_cb->version = IPICB_VERSION;
@@ -281,6 +369,8 @@ qla24xx_ip_initialize(scsi_qla_host_t *ha)
 		ipinit_cb->mtu = cpu_to_le16((uint16_t) ha->ip.mtu);
 		ipinit_cb->receive_buffer_size =
 		    cpu_to_le16((uint16_t) ha->ip.receive_buff_data_size);
+		ipinit_cb->small_buffer_size =
+		    cpu_to_le16(ha->ip.small_buff_data_size);
 		ipinit_cb->low_water_mark =
 		    __constant_cpu_to_le16(IPICB_LOW_WATER_MARK);
 		ipinit_cb->container_count =
@@ -298,7 +388,7 @@ qla24xx_ip_initialize(scsi_qla_host_t *ha)
 		mcp->buf_size = sizeof(struct ip_init_cb);
 		mcp->flags = MBX_DMA_OUT;
 
-		status = qla2x00_mailbox_command(ha, mcp);
+		status = qla2x00_ip_mailbox_command(ha, mcp);
 		if (status == QL_STATUS_SUCCESS) {
 			/* IP initialization successful */
 			ql_dbg(ql_dbg_disc, ha, 0x0, "%s: successful\n", __func__);
@@ -306,6 +396,8 @@ qla24xx_ip_initialize(scsi_qla_host_t *ha)
 			ha->ip.flags.enable_ip = 1;
 
 			qla24xx_add_buffers(ha, 0, 0);
+			if (ha->ip.emu)
+				qla2x00_ip_emu_doorbell(ha);
 
 			/* Force database update */
 			set_bit(LOOP_RESYNC_NEEDED, &ha->dpc_flags);
@@ -323,8 +415,8 @@ qla24xx_ip_initialize(scsi_qla_host_t *ha)
 			    "%x\n", __func__, status, mcp->mb[0]);
 			status = 0;
 		}
-		pci_free_consistent(ha->hw->pdev, sizeof(struct ip_init_cb_24xx),
-		    ipinit_cb, ipinit_cb_dma);
+		dma_free_coherent(&ha->hw->pdev->dev,
+		    sizeof(struct ip_init_cb_24xx), ipinit_cb, ipinit_cb_dma);
 
 	} else {
 		ql_dbg(ql_dbg_disc, ha, 0x0, "%s: memory allocation error\n", __func__);
@@ -358,9 +450,9 @@ qla2x00_ip_send_complete(scsi_qla_host_t *ha,
 			ha->active_scb_q[handle] = NULL;
 
 			scb->comp_status = comp_status;
-			pci_unmap_single(ha->pdev,
+			dma_unmap_single(&ha->pdev->dev,
 					 scb->skb_data_dma,
-					 scb->skb->len, PCI_DMA_TODEVICE);
+					 scb->skb->len, DMA_TO_DEVICE);
 
 			/* Return send packet to IP driver */
 			ha->send_completion_routine(scb);
@@ -378,22 +470,35 @@ qla2x00_ip_send_complete(scsi_qla_host_t *ha,
 #endif
 
 
+/**
+ * qla24xx_ip_send_complete() - Handle IP send completion.
+ * @ha: SCSI driver HA context
+ * @handle: handle to completed send_cb
+ * @comp_status: Firmware completion status of send_cb
+ *
+ * Note: called with the lock of the handle's transmit queue held, either
+ * the hardware_lock or the q_lock of a dedicated queue pair.
+ */
 void
 qla24xx_ip_send_complete(scsi_qla_host_t *ha, uint32_t handle,
     uint16_t comp_status)
 {
 	struct send_cb *scb;
+	struct qla_ip_txq *txq;
+	uint16_t queue = IP_SEND_HANDLE_QUEUE(handle);
+	uint16_t index = IP_SEND_HANDLE_INDEX(handle);
 
 	/* Set packet pointer from queue entry handle */
-	if (handle < MAX_SEND_PACKETS) {
-		scb = ha->ip.active_scb_q[handle];
+	txq = queue < ha->ip.num_txqs ? &ha->ip.txq[queue] : NULL;
+	if (txq && index < txq->max_send_packets) {
+		scb = txq->active_scb_q[index];
 		if (scb) {
-			ha->ip.ipreq_cnt--;
-			ha->ip.active_scb_q[handle] = NULL;
+			txq->ipreq_cnt--;
+			txq->active_scb_q[index] = NULL;
+			txq->free_scb_q[txq->free_scb_cnt++] = index;
+			txq->tx_mod.intr_frames++;
 
 			scb->comp_status = comp_status;
-			pci_unmap_single(ha->hw->pdev, scb->skb_data_dma,
-			    scb->skb->len, PCI_DMA_TODEVICE);
 
 			/* Return send packet to IP driver */
 			ha->ip.send_completion_routine(scb);
@@ -537,6 +642,20 @@ qla2x00_ip_receive(scsi_qla_host_t *ha, struct ip_rec_entry *iprec_entry)
 
 #endif
 
+/**
+ * qla24xx_ip_buffer_size() - Data size of a receive buffer.
+ * @ha: SCSI driver HA context
+ * @bcb: receive buffer
+ *
+ * Returns the buffer size of @bcb's firmware buffer pool.
+ */
+static inline uint32_t
+qla24xx_ip_buffer_size(scsi_qla_host_t *ha, struct buffer_cb *bcb)
+{
+	return bcb->pool_id == BD_POOL_SMALL ? ha->ip.small_buff_data_size :
+	    ha->ip.receive_buff_data_size;
+}
+
 void
 qla24xx_ip_receive(scsi_qla_host_t *ha, struct ip_rec_entry_24xx *iprec_entry)
 {
@@ -550,12 +669,6 @@ qla24xx_ip_receive(scsi_qla_host_t *ha, struct ip_rec_entry_24xx *iprec_entry)
 
 	comp_status = le16_to_cpu(iprec_entry->comp_status);
 
-	/* If split buffer, set header size for 1st buffer */
-	if (comp_status & BIT_0)
-		rec_data_size = ha->ip.header_size;
-	else
-		rec_data_size = ha->ip.receive_buff_data_size;
-
 	handle = iprec_entry->buffer_handles[0];
 	if (handle >= ha->ip.max_receive_buffers) {
 		/* Invalid handle from RISC, reset RISC firmware */
@@ -577,24 +690,42 @@ qla24xx_ip_receive(scsi_qla_host_t *ha, struct ip_rec_entry_24xx *iprec_entry)
 		return;
 	}
 
+	/* If split buffer, set header size for 1st buffer */
+	if (comp_status & IPREC_STATUS_SPLIT_BUFFER)
+		rec_data_size = ha->ip.header_size;
+	else
+		rec_data_size = qla24xx_ip_buffer_size(ha, bcb);
+
 	packet_size = le16_to_cpu(iprec_entry->sequence_length);
 	bcb->comp_status = comp_status;
 	bcb->packet_size = packet_size;
 	nbcb = bcb;
 
 	/* Prepare any linked buffers */
-	for (linked_bcb_cnt = 0; linked_bcb_cnt < IP_RCV_BUFFERS;
-	    linked_bcb_cnt++) {
+	for (linked_bcb_cnt = 0;; linked_bcb_cnt++) {
 		if (packet_size > rec_data_size) {
+			if (linked_bcb_cnt + 1 >= IP_RCV_BUFFERS) {
+				/*
+				 * Sequence larger than the buffers described
+				 * by the IOCB, reset RISC firmware
+				 */
+				printk(KERN_WARNING
+				    "%s: Bad IP sequence length %x...Post ISP "
+				    "Abort\n", __func__,
+				    le16_to_cpu(iprec_entry->sequence_length));
+				set_bit(ISP_ABORT_NEEDED, &ha->dpc_flags);
+				return;
+			}
 			nbcb->rec_data_size = rec_data_size;
 			packet_size -= rec_data_size;
 
 			/*
 			 * If split buffer, only use header size on 1st buffer
 			 */
-			rec_data_size = ha->ip.receive_buff_data_size;
+			rec_data_size = qla24xx_ip_buffer_size(ha, bcb);
 
-			handle = iprec_entry->buffer_handles[linked_bcb_cnt];
+			handle =
+			    iprec_entry->buffer_handles[linked_bcb_cnt + 1];
 			if (handle >= ha->ip.max_receive_buffers) {
 				/*
 				 * Invalid handle from RISC reset RISC firmware
@@ -609,7 +740,9 @@ qla24xx_ip_receive(scsi_qla_host_t *ha, struct ip_rec_entry_24xx *iprec_entry)
 			nbcb->next_bcb = &ha->ip.receive_buffers[handle];
 			nbcb = nbcb->next_bcb;
 
-			if (!test_and_clear_bit(BCB_RISC_OWNS_BUFFER,
+			/* Linked buffers come from the same pool */
+			if (nbcb->pool_id != bcb->pool_id ||
+			    !test_and_clear_bit(BCB_RISC_OWNS_BUFFER,
 			    &nbcb->state)) {
 				/*
 				 * Invalid handle from RISC reset RISC firmware
@@ -629,28 +762,14 @@ qla24xx_ip_receive(scsi_qla_host_t *ha, struct ip_rec_entry_24xx *iprec_entry)
 		}
 	}
 
-	/* Check for incoming ARP packet with matching IP address */
-	if (le16_to_cpu(iprec_entry->service_class) == 0) {
-		fc_port_t *fcport;
-		struct packet_header *packethdr;
-
-		packethdr = (struct packet_header *)bcb->skb_data;
-
-		/* Scan list of IP devices to see if login needed */
-		list_for_each_entry(fcport, &ha->vp_fcports, list)
-			if (!memcmp(&fcport->port_name[2],
-			    packethdr->networkh.s.na.addr, ETH_ALEN))
-				break;
-	}
-
-	/* Pass received packet to IP driver */
+	/*
+	 * Pass received packet to IP driver.  The IP driver only queues the
+	 * buffer_cb here and defers all packet processing (and buffer
+	 * replenishment) to its NAPI poll routine, keeping the time spent
+	 * under the hardware_lock to a minimum.
+	 */
 	bcb->linked_bcb_cnt = linked_bcb_cnt + 1;
 	ha->ip.receive_packets_routine(ha->ip.receive_packets_context, bcb);
-
-	/* Keep track of RISC buffer pointer (for IP reinit) */
-	ha->ip.rec_entries_out += linked_bcb_cnt + 1;
-	if (ha->ip.rec_entries_out >= IP_BUFFER_QUEUE_DEPTH)
-		ha->ip.rec_entries_out -= IP_BUFFER_QUEUE_DEPTH;
 }
 
 
@@ -671,6 +790,15 @@ qla2x00_convert_to_arp(scsi_qla_host_t *ha, struct send_cb *scb)
 
 	ql_dbg(ql_dbg_disc, ha, 0x0, "%s: convert packet to ARP\n", __func__);
 
+	/*
+	 * ARP header must fit in the linear (first) data segment, which must
+	 * hold the IP header, unlike for a TSO segment or an XDP frame.
+	 */
+	if (!(scb->flags & SCB_HEAD_MAPPED) ||
+	    scb->header_len != sizeof(struct packet_header) ||
+	    scb->dseg[0].length < sizeof(struct arp_header))
+		return 0;
+
 	skb = scb->skb;
 	packethdr = scb->header;
 	arphdr = (struct arp_header *)skb->data;
@@ -694,7 +822,16 @@ qla2x00_convert_to_arp(scsi_qla_host_t *ha, struct send_cb *scb)
 		memcpy(arphdr->ar_sha, packethdr->networkh.s.na.addr, ETH_ALEN);
 		memset(arphdr->ar_tha, 0, ETH_ALEN);
 
-		skb->len = sizeof(struct arp_header);
+		/*
+		 * The skb keeps its length, its fragments are still mapped;
+		 * the IOCB is built with the ARP header length instead.
+		 */
+		scb->flags |= SCB_ARP_CONVERTED;
+
+		/* Data was rewritten after the IP driver mapped it */
+		dma_sync_single_for_device(&ha->hw->pdev->dev,
+		    scb->dseg[0].address, sizeof(struct arp_header),
+		    DMA_TO_DEVICE);
 
 		return 1;
 	} else {
@@ -703,30 +840,205 @@ qla2x00_convert_to_arp(scsi_qla_host_t *ha, struct send_cb *scb)
 	return 1;
 }
 
+/**
+ * qla2x00_ip_addr_hash() - Hash the IEEE MAC portion of a port name.
+ * @addr: The 6 byte IEEE MAC address
+ */
+static inline u32
+qla2x00_ip_addr_hash(const uint8_t *addr)
+{
+	return jhash(addr, ETH_ALEN, 0);
+}
+
+/**
+ * qla2x00_ip_hash_fcport() - Add a port to the IP destination hash.
+ * @ha: SCSI driver HA context
+ * @fcport: The port added to the @ha port list
+ *
+ * Called whenever a port is added to the vp_fcports list, so that
+ * qla2x00_get_ip_loopid() does not have to scan the list.
+ */
+void
+qla2x00_ip_hash_fcport(scsi_qla_host_t *ha, fc_port_t *fcport)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ha->hw->hardware_lock, flags);
+	if (!hash_hashed(&fcport->ip_hash))
+		hash_add_rcu(ha->ip.fcport_hash, &fcport->ip_hash,
+		    qla2x00_ip_addr_hash(&fcport->port_name[2]));
+	spin_unlock_irqrestore(&ha->hw->hardware_lock, flags);
+}
+
+/**
+ * qla2x00_ip_del_fcport() - Unlink a port from the IP destination hash.
+ * @ha: SCSI driver HA context
+ * @fcport: The port to unlink
+ *
+ * The caller holds the hardware_lock and waits for an RCU grace period
+ * before @fcport is freed.
+ *
+ * Returns 1 if @fcport was hashed.
+ */
+static int
+qla2x00_ip_del_fcport(scsi_qla_host_t *ha, fc_port_t *fcport)
+{
+	if (!hash_hashed(&fcport->ip_hash))
+		return 0;
+
+	hash_del_rcu(&fcport->ip_hash);
+	smp_wmb();
+	ha->ip.dest_gen++;
+	return 1;
+}
+
+/**
+ * qla2x00_ip_unhash_fcport() - Remove a port from the IP destination hash.
+ * @ha: SCSI driver HA context
+ * @fcport: The port about to be freed
+ *
+ * The per-CPU destination caches are invalidated, and transmitters that may
+ * still reference @fcport are waited for.  Must be called from process
+ * context.
+ */
+void
+qla2x00_ip_unhash_fcport(scsi_qla_host_t *ha, fc_port_t *fcport)
+{
+	int hashed;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ha->hw->hardware_lock, flags);
+	hashed = qla2x00_ip_del_fcport(ha, fcport);
+	spin_unlock_irqrestore(&ha->hw->hardware_lock, flags);
+
+	if (hashed)
+		synchronize_rcu();
+
+	/* Fail any packets still waiting for the port */
+	if (fcport->ip_pending_cnt)
+		qla2x00_ip_flush_pending(ha, fcport, 1);
+}
+
+/**
+ * qla2x00_ip_unhash_fcports() - Remove all ports from the IP destination hash.
+ * @ha: SCSI driver HA context
+ *
+ * As qla2x00_ip_unhash_fcport() for every port on the vp_fcports list, with
+ * a single RCU grace period for the lot.  Must be called from process
+ * context.
+ */
+void
+qla2x00_ip_unhash_fcports(scsi_qla_host_t *ha)
+{
+	int hashed = 0;
+	unsigned long flags;
+	fc_port_t *fcport;
+
+	spin_lock_irqsave(&ha->hw->hardware_lock, flags);
+	list_for_each_entry(fcport, &ha->vp_fcports, list)
+		hashed |= qla2x00_ip_del_fcport(ha, fcport);
+	spin_unlock_irqrestore(&ha->hw->hardware_lock, flags);
+
+	if (hashed)
+		synchronize_rcu();
+
+	/* Fail any packets still waiting for the ports */
+	list_for_each_entry(fcport, &ha->vp_fcports, list) {
+		if (fcport->ip_pending_cnt)
+			qla2x00_ip_flush_pending(ha, fcport, 1);
+	}
+}
+
+/**
+ * qla2x00_ip_find_fcport() - Find the port owning an IEEE MAC address.
+ * @ha: SCSI driver HA context
+ * @addr: The IEEE MAC portion of the destination port name
+ *
+ * The last destination resolved on this CPU is checked first, then the port
+ * hash.  Cache entries are only valid for the ha->ip.dest_gen they were
+ * filled in.  Must be called under rcu_read_lock(); the port may not be
+ * used once it is dropped.
+ *
+ * Returns the matching fc_port_t, else NULL.
+ */
+static fc_port_t *
+qla2x00_ip_find_fcport(scsi_qla_host_t *ha, const uint8_t *addr)
+{
+	fc_port_t *fcport;
+	uint32_t gen;
+	struct qla_ip_dest_cache __percpu *dest_cache;
+	struct qla_ip_dest_cache *cache;
+
+	gen = READ_ONCE(ha->ip.dest_gen);
+	smp_rmb();
+
+	cache = NULL;
+	dest_cache = READ_ONCE(ha->ip.dest_cache);
+	if (dest_cache) {
+		cache = get_cpu_ptr(dest_cache);
+		if (cache->fcport && cache->gen == gen &&
+		    !memcmp(cache->addr, addr, ETH_ALEN)) {
+			fcport = cache->fcport;
+			goto done;
+		}
+	}
+
+	hash_for_each_possible_rcu(ha->ip.fcport_hash, fcport, ip_hash,
+	    qla2x00_ip_addr_hash(addr)) {
+		if (memcmp(&fcport->port_name[2], addr, ETH_ALEN))
+			continue;
+
+		if (cache) {
+			memcpy(cache->addr, addr, ETH_ALEN);
+			cache->gen = gen;
+			cache->fcport = fcport;
+		}
+		goto done;
+	}
+	fcport = NULL;
+done:
+	if (cache)
+		put_cpu_ptr(dest_cache);
+
+	return fcport;
+}
+
 /**
  * qla2x00_get_ip_loopid() - Retrieve loop id of an IP device.
  * @ha: SCSI driver HA context
  * @packethdr: IP device to remove
  * @loop_id: loop id of discovered device
+ * @fcportp: returned destination port, if known
+ * @held: @packethdr is of a send_cb held on the pending queue
  *
  * This routine will interrogate the packet header to determine if the sender is
  * in the list of active IP devices.  The first two bytes of the destination
  * address will be modified to match the port name stored in the active IP
  * device list.
  *
+ * If the destination port is known but not logged in (or still has packets
+ * waiting for its login, unless @held), @fcportp is set and no loop id is
+ * returned.
+ *
+ * Note: called under rcu_read_lock().
+ *
  * Returns 1 if a valid loop id is returned.
  */
 static int
 qla2x00_get_ip_loopid(scsi_qla_host_t *ha,
-		      struct packet_header *packethdr, uint16_t * loop_id)
+		      struct packet_header *packethdr, uint16_t * loop_id,
+		      fc_port_t **fcportp, int held)
 {
 	fc_port_t *fcport;
 
-	/* Scan list of logged in IP devices for match */
-	list_for_each_entry(fcport, &ha->vp_fcports, list) {
-		if (memcmp(&fcport->port_name[2],
-			   &(packethdr->networkh.d.fcaddr[2]), ETH_ALEN))
-			continue;
+	/* Look up logged in IP devices for match */
+	fcport = qla2x00_ip_find_fcport(ha, &packethdr->networkh.d.fcaddr[2]);
+	*fcportp = fcport;
+	if (fcport) {
+		/* Keep packet order while the port is (re)logged in */
+		if (atomic_read(&fcport->state) != FCS_ONLINE ||
+		    (fcport->ip_pending_cnt && !held))
+			return 0;
 
 		/* Found match, return loop ID  */
 		*loop_id = fcport->loop_id;
@@ -738,7 +1050,10 @@ qla2x00_get_ip_loopid(scsi_qla_host_t *ha,
 		return 1;
 	}
 
-	/* Check for broadcast or multicast packet */
+	/*
+	 * Check for broadcast or multicast packet; FC has no multicast, the
+	 * receiving IP drivers filter the groups
+	 */
 	if (!memcmp(packethdr->networkh.d.na.addr, hwbroadcast_addr,
 	    ETH_ALEN) || (packethdr->networkh.d.na.addr[0] & 0x01)) {
 		/* Broadcast packet, return broadcast loop ID  */
@@ -754,9 +1069,7 @@ qla2x00_get_ip_loopid(scsi_qla_host_t *ha,
 		return 1;
 	}
 
-	/* TODO */
-	/* Try sending FARP IOCB to request login */
-
+	/* Unknown port, the caller falls back to a broadcast ARP */
 	ql_dbg(ql_dbg_disc, ha, 0x0, "%s: ID not found for "
 		       "XX XX %02x %02x %02x %02x %02x %02x\n",
 		       __func__,
@@ -771,72 +1084,729 @@ qla2x00_get_ip_loopid(scsi_qla_host_t *ha,
 }
 
 /**
- * qla2x00_ip_enable() - Create IP-driver/SCSI-driver IP connection.
+ * qla2x00_ip_login_fcport() - Request a login to an IP destination port.
  * @ha: SCSI driver HA context
- * @enable_data: bd_enable data describing the IP connection
+ * @fcport: The port to log in to
  *
- * This routine is called by the IP driver to enable an IP connection to the
- * SCSI driver and to pass in IP driver parameters.
+ * An asynchronous PLOGI is posted if the port still has a loop id, else the
+ * DPC relogin logic is asked to find one and log in.
  *
- * The HA context is propagated with the specified @enable_data and the
- * Firmware is initialized for IP support.
+ * Note: called with the hardware_lock held.
+ */
+static void
+qla2x00_ip_login_fcport(scsi_qla_host_t *ha, fc_port_t *fcport)
+{
+	if (fcport->flags & FCF_ASYNC_SENT)
+		return;
+
+	if (IS_ALOGIO_CAPABLE(ha->hw) && (fcport->flags & FCF_FABRIC_DEVICE) &&
+	    fcport->loop_id != FC_NO_LOOP_ID) {
+		fcport->flags |= FCF_ASYNC_SENT;
+		if (qla2x00_post_async_login_work(ha, fcport, NULL) ==
+		    QLA_SUCCESS)
+			return;
+		fcport->flags &= ~FCF_ASYNC_SENT;
+	}
+
+	fcport->flags |= FCF_LOGIN_NEEDED;
+	if (!fcport->login_retry)
+		fcport->login_retry = ha->hw->login_retry_count;
+	set_bit(RELOGIN_NEEDED, &ha->dpc_flags);
+	qla2xxx_wake_dpc(ha);
+}
+
+/**
+ * qla2x00_ip_queue_pending() - Hold a send_cb until its port is logged in.
+ * @ha: SCSI driver HA context
+ * @scb: The send_cb to hold
+ * @fcport: The destination port
  *
- * Returns 1 if the IP connection was successfully enabled.
+ * Held send_cbs are sent from qla2x00_ip_fcport_online() once the port is
+ * logged in, or completed with an error after IP_PENDING_TIMEOUT.
+ *
+ * Note: called with the hardware_lock held.
+ *
+ * Returns 1 if @scb was queued.
  */
 static int
-qla2x00_ip_enable(scsi_qla_host_t *ha, struct bd_enable *enable_data)
+qla2x00_ip_queue_pending(scsi_qla_host_t *ha, struct send_cb *scb,
+    fc_port_t *fcport)
 {
-	int status;
+	if (fcport->ip_pending_cnt >= IP_PENDING_PER_PORT ||
+	    ha->ip.pending_cnt >= IP_PENDING_MAX)
+		return 0;
 
-	ql_dbg(ql_dbg_disc, ha, 0x0, "%s: enable adapter %ld\n", __func__, ha->host_no);
+	/* Doorbell is rung when the send_cb is eventually sent */
+	scb->flags &= ~SCB_DEFER_DOORBELL;
+	scb->fcport = fcport;
+	scb->expires = jiffies + IP_PENDING_TIMEOUT;
+	list_add_tail(&scb->pending, &ha->ip.pending_q);
+	fcport->ip_pending_cnt++;
+	ha->ip.pending_cnt++;
 
-	status = 0;
+	if (atomic_read(&fcport->state) != FCS_ONLINE)
+		qla2x00_ip_login_fcport(ha, fcport);
 
-	/* Verify structure size and version and adapter online */
-	if (!(ha->flags.online) ||
-	    (enable_data->length != BDE_LENGTH) ||
-	    (enable_data->version != BDE_VERSION)) {
+	return 1;
+}
 
-		ql_dbg(ql_dbg_disc, ha, 0x0, "%s: incompatable structure or offline\n",
+/**
+ * qla24xx_ip_alloc_scb_tables() - Allocate a send_cb handle table.
+ * @ha: SCSI driver HA context
+ * @max_send_packets: number of send_cb handles to allocate
+ * @active_scb_q: returned table of outstanding send_cbs
+ * @free_scb_q: returned free-handle stack, filled with every handle
+ *
+ * Send handles are allocated from a free-handle stack, so both allocation in
+ * qla24xx_send_packet() and release in qla24xx_ip_send_complete() are O(1)
+ * regardless of the table size.
+ *
+ * Returns 1 if the tables were successfully allocated.
+ */
+static int
+qla24xx_ip_alloc_scb_tables(scsi_qla_host_t *ha, uint16_t max_send_packets,
+    struct send_cb ***active_scb_q, uint16_t **free_scb_q)
+{
+	int i;
+
+	*active_scb_q = kcalloc(max_send_packets, sizeof(struct send_cb *),
+	    GFP_KERNEL);
+	*free_scb_q = kcalloc(max_send_packets, sizeof(uint16_t), GFP_KERNEL);
+	if (!*active_scb_q || !*free_scb_q) {
+		ql_dbg(ql_dbg_disc, ha, 0x0, "%s: memory allocation error\n",
 		    __func__);
-		return status;
+		kfree(*active_scb_q);
+		kfree(*free_scb_q);
+		*active_scb_q = NULL;
+		*free_scb_q = NULL;
+		return 0;
 	}
 
-	/* Save parameters from IP driver */
-	ha->ip.mtu = enable_data->mtu;
-	ha->ip.header_size = enable_data->header_size;
-	ha->ip.receive_buffers = enable_data->receive_buffers;
-	ha->ip.max_receive_buffers = enable_data->max_receive_buffers;
-	ha->ip.receive_buff_data_size = enable_data->receive_buff_data_size;
-	if (test_bit(BDE_NOTIFY_ROUTINE, &enable_data->options)) {
-		ha->ip.notify_routine = enable_data->notify_routine;
-		ha->ip.notify_context = enable_data->notify_context;
-	}
-	ha->ip.send_completion_routine = enable_data->send_completion_routine;
-	ha->ip.receive_packets_routine = enable_data->receive_packets_routine;
-	ha->ip.receive_packets_context = enable_data->receive_packets_context;
+	/* Hand out the lowest handles first */
+	for (i = 0; i < max_send_packets; i++)
+		(*free_scb_q)[i] = max_send_packets - 1 - i;
 
-	/* Enable RISC IP support */
-	if (IS_QLA24XX(ha->hw) || IS_QLA54XX(ha->hw))
-		status = qla24xx_ip_initialize(ha);
-	else
-		//status = qla2x00_ip_initialize(ha);
-		status = 0; // only qla24xx supported
-	if (!status) {
-		ql_dbg(ql_dbg_disc, ha, 0x0, "%s: IP initialization failed", __func__);
-		ha->ip.notify_routine = NULL;
-	}
-	return status;
+	return 1;
 }
 
 /**
- * qla2x00_ip_disable() - Remove IP-driver/SCSI-driver IP connection.
+ * qla24xx_ip_alloc_send_q() - (Re)size the outstanding send_cb handle table.
  * @ha: SCSI driver HA context
+ * @txq: transmit queue to size
+ * @max_send_packets: number of send_cb handles to allocate
  *
- * This routine is called by the IP driver to disable a previously created IP
- * connection.
+ * The table can only be replaced while no send_cbs are outstanding on @txq.
  *
- * A Firmware call to disable IP support is issued.
+ * Returns 1 if the handle table was successfully allocated.
+ */
+static int
+qla24xx_ip_alloc_send_q(scsi_qla_host_t *ha, struct qla_ip_txq *txq,
+    uint16_t max_send_packets)
+{
+	unsigned long flags;
+	struct send_cb **active_scb_q, **old_active_scb_q;
+	uint16_t *free_scb_q, *old_free_scb_q;
+
+	if (max_send_packets < MIN_SEND_PACKETS ||
+	    max_send_packets > MAX_SEND_PACKETS)
+		return 0;
+
+	if (!qla24xx_ip_alloc_scb_tables(ha, max_send_packets, &active_scb_q,
+	    &free_scb_q))
+		return 0;
+
+	spin_lock_irqsave(txq->lock, flags);
+	if (txq->ipreq_cnt) {
+		spin_unlock_irqrestore(txq->lock, flags);
+		ql_dbg(ql_dbg_disc, ha, 0x0, "%s: %ld send_cbs outstanding\n",
+		    __func__, txq->ipreq_cnt);
+		kfree(active_scb_q);
+		kfree(free_scb_q);
+		return 0;
+	}
+	old_active_scb_q = txq->active_scb_q;
+	old_free_scb_q = txq->free_scb_q;
+	txq->active_scb_q = active_scb_q;
+	txq->free_scb_q = free_scb_q;
+	txq->free_scb_cnt = max_send_packets;
+	txq->max_send_packets = max_send_packets;
+	spin_unlock_irqrestore(txq->lock, flags);
+
+	kfree(old_active_scb_q);
+	kfree(old_free_scb_q);
+
+	return 1;
+}
+
+/**
+ * qla24xx_ip_free_send_q() - Release the outstanding send_cb handle table.
+ * @ha: SCSI driver HA context
+ * @txq: transmit queue to release
+ */
+static void
+qla24xx_ip_free_send_q(scsi_qla_host_t *ha, struct qla_ip_txq *txq)
+{
+	unsigned long flags;
+	struct send_cb **active_scb_q;
+	uint16_t *free_scb_q;
+
+	spin_lock_irqsave(txq->lock, flags);
+	active_scb_q = txq->active_scb_q;
+	free_scb_q = txq->free_scb_q;
+	txq->active_scb_q = NULL;
+	txq->free_scb_q = NULL;
+	txq->free_scb_cnt = 0;
+	txq->max_send_packets = 0;
+	spin_unlock_irqrestore(txq->lock, flags);
+
+	kfree(active_scb_q);
+	kfree(free_scb_q);
+}
+
+/* Adaptive hold-off for a given IP frame rate */
+static const struct {
+	uint32_t rate;		/* IP frames per second, 0 terminates */
+	uint32_t usecs;
+} qla_ip_mod_profile[] = {
+	{  10000,   0 },
+	{  50000,  20 },
+	{ 100000,  50 },
+	{ 200000, 100 },
+	{      0, QLA_IP_MOD_MAX_USECS },
+};
+
+/**
+ * qla2x00_ip_mod_timer() - End an interrupt hold-off.
+ * @timer: hold-off timer of a qla_ip_irq_mod
+ *
+ * An interrupt raised while the vector was held off is replayed by the IRQ
+ * core once it is re-enabled.
+ */
+static enum hrtimer_restart
+qla2x00_ip_mod_timer(struct hrtimer *timer)
+{
+	struct qla_ip_irq_mod *mod =
+	    container_of(timer, struct qla_ip_irq_mod, timer);
+
+	mod->masked = 0;
+	enable_irq(mod->vector);
+
+	return HRTIMER_NORESTART;
+}
+
+/**
+ * qla2x00_ip_mod_start() - Start moderating a response queue's vector.
+ * @mod: moderation state
+ * @rsp: MSI-X response queue
+ */
+static void
+qla2x00_ip_mod_start(struct qla_ip_irq_mod *mod, struct rsp_que *rsp)
+{
+	hrtimer_init(&mod->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	mod->timer.function = qla2x00_ip_mod_timer;
+	mod->masked = 0;
+	mod->vector = rsp->msix->vector;
+	mod->intr_frames = 0;
+	mod->sample_frames = 0;
+	mod->sample_start = jiffies;
+	mod->rsp = rsp;
+}
+
+/**
+ * qla2x00_ip_mod_stop() - Stop moderating a response queue's vector.
+ * @mod: moderation state
+ *
+ * The caller must have cleared @mod->rsp under the lock protecting the
+ * response queue, so the vector is not held off again.
+ */
+static void
+qla2x00_ip_mod_stop(struct qla_ip_irq_mod *mod)
+{
+	hrtimer_cancel(&mod->timer);
+	if (mod->masked) {
+		mod->masked = 0;
+		enable_irq(mod->vector);
+	}
+}
+
+/**
+ * qla2x00_ip_mod_config() - Set the hold-off parameters of a vector.
+ * @mod: moderation state
+ * @usecs: hold-off, or its upper bound if @adaptive
+ * @frames: minimum IP frames per interrupt before holding off
+ * @adaptive: derive the hold-off from the IP frame rate
+ *
+ * Note: called with the lock protecting the response queue held.
+ */
+static void
+qla2x00_ip_mod_config(struct qla_ip_irq_mod *mod, uint32_t usecs,
+    uint32_t frames, int adaptive)
+{
+	mod->adaptive = adaptive;
+	mod->max_usecs = adaptive && !usecs ? QLA_IP_MOD_MAX_USECS : usecs;
+	mod->min_frames = frames;
+	mod->usecs = adaptive ? 0 : usecs;
+	mod->sample_frames = 0;
+	mod->sample_start = jiffies;
+}
+
+/**
+ * qla2x00_ip_mod_sample() - Adapt the hold-off to the IP frame rate.
+ * @mod: moderation state
+ */
+static void
+qla2x00_ip_mod_sample(struct qla_ip_irq_mod *mod)
+{
+	int i;
+	uint32_t rate;
+	unsigned long elapsed;
+
+	elapsed = jiffies - mod->sample_start;
+	rate = (uint32_t)div_u64((uint64_t)mod->sample_frames * HZ, elapsed);
+
+	for (i = 0; qla_ip_mod_profile[i].rate; i++)
+		if (rate < qla_ip_mod_profile[i].rate)
+			break;
+	mod->usecs = min(qla_ip_mod_profile[i].usecs, mod->max_usecs);
+
+	mod->sample_frames = 0;
+	mod->sample_start = jiffies;
+}
+
+/**
+ * qla2x00_ip_mod_interrupt() - Account and possibly hold off an interrupt.
+ * @mod: moderation state
+ *
+ * Called once the response queue has been processed.  If the interrupt
+ * serviced enough IP frames, the vector is disabled for the hold-off period
+ * so further completions accumulate on the response queue and are processed
+ * by a single interrupt.  Interrupts without IP frames are never held off.
+ *
+ * Note: called with the lock protecting the response queue held.
+ */
+static void
+qla2x00_ip_mod_interrupt(struct qla_ip_irq_mod *mod)
+{
+	uint32_t frames;
+
+	if (!mod->rsp)
+		return;
+
+	frames = mod->intr_frames;
+	mod->intr_frames = 0;
+	mod->sample_frames += frames;
+	if (mod->adaptive &&
+	    time_after_eq(jiffies, mod->sample_start + QLA_IP_MOD_SAMPLE))
+		qla2x00_ip_mod_sample(mod);
+
+	if (!mod->usecs || !frames || frames < mod->min_frames || mod->masked)
+		return;
+
+	mod->masked = 1;
+	disable_irq_nosync(mod->vector);
+	hrtimer_start(&mod->timer, ns_to_ktime((u64)mod->usecs * NSEC_PER_USEC),
+	    HRTIMER_MODE_REL);
+}
+
+/**
+ * qla2x00_ip_irq_moderate() - Moderate a response queue's vector.
+ * @ha: SCSI driver HA context
+ * @rsp: response queue just processed
+ *
+ * Called from qla24xx_rsp_poll() once @rsp is drained, with rsp->lock held.
+ * Only the response queues of IP transmit queue pairs are moderated, under
+ * the transmit queue's own lock; the base response queue's vector also
+ * completes SCSI I/O and is never held off.
+ */
+void
+qla2x00_ip_irq_moderate(scsi_qla_host_t *ha, struct rsp_que *rsp)
+{
+	if (rsp->ip_mod)
+		qla2x00_ip_mod_interrupt(rsp->ip_mod);
+}
+
+/**
+ * qla24xx_ip_destroy_txqs() - Release the IP transmit queues.
+ * @ha: SCSI driver HA context
+ *
+ * Dedicated request/response queue pairs are deleted from the firmware.  IP
+ * support must already be disabled.
+ */
+static void
+qla24xx_ip_destroy_txqs(scsi_qla_host_t *ha)
+{
+	int i;
+	unsigned long flags;
+	struct qla_ip_txq *txq;
+
+	for (i = 0; i < ha->ip.num_txqs; i++) {
+		txq = &ha->ip.txq[i];
+		qla24xx_ip_free_send_q(ha, txq);
+		if (!txq->rsp)
+			continue;
+
+		spin_lock_irqsave(txq->lock, flags);
+		txq->tx_mod.rsp = NULL;
+		spin_unlock_irqrestore(txq->lock, flags);
+		qla2x00_ip_mod_stop(&txq->tx_mod);
+
+		qla25xx_delete_req_que(ha, txq->req);
+		qla25xx_delete_rsp_que(ha, txq->rsp);
+	}
+
+	kfree(ha->ip.txq);
+	ha->ip.txq = NULL;
+	ha->ip.num_txqs = 0;
+}
+
+/**
+ * qla24xx_ip_create_txqs() - Set up the IP transmit queues.
+ * @ha: SCSI driver HA context
+ * @count: number of transmit queues requested by the IP driver
+ * @max_send_packets: number of send_cb handles per transmit queue
+ *
+ * On multi-queue capable adapters running MSI-X, each transmit queue is a
+ * dedicated request/response queue pair, so IP transmits and their
+ * completions on different CPUs neither contend with each other nor with the
+ * SCSI driver for the hardware_lock.  Otherwise, or if no queue pair can be
+ * created, a single transmit queue shares the base request queue.
+ *
+ * Returns the number of transmit queues created, 0 on failure.
+ */
+static int
+qla24xx_ip_create_txqs(scsi_qla_host_t *ha, uint16_t count,
+    uint16_t max_send_packets)
+{
+	int i;
+	int rsp_id, req_id;
+	struct qla_hw_data *hw = ha->hw;
+	struct qla_ip_txq *txq;
+
+	count = clamp_t(uint16_t, count, 1, QLA_IP_MAX_TX_QUEUES);
+	ha->ip.txq = kcalloc(count, sizeof(struct qla_ip_txq), GFP_KERNEL);
+	if (!ha->ip.txq)
+		return 0;
+
+	ha->ip.num_txqs = 0;
+	if (hw->mqenable && hw->flags.msix_enabled) {
+		for (i = 0; i < count; i++) {
+			rsp_id = qla25xx_create_rsp_que(hw, 0, ha->vp_idx, 0,
+			    -1, NULL);
+			if (!rsp_id)
+				break;
+			req_id = qla25xx_create_req_que(hw, 0, ha->vp_idx, 0,
+			    rsp_id, 0);
+			if (!req_id) {
+				qla25xx_delete_rsp_que(ha,
+				    hw->rsp_q_map[rsp_id]);
+				break;
+			}
+
+			txq = &ha->ip.txq[i];
+			spin_lock_init(&txq->q_lock);
+			txq->lock = &txq->q_lock;
+			txq->req = hw->req_q_map[req_id];
+			txq->rsp = hw->rsp_q_map[rsp_id];
+			txq->rsp->req = txq->req;
+			qla2x00_ip_mod_start(&txq->tx_mod, txq->rsp);
+			/*
+			 * Only IP command completions are posted to the
+			 * response queue, so it is processed under the
+			 * transmit queue's own lock.
+			 */
+			txq->rsp->lock = txq->lock;
+			txq->rsp->ip_mod = &txq->tx_mod;
+			ha->ip.num_txqs++;
+		}
+	}
+
+	if (!ha->ip.num_txqs) {
+		/* Share the base request queue with the SCSI driver */
+		txq = &ha->ip.txq[0];
+		txq->lock = &hw->hardware_lock;
+		txq->req = ha->req;
+		txq->rsp = NULL;
+		ha->ip.num_txqs = 1;
+	}
+
+	for (i = 0; i < ha->ip.num_txqs; i++) {
+		if (!qla24xx_ip_alloc_send_q(ha, &ha->ip.txq[i],
+		    max_send_packets)) {
+			qla24xx_ip_destroy_txqs(ha);
+			return 0;
+		}
+	}
+
+	ql_dbg(ql_dbg_disc, ha, 0x0, "%s: %d transmit queue(s), %s\n",
+	    __func__, ha->ip.num_txqs,
+	    ha->ip.txq[0].rsp ? "dedicated" : "shared");
+
+	return ha->ip.num_txqs;
+}
+
+/**
+ * qla2x00_ip_set_send_packets() - Change the number of outstanding send_cbs.
+ * @ha: SCSI driver HA context
+ * @max_send_packets: new number of send_cb handles per transmit queue
+ *
+ * This routine is called by the IP driver, with its transmit queues quiesced,
+ * to resize the outstanding send_cb handle tables.  The new tables are all
+ * allocated before any is installed, so on failure every transmit queue
+ * keeps its old table.
+ *
+ * Returns 1 if the handle tables were successfully resized.
+ */
+static int
+qla2x00_ip_set_send_packets(scsi_qla_host_t *ha, uint16_t max_send_packets)
+{
+	int i;
+	int rval = 0;
+	unsigned long flags;
+	struct qla_ip_txq *txq;
+	struct send_cb **active_scb_q[QLA_IP_MAX_TX_QUEUES] = { NULL };
+	uint16_t *free_scb_q[QLA_IP_MAX_TX_QUEUES] = { NULL };
+
+	ql_dbg(ql_dbg_disc, ha, 0x0, "%s: adapter %ld, %d send packets\n",
+	    __func__, ha->host_no, max_send_packets);
+
+	if (max_send_packets < MIN_SEND_PACKETS ||
+	    max_send_packets > MAX_SEND_PACKETS)
+		return 0;
+
+	for (i = 0; i < ha->ip.num_txqs; i++) {
+		if (!qla24xx_ip_alloc_scb_tables(ha, max_send_packets,
+		    &active_scb_q[i], &free_scb_q[i]))
+			goto done;
+	}
+
+	for (i = 0; i < ha->ip.num_txqs; i++) {
+		txq = &ha->ip.txq[i];
+		if (READ_ONCE(txq->ipreq_cnt)) {
+			ql_dbg(ql_dbg_disc, ha, 0x0,
+			    "%s: %ld send_cbs outstanding on queue %d\n",
+			    __func__, txq->ipreq_cnt, i);
+			goto done;
+		}
+	}
+
+	for (i = 0; i < ha->ip.num_txqs; i++) {
+		txq = &ha->ip.txq[i];
+		spin_lock_irqsave(txq->lock, flags);
+		swap(txq->active_scb_q, active_scb_q[i]);
+		swap(txq->free_scb_q, free_scb_q[i]);
+		txq->free_scb_cnt = max_send_packets;
+		txq->max_send_packets = max_send_packets;
+		spin_unlock_irqrestore(txq->lock, flags);
+	}
+	rval = 1;
+
+done:
+	for (i = 0; i < ha->ip.num_txqs; i++) {
+		kfree(active_scb_q[i]);
+		kfree(free_scb_q[i]);
+	}
+
+	return rval;
+}
+
+/**
+ * qla2x00_ip_set_coalesce() - Set IP interrupt coalescing.
+ * @ha: SCSI driver HA context
+ * @params: coalescing parameters
+ *
+ * This routine is called by the IP driver to set how IP send completion
+ * interrupts are coalesced.  The vectors of dedicated transmit queue pairs
+ * are held off in software, see struct qla_ip_irq_mod.  The base response
+ * queue's vector, which receives and the send completions of a shared
+ * transmit queue use, also completes SCSI I/O and is never held off.
+ * Without transmit queue pairs coalescing is not supported: the firmware's
+ * ZIO mode is only programmed by an ISP abort, which would reset all SCSI I/O
+ * and the IP connection with it.
+ *
+ * Returns 1 if the parameters were applied.
+ */
+static int
+qla2x00_ip_set_coalesce(scsi_qla_host_t *ha, struct bd_coalesce *params)
+{
+	int i;
+	unsigned long flags;
+	struct qla_ip_coalesce *coal = ha->ip.coal;
+	struct qla_ip_txq *txq;
+
+	if (!coal)
+		return 0;
+
+	if (!ha->ip.txq[0].rsp) {
+		if (params->options || params->tx_usecs || params->tx_frames)
+			return 0;
+		coal->params = *params;
+		return 1;
+	}
+
+	coal->params = *params;
+
+	for (i = 0; i < ha->ip.num_txqs; i++) {
+		txq = &ha->ip.txq[i];
+		if (!txq->rsp)
+			continue;
+
+		spin_lock_irqsave(txq->lock, flags);
+		qla2x00_ip_mod_config(&txq->tx_mod, params->tx_usecs,
+		    params->tx_frames,
+		    test_bit(BDC_ADAPTIVE_TX, &params->options));
+		spin_unlock_irqrestore(txq->lock, flags);
+	}
+
+	return 1;
+}
+
+/**
+ * qla2x00_ip_alloc_coalesce() - Set up interrupt coalescing state.
+ * @ha: SCSI driver HA context
+ *
+ * Coalescing starts disabled; the IP driver applies its parameters once the
+ * connection is enabled.
+ *
+ * Returns 1 on success.
+ */
+static int
+qla2x00_ip_alloc_coalesce(scsi_qla_host_t *ha)
+{
+	ha->ip.coal = kzalloc(sizeof(struct qla_ip_coalesce), GFP_KERNEL);
+
+	return ha->ip.coal != NULL;
+}
+
+/**
+ * qla2x00_ip_free_coalesce() - Release interrupt coalescing state.
+ * @ha: SCSI driver HA context
+ */
+static void
+qla2x00_ip_free_coalesce(scsi_qla_host_t *ha)
+{
+	kfree(ha->ip.coal);
+	ha->ip.coal = NULL;
+}
+
+/**
+ * qla2x00_ip_free_dest_cache() - Release the per-CPU destination cache.
+ * @ha: SCSI driver HA context
+ */
+static void
+qla2x00_ip_free_dest_cache(scsi_qla_host_t *ha)
+{
+	unsigned long flags;
+	struct qla_ip_dest_cache __percpu *dest_cache;
+
+	spin_lock_irqsave(&ha->hw->hardware_lock, flags);
+	dest_cache = ha->ip.dest_cache;
+	ha->ip.dest_cache = NULL;
+	spin_unlock_irqrestore(&ha->hw->hardware_lock, flags);
+
+	synchronize_rcu();
+	free_percpu(dest_cache);
+}
+
+/**
+ * qla2x00_ip_enable() - Create IP-driver/SCSI-driver IP connection.
+ * @ha: SCSI driver HA context
+ * @enable_data: bd_enable data describing the IP connection
+ *
+ * This routine is called by the IP driver to enable an IP connection to the
+ * SCSI driver and to pass in IP driver parameters.
+ *
+ * The HA context is propagated with the specified @enable_data and the
+ * Firmware is initialized for IP support.
+ *
+ * Returns 1 if the IP connection was successfully enabled.
+ */
+static int
+qla2x00_ip_enable(scsi_qla_host_t *ha, struct bd_enable *enable_data)
+{
+	int status;
+
+	ql_dbg(ql_dbg_disc, ha, 0x0, "%s: enable adapter %ld\n", __func__, ha->host_no);
+
+	status = 0;
+
+	/* Verify structure size and version and adapter online */
+	if (!(ha->flags.online) ||
+	    (enable_data->length != BDE_LENGTH) ||
+	    (enable_data->version != BDE_VERSION)) {
+
+		ql_dbg(ql_dbg_disc, ha, 0x0, "%s: incompatable structure or offline\n",
+		    __func__);
+		return status;
+	}
+
+	/* Save parameters from IP driver */
+	ha->ip.mtu = enable_data->mtu;
+	ha->ip.header_size = enable_data->header_size;
+	ha->ip.receive_buffers = enable_data->receive_buffers;
+	ha->ip.rx_ring = enable_data->rx_ring;
+	ha->ip.max_receive_buffers = enable_data->max_receive_buffers;
+	ha->ip.receive_buff_data_size = enable_data->receive_buff_data_size;
+	ha->ip.small_buff_data_size = qla2x00_ip_rx_pools(ha) ?
+	    enable_data->small_buff_data_size : 0;
+	if (test_bit(BDE_NOTIFY_ROUTINE, &enable_data->options)) {
+		ha->ip.notify_routine = enable_data->notify_routine;
+		ha->ip.notify_context = enable_data->notify_context;
+	}
+	ha->ip.send_completion_routine = enable_data->send_completion_routine;
+	ha->ip.receive_packets_routine = enable_data->receive_packets_routine;
+	ha->ip.receive_packets_context = enable_data->receive_packets_context;
+
+	if (!qla2x00_ip_alloc_coalesce(ha)) {
+		ql_dbg(ql_dbg_disc, ha, 0x0, "%s: unable to allocate "
+		    "coalescing state\n", __func__);
+		ha->ip.notify_routine = NULL;
+		return status;
+	}
+
+	if (!qla24xx_ip_create_txqs(ha, enable_data->tx_queues,
+	    enable_data->max_send_packets)) {
+		ql_dbg(ql_dbg_disc, ha, 0x0, "%s: unable to allocate %d send "
+		    "handles\n", __func__, enable_data->max_send_packets);
+		ha->ip.notify_routine = NULL;
+		qla2x00_ip_free_coalesce(ha);
+		return status;
+	}
+	enable_data->tx_queues = ha->ip.num_txqs;
+
+	ha->ip.dest_cache = alloc_percpu(struct qla_ip_dest_cache);
+	if (!ha->ip.dest_cache) {
+		ql_dbg(ql_dbg_disc, ha, 0x0, "%s: unable to allocate "
+		    "destination cache\n", __func__);
+		ha->ip.notify_routine = NULL;
+		qla24xx_ip_destroy_txqs(ha);
+		qla2x00_ip_free_coalesce(ha);
+		return status;
+	}
+
+	/* Enable RISC IP support */
+	if (IS_QLA24XX(ha->hw) || IS_QLA54XX(ha->hw))
+		status = qla24xx_ip_initialize(ha);
+	else
+		//status = qla2x00_ip_initialize(ha);
+		status = 0; // only qla24xx supported
+	if (!status) {
+		ql_dbg(ql_dbg_disc, ha, 0x0, "%s: IP initialization failed", __func__);
+		ha->ip.notify_routine = NULL;
+		qla24xx_ip_destroy_txqs(ha);
+		qla2x00_ip_free_coalesce(ha);
+		qla2x00_ip_free_dest_cache(ha);
+	}
+	return status;
+}
+
+/**
+ * qla2x00_ip_disable() - Remove IP-driver/SCSI-driver IP connection.
+ * @ha: SCSI driver HA context
+ *
+ * This routine is called by the IP driver to disable a previously created IP
+ * connection.
+ *
+ * A Firmware call to disable IP support is issued.
  */
 static void
 qla2x00_ip_disable(scsi_qla_host_t *ha)
@@ -861,7 +1831,7 @@ qla2x00_ip_disable(scsi_qla_host_t *ha)
 	mcp->in_mb = MBX_0;
 	mcp->tov = 30;
 	mcp->flags = 0;
-	rval = qla2x00_mailbox_command(ha, mcp);
+	rval = qla2x00_ip_mailbox_command(ha, mcp);
 	if (rval == QL_STATUS_SUCCESS) {
 		/* IP disabled successful */
 		ql_dbg(ql_dbg_disc, ha, 0x0, "%s: successful\n", __func__);
@@ -870,10 +1840,15 @@ qla2x00_ip_disable(scsi_qla_host_t *ha)
 			       "%s: MBC_DISABLE_IP failed\n", __func__);
 	}
 
+	/* Return any packets awaiting a port login */
+	qla2x00_ip_flush_pending(ha, NULL, 1);
+
 	/* Reset IP parameters */
-	ha->ip.rec_entries_in = 0;
-	ha->ip.rec_entries_out = 0;
+	ha->ip.rx_ring = NULL;
 	ha->ip.notify_routine = NULL;
+	qla24xx_ip_destroy_txqs(ha);
+	qla2x00_ip_free_coalesce(ha);
+	qla2x00_ip_free_dest_cache(ha);
 }
 
 #if 0
@@ -1039,8 +2014,8 @@ found_handle:
 	ipcmd_entry->reserved_2 = 0;
 	ipcmd_entry->service_class = __constant_cpu_to_le16(0);
 	ipcmd_entry->data_seg_count = __constant_cpu_to_le16(2);
-	scb->skb_data_dma = pci_map_single(ha->pdev, skb->data, skb->len,
-					   PCI_DMA_TODEVICE);
+	scb->skb_data_dma = dma_map_single(&ha->pdev->dev, skb->data,
+					   skb->len, DMA_TO_DEVICE);
 	ipcmd_entry->dseg_0_address[0] = cpu_to_le32(LSD(scb->header_dma));
 	ipcmd_entry->dseg_0_address[1] = cpu_to_le32(MSD(scb->header_dma));
 	ipcmd_entry->dseg_0_length =
@@ -1075,26 +2050,85 @@ found_handle:
 
 #endif
 
+/**
+ * qla24xx_ip_prep_cont_iocb() - Initialize a Continuation Type 1 IOCB.
+ * @req: request queue the IP command IOCB is being built on
+ *
+ * Returns a pointer to the continuation type 1 IOCB packet.
+ */
+static inline cont_a64_entry_t *
+qla24xx_ip_prep_cont_iocb(struct req_que *req)
+{
+	cont_a64_entry_t *cont_pkt;
+
+	/* Adjust ring index. */
+	req->ring_index++;
+	if (req->ring_index == req->length) {
+		req->ring_index = 0;
+		req->ring_ptr = req->ring;
+	} else {
+		req->ring_ptr++;
+	}
+
+	cont_pkt = (cont_a64_entry_t *)req->ring_ptr;
+	memset(cont_pkt, 0, REQUEST_ENTRY_SIZE);
+
+	/* Load packet defaults. */
+	*((uint32_t *)(&cont_pkt->entry_type)) =
+	    __constant_cpu_to_le32(CONTINUE_A64_TYPE);
+
+	return (cont_pkt);
+}
+
+/**
+ * __qla24xx_send_packet() - Transmit a send_cb.
+ * @ha: SCSI driver HA context
+ * @scb: The send_cb structure to send
+ * @held: @scb is sent from the pending queue by qla2x00_ip_flush_pending()
+ *
+ * This routine is called by the IP driver to pass @scb (IP packet) to the ISP
+ * for transmission on transmit queue @scb->queue.  The packet data must
+ * already be DMA mapped into @scb->dseg[] by the IP driver; the network/SNAP
+ * header is sent as the first data segment, followed by one data segment per
+ * mapped skb fragment in as many Continuation Type 1 IOCBs as needed.
+ *
+ * The destination is resolved without any lock held, so only the transmit
+ * queue's own lock is taken for a packet to a logged in port.  A packet to a
+ * port with held packets is held behind them; a held packet that can not be
+ * sent yet is left to the caller to hold again.
+ *
+ * Returns QL_STATUS_SUCCESS if @scb was sent, QL_STATUS_RESOURCE_ERROR if the
+ * RISC was too busy to send, or QLA_FUNCTION_FAILED.
+ */
 static int
-qla24xx_send_packet(scsi_qla_host_t *ha, struct send_cb *scb)
+__qla24xx_send_packet(scsi_qla_host_t *ha, struct send_cb *scb, int held)
 {
-	int i;
+	int found;
+	int queued, online;
 	uint16_t cnt;
 	uint16_t loop_id;
-	uint32_t handle;
+	uint16_t req_cnt;
+	uint16_t dseg_count;
+	uint16_t avail_dsds;
+	uint32_t byte_count;
+	uint16_t handle;
+	uint32_t *cur_dsd;
 	unsigned long flags;
+	int i;
+	fc_port_t *fcport;
+	struct qla_ip_txq *txq;
+	struct req_que *req;
 	struct ip_cmd_entry_24xx *ipcmd_entry;
 	cont_a64_entry_t *ipcmd_cont;
-	struct sk_buff *skb;
-	struct device_reg_24xx __iomem *reg;
-
-	skb = scb->skb;
-	reg = (struct device_reg_24xx __iomem *)ha->hw->iobase;
 
 	/* Check adapter state */
 	if (!ha->flags.online) {
 		return QLA_FUNCTION_FAILED;
 	}
+	if (scb->queue >= ha->ip.num_txqs)
+		return QLA_FUNCTION_FAILED;
+	txq = &ha->ip.txq[scb->queue];
+	req = txq->req;
 
 	/* Send marker if required */
 	if (ha->marker_needed != 0) {
@@ -1107,124 +2141,411 @@ qla24xx_send_packet(scsi_qla_host_t *ha, struct send_cb *scb)
 		ha->marker_needed = 0;
 	}
 
+	/* Get destination loop ID for packet */
+	rcu_read_lock();
+	found = qla2x00_get_ip_loopid(ha, scb->header, &loop_id, &fcport,
+	    held);
+	if (!found && held) {
+		rcu_read_unlock();
+		return QL_STATUS_RESOURCE_ERROR;
+	}
+	if (!found && fcport) {
+		/* Hold packet until the port is logged in */
+		spin_lock_irqsave(&ha->hw->hardware_lock, flags);
+		queued = qla2x00_ip_queue_pending(ha, scb, fcport);
+		online = atomic_read(&fcport->state) == FCS_ONLINE;
+		spin_unlock_irqrestore(&ha->hw->hardware_lock, flags);
+		rcu_read_unlock();
+		if (queued) {
+			/* Queued behind packets being sent, follow them */
+			if (online)
+				qla2x00_ip_flush_pending(ha, fcport, 0);
+			return QL_STATUS_SUCCESS;
+		}
+
+		ql_dbg(ql_dbg_disc, ha, 0x0, "%s: Too many packets "
+		    "awaiting login.\n", __func__);
+		return QLA_FUNCTION_FAILED;
+	}
+	rcu_read_unlock();
+
+	/* Header data segment plus one per mapped fragment */
+	dseg_count = scb->dseg_count;
+	byte_count = scb->len;
+	req_cnt = qla24xx_calc_iocbs(ha, dseg_count + 1);
+
 	/* Acquire ring specific lock */
-	spin_lock_irqsave(&ha->hw->hardware_lock, flags);
+	spin_lock_irqsave(txq->lock, flags);
 
-	if (ha->req->cnt < 4) {
+	if (req->cnt < req_cnt + 2) {
 		/* Update number of free request entries */
-		cnt = (uint16_t)RD_REG_DWORD_RELAXED(&reg->req_q_out);
-		if (ha->req->ring_index < cnt)
-			ha->req->cnt = cnt - ha->req->ring_index;
+		cnt = (uint16_t)RD_REG_DWORD_RELAXED(req->req_q_out);
+		if (req->ring_index < cnt)
+			req->cnt = cnt - req->ring_index;
 		else
-			ha->req->cnt = ha->req->length -
-			    (ha->req->ring_index - cnt);
+			req->cnt = req->length - (req->ring_index - cnt);
 	}
 
-	if (ha->req->cnt >= 4) {
+	if (req->cnt >= req_cnt + 2 && txq->free_scb_cnt) {
 		/* Get tag handle for command */
-		handle = ha->ip.current_scb_q_idx;
-		for (i = 0; i < MAX_SEND_PACKETS; i++) {
-			handle++;
-			if (handle == MAX_SEND_PACKETS)
-				handle = 0;
-			if (ha->ip.active_scb_q[handle] == NULL) {
-				ha->ip.current_scb_q_idx = handle;
-				goto found_handle;
-			}
-		}
+		handle = txq->free_scb_q[--txq->free_scb_cnt];
+		goto found_handle;
 	}
 
 	/* Low on resources, try again later */
-	spin_unlock_irqrestore(&ha->hw->hardware_lock, flags);
-	printk(KERN_WARNING
-	       "%s: Low on resources, try again later...\n", __func__);
+	spin_unlock_irqrestore(txq->lock, flags);
 
-	return QLA_MEMORY_ALLOC_FAILED;
+	return QL_STATUS_RESOURCE_ERROR;
 
 found_handle:
 
-	/* Build ISP command packet */
-	ipcmd_entry = (struct ip_cmd_entry_24xx *)ha->req->ring_ptr;
-
-	/* Set entry type and entry count */
-	*((uint32_t *) (&ipcmd_entry->entry_type)) =
-	    __constant_cpu_to_le32(IP_COMMAND_24XX | (2 << 8));
-
-	ipcmd_entry->handle = handle;
-	memset((uint32_t *)ipcmd_entry + 2, 0, REQUEST_ENTRY_SIZE - 8);
-
-	/* Get destination loop ID for packet */
-	if (!qla2x00_get_ip_loopid(ha, scb->header, &loop_id)) {
+	if (!found) {
 		/* Failed to get loop ID, convert packet to ARP */
 		if (qla2x00_convert_to_arp(ha, scb)) {
-			/* Broadcast ARP */
+			/* Broadcast ARP, held in the linear data segment */
 			loop_id = BROADCAST_4G;
+			dseg_count = 1;
+			byte_count = sizeof(struct packet_header) +
+			    sizeof(struct arp_header);
+			req_cnt = qla24xx_calc_iocbs(ha, dseg_count + 1);
 		} else {
-			/* Return packet */
-			spin_unlock_irqrestore(&ha->hw->hardware_lock, flags);
-			printk(KERN_WARNING
-			       "%s: Unable to determine loop id for "
-			       "destination.\n", __func__);
+			/* Return handle and packet */
+			txq->free_scb_q[txq->free_scb_cnt++] = handle;
+			spin_unlock_irqrestore(txq->lock, flags);
+			ql_dbg(ql_dbg_disc, ha, 0x0, "%s: Unable to determine "
+			    "loop id for destination.\n", __func__);
 			return QLA_FUNCTION_FAILED;
 		}
 	}
 
+	/* Build ISP command packet */
+	ipcmd_entry = (struct ip_cmd_entry_24xx *)req->ring_ptr;
+
+	/* Set entry type and entry count */
+	*((uint32_t *) (&ipcmd_entry->entry_type)) =
+	    cpu_to_le32(IP_COMMAND_24XX | (req_cnt << 8));
+
+	ipcmd_entry->handle = IP_SEND_HANDLE(scb->queue, handle);
+	memset((uint32_t *)ipcmd_entry + 2, 0, REQUEST_ENTRY_SIZE - 8);
+
 	/* Default five second firmware timeout */
 	ipcmd_entry->nport_handle = cpu_to_le16(loop_id);
 	ipcmd_entry->timeout = __constant_cpu_to_le16(5);
-	ipcmd_entry->dseg_count = __constant_cpu_to_le16(2);
+	ipcmd_entry->dseg_count = cpu_to_le16(dseg_count + 1);
 
 	ipcmd_entry->control_flags = __constant_cpu_to_le16(BIT_0);
 	ipcmd_entry->fhdr_control_flags = __constant_cpu_to_le16(BIT_4|BIT_5);
-	ipcmd_entry->byte_count =
-	    cpu_to_le32(skb->len + sizeof(struct packet_header));
+	ipcmd_entry->byte_count = cpu_to_le32(byte_count);
 
-	scb->skb_data_dma = pci_map_single(ha->hw->pdev, skb->data, skb->len,
-	    PCI_DMA_TODEVICE);
 	ipcmd_entry->dseg_0_address[0] = cpu_to_le32(LSD(scb->header_dma));
 	ipcmd_entry->dseg_0_address[1] = cpu_to_le32(MSD(scb->header_dma));
-	ipcmd_entry->dseg_0_length =
-	    __constant_cpu_to_le32(sizeof(struct packet_header));
-
-	/* Adjust ring index. */
-	ha->req->ring_index++;
-	if (ha->req->ring_index == ha->req->length) {
-		ha->req->ring_index = 0;
-		ha->req->ring_ptr = ha->req->ring;
-	} else
-		ha->req->ring_ptr++;
-	ha->req->cnt--;
+	ipcmd_entry->dseg_0_length = cpu_to_le32(scb->header_len);
+
+	/* Load data segments into Continuation Type 1 IOCBs */
+	avail_dsds = 0;
+	cur_dsd = NULL;
+	for (i = 0; i < dseg_count; i++) {
+		uint32_t length = scb->dseg[i].length;
+
+		if (avail_dsds == 0) {
+			ipcmd_cont = qla24xx_ip_prep_cont_iocb(req);
+			cur_dsd = (uint32_t *)ipcmd_cont->dseg_0_address;
+			avail_dsds = 5;
+		}
 
-	/* Build continuation packet */
-	ipcmd_cont = (cont_a64_entry_t *)ha->req->ring_ptr;
-	memset(ipcmd_cont, 0, REQUEST_ENTRY_SIZE);
-	*((uint32_t *) (&ipcmd_cont->entry_type)) =
-	    __constant_cpu_to_le32(CONTINUE_A64_TYPE);
+		/* Only the ARP header is sent from a converted packet */
+		if (scb->flags & SCB_ARP_CONVERTED)
+			length = sizeof(struct arp_header);
 
-	ipcmd_cont->dseg_0_address[0] = cpu_to_le32(LSD(scb->skb_data_dma));
-	ipcmd_cont->dseg_0_address[1] = cpu_to_le32(MSD(scb->skb_data_dma));
-	ipcmd_cont->dseg_0_length = cpu_to_le32(skb->len);
+		*cur_dsd++ = cpu_to_le32(LSD(scb->dseg[i].address));
+		*cur_dsd++ = cpu_to_le32(MSD(scb->dseg[i].address));
+		*cur_dsd++ = cpu_to_le32(length);
+		avail_dsds--;
+	}
 	wmb();
 
 	/* Adjust ring index. */
-	ha->req->ring_index++;
-	if (ha->req->ring_index == ha->req->length) {
-		ha->req->ring_index = 0;
-		ha->req->ring_ptr = ha->req->ring;
+	req->ring_index++;
+	if (req->ring_index == req->length) {
+		req->ring_index = 0;
+		req->ring_ptr = req->ring;
 	} else
-		ha->req->ring_ptr++;
-	ha->req->cnt--;
+		req->ring_ptr++;
+	req->cnt -= req_cnt;
+
+	txq->ipreq_cnt++;
+	txq->active_scb_q[handle] = scb;
+
+	/*
+	 * Set chip new ring index, unless the IP driver has more packets to
+	 * follow, in which case the doorbell is rung once for the batch.
+	 */
+	if (scb->flags & SCB_DEFER_DOORBELL) {
+		txq->doorbell_pending = 1;
+	} else {
+		WRT_REG_DWORD(req->req_q_in, req->ring_index);
+		RD_REG_DWORD_RELAXED(req->req_q_in);	/* PCI Posting. */
+		txq->doorbell_pending = 0;
+	}
 
-	ha->ip.ipreq_cnt++;
-	ha->ip.active_scb_q[handle] = scb;
+	spin_unlock_irqrestore(txq->lock, flags);
 
-	/* Set chip new ring index. */
-	WRT_REG_DWORD(&reg->req_q_in, ha->req->ring_index);
-	RD_REG_DWORD_RELAXED(&reg->req_q_in);           /* PCI Posting. */
+	return QL_STATUS_SUCCESS;
+}
+
+/**
+ * qla24xx_send_packet() - Transmit a send_cb.
+ * @ha: SCSI driver HA context
+ * @scb: The send_cb structure to send
+ *
+ * This routine is called by the IP driver, see __qla24xx_send_packet().
+ *
+ * Returns QL_STATUS_SUCCESS if @scb was sent, QL_STATUS_RESOURCE_ERROR if the
+ * RISC was too busy to send, or QLA_FUNCTION_FAILED.
+ */
+static int
+qla24xx_send_packet(scsi_qla_host_t *ha, struct send_cb *scb)
+{
+	return __qla24xx_send_packet(ha, scb, 0);
+}
+
+/**
+ * qla24xx_flush_packets() - Ring the request queue doorbell.
+ * @ha: SCSI driver HA context
+ * @queue: transmit queue to post
+ *
+ * This routine is called by the IP driver to post any IP command IOCBs
+ * queued with SCB_DEFER_DOORBELL on @queue to the ISP.
+ */
+static void
+qla24xx_flush_packets(scsi_qla_host_t *ha, uint16_t queue)
+{
+	unsigned long flags;
+	struct qla_ip_txq *txq;
+
+	if (queue >= ha->ip.num_txqs)
+		return;
+	txq = &ha->ip.txq[queue];
+
+	spin_lock_irqsave(txq->lock, flags);
+	if (txq->doorbell_pending) {
+		WRT_REG_DWORD(txq->req->req_q_in, txq->req->ring_index);
+		RD_REG_DWORD_RELAXED(txq->req->req_q_in);	/* PCI Posting. */
+		txq->doorbell_pending = 0;
+	}
+	spin_unlock_irqrestore(txq->lock, flags);
+}
+
+/*
+ * Backdoor routines of a software-emulated adapter.  Its request queue
+ * doorbell is a plain memory location, so the emulated firmware is kicked
+ * once the real routine has (possibly) rung it.
+ */
+static void
+qla24xx_emu_add_buffers(scsi_qla_host_t *ha, uint16_t unused, int ha_locked)
+{
+	qla24xx_add_buffers(ha, unused, ha_locked);
+	qla2x00_ip_emu_doorbell(ha);
+}
+
+static int
+qla24xx_emu_send_packet(scsi_qla_host_t *ha, struct send_cb *scb)
+{
+	int status;
+
+	status = qla24xx_send_packet(ha, scb);
+	qla2x00_ip_emu_doorbell(ha);
+
+	return status;
+}
+
+static void
+qla24xx_emu_flush_packets(scsi_qla_host_t *ha, uint16_t queue)
+{
+	qla24xx_flush_packets(ha, queue);
+	qla2x00_ip_emu_doorbell(ha);
+}
+
+/**
+ * qla2x00_ip_unqueue_pending() - Remove a send_cb from the pending queue.
+ * @ha: SCSI driver HA context
+ * @scb: The held send_cb
+ *
+ * Note: called with the hardware_lock held.
+ */
+static void
+qla2x00_ip_unqueue_pending(scsi_qla_host_t *ha, struct send_cb *scb)
+{
+	list_del(&scb->pending);
+	scb->fcport->ip_pending_cnt--;
+	ha->ip.pending_cnt--;
+}
+
+/**
+ * qla2x00_ip_fail_send() - Return an unsent send_cb to the IP driver.
+ * @ha: SCSI driver HA context
+ * @scb: The send_cb that could not be sent
+ *
+ * The IP driver expects completions for a transmit queue to be serialized,
+ * so the send_cb is completed under the lock of its transmit queue.
+ */
+static void
+qla2x00_ip_fail_send(scsi_qla_host_t *ha, struct send_cb *scb)
+{
+	unsigned long flags;
+	struct qla_ip_txq *txq = &ha->ip.txq[scb->queue];
+
+	spin_lock_irqsave(txq->lock, flags);
+	scb->comp_status = SCB_CS_PORT_UNAVAILABLE;
+	ha->ip.send_completion_routine(scb);
+	spin_unlock_irqrestore(txq->lock, flags);
+}
+
+/**
+ * qla2x00_ip_flush_pending() - Send or fail send_cbs awaiting a port login.
+ * @ha: SCSI driver HA context
+ * @match: Only process send_cbs for this port, NULL for all ports
+ * @abort: Fail the send_cbs rather than sending them
+ *
+ * Held send_cbs whose port is logged in are passed to qla24xx_send_packet(),
+ * those that have waited longer than IP_PENDING_TIMEOUT (or all, if @abort)
+ * are returned to the IP driver with an error status.
+ *
+ * A send_cb stays counted in its port's ip_pending_cnt until it is on the
+ * request ring, so a packet sent meanwhile to the port is held behind it
+ * rather than overtaking it.  Only one caller sends at a time; a caller
+ * finding the queue busy has the active one scan the queue again.  The
+ * ports being sent to are kept alive by the RCU read side, see
+ * qla2x00_ip_unhash_fcport().
+ */
+static void
+qla2x00_ip_flush_pending(scsi_qla_host_t *ha, fc_port_t *match, int abort)
+{
+	int status;
+	unsigned long flags;
+	fc_port_t *fcport;
+	struct send_cb *scb, *tscb;
+	LIST_HEAD(send_q);
+	LIST_HEAD(fail_q);
+
+	rcu_read_lock();
+	spin_lock_irqsave(&ha->hw->hardware_lock, flags);
+	if (!abort) {
+		if (ha->ip.flush_active) {
+			ha->ip.flush_again = 1;
+			goto unlock;
+		}
+		ha->ip.flush_active = 1;
+	}
+again:
+	if (!abort)
+		ha->ip.flush_again = 0;
+	list_for_each_entry_safe(scb, tscb, &ha->ip.pending_q, pending) {
+		if (match && scb->fcport != match)
+			continue;
+
+		if (abort || time_after(jiffies, scb->expires)) {
+			qla2x00_ip_unqueue_pending(ha, scb);
+			list_add_tail(&scb->pending, &fail_q);
+			continue;
+		}
+		if (atomic_read(&scb->fcport->state) != FCS_ONLINE ||
+		    !hash_hashed(&scb->fcport->ip_hash))
+			continue;
 
+		list_move_tail(&scb->pending, &send_q);
+	}
 	spin_unlock_irqrestore(&ha->hw->hardware_lock, flags);
 
-	return QL_STATUS_SUCCESS;
+	list_for_each_entry_safe(scb, tscb, &fail_q, pending) {
+		list_del(&scb->pending);
+		qla2x00_ip_fail_send(ha, scb);
+	}
+
+	list_for_each_entry_safe(scb, tscb, &send_q, pending) {
+		/* @scb may complete, and be reused, once sent */
+		fcport = scb->fcport;
+		list_del(&scb->pending);
+		status = __qla24xx_send_packet(ha, scb, 1);
+		if (status == QL_STATUS_RESOURCE_ERROR) {
+			list_add(&scb->pending, &send_q);
+			break;
+		}
+
+		spin_lock_irqsave(&ha->hw->hardware_lock, flags);
+		fcport->ip_pending_cnt--;
+		ha->ip.pending_cnt--;
+		spin_unlock_irqrestore(&ha->hw->hardware_lock, flags);
+
+		if (status != QL_STATUS_SUCCESS)
+			qla2x00_ip_fail_send(ha, scb);
+	}
+
+	spin_lock_irqsave(&ha->hw->hardware_lock, flags);
+	if (!list_empty(&send_q)) {
+		/* Request ring is full, retry from the timer */
+		list_splice(&send_q, &ha->ip.pending_q);
+	} else if (!abort && ha->ip.flush_again) {
+		match = NULL;
+		goto again;
+	}
+	if (!abort)
+		ha->ip.flush_active = 0;
+unlock:
+	spin_unlock_irqrestore(&ha->hw->hardware_lock, flags);
+	rcu_read_unlock();
+}
+
+/**
+ * qla2x00_ip_fcport_online() - Send packets held for a port.
+ * @ha: SCSI driver HA context
+ * @fcport: The port that has been logged in
+ *
+ * Called once @fcport has been (re)logged in.
+ */
+void
+qla2x00_ip_fcport_online(scsi_qla_host_t *ha, fc_port_t *fcport)
+{
+	if (fcport->ip_pending_cnt)
+		qla2x00_ip_flush_pending(ha, fcport, 0);
+}
+
+/**
+ * qla2x00_ip_timer() - Periodic processing of held send packets.
+ * @ha: SCSI driver HA context
+ *
+ * Called from the driver's one second timer to send packets for ports
+ * logged in by other paths, and to expire packets for unreachable ports.
+ */
+void
+qla2x00_ip_timer(scsi_qla_host_t *ha)
+{
+	if (ha->ip.pending_cnt)
+		qla2x00_ip_flush_pending(ha, NULL, 0);
+}
+
+/**
+ * qla2x00_ip_buffer_event() - Handle a RISC receive buffer event.
+ * @ha: SCSI driver HA context
+ * @event: MBA_IP_RECEIVE_BUFFERS_LOW or MBA_IP_OUT_OF_BUFFERS
+ *
+ * The IP driver is notified so it can account the event and return any
+ * receive buffers it is still holding.
+ *
+ * Note: called from the async event handler with the hardware_lock held.
+ */
+void
+qla2x00_ip_buffer_event(scsi_qla_host_t *ha, uint16_t event)
+{
+	if (!ha->ip.flags.enable_ip || !ha->ip.notify_routine)
+		return;
+
+	ql_dbg(ql_dbg_disc, ha, 0x0, "%s: receive buffers %s\n", __func__,
+	    event == MBA_IP_OUT_OF_BUFFERS ? "exhausted" : "low");
+
+	ha->ip.notify_routine(ha->ip.notify_context,
+	    event == MBA_IP_OUT_OF_BUFFERS ? NOTIFY_EVENT_OUT_OF_BUFFERS :
+	    NOTIFY_EVENT_RCV_BUFFERS_LOW);
 }
 
 /**
@@ -1255,7 +2576,8 @@ qla2x00_tx_timeout(scsi_qla_host_t *ha)
  * @inq_data: return bd_inquiry data of the discovered adapter
  *
  * This routine is called by the IP driver to discover adapters that support IP
- * and to get adapter parameters from the SCSI driver.
+ * and to get adapter parameters from the SCSI driver.  Software-emulated
+ * adapters, if any, are numbered after the real ones.
  *
  * Returns 1 if the specified adapter supports IP.
  */
@@ -1284,9 +2606,12 @@ qla2x00_ip_inquiry(uint16_t adapter_num, struct bd_inquiry *inq_data)
 		}
 	}
 	read_unlock(&qla_hostlist_lock);
- 
-	if (!found)
-		return 0;
+
+	if (!found) {
+		ha = qla2x00_ip_emu_host(adapter_num - instance);
+		if (!ha)
+			return 0;
+	}
 	if (!ha->flags.online)
 		return 0;
 
@@ -1296,28 +2621,13 @@ qla2x00_ip_inquiry(uint16_t adapter_num, struct bd_inquiry *inq_data)
 		ql_dbg(ql_dbg_disc, ha, 0x0, "%s: adapter %d LOOP_UP\n", __func__, adapter_num);
 	}
 
-	{
-		{
-                        /* Get consistent memory allocated for SNS commands */
-                        ha->ip.risc_rec_q = dma_alloc_coherent(&ha->hw->pdev->dev,
-                            IP_BUFFER_QUEUE_DEPTH *
-                            sizeof(struct risc_rec_entry),
-                            &ha->ip.risc_rec_q_dma, GFP_KERNEL);
-                        if (ha->ip.risc_rec_q == NULL) {
-                                /* error */
-                        }
-                        memset(ha->ip.risc_rec_q, 0, IP_BUFFER_QUEUE_DEPTH *
-                            sizeof(struct risc_rec_entry));
-                }
-	}
-
 	/* Return inquiry data to backdoor IP driver */
 	set_bit(BDI_IP_SUPPORT, &inq_data->options);
 	if (ha->hw->flags.enable_64bit_addressing)
 		set_bit(BDI_64BIT_ADDRESSING, &inq_data->options);
+	if (qla2x00_ip_rx_pools(ha))
+		set_bit(BDI_RX_POOLS, &inq_data->options);
 	inq_data->ha = ha;
-	inq_data->risc_rec_q = ha->ip.risc_rec_q;
-	inq_data->risc_rec_q_size = IP_BUFFER_QUEUE_DEPTH;
 	inq_data->link_speed = ha->hw->link_data_rate;
 	memcpy(inq_data->port_name, ha->ip.ip_port_name, WWN_SIZE);
 	inq_data->pdev = ha->hw->pdev;
@@ -1327,12 +2637,23 @@ qla2x00_ip_inquiry(uint16_t adapter_num, struct bd_inquiry *inq_data)
 		set_bit(BDI_64BIT_ADDRESSING, &inq_data->options);
 		inq_data->ip_add_buffers_routine = qla24xx_add_buffers;
 		inq_data->ip_send_packet_routine = qla24xx_send_packet;
+		inq_data->ip_flush_packets_routine = qla24xx_flush_packets;
+		if (ha->ip.emu) {
+			inq_data->ip_add_buffers_routine =
+			    qla24xx_emu_add_buffers;
+			inq_data->ip_send_packet_routine =
+			    qla24xx_emu_send_packet;
+			inq_data->ip_flush_packets_routine =
+			    qla24xx_emu_flush_packets;
+		}
 	} else {
 		return 0; // We only implemented qla24xx
 		//inq_data->ip_add_buffers_routine = qla2x00_add_buffers;
 		//inq_data->ip_send_packet_routine = qla2x00_send_packet;
 	}
 	inq_data->ip_tx_timeout_routine = qla2x00_tx_timeout;
+	inq_data->ip_set_send_packets_routine = qla2x00_ip_set_send_packets;
+	inq_data->ip_set_coalesce_routine = qla2x00_ip_set_coalesce;
 
 	return 1;
 }
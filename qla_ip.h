@@ -12,15 +12,23 @@
 #if !defined(_QLA_IP_H_)
 #define _QLA_IP_H_
 
-#define MAX_SEND_PACKETS		32	/* Maximum # send packets */
-#define MAX_RECEIVE_BUFFERS		64	/* Maximum # receive buffers */
+#define MAX_SEND_PACKETS		4096	/* Maximum # send packets */
+#define MIN_SEND_PACKETS		8	/* Minimum # send packets */
+#define MAX_RECEIVE_BUFFERS		4096	/* Maximum # receive buffers */
 #define MIN_RECEIVE_BUFFERS		8	/* Minimum # receive buffers */
 #define IP_BUFFER_QUEUE_DEPTH		(MAX_RECEIVE_BUFFERS+1)
 
+/* Send packets held while their destination port is being logged in */
+#define IP_PENDING_PER_PORT		16	/* Maximum # per destination */
+#define IP_PENDING_MAX			256	/* Maximum # per adapter */
+#define IP_PENDING_TIMEOUT		(5 * HZ)	/* Login wait time */
+
 /* Async notification types */
 #define NOTIFY_EVENT_LINK_DOWN		1	/* Link went down */
 #define NOTIFY_EVENT_LINK_UP		2	/* Link is back up */
 #define NOTIFY_EVENT_RESET_DETECTED	3	/* Reset detected */
+#define NOTIFY_EVENT_RCV_BUFFERS_LOW	4	/* RISC receive buffers low */
+#define NOTIFY_EVENT_OUT_OF_BUFFERS	5	/* RISC out of receive buffers */
 
 /* QLogic subroutine status definitions */
 #define QL_STATUS_SUCCESS		0
@@ -110,17 +118,101 @@ struct buffer_cb {
 	unsigned long state;	/* Buffer CB state */
 #define BCB_RISC_OWNS_BUFFER	1
 
-	struct sk_buff *skb;	/* Socket buffer */
-	uint8_t *skb_data;	/* Socket buffer data */
-	dma_addr_t skb_data_dma;	/* SKB data physical address */
+	struct page *page;	/* Page pool page holding the buffer */
+	uint8_t *skb_data;	/* Receive buffer data */
+	dma_addr_t skb_data_dma;	/* Receive buffer physical address */
 	uint32_t rec_data_size;	/* Size of received data */
 	uint32_t packet_size;	/* Size of packet received */
 
 	uint16_t linked_bcb_cnt;	/* # of linked CBs for packet */
-	uint16_t unused2;
+	uint16_t pool_id;	/* Firmware buffer pool */
+#define BD_POOL_LARGE		0	/*  MTU sized data buffers */
+#define BD_POOL_SMALL		1	/*  ARP/ACK sized buffers */
+#define BD_RX_POOLS		2
 	struct buffer_cb *next_bcb;	/* Next buffer CB */
 };
 
+/*
+ * Free receive buffer ring, shared by the IP driver (single producer) and the
+ * SCSI driver (single consumer, under the hardware_lock).  The IP driver
+ * pushes the handle of each replenished buffer_cb, the SCSI driver pops
+ * handles in batches to load the firmware's buffer pool.  Indices are
+ * free-running; a buffer_cb is on the ring at most once, so the ring never
+ * overflows.  There is one ring per buffer pool.
+ */
+#define BD_RX_RING_SIZE		MAX_RECEIVE_BUFFERS	/* Power of 2 */
+
+struct bd_rx_ring {
+	uint32_t prod;		/* Written by the IP driver */
+	uint16_t handles[BD_RX_RING_SIZE];
+
+	uint32_t cons ____cacheline_aligned_in_smp;	/* Written by the */
+							/*  SCSI driver */
+};
+
+/* Per-CPU cache of the last IP destination resolved on that CPU */
+struct qla_ip_dest_cache {
+	uint8_t addr[ETH_ALEN];	/* IEEE MAC portion of the port name */
+	uint32_t gen;		/* valid while equal to ha->ip.dest_gen */
+	struct fc_port *fcport;
+};
+
+/*
+ * Software interrupt moderation of a response queue MSI-X vector: once an
+ * interrupt has serviced at least @min_frames IP frames, the vector is held
+ * off for @usecs.  With @adaptive set, @usecs follows the sampled IP frame
+ * rate, bounded by @max_usecs.
+ */
+#define QLA_IP_MOD_SAMPLE		(HZ / 20)	/* Rate sample period */
+#define QLA_IP_MOD_MAX_USECS		200	/* Adaptive hold-off limit */
+
+struct qla_ip_irq_mod {
+	struct rsp_que *rsp;	/* NULL while moderation is inactive */
+	uint32_t vector;
+	struct hrtimer timer;
+	int masked;
+
+	uint32_t usecs;		/* current hold-off */
+	uint32_t max_usecs;
+	uint32_t min_frames;
+	int adaptive;
+
+	uint32_t intr_frames;	/* IP frames since the last interrupt */
+	uint32_t sample_frames;	/* IP frames in the current sample */
+	unsigned long sample_start;
+};
+
+/*
+ * IP transmit queue: an ISP request queue and the table of send_cbs
+ * outstanding on it.  Dedicated request/response queue pairs have their own
+ * lock; the fallback queue shares the base request queue, and hardware_lock,
+ * with the SCSI driver.
+ */
+#define QLA_IP_MAX_TX_QUEUES		8
+
+struct qla_ip_txq {
+	spinlock_t *lock;	/* &q_lock or &hw->hardware_lock */
+	spinlock_t q_lock;
+	struct req_que *req;
+	struct rsp_que *rsp;	/* NULL when shared with the SCSI driver */
+
+	struct send_cb **active_scb_q;
+	uint16_t *free_scb_q;	/* free handle stack */
+	uint16_t free_scb_cnt;
+	uint16_t max_send_packets;
+	u_long ipreq_cnt;
+
+	uint32_t doorbell_pending;
+
+	/* Completion interrupt moderation, only of a dedicated queue pair */
+	struct qla_ip_irq_mod tx_mod;
+};
+
+/* Send handles carry the transmit queue in their upper 16 bits */
+#define IP_SEND_HANDLE(queue, index)	(((uint32_t)(queue) << 16) | (index))
+#define IP_SEND_HANDLE_QUEUE(handle)	((uint16_t)((handle) >> 16))
+#define IP_SEND_HANDLE_INDEX(handle)	((uint16_t)(handle))
+
 /* Send control block definitions */
 struct send_cb {
 	uint16_t comp_status;	/* completion status from FW */
@@ -134,15 +226,47 @@ struct send_cb {
 #define SCB_CS_PORT_CONFIG_CHG	0x2A
 #define SCB_CS_FW_RESOURCE_UNAVAILABLE	0x2C
 
-	uint16_t unused1;
+	uint16_t flags;		/* send flags from IP driver */
+#define SCB_DEFER_DOORBELL	BIT_0	/* more packets follow, don't ring */
+					/*  the request queue doorbell */
+#define SCB_HEAD_MAPPED		BIT_1	/* dseg[0] maps the linear skb data */
+#define SCB_ARP_CONVERTED	BIT_2	/* set by the SCSI driver when sent */
+					/*  as a broadcast ARP request */
 
 	void *qdev;		/* netdev private structure */
 
 	struct packet_header *header;	/* Network/SNAP Header pool.  */
 	dma_addr_t header_dma;
+	uint16_t header_len;	/* bytes sent from header_dma, more than */
+				/*  the packet_header for TSO segments */
 
 	struct sk_buff *skb;	/* socket buffer to send */
-	dma_addr_t skb_data_dma;	/* skb data physical address */
+	uint32_t len;		/* bytes on the wire (BQL accounting) */
+
+	/* DMA mapped skb data, linear area first, then page fragments */
+	uint16_t dseg_count;
+	uint16_t queue;		/* transmit queue, < bd_enable tx_queues */
+#define SCB_MAX_DSEGS		(MAX_SKB_FRAGS + 1)
+	struct {
+		dma_addr_t address;
+		uint32_t length;
+	} dseg[SCB_MAX_DSEGS];
+
+	/* Held by the SCSI driver until the destination is logged in */
+	struct list_head pending;
+	struct fc_port *fcport;
+	unsigned long expires;
+
+	/* IP driver only: TSO segment's send_cb owning the skb and mapping */
+	struct send_cb *tso_owner;
+	atomic_t tso_refs;	/*  owner: segments outstanding + 1 */
+
+	/* IP driver only: XDP_TX frame sent instead of an skb */
+	struct xdp_frame *xdpf;
+	struct llist_node xdp_node;
+
+	/* IP driver only: destination slot of the transmit queue */
+	uint16_t tx_dest;
 };
 
 /************************************************************************/
@@ -155,16 +279,17 @@ struct bd_inquiry {
 
 	uint16_t version;	/* Structure version number */
 /* NOTE: Update this value anytime the structure changes */
-#define BDI_VERSION		2
+#define BDI_VERSION		7
 
 	/* Exports */
 	unsigned long options;	/*  supported options */
 #define BDI_IP_SUPPORT		1	/*   IP supported */
 #define BDI_64BIT_ADDRESSING	2	/*   64bit address supported */
+#define BDI_RX_POOLS		3	/*   small buffer pool supported */
 
 	void *ha;		/*  Driver ha pointer */
-	void *risc_rec_q;	/*  RISC receive queue */
-	uint16_t risc_rec_q_size;	/*   size */
+	void *unused1;		/*  was the RISC receive queue */
+	uint16_t unused1_size;
 
 	uint16_t link_speed;	/* Current link speed */
 #define BDI_1GBIT_PORTSPEED	1	/*   operating at 1GBIT */
@@ -183,8 +308,12 @@ struct bd_inquiry {
 	void *ip_add_buffers_routine;
 	void *ip_send_packet_routine;
 	void *ip_tx_timeout_routine;
+	void *ip_set_send_packets_routine;
+	void *ip_flush_packets_routine;
+	void *ip_set_coalesce_routine;
 
-	uint32_t unused2[9];
+	/* The three callbacks above came out of the padding */
+	uint32_t unused2[9 - 3 * sizeof(void *) / sizeof(uint32_t)];
 };
 
 /************************************************************************/
@@ -197,7 +326,7 @@ struct bd_enable {
 
 	uint16_t version;	/* Structure version number */
 /* NOTE: Update this value anytime the structure changes */
-#define BDE_VERSION		2
+#define BDE_VERSION		8
 
 	/* Imports */
 	unsigned long options;	/*  supported options */
@@ -205,12 +334,15 @@ struct bd_enable {
 
 	uint32_t mtu;		/*  maximum transfer size */
 	uint16_t header_size;	/*  split header size */
-	uint16_t unused1;
+	uint16_t max_send_packets;	/*  max # outstanding send_cbs */
 
 	void *receive_buffers;	/*  receive buffers array */
-	uint16_t max_receive_buffers;	/*  max # receive buffers */
-	uint16_t unused2;
-	uint32_t receive_buff_data_size;	/*  buffer size */
+	struct bd_rx_ring *rx_ring;	/*  free receive buffer rings, */
+					/*   BD_RX_POOLS */
+	uint16_t max_receive_buffers;	/*  max # receive buffers, all pools */
+	uint16_t tx_queues;	/*  # transmit queues, returns # granted */
+	uint32_t receive_buff_data_size;	/*  large buffer size */
+	uint16_t small_buff_data_size;	/*  small buffer size, 0 if none */
 
 	/* Pointers to IP-backdoor callbacks */
 	void *notify_routine;
@@ -222,10 +354,34 @@ struct bd_enable {
 	uint32_t unused3[9];
 };
 
+/************************************************************************/
+/* Definitions for Backdoor Interrupt Coalescing.                       */
+/************************************************************************/
+
+/*
+ * Send completion coalescing.  Receives are not coalesced: they arrive on the
+ * base response queue, whose vector also completes SCSI I/O.
+ */
+struct bd_coalesce {
+	uint32_t tx_usecs;	/*  send completion hold-off, adaptive limit */
+	uint32_t tx_frames;	/*  minimum frames per held off interrupt */
+
+	unsigned long options;
+#define BDC_ADAPTIVE_TX		1	/*  tx hold-off follows packet rate */
+};
+
+/* Interrupt coalescing state of an IP connection */
+struct qla_ip_coalesce {
+	struct bd_coalesce params;
+};
+
 /************************************************************************/
 /* RISC interface structures                                            */
 /************************************************************************/
 
+/* Broadcast loop ID of FWI2 capable adapters */
+#define BROADCAST_4G			0x7ff
+
 /* IP mailbox commands */
 #define MBC_INITIALIZE_IP               0x0077
 #define MBC_DISABLE_IP                  0x0079
@@ -351,7 +507,8 @@ struct ip_init_cb_24xx {
 	uint16_t header_size;
 	uint16_t mtu;
 	uint16_t receive_buffer_size;
-	uint16_t reserved_2[5];
+	uint16_t small_buffer_size;	/* Pool 1, if BDI_RX_POOLS */
+	uint16_t reserved_2[4];
 
 	uint16_t low_water_mark;
 	uint16_t reserved_3[6];
@@ -448,4 +605,6 @@ void qla24xx_ip_send_complete(scsi_qla_host_t *ha, uint32_t handle,
 
 void qla24xx_ip_receive(scsi_qla_host_t *ha, struct ip_rec_entry_24xx *iprec_entry);
 
+void qla2x00_ip_irq_moderate(scsi_qla_host_t *ha, struct rsp_que *rsp);
+
 #endif
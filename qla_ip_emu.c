@@ -0,0 +1,825 @@
+/*
+ * QLogic Fibre Channel HBA Driver
+ * Copyright (c)  2003-2005 QLogic Corporation
+ *
+ * See LICENSE.qla2xxx for copyright and licensing details.
+ */
+
+/*
+ * Software-emulated ISP24xx IP firmware.
+ *
+ * An emulated adapter runs the real IP path of qla_ip.c: IP command and
+ * load pool IOCBs are built on an in-memory request queue, and receive and
+ * send completion entries are dispatched by qla24xx_process_response_queue().
+ * Its register file is plain memory, so the backdoor routines kick the
+ * emulated firmware after each doorbell, see qla2x00_ip_emu_doorbell().
+ *
+ * The firmware runs from an unbound work queue, like a RISC running next to
+ * the host CPUs.  It "DMAs" by copying between the DMA addresses of the
+ * sender's data segments and the receiver's posted buffers, so the DMA API
+ * must map host memory directly (no IOMMU translation).
+ *
+ * Adapters are linked in pairs, point-to-point; an odd last adapter is looped
+ * back to itself.
+ */
+#include <linux/dma-direct.h>
+#include <linux/workqueue.h>
+#include "qla_def.h"
+#include "qla_ip.h"
+
+#define QLA_IP_EMU_MAX_ADAPTERS	8
+#define QLA_IP_EMU_MAX_DSEGS	32	/* Data segments per IP command */
+#define QLA_IP_EMU_BATCH	64	/* IOCBs processed per interrupt */
+#define QLA_IP_EMU_CLASS	3	/* Receive service class */
+
+/* Emulated data segment */
+struct qla_ip_emu_dseg {
+	uint64_t address;
+	uint32_t length;
+};
+
+/* Emulated firmware receive buffer pool */
+struct qla_ip_emu_pool {
+	struct risc_rec_entry *buffers;	/* IP_BUFFER_QUEUE_DEPTH entries */
+	uint16_t buffer_size;
+	uint16_t in;
+	uint16_t out;
+	uint16_t cnt;
+};
+
+/* Software-emulated adapter */
+struct qla_ip_emu {
+	scsi_qla_host_t *vha;
+	struct qla_hw_data *hw;
+	struct pci_dev *pdev;		/* DMA device, not on the PCI bus */
+	device_reg_t *regs;		/* register file */
+	struct req_que req;
+	struct rsp_que rsp;
+	struct req_que *req_q_map[1];
+	struct rsp_que *rsp_q_map[1];
+
+	/* Link partner */
+	struct qla_ip_emu *peer;
+	fc_port_t *peer_fcport;
+	uint16_t loop_id;
+
+	/* Firmware state */
+	struct work_struct fw_work;
+	uint16_t req_out;		/* request queue out-pointer */
+	uint16_t rsp_in;		/* response queue in-pointer */
+
+	/* Firmware IP state, protected by the hardware_lock */
+	int enable_ip;
+	uint16_t header_size;
+	uint16_t mtu;
+	struct qla_ip_emu_pool pool[BD_RX_POOLS];
+};
+
+int ql2xipemu;
+module_param(ql2xipemu, int, S_IRUGO);
+MODULE_PARM_DESC(ql2xipemu,
+		"Number of software-emulated IP adapters, linked in pairs, "
+		"for benchmarking the IP path without hardware. "
+		"0 (Default) - Disabled.");
+
+static struct qla_ip_emu *qla_ip_emus[QLA_IP_EMU_MAX_ADAPTERS];
+static int qla_ip_emu_count;
+static struct workqueue_struct *qla_ip_emu_wq;
+
+/**
+ * qla_ip_emu_dma() - Host address of a DMA address.
+ * @emu: emulated adapter
+ * @address: DMA address mapped for the adapter
+ */
+static inline void *
+qla_ip_emu_dma(struct qla_ip_emu *emu, uint64_t address)
+{
+	return phys_to_virt(dma_to_phys(&emu->pdev->dev, address));
+}
+
+/**
+ * qla_ip_emu_interrupt() - Raise a response queue interrupt.
+ * @emu: emulated adapter
+ *
+ * The response queue is processed as by the adapter's interrupt handler,
+ * with the hardware_lock held.  Softirqs raised by the IP driver run once the
+ * "interrupt" returns.
+ */
+static void
+qla_ip_emu_interrupt(struct qla_ip_emu *emu)
+{
+	unsigned long flags;
+
+	local_bh_disable();
+	spin_lock_irqsave(&emu->hw->hardware_lock, flags);
+	qla24xx_process_response_queue(emu->vha, &emu->rsp);
+	spin_unlock_irqrestore(&emu->hw->hardware_lock, flags);
+	local_bh_enable();
+}
+
+/**
+ * qla_ip_emu_intr_handler() - isp_ops interrupt handler.
+ * @irq: unused
+ * @dev_id: response queue
+ *
+ * Only called by qla2x00_poll(), should the request queue run full.
+ */
+static irqreturn_t
+qla_ip_emu_intr_handler(int irq, void *dev_id)
+{
+	struct rsp_que *rsp = dev_id;
+	struct qla_ip_emu *emu = container_of(rsp, struct qla_ip_emu, rsp);
+	unsigned long flags;
+
+	spin_lock_irqsave(&emu->hw->hardware_lock, flags);
+	qla24xx_process_response_queue(emu->vha, rsp);
+	spin_unlock_irqrestore(&emu->hw->hardware_lock, flags);
+
+	return IRQ_HANDLED;
+}
+
+static struct isp_operations qla_ip_emu_isp_ops = {
+	.intr_handler = qla_ip_emu_intr_handler,
+};
+
+/**
+ * qla_ip_emu_post_rsp() - Post a response queue entry.
+ * @emu: emulated adapter
+ * @entry: entry to copy to the response queue
+ *
+ * A full response queue is processed first, as the interrupt would have
+ * been.
+ *
+ * Note: called with the hardware_lock held.
+ */
+static void
+qla_ip_emu_post_rsp(struct qla_ip_emu *emu, const void *entry)
+{
+	struct rsp_que *rsp = &emu->rsp;
+	response_t *pkt = &rsp->ring[emu->rsp_in];
+
+	if (pkt->signature != RESPONSE_PROCESSED)
+		qla24xx_process_response_queue(emu->vha, rsp);
+
+	memcpy(pkt, entry, RESPONSE_ENTRY_SIZE);
+	wmb();
+
+	if (++emu->rsp_in == rsp->length)
+		emu->rsp_in = 0;
+	WRT_REG_DWORD(rsp->rsp_q_in, emu->rsp_in);
+}
+
+/**
+ * qla_ip_emu_reset_pools() - Drop all posted receive buffers.
+ * @emu: emulated adapter
+ *
+ * Note: called with the hardware_lock held.
+ */
+static void
+qla_ip_emu_reset_pools(struct qla_ip_emu *emu)
+{
+	int i;
+
+	for (i = 0; i < BD_RX_POOLS; i++) {
+		emu->pool[i].in = 0;
+		emu->pool[i].out = 0;
+		emu->pool[i].cnt = 0;
+	}
+}
+
+/**
+ * qla_ip_emu_get_buffer() - Take a posted receive buffer.
+ * @pool: receive buffer pool, not empty
+ *
+ * Note: called with the hardware_lock held.
+ */
+static struct risc_rec_entry *
+qla_ip_emu_get_buffer(struct qla_ip_emu_pool *pool)
+{
+	struct risc_rec_entry *rentry = &pool->buffers[pool->out];
+
+	if (++pool->out == IP_BUFFER_QUEUE_DEPTH)
+		pool->out = 0;
+	pool->cnt--;
+
+	return rentry;
+}
+
+/**
+ * qla_ip_emu_load_pool() - Process an IP Load Pool IOCB.
+ * @emu: emulated adapter
+ * @pkt: IOCB
+ */
+static void
+qla_ip_emu_load_pool(struct qla_ip_emu *emu, struct ip_load_pool_24xx *pkt)
+{
+	int i;
+	unsigned long flags;
+	uint16_t pool_id;
+	struct qla_ip_emu_pool *pool;
+
+	pool_id = le16_to_cpu(pkt->pool_id);
+	if (pool_id >= BD_RX_POOLS) {
+		ql_dbg(ql_dbg_disc, emu->vha, 0x0,
+		    "%s: invalid receive buffer pool %d.\n", __func__, pool_id);
+		return;
+	}
+	pool = &emu->pool[pool_id];
+
+	spin_lock_irqsave(&emu->hw->hardware_lock, flags);
+	for (i = 0; i < le16_to_cpu(pkt->buffer_count) && i < IP_POOL_BUFFERS;
+	    i++) {
+		if (pool->cnt == IP_BUFFER_QUEUE_DEPTH) {
+			ql_dbg(ql_dbg_disc, emu->vha, 0x0,
+			    "%s: receive buffer pool overflow.\n", __func__);
+			break;
+		}
+		pool->buffers[pool->in] = pkt->buffers[i];
+		if (++pool->in == IP_BUFFER_QUEUE_DEPTH)
+			pool->in = 0;
+		pool->cnt++;
+	}
+	spin_unlock_irqrestore(&emu->hw->hardware_lock, flags);
+}
+
+/**
+ * qla_ip_emu_receive() - Receive an IP sequence.
+ * @emu: receiving adapter
+ * @src: sending adapter
+ * @dseg: sender's data segments
+ * @dseg_count: number of data segments
+ * @byte_count: sequence length
+ *
+ * The sequence is copied into posted receive buffers and an IP Receive entry
+ * is posted.  A sequence that fits a small buffer takes one, if any is
+ * posted; otherwise large buffers are used, the first only taking the split
+ * header if header/data split is enabled.  The sequence is discarded if not
+ * enough buffers are posted.
+ *
+ * Returns 1 if an IP Receive entry was posted.
+ */
+static int
+qla_ip_emu_receive(struct qla_ip_emu *emu, struct qla_ip_emu *src,
+    struct qla_ip_emu_dseg *dseg, uint16_t dseg_count, uint32_t byte_count)
+{
+	int i;
+	int posted;
+	unsigned long flags;
+	uint16_t cnt;
+	uint16_t header_size;
+	uint32_t size, len, copied, src_off, buf_size;
+	uint8_t *buf;
+	struct qla_ip_emu_pool *pool;
+	struct risc_rec_entry *rentry;
+	struct ip_rec_entry_24xx iprec;
+
+	memset(&iprec, 0, sizeof(iprec));
+	iprec.entry_type = IP_RECEIVE_24XX;
+	iprec.entry_count = 1;
+	iprec.nport_handle = cpu_to_le16(src->loop_id);
+	iprec.service_class = cpu_to_le16(QLA_IP_EMU_CLASS);
+	iprec.sequence_length = cpu_to_le16(byte_count);
+
+	posted = 0;
+	spin_lock_irqsave(&emu->hw->hardware_lock, flags);
+	if (!emu->enable_ip || byte_count > U16_MAX)
+		goto done;
+
+	/* Pool and buffers needed for the sequence */
+	pool = &emu->pool[BD_POOL_SMALL];
+	if (byte_count <= pool->buffer_size && pool->cnt) {
+		header_size = 0;
+	} else {
+		pool = &emu->pool[BD_POOL_LARGE];
+		header_size = emu->header_size;
+	}
+	buf_size = header_size ? header_size : pool->buffer_size;
+	for (cnt = 0, size = byte_count; size; cnt++) {
+		size -= min(size, buf_size);
+		buf_size = pool->buffer_size;
+	}
+	if (cnt > IP_RCV_BUFFERS)
+		goto done;
+	if (cnt > pool->cnt) {
+		if (emu->vha->ip.flags.enable_ip)
+			qla2x00_ip_buffer_event(emu->vha,
+			    MBA_IP_RCV_BUFFER_EMPTY);
+		goto done;
+	}
+
+	/* DMA the sequence */
+	if (header_size)
+		iprec.comp_status = cpu_to_le16(IPREC_STATUS_SPLIT_BUFFER);
+	buf_size = header_size ? header_size : pool->buffer_size;
+	src_off = 0;
+	for (i = 0, size = byte_count; i < cnt; i++) {
+		rentry = qla_ip_emu_get_buffer(pool);
+		iprec.buffer_handles[i] = rentry->handle;
+		buf = qla_ip_emu_dma(emu,
+		    ((uint64_t)le32_to_cpu(rentry->data_addr_high) << 32) |
+		    le32_to_cpu(rentry->data_addr_low));
+
+		for (copied = 0; copied < min(size, buf_size); copied += len) {
+			len = min(min(size, buf_size) - copied,
+			    dseg->length - src_off);
+			memcpy(buf + copied,
+			    (uint8_t *)qla_ip_emu_dma(src, dseg->address) +
+			    src_off, len);
+			src_off += len;
+			if (src_off == dseg->length) {
+				dseg++;
+				src_off = 0;
+			}
+		}
+		size -= copied;
+		buf_size = pool->buffer_size;
+	}
+
+	qla_ip_emu_post_rsp(emu, &iprec);
+	posted = 1;
+done:
+	spin_unlock_irqrestore(&emu->hw->hardware_lock, flags);
+
+	return posted;
+}
+
+/**
+ * qla_ip_emu_ip_cmd() - Process an IP Command IOCB.
+ * @emu: emulated adapter
+ * @index: request queue index of the IOCB
+ *
+ * The sequence is delivered to the link partner if addressed to it, or
+ * broadcast, then the command is completed.
+ *
+ * Returns 1 if an IP Receive entry was posted to the link partner.
+ */
+static int
+qla_ip_emu_ip_cmd(struct qla_ip_emu *emu, uint16_t index)
+{
+	int i;
+	int posted;
+	unsigned long flags;
+	uint16_t loop_id;
+	uint16_t dseg_count;
+	uint32_t byte_count, total;
+	uint32_t *cur_dsd;
+	struct req_que *req = &emu->req;
+	struct ip_cmd_entry_24xx *ipcmd_entry;
+	struct qla_ip_emu_dseg dseg[QLA_IP_EMU_MAX_DSEGS];
+	struct sts_entry_24xx sts;
+
+	ipcmd_entry = (struct ip_cmd_entry_24xx *)&req->ring[index];
+	loop_id = le16_to_cpu(ipcmd_entry->nport_handle);
+	dseg_count = le16_to_cpu(ipcmd_entry->dseg_count);
+	byte_count = le32_to_cpu(ipcmd_entry->byte_count);
+
+	memset(&sts, 0, sizeof(sts));
+	sts.entry_type = IP_COMMAND_24XX;
+	sts.entry_count = 1;
+	sts.handle = ipcmd_entry->handle;
+	sts.comp_status = cpu_to_le16(SCB_CS_COMPLETE);
+
+	/* Gather data segments, 5 per Continuation Type 1 IOCB */
+	if (!dseg_count || dseg_count > QLA_IP_EMU_MAX_DSEGS) {
+		sts.comp_status = cpu_to_le16(SCB_CS_INCOMPLETE);
+		dseg_count = 0;
+	}
+	total = 0;
+	cur_dsd = ipcmd_entry->dseg_0_address;
+	for (i = 0; i < dseg_count; i++) {
+		if (i && (i - 1) % 5 == 0) {
+			if (++index == req->length)
+				index = 0;
+			cur_dsd = ((cont_a64_entry_t *)
+			    &req->ring[index])->dseg_0_address;
+		}
+		dseg[i].address = le32_to_cpu(cur_dsd[0]) |
+		    ((uint64_t)le32_to_cpu(cur_dsd[1]) << 32);
+		dseg[i].length = le32_to_cpu(cur_dsd[2]);
+		total += dseg[i].length;
+		cur_dsd += 3;
+	}
+	if (total < byte_count)
+		sts.comp_status = cpu_to_le16(SCB_CS_INCOMPLETE);
+
+	posted = 0;
+	if (loop_id != BROADCAST_4G && loop_id != emu->peer->loop_id)
+		sts.comp_status = cpu_to_le16(SCB_CS_PORT_UNAVAILABLE);
+	else if (sts.comp_status == cpu_to_le16(SCB_CS_COMPLETE))
+		posted = qla_ip_emu_receive(emu->peer, emu, dseg, dseg_count,
+		    byte_count);
+
+	spin_lock_irqsave(&emu->hw->hardware_lock, flags);
+	qla_ip_emu_post_rsp(emu, &sts);
+	spin_unlock_irqrestore(&emu->hw->hardware_lock, flags);
+
+	return posted;
+}
+
+/**
+ * qla_ip_emu_fw_work() - Emulated firmware.
+ * @work: the adapter's firmware work
+ *
+ * Processes the request queue up to its in-pointer, raising an interrupt
+ * every QLA_IP_EMU_BATCH IOCBs and once the queue is empty.
+ */
+static void
+qla_ip_emu_fw_work(struct work_struct *work)
+{
+	struct qla_ip_emu *emu = container_of(work, struct qla_ip_emu, fw_work);
+	struct qla_ip_emu *peer = emu->peer;
+	struct req_que *req = &emu->req;
+	request_t *pkt;
+	uint16_t req_in;
+	int peer_intr;
+	int batch;
+
+	peer_intr = 0;
+	batch = 0;
+	while ((req_in = RD_REG_DWORD(req->req_q_in)) != emu->req_out) {
+		/* Read IOCBs after the in-pointer */
+		rmb();
+
+		pkt = &req->ring[emu->req_out];
+		switch (pkt->entry_type) {
+		case IP_LOAD_POOL_24XX:
+			qla_ip_emu_load_pool(emu,
+			    (struct ip_load_pool_24xx *)pkt);
+			break;
+		case IP_COMMAND_24XX:
+			peer_intr |= qla_ip_emu_ip_cmd(emu, emu->req_out);
+			break;
+		case MARKER_TYPE:
+			break;
+		default:
+			ql_dbg(ql_dbg_disc, emu->vha, 0x0,
+			    "%s: unsupported IOCB type %x.\n", __func__,
+			    pkt->entry_type);
+			break;
+		}
+
+		/* Release the IOCB and its continuations */
+		emu->req_out += pkt->entry_count ? pkt->entry_count : 1;
+		if (emu->req_out >= req->length)
+			emu->req_out -= req->length;
+		WRT_REG_DWORD(req->req_q_out, emu->req_out);
+
+		if (++batch == QLA_IP_EMU_BATCH) {
+			qla_ip_emu_interrupt(emu);
+			if (peer_intr && peer != emu)
+				qla_ip_emu_interrupt(peer);
+			peer_intr = 0;
+			batch = 0;
+		}
+	}
+
+	qla_ip_emu_interrupt(emu);
+	if (peer_intr && peer != emu)
+		qla_ip_emu_interrupt(peer);
+}
+
+/**
+ * qla2x00_ip_emu_doorbell() - Kick the emulated firmware.
+ * @vha: emulated adapter's HA context
+ *
+ * Called after the request queue in-pointer may have been written.
+ */
+void
+qla2x00_ip_emu_doorbell(scsi_qla_host_t *vha)
+{
+	queue_work(qla_ip_emu_wq, &vha->ip.emu->fw_work);
+}
+
+/**
+ * qla_ip_emu_discard_receives() - Discard unprocessed IP Receive entries.
+ * @emu: emulated adapter
+ *
+ * The buffers of IP Receive entries still on the response queue are owned by
+ * the IP driver once IP is disabled, so the entries are neutralized.
+ *
+ * Note: called with the hardware_lock held.
+ */
+static void
+qla_ip_emu_discard_receives(struct qla_ip_emu *emu)
+{
+	struct rsp_que *rsp = &emu->rsp;
+	uint16_t index;
+
+	for (index = rsp->ring_index; index != emu->rsp_in;) {
+		if (rsp->ring[index].entry_type == IP_RECEIVE_24XX)
+			rsp->ring[index].entry_type = MARKER_TYPE;
+		if (++index == rsp->length)
+			index = 0;
+	}
+}
+
+/**
+ * qla2x00_ip_emu_mailbox() - Execute an IP mailbox command.
+ * @vha: emulated adapter's HA context
+ * @mcp: mailbox command
+ *
+ * Returns QLA_SUCCESS if the command completed.
+ */
+int
+qla2x00_ip_emu_mailbox(scsi_qla_host_t *vha, mbx_cmd_t *mcp)
+{
+	struct qla_ip_emu *emu = vha->ip.emu;
+	struct ip_init_cb_24xx *ipinit_cb;
+	unsigned long flags;
+	uint64_t address;
+
+	switch (mcp->mb[0]) {
+	case MBC_INITIALIZE_IP:
+		address = ((uint64_t)mcp->mb[6] << 48) |
+		    ((uint64_t)mcp->mb[7] << 32) |
+		    ((uint64_t)mcp->mb[2] << 16) | mcp->mb[3];
+		ipinit_cb = qla_ip_emu_dma(emu, address);
+
+		spin_lock_irqsave(&emu->hw->hardware_lock, flags);
+		emu->header_size = le16_to_cpu(ipinit_cb->header_size);
+		emu->mtu = le16_to_cpu(ipinit_cb->mtu);
+		emu->pool[BD_POOL_LARGE].buffer_size =
+		    le16_to_cpu(ipinit_cb->receive_buffer_size);
+		emu->pool[BD_POOL_SMALL].buffer_size =
+		    le16_to_cpu(ipinit_cb->small_buffer_size);
+		qla_ip_emu_reset_pools(emu);
+		emu->enable_ip = 1;
+		spin_unlock_irqrestore(&emu->hw->hardware_lock, flags);
+		break;
+
+	case MBC_DISABLE_IP:
+		spin_lock_irqsave(&emu->hw->hardware_lock, flags);
+		emu->enable_ip = 0;
+		spin_unlock_irqrestore(&emu->hw->hardware_lock, flags);
+
+		flush_work(&emu->fw_work);
+
+		spin_lock_irqsave(&emu->hw->hardware_lock, flags);
+		qla_ip_emu_discard_receives(emu);
+		qla24xx_process_response_queue(vha, &emu->rsp);
+		qla_ip_emu_reset_pools(emu);
+		spin_unlock_irqrestore(&emu->hw->hardware_lock, flags);
+		break;
+
+	default:
+		mcp->mb[0] = MBS_INVALID_COMMAND;
+		return QLA_FUNCTION_FAILED;
+	}
+
+	mcp->mb[0] = MBS_COMMAND_COMPLETE;
+	return QLA_SUCCESS;
+}
+
+/**
+ * qla2x00_ip_emu_host() - Retrieve an emulated adapter.
+ * @index: emulated adapter number
+ *
+ * Returns the adapter's HA context, else NULL.
+ */
+scsi_qla_host_t *
+qla2x00_ip_emu_host(int index)
+{
+	if (index < 0 || index >= qla_ip_emu_count)
+		return NULL;
+
+	return qla_ip_emus[index]->vha;
+}
+
+static void
+qla_ip_emu_release_pdev(struct device *dev)
+{
+	kfree(to_pci_dev(dev));
+}
+
+/**
+ * qla_ip_emu_free() - Release an emulated adapter.
+ * @emu: emulated adapter
+ */
+static void
+qla_ip_emu_free(struct qla_ip_emu *emu)
+{
+	int i;
+
+	if (emu->peer_fcport) {
+		qla2x00_ip_unhash_fcport(emu->vha, emu->peer_fcport);
+		kfree(emu->peer_fcport);
+	}
+	for (i = 0; i < BD_RX_POOLS; i++)
+		kvfree(emu->pool[i].buffers);
+	kfree(emu->req.ring);
+	kfree(emu->rsp.ring);
+	kfree(emu->regs);
+	kfree(emu->vha);
+	kfree(emu->hw);
+	if (emu->pdev)
+		put_device(&emu->pdev->dev);
+	kfree(emu);
+}
+
+/**
+ * qla_ip_emu_alloc() - Create an emulated adapter.
+ * @index: emulated adapter number
+ *
+ * Only the state used by the IP path is set up: an online ISP2432 HA
+ * context with a single request/response queue pair and no interrupts.
+ *
+ * Returns the emulated adapter, else NULL.
+ */
+static struct qla_ip_emu *
+qla_ip_emu_alloc(int index)
+{
+	int i;
+	struct qla_ip_emu *emu;
+	struct qla_hw_data *hw;
+	scsi_qla_host_t *vha;
+	struct pci_dev *pdev;
+
+	emu = kzalloc(sizeof(struct qla_ip_emu), GFP_KERNEL);
+	if (!emu)
+		return NULL;
+
+	/* DMA device */
+	pdev = kzalloc(sizeof(struct pci_dev), GFP_KERNEL);
+	if (!pdev)
+		goto fail;
+	device_initialize(&pdev->dev);
+	pdev->dev.release = qla_ip_emu_release_pdev;
+	emu->pdev = pdev;
+	if (dev_set_name(&pdev->dev, "qla2xip-emu%d", index))
+		goto fail;
+	pdev->dma_mask = DMA_BIT_MASK(64);
+	pdev->dev.dma_mask = &pdev->dma_mask;
+	pdev->dev.coherent_dma_mask = DMA_BIT_MASK(64);
+
+	emu->hw = hw = kzalloc(sizeof(struct qla_hw_data), GFP_KERNEL);
+	emu->vha = vha = kzalloc(sizeof(scsi_qla_host_t), GFP_KERNEL);
+	emu->regs = kzalloc(sizeof(device_reg_t), GFP_KERNEL);
+	emu->req.ring = kcalloc(REQUEST_ENTRY_CNT_24XX, REQUEST_ENTRY_SIZE,
+	    GFP_KERNEL);
+	emu->rsp.ring = kcalloc(RESPONSE_ENTRY_CNT_2300, RESPONSE_ENTRY_SIZE,
+	    GFP_KERNEL);
+	if (!hw || !vha || !emu->regs || !emu->req.ring || !emu->rsp.ring)
+		goto fail;
+	for (i = 0; i < BD_RX_POOLS; i++) {
+		emu->pool[i].buffers = kvcalloc(IP_BUFFER_QUEUE_DEPTH,
+		    sizeof(struct risc_rec_entry), GFP_KERNEL);
+		if (!emu->pool[i].buffers)
+			goto fail;
+	}
+
+	/* Request/response queue pair */
+	emu->req.length = REQUEST_ENTRY_CNT_24XX;
+	emu->req.cnt = emu->req.length;
+	emu->req.ring_ptr = emu->req.ring;
+	emu->req.req_q_in = &emu->regs->isp24.req_q_in;
+	emu->req.req_q_out = &emu->regs->isp24.req_q_out;
+	emu->req.rsp = &emu->rsp;
+
+	emu->rsp.length = RESPONSE_ENTRY_CNT_2300;
+	emu->rsp.ring_ptr = emu->rsp.ring;
+	emu->rsp.rsp_q_in = &emu->regs->isp24.rsp_q_in;
+	emu->rsp.rsp_q_out = &emu->regs->isp24.rsp_q_out;
+	emu->rsp.hw = hw;
+	emu->rsp.req = &emu->req;
+	for (i = 0; i < emu->rsp.length; i++)
+		emu->rsp.ring[i].signature = RESPONSE_PROCESSED;
+
+	/* HA context */
+	hw->pdev = pdev;
+	hw->iobase = emu->regs;
+	hw->isp_ops = &qla_ip_emu_isp_ops;
+	hw->device_type = DT_ISP2432 | DT_FWI2;
+	hw->flags.enable_64bit_addressing = 1;
+	hw->link_data_rate = PORT_SPEED_4GB;
+	spin_lock_init(&hw->hardware_lock);
+	emu->req_q_map[0] = &emu->req;
+	emu->rsp_q_map[0] = &emu->rsp;
+	hw->req_q_map = emu->req_q_map;
+	hw->rsp_q_map = emu->rsp_q_map;
+	hw->max_req_queues = 1;
+	hw->max_rsp_queues = 1;
+
+	vha->hw = hw;
+	vha->req = &emu->req;
+	vha->host_no = index;
+	vha->flags.online = 1;
+	vha->flags.init_done = 1;
+	atomic_set(&vha->loop_state, LOOP_UP);
+
+	/* Port name carries a locally administered IEEE MAC address */
+	vha->ip.ip_port_name[0] = 0x10;
+	vha->ip.ip_port_name[2] = 0x02;
+	vha->ip.ip_port_name[4] = 0x51;
+	vha->ip.ip_port_name[5] = 0x4c;
+	vha->ip.ip_port_name[7] = index;
+	hash_init(vha->ip.fcport_hash);
+	INIT_LIST_HEAD(&vha->ip.pending_q);
+	vha->ip.emu = emu;
+
+	emu->loop_id = index + 1;
+	INIT_WORK(&emu->fw_work, qla_ip_emu_fw_work);
+
+	return emu;
+
+fail:
+	qla_ip_emu_free(emu);
+	return NULL;
+}
+
+/**
+ * qla_ip_emu_link() - Connect an emulated adapter to its link partner.
+ * @emu: emulated adapter
+ * @peer: link partner, possibly @emu
+ *
+ * The partner's port is logged in, as seen by the IP path.
+ *
+ * Returns 0 on success.
+ */
+static int
+qla_ip_emu_link(struct qla_ip_emu *emu, struct qla_ip_emu *peer)
+{
+	fc_port_t *fcport;
+
+	fcport = kzalloc(sizeof(fc_port_t), GFP_KERNEL);
+	if (!fcport)
+		return -ENOMEM;
+
+	fcport->vha = emu->vha;
+	fcport->loop_id = peer->loop_id;
+	memcpy(fcport->port_name, peer->vha->ip.ip_port_name, WWN_SIZE);
+	atomic_set(&fcport->state, FCS_ONLINE);
+
+	emu->peer = peer;
+	emu->peer_fcport = fcport;
+	qla2x00_ip_hash_fcport(emu->vha, fcport);
+
+	return 0;
+}
+
+/**
+ * qla2x00_ip_emu_init() - Create the emulated adapters.
+ *
+ * Returns 0 on success.
+ */
+int
+qla2x00_ip_emu_init(void)
+{
+	int i;
+	int count;
+
+	count = min(ql2xipemu, QLA_IP_EMU_MAX_ADAPTERS);
+	if (count <= 0)
+		return 0;
+
+	qla_ip_emu_wq = alloc_workqueue("qla2xip_emu",
+	    WQ_UNBOUND | WQ_HIGHPRI, 0);
+	if (!qla_ip_emu_wq)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++) {
+		qla_ip_emus[i] = qla_ip_emu_alloc(i);
+		if (!qla_ip_emus[i])
+			goto fail;
+		qla_ip_emu_count++;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (qla_ip_emu_link(qla_ip_emus[i],
+		    qla_ip_emus[(i ^ 1) < count ? i ^ 1 : i]))
+			goto fail;
+	}
+
+	ql_log(ql_log_info, NULL, 0x0,
+	    "%d software-emulated IP adapter(s).\n", count);
+
+	return 0;
+
+fail:
+	qla2x00_ip_emu_exit();
+	return -ENOMEM;
+}
+
+/**
+ * qla2x00_ip_emu_exit() - Release the emulated adapters.
+ *
+ * The IP driver, which holds a reference on this module, is gone.
+ */
+void
+qla2x00_ip_emu_exit(void)
+{
+	int i;
+
+	if (qla_ip_emu_wq)
+		flush_workqueue(qla_ip_emu_wq);
+
+	for (i = 0; i < qla_ip_emu_count; i++) {
+		qla_ip_emu_free(qla_ip_emus[i]);
+		qla_ip_emus[i] = NULL;
+	}
+	qla_ip_emu_count = 0;
+
+	if (qla_ip_emu_wq) {
+		destroy_workqueue(qla_ip_emu_wq);
+		qla_ip_emu_wq = NULL;
+	}
+}
@@ -9,6 +9,7 @@
 #include "qla_ip.h"
 
 #include <linux/delay.h>
+#include <linux/prefetch.h>
 #include <linux/slab.h>
 #include <scsi/scsi_tcq.h>
 #include <scsi/scsi_bsg_fc.h>
@@ -1057,6 +1058,11 @@ global_port_update:
 			qla2x00_process_response_queue(rsp);
 		break;
 
+	case MBA_IP_LOW_WATER_MARK:
+	case MBA_IP_RCV_BUFFER_EMPTY:
+		qla2x00_ip_buffer_event(vha, mb[0]);
+		break;
+
 	case MBA_DISCARD_RND_FRAME:
 		ql_dbg(ql_dbg_async, vha, 0x5016,
 		    "Discard RND Frame -- %04x %04x %04x.\n",
@@ -1202,7 +1208,7 @@ qla2x00_process_completed_request(struct scsi_qla_host *vha,
 	sp = req->outstanding_cmds[index];
 	if (sp) {
 		/* Free outstanding command slot. */
-		req->outstanding_cmds[index] = NULL;
+		qla2x00_clear_outstanding(req, index);
 
 		/* Save ISP completion status */
 		sp->done(ha, sp, DID_OK << 16);
@@ -1247,7 +1253,7 @@ qla2x00_get_sp_from_handle(scsi_qla_host_t *vha, const char *func,
 		return NULL;
 	}
 
-	req->outstanding_cmds[index] = NULL;
+	qla2x00_clear_outstanding(req, index);
 
 done:
 	return sp;
@@ -1342,7 +1348,8 @@ qla2x00_ct_entry(scsi_qla_host_t *vha, struct req_que *req,
 	const char func[] = "CT_IOCB";
 	const char *type;
 	srb_t *sp;
-	struct fc_bsg_job *bsg_job;
+	struct bsg_job *bsg_job;
+	struct fc_bsg_reply *bsg_reply;
 	uint16_t comp_status;
 	int res;
 
@@ -1351,6 +1358,7 @@ qla2x00_ct_entry(scsi_qla_host_t *vha, struct req_que *req,
 		return;
 
 	bsg_job = sp->u.bsg_job;
+	bsg_reply = bsg_job->reply;
 
 	type = "ct pass-through";
 
@@ -1359,32 +1367,32 @@ qla2x00_ct_entry(scsi_qla_host_t *vha, struct req_que *req,
 	/* return FC_CTELS_STATUS_OK and leave the decoding of the ELS/CT
 	 * fc payload  to the caller
 	 */
-	bsg_job->reply->reply_data.ctels_reply.status = FC_CTELS_STATUS_OK;
+	bsg_reply->reply_data.ctels_reply.status = FC_CTELS_STATUS_OK;
 	bsg_job->reply_len = sizeof(struct fc_bsg_reply);
 
 	if (comp_status != CS_COMPLETE) {
 		if (comp_status == CS_DATA_UNDERRUN) {
 			res = DID_OK << 16;
-			bsg_job->reply->reply_payload_rcv_len =
+			bsg_reply->reply_payload_rcv_len =
 			    le16_to_cpu(((sts_entry_t *)pkt)->rsp_info_len);
 
 			ql_log(ql_log_warn, vha, 0x5048,
 			    "CT pass-through-%s error "
 			    "comp_status-status=0x%x total_byte = 0x%x.\n",
 			    type, comp_status,
-			    bsg_job->reply->reply_payload_rcv_len);
+			    bsg_reply->reply_payload_rcv_len);
 		} else {
 			ql_log(ql_log_warn, vha, 0x5049,
 			    "CT pass-through-%s error "
 			    "comp_status-status=0x%x.\n", type, comp_status);
 			res = DID_ERROR << 16;
-			bsg_job->reply->reply_payload_rcv_len = 0;
+			bsg_reply->reply_payload_rcv_len = 0;
 		}
 		ql_dump_buffer(ql_dbg_async + ql_dbg_buffer, vha, 0x5035,
 		    (uint8_t *)pkt, sizeof(*pkt));
 	} else {
 		res = DID_OK << 16;
-		bsg_job->reply->reply_payload_rcv_len =
+		bsg_reply->reply_payload_rcv_len =
 		    bsg_job->reply_payload.payload_len;
 		bsg_job->reply_len = 0;
 	}
@@ -1399,7 +1407,8 @@ qla24xx_els_ct_entry(scsi_qla_host_t *vha, struct req_que *req,
 	const char func[] = "ELS_CT_IOCB";
 	const char *type;
 	srb_t *sp;
-	struct fc_bsg_job *bsg_job;
+	struct bsg_job *bsg_job;
+	struct fc_bsg_reply *bsg_reply;
 	uint16_t comp_status;
 	uint32_t fw_status[3];
 	uint8_t* fw_sts_ptr;
@@ -1409,6 +1418,7 @@ qla24xx_els_ct_entry(scsi_qla_host_t *vha, struct req_que *req,
 	if (!sp)
 		return;
 	bsg_job = sp->u.bsg_job;
+	bsg_reply = bsg_job->reply;
 
 	type = NULL;
 	switch (sp->type) {
@@ -1432,13 +1442,13 @@ qla24xx_els_ct_entry(scsi_qla_host_t *vha, struct req_que *req,
 	/* return FC_CTELS_STATUS_OK and leave the decoding of the ELS/CT
 	 * fc payload  to the caller
 	 */
-	bsg_job->reply->reply_data.ctels_reply.status = FC_CTELS_STATUS_OK;
+	bsg_reply->reply_data.ctels_reply.status = FC_CTELS_STATUS_OK;
 	bsg_job->reply_len = sizeof(struct fc_bsg_reply) + sizeof(fw_status);
 
 	if (comp_status != CS_COMPLETE) {
 		if (comp_status == CS_DATA_UNDERRUN) {
 			res = DID_OK << 16;
-			bsg_job->reply->reply_payload_rcv_len =
+			bsg_reply->reply_payload_rcv_len =
 			    le16_to_cpu(((struct els_sts_entry_24xx *)pkt)->total_byte_count);
 
 			ql_dbg(ql_dbg_user, vha, 0x503f,
@@ -1447,7 +1457,7 @@ qla24xx_els_ct_entry(scsi_qla_host_t *vha, struct req_que *req,
 			    type, sp->handle, comp_status, fw_status[1], fw_status[2],
 			    le16_to_cpu(((struct els_sts_entry_24xx *)
 				pkt)->total_byte_count));
-			fw_sts_ptr = ((uint8_t*)bsg_job->req->sense) + sizeof(struct fc_bsg_reply);
+			fw_sts_ptr = ((uint8_t*)bsg_job->reply) + sizeof(struct fc_bsg_reply);
 			memcpy( fw_sts_ptr, fw_status, sizeof(fw_status));
 		}
 		else {
@@ -1460,8 +1470,8 @@ qla24xx_els_ct_entry(scsi_qla_host_t *vha, struct req_que *req,
 			    le16_to_cpu(((struct els_sts_entry_24xx *)
 				    pkt)->error_subcode_2));
 			res = DID_ERROR << 16;
-			bsg_job->reply->reply_payload_rcv_len = 0;
-			fw_sts_ptr = ((uint8_t*)bsg_job->req->sense) + sizeof(struct fc_bsg_reply);
+			bsg_reply->reply_payload_rcv_len = 0;
+			fw_sts_ptr = ((uint8_t*)bsg_job->reply) + sizeof(struct fc_bsg_reply);
 			memcpy( fw_sts_ptr, fw_status, sizeof(fw_status));
 		}
 		ql_dump_buffer(ql_dbg_user + ql_dbg_buffer, vha, 0x5056,
@@ -1469,7 +1479,7 @@ qla24xx_els_ct_entry(scsi_qla_host_t *vha, struct req_que *req,
 	}
 	else {
 		res =  DID_OK << 16;
-		bsg_job->reply->reply_payload_rcv_len = bsg_job->reply_payload.payload_len;
+		bsg_reply->reply_payload_rcv_len = bsg_job->reply_payload.payload_len;
 		bsg_job->reply_len = 0;
 	}
 
@@ -1840,31 +1850,22 @@ qla2x00_handle_dif_error(srb_t *sp, struct sts_entry_24xx *sts24)
 
 	/* check guard */
 	if (e_guard != a_guard) {
-		scsi_build_sense_buffer(1, cmd->sense_buffer, ILLEGAL_REQUEST,
-		    0x10, 0x1);
-		set_driver_byte(cmd, DRIVER_SENSE);
+		scsi_build_sense(cmd, 1, ILLEGAL_REQUEST, 0x10, 0x1);
 		set_host_byte(cmd, DID_ABORT);
-		cmd->result |= SAM_STAT_CHECK_CONDITION << 1;
 		return 1;
 	}
 
 	/* check ref tag */
 	if (e_ref_tag != a_ref_tag) {
-		scsi_build_sense_buffer(1, cmd->sense_buffer, ILLEGAL_REQUEST,
-		    0x10, 0x3);
-		set_driver_byte(cmd, DRIVER_SENSE);
+		scsi_build_sense(cmd, 1, ILLEGAL_REQUEST, 0x10, 0x3);
 		set_host_byte(cmd, DID_ABORT);
-		cmd->result |= SAM_STAT_CHECK_CONDITION << 1;
 		return 1;
 	}
 
 	/* check appl tag */
 	if (e_app_tag != a_app_tag) {
-		scsi_build_sense_buffer(1, cmd->sense_buffer, ILLEGAL_REQUEST,
-		    0x10, 0x2);
-		set_driver_byte(cmd, DRIVER_SENSE);
+		scsi_build_sense(cmd, 1, ILLEGAL_REQUEST, 0x10, 0x2);
 		set_host_byte(cmd, DID_ABORT);
-		cmd->result |= SAM_STAT_CHECK_CONDITION << 1;
 		return 1;
 	}
 
@@ -1881,7 +1882,9 @@ qla25xx_process_bidir_status_iocb(scsi_qla_host_t *vha, void *pkt,
 	uint16_t	scsi_status;
 	uint16_t thread_id;
 	uint32_t rval = EXT_STATUS_OK;
-	struct fc_bsg_job *bsg_job = NULL;
+	struct bsg_job *bsg_job = NULL;
+	struct fc_bsg_request *bsg_request;
+	struct fc_bsg_reply *bsg_reply;
 	sts_entry_t *sts;
 	struct sts_entry_24xx *sts24;
 	sts = (sts_entry_t *) pkt;
@@ -1898,8 +1901,10 @@ qla25xx_process_bidir_status_iocb(scsi_qla_host_t *vha, void *pkt,
 	sp = req->outstanding_cmds[index];
 	if (sp) {
 		/* Free outstanding command slot. */
-		req->outstanding_cmds[index] = NULL;
+		qla2x00_clear_outstanding(req, index);
 		bsg_job = sp->u.bsg_job;
+		bsg_request = bsg_job->request;
+		bsg_reply = bsg_job->reply;
 	} else {
 		ql_log(ql_log_warn, vha, 0x70b0,
 		    "Req:%d: Invalid ISP SCSI completion handle(0x%x)\n",
@@ -1917,14 +1922,14 @@ qla25xx_process_bidir_status_iocb(scsi_qla_host_t *vha, void *pkt,
 		scsi_status = le16_to_cpu(sts->scsi_status) & SS_MASK;
 	}
 
-	thread_id = bsg_job->request->rqst_data.h_vendor.vendor_cmd[1];
+	thread_id = bsg_request->rqst_data.h_vendor.vendor_cmd[1];
 	switch (comp_status) {
 	case CS_COMPLETE:
 		if (scsi_status == 0) {
-			bsg_job->reply->reply_payload_rcv_len =
+			bsg_reply->reply_payload_rcv_len =
 					bsg_job->reply_payload.payload_len;
 			vha->qla_stats.input_bytes +=
-				bsg_job->reply->reply_payload_rcv_len;
+				bsg_reply->reply_payload_rcv_len;
 			vha->qla_stats.input_requests++;
 			rval = EXT_STATUS_OK;
 		}
@@ -2005,11 +2010,11 @@ qla25xx_process_bidir_status_iocb(scsi_qla_host_t *vha, void *pkt,
 		rval = EXT_STATUS_ERR;
 		break;
 	}
-		bsg_job->reply->reply_payload_rcv_len = 0;
+		bsg_reply->reply_payload_rcv_len = 0;
 
 done:
 	/* Return the vendor specific reply to API */
-	bsg_job->reply->reply_data.vendor_reply.vendor_rsp[0] = rval;
+	bsg_reply->reply_data.vendor_reply.vendor_rsp[0] = rval;
 	bsg_job->reply_len = sizeof(struct fc_bsg_reply);
 	/* Always return DID_OK, bsg will send the vendor specific response
 	 * in this case only */
@@ -2017,6 +2022,25 @@ done:
 
 }
 
+/*
+ * Complete a SCSI command whose status was posted to @rsp.  Within
+ * qla24xx_rsp_poll() the completion is deferred until the queue's lock has
+ * been dropped.
+ */
+static inline void
+qla2x00_sp_complete(struct rsp_que *rsp, srb_t *sp, int res)
+{
+	struct qla_rsp_compl *compl;
+
+	if (rsp->defer_compl && rsp->num_compl < QLA_RSP_POLL_WEIGHT) {
+		compl = &rsp->compl[rsp->num_compl++];
+		compl->sp = sp;
+		compl->res = res;
+		return;
+	}
+	sp->done(rsp->hw, sp, res);
+}
+
 /**
  * qla2x00_status_entry() - Process a Status IOCB entry.
  * @ha: SCSI driver HA context
@@ -2108,12 +2132,12 @@ qla2x00_status_entry(scsi_qla_host_t *vha, struct rsp_que *rsp, void *pkt)
 
 	/* Fast path completion. */
 	if (comp_status == CS_COMPLETE && scsi_status == 0) {
-		qla2x00_process_completed_request(vha, req, handle);
-
+		qla2x00_clear_outstanding(req, handle);
+		qla2x00_sp_complete(rsp, sp, DID_OK << 16);
 		return;
 	}
 
-	req->outstanding_cmds[handle] = NULL;
+	qla2x00_clear_outstanding(req, handle);
 	cp = GET_CMD_SP(sp);
 	if (cp == NULL) {
 		ql_dbg(ql_dbg_io, vha, 0x3018,
@@ -2377,7 +2401,7 @@ out:
 		    resid_len, fw_resid_len, sp, cp);
 
 	if (rsp->status_srb == NULL)
-		sp->done(ha, sp, res);
+		qla2x00_sp_complete(rsp, sp, res);
 }
 
 /**
@@ -2434,7 +2458,7 @@ qla2x00_status_cont_entry(struct rsp_que *rsp, sts_cont_entry_t *pkt)
 	/* Place command on done queue. */
 	if (sense_len == 0) {
 		rsp->status_srb = NULL;
-		sp->done(ha, sp, cp->result);
+		qla2x00_sp_complete(rsp, sp, cp->result);
 	}
 }
 
@@ -2528,20 +2552,31 @@ qla24xx_abort_iocb_entry(scsi_qla_host_t *vha, struct req_que *req,
 }
 
 /**
- * qla24xx_process_response_queue() - Process response queue entries.
- * @ha: SCSI driver HA context
+ * __qla24xx_process_response_queue() - Process response queue entries.
+ * @vha: SCSI driver HA context
+ * @rsp: response queue
+ * @budget: maximum number of entries to process
+ *
+ * The signatures of processed entries are reset without a barrier each; a
+ * single wmb() orders them all before the out pointer hands the entries back
+ * to the firmware.
+ *
+ * Returns the number of entries processed.
  */
-void qla24xx_process_response_queue(struct scsi_qla_host *vha,
-	struct rsp_que *rsp)
+static int __qla24xx_process_response_queue(struct scsi_qla_host *vha,
+	struct rsp_que *rsp, int budget)
 {
 	struct sts_entry_24xx *pkt;
 	struct qla_hw_data *ha = vha->hw;
+	int work_done = 0;
 
 	if (!vha->flags.online)
-		return;
+		return 0;
 
-	while (rsp->ring_ptr->signature != RESPONSE_PROCESSED) {
+	while (work_done < budget &&
+	    rsp->ring_ptr->signature != RESPONSE_PROCESSED) {
 		pkt = (struct sts_entry_24xx *)rsp->ring_ptr;
+		work_done++;
 
 		rsp->ring_index++;
 		if (rsp->ring_index == rsp->length) {
@@ -2550,6 +2585,7 @@ void qla24xx_process_response_queue(struct scsi_qla_host *vha,
 		} else {
 			rsp->ring_ptr++;
 		}
+		prefetch(rsp->ring_ptr);
 
 		if (pkt->entry_status != 0) {
 			qla2x00_error_entry(vha, rsp, (sts_entry_t *) pkt);
@@ -2557,7 +2593,6 @@ void qla24xx_process_response_queue(struct scsi_qla_host *vha,
 			(void)qlt_24xx_process_response_error(vha, pkt);
 
 			((response_t *)pkt)->signature = RESPONSE_PROCESSED;
-			wmb();
 			continue;
 		}
 
@@ -2620,8 +2655,8 @@ void qla24xx_process_response_queue(struct scsi_qla_host *vha,
 			break;
 		}
 		((response_t *)pkt)->signature = RESPONSE_PROCESSED;
-		wmb();
 	}
+	wmb();
 
 	/* Adjust ring index */
 	if (IS_P3P_TYPE(ha)) {
@@ -2629,6 +2664,19 @@ void qla24xx_process_response_queue(struct scsi_qla_host *vha,
 		WRT_REG_DWORD(&reg->rsp_q_out[0], rsp->ring_index);
 	} else
 		WRT_REG_DWORD(rsp->rsp_q_out, rsp->ring_index);
+
+	return work_done;
+}
+
+/**
+ * qla24xx_process_response_queue() - Process all response queue entries.
+ * @vha: SCSI driver HA context
+ * @rsp: response queue
+ */
+void qla24xx_process_response_queue(struct scsi_qla_host *vha,
+	struct rsp_que *rsp)
+{
+	__qla24xx_process_response_queue(vha, rsp, INT_MAX);
 }
 
 static void
@@ -2785,6 +2833,84 @@ qla24xx_intr_handler(int irq, void *dev_id)
 	return IRQ_HANDLED;
 }
 
+/**
+ * qla24xx_rsp_poll() - Process a response queue from softirq context.
+ * @iop: irq_poll context of the response queue
+ * @budget: maximum number of entries to process
+ *
+ * Scheduled by the response queue's MSI-X handler.  At most @budget entries
+ * are processed per pass, so the queue's lock, and with it interrupts, is
+ * held for a bounded time; a longer burst is continued in a later pass.  The
+ * SCSI commands completed by a pass are finished once the lock is dropped.
+ * Nothing is processed while the adapter is offline.
+ *
+ * Returns the number of entries processed.
+ */
+static int
+qla24xx_rsp_poll(struct irq_poll *iop, int budget)
+{
+	struct rsp_que *rsp = container_of(iop, struct rsp_que, irqpoll);
+	struct qla_hw_data *ha = rsp->hw;
+	scsi_qla_host_t *vha = pci_get_drvdata(ha->pdev);
+	struct qla_rsp_compl *compl;
+	unsigned long flags;
+	int work_done, i;
+
+	spin_lock_irqsave(rsp->lock, flags);
+	rsp->num_compl = 0;
+	rsp->defer_compl = 1;
+	work_done = __qla24xx_process_response_queue(vha, rsp, budget);
+	rsp->defer_compl = 0;
+	if (work_done < budget && !rsp->qpair)
+		qla2x00_ip_irq_moderate(vha, rsp);
+	spin_unlock_irqrestore(rsp->lock, flags);
+
+	/* compl[] is only written by this poller */
+	for (i = 0; i < rsp->num_compl; i++) {
+		compl = &rsp->compl[i];
+		compl->sp->done(ha, compl->sp, compl->res);
+	}
+
+	if (work_done < budget) {
+		irq_poll_complete(iop);
+		/*
+		 * An entry posted before completion did not reschedule us.
+		 * Entries are left unprocessed while the adapter is offline,
+		 * an ISP abort reinitializes the queue and the next interrupt
+		 * schedules us again.
+		 */
+		if (vha->flags.online &&
+		    rsp->ring_ptr->signature != RESPONSE_PROCESSED)
+			irq_poll_sched(iop);
+	}
+
+	return work_done;
+}
+
+void
+qla24xx_rsp_poll_init(struct rsp_que *rsp)
+{
+	irq_poll_init(&rsp->irqpoll, QLA_RSP_POLL_WEIGHT, qla24xx_rsp_poll);
+	rsp->irqpoll_enabled = 1;
+}
+
+/**
+ * qla24xx_rsp_poll_disable() - Stop response queue polling.
+ * @rsp: response queue
+ *
+ * Waits for a running pass to finish.  The vector of the response queue must
+ * already be freed.
+ */
+void
+qla24xx_rsp_poll_disable(struct rsp_que *rsp)
+{
+	if (!rsp->irqpoll_enabled)
+		return;
+
+	irq_poll_disable(&rsp->irqpoll);
+	rsp->irqpoll_enabled = 0;
+}
+
 static irqreturn_t
 qla24xx_msix_rsp_q(int irq, void *dev_id)
 {
@@ -2814,11 +2940,15 @@ qla24xx_msix_rsp_q(int irq, void *dev_id)
 	stat = RD_REG_DWORD(&reg->host_status);
 	if (qla2x00_check_reg_for_disconnect(vha, stat))
 		goto out;
-	qla24xx_process_response_queue(vha, rsp);
 	if (!ha->flags.disable_msix_handshake) {
 		WRT_REG_DWORD(&reg->hccr, HCCRX_CLR_RISC_INT);
 		RD_REG_DWORD_RELAXED(&reg->hccr);
 	}
+	spin_unlock_irqrestore(&ha->hardware_lock, flags);
+
+	irq_poll_sched(&rsp->irqpoll);
+	return IRQ_HANDLED;
+
 out:
 	spin_unlock_irqrestore(&ha->hardware_lock, flags);
 
@@ -2854,7 +2984,8 @@ qla25xx_msix_rsp_q(int irq, void *dev_id)
 	}
 	if (qla2x00_check_reg_for_disconnect(vha, hccr))
 		goto out;
-	queue_work_on((int) (rsp->id - 1), ha->wq, &rsp->q_work);
+	/* Processed on the CPU taking the interrupt, affine by the PCI core */
+	irq_poll_sched(&rsp->irqpoll);
 
 out:
 	return IRQ_HANDLED;
@@ -2980,10 +3111,12 @@ qla24xx_disable_msix(struct qla_hw_data *ha)
 
 	for (i = 0; i < ha->msix_count; i++) {
 		qentry = &ha->msix_entries[i];
-		if (qentry->have_irq)
+		if (qentry->have_irq) {
 			free_irq(qentry->vector, qentry->rsp);
+			qla24xx_rsp_poll_disable(qentry->rsp);
+		}
 	}
-	pci_disable_msix(ha->pdev);
+	pci_free_irq_vectors(ha->pdev);
 	kfree(ha->msix_entries);
 	ha->msix_entries = NULL;
 	ha->flags.msix_enabled = 0;
@@ -2997,60 +3130,66 @@ qla24xx_enable_msix(struct qla_hw_data *ha, struct rsp_que *rsp)
 #define MIN_MSIX_COUNT	2
 #define ATIO_VECTOR	2
 	int i, ret;
-	struct msix_entry *entries;
 	struct qla_msix_entry *qentry;
 	scsi_qla_host_t *vha = pci_get_drvdata(ha->pdev);
+	struct irq_affinity desc = {
+		.pre_vectors = MIN_MSIX_COUNT,
+	};
 
-	entries = kzalloc(sizeof(struct msix_entry) * ha->msix_count,
-			GFP_KERNEL);
-	if (!entries) {
-		ql_log(ql_log_warn, vha, 0x00bc,
-		    "Failed to allocate memory for msix_entry.\n");
-		return -ENOMEM;
-	}
-
-	for (i = 0; i < ha->msix_count; i++)
-		entries[i].entry = i;
-
-	ret = pci_enable_msix(ha->pdev, entries, ha->msix_count);
-	if (ret) {
-		if (ret < MIN_MSIX_COUNT)
-			goto msix_failed;
-
+	/*
+	 * The default, base response queue and ATIO vectors serve all CPUs;
+	 * the PCI core spreads the others, one per queue pair, over the CPUs.
+	 */
+	if (QLA_TGT_MODE_ENABLED() && IS_ATIO_MSIX_CAPABLE(ha))
+		desc.pre_vectors++;
+
+	ret = pci_alloc_irq_vectors_affinity(ha->pdev, desc.pre_vectors,
+	    ha->msix_count, PCI_IRQ_MSIX | PCI_IRQ_AFFINITY, &desc);
+	if (ret < 0) {
+		ql_log(ql_log_fatal, vha, 0x00c7,
+		    "MSI-X: Failed to enable support, "
+		    "giving   up -- %d/%d.\n",
+		    ha->msix_count, ret);
+		goto msix_out;
+	} else if (ret < ha->msix_count) {
 		ql_log(ql_log_warn, vha, 0x00c6,
 		    "MSI-X: Failed to enable support "
 		    "-- %d/%d\n Retry with %d vectors.\n",
 		    ha->msix_count, ret, ret);
 		ha->msix_count = ret;
-		ret = pci_enable_msix(ha->pdev, entries, ha->msix_count);
-		if (ret) {
-msix_failed:
-			ql_log(ql_log_fatal, vha, 0x00c7,
-			    "MSI-X: Failed to enable support, "
-			    "giving   up -- %d/%d.\n",
-			    ha->msix_count, ret);
-			goto msix_out;
-		}
 		ha->max_rsp_queues = ha->msix_count - 1;
+		if (ha->max_req_queues > ha->max_rsp_queues)
+			ha->max_req_queues = ha->max_rsp_queues;
 	}
+	/* Each queue pair needs a vector of its own */
+	if (ha->max_qpairs > ha->msix_count - desc.pre_vectors)
+		ha->max_qpairs = ha->msix_count - desc.pre_vectors;
+
 	ha->msix_entries = kzalloc(sizeof(struct qla_msix_entry) *
 				ha->msix_count, GFP_KERNEL);
 	if (!ha->msix_entries) {
 		ql_log(ql_log_fatal, vha, 0x00c8,
 		    "Failed to allocate memory for ha->msix_entries.\n");
+		pci_free_irq_vectors(ha->pdev);
 		ret = -ENOMEM;
 		goto msix_out;
 	}
 	ha->flags.msix_enabled = 1;
+	ret = 0;
 
 	for (i = 0; i < ha->msix_count; i++) {
 		qentry = &ha->msix_entries[i];
-		qentry->vector = entries[i].vector;
-		qentry->entry = entries[i].entry;
+		qentry->vector = pci_irq_vector(ha->pdev, i);
+		qentry->entry = i;
 		qentry->have_irq = 0;
+		qentry->in_use = 0;
 		qentry->rsp = NULL;
 	}
 
+	/* Response queue 0 is processed by qla24xx_rsp_poll() */
+	if (!IS_P3P_TYPE(ha))
+		qla24xx_rsp_poll_init(rsp);
+
 	/* Enable MSI-X vectors for the base queue */
 	for (i = 0; i < 2; i++) {
 		qentry = &ha->msix_entries[i];
@@ -3065,6 +3204,7 @@ msix_failed:
 		if (ret)
 			goto msix_register_fail;
 		qentry->have_irq = 1;
+		qentry->in_use = 1;
 		qentry->rsp = rsp;
 		rsp->msix = qentry;
 	}
@@ -3079,6 +3219,7 @@ msix_failed:
 			qla83xx_msix_entries[ATIO_VECTOR].handler,
 			0, qla83xx_msix_entries[ATIO_VECTOR].name, rsp);
 		qentry->have_irq = 1;
+		qentry->in_use = 1;
 		qentry->rsp = rsp;
 		rsp->msix = qentry;
 	}
@@ -3110,7 +3251,6 @@ msix_register_fail:
 	    ha->mqiobase, ha->max_rsp_queues, ha->max_req_queues);
 
 msix_out:
-	kfree(entries);
 	return ret;
 }
 
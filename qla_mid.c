@@ -484,7 +484,7 @@ qla24xx_create_vhost(struct fc_vport *fc_vport)
 	atomic_set(&vha->loop_state, LOOP_DOWN);
 	atomic_set(&vha->loop_down_timer, LOOP_DOWN_TIME);
 
-	qla2x00_start_timer(vha, qla2x00_timer, WATCH_INTERVAL);
+	qla2x00_start_timer(vha, WATCH_INTERVAL);
 
 	vha->req = base_vha->req;
 	host->can_queue = base_vha->req->length + 128;
@@ -533,6 +533,7 @@ qla25xx_free_req_que(struct scsi_qla_host *vha, struct req_que *req)
 		mutex_unlock(&ha->vport_lock);
 	}
 	kfree(req->outstanding_cmds);
+	kfree(req->outstanding_map);
 	kfree(req);
 	req = NULL;
 }
@@ -548,6 +549,9 @@ qla25xx_free_rsp_que(struct scsi_qla_host *vha, struct rsp_que *rsp)
 		rsp->msix->have_irq = 0;
 		rsp->msix->rsp = NULL;
 	}
+	qla24xx_rsp_poll_disable(rsp);
+	if (rsp->msix)
+		rsp->msix->in_use = 0;
 	dma_free_coherent(&ha->pdev->dev, (rsp->length + 1) *
 		sizeof(response_t), rsp->ring, rsp->dma);
 	rsp->ring = NULL;
@@ -577,7 +581,7 @@ qla25xx_delete_req_que(struct scsi_qla_host *vha, struct req_que *req)
 	return ret;
 }
 
-static int
+int
 qla25xx_delete_rsp_que(struct scsi_qla_host *vha, struct rsp_que *rsp)
 {
 	int ret = -1;
@@ -599,8 +603,19 @@ qla25xx_delete_queues(struct scsi_qla_host *vha)
 	int cnt, ret = 0;
 	struct req_que *req = NULL;
 	struct rsp_que *rsp = NULL;
+	struct qla_qpair *qpair, *tqpair;
 	struct qla_hw_data *ha = vha->hw;
 
+	/* Delete queue pairs, so their srb pools go with them */
+	list_for_each_entry_safe(qpair, tqpair, &vha->qp_list, qp_list_elem) {
+		ret = qla2xxx_delete_qpair(vha, qpair);
+		if (ret != QLA_SUCCESS) {
+			ql_log(ql_log_warn, vha, 0x0195,
+			    "Couldn't delete queue pair %d.\n", qpair->id);
+			return ret;
+		}
+	}
+
 	/* Delete request queues */
 	for (cnt = 1; cnt < ha->max_req_queues; cnt++) {
 		req = ha->req_q_map[cnt];
@@ -640,7 +655,6 @@ qla25xx_create_req_que(struct qla_hw_data *ha, uint16_t options,
 	struct scsi_qla_host *base_vha = pci_get_drvdata(ha->pdev);
 	uint16_t que_id = 0;
 	device_reg_t *reg;
-	uint32_t cnt;
 
 	req = kzalloc(sizeof(struct req_que), GFP_KERNEL);
 	if (req == NULL) {
@@ -699,9 +713,7 @@ qla25xx_create_req_que(struct qla_hw_data *ha, uint16_t options,
 	    "options=0x%x.\n", req->options);
 	ql_dbg(ql_dbg_init, base_vha, 0x00dd,
 	    "options=0x%x.\n", req->options);
-	for (cnt = 1; cnt < req->num_outstanding_cmds; cnt++)
-		req->outstanding_cmds[cnt] = NULL;
-	req->current_outstanding_cmd = 1;
+	qla2x00_reset_outstanding(req);
 
 	req->ring_ptr = req->ring;
 	req->ring_index = 0;
@@ -742,25 +754,12 @@ failed:
 	return 0;
 }
 
-static void qla_do_work(struct work_struct *work)
-{
-	unsigned long flags;
-	struct rsp_que *rsp = container_of(work, struct rsp_que, q_work);
-	struct scsi_qla_host *vha;
-	struct qla_hw_data *ha = rsp->hw;
-
-	spin_lock_irqsave(&rsp->hw->hardware_lock, flags);
-	vha = pci_get_drvdata(ha->pdev);
-	qla24xx_process_response_queue(vha, rsp);
-	spin_unlock_irqrestore(&rsp->hw->hardware_lock, flags);
-}
-
 /* create response queue */
 int
 qla25xx_create_rsp_que(struct qla_hw_data *ha, uint16_t options,
-	uint8_t vp_idx, uint16_t rid, int req)
+	uint8_t vp_idx, uint16_t rid, int req, struct qla_qpair *qpair)
 {
-	int ret = 0;
+	int i, ret = 0;
 	struct rsp_que *rsp = NULL;
 	struct scsi_qla_host *base_vha = pci_get_drvdata(ha->pdev);
 	uint16_t que_id = 0;
@@ -793,9 +792,23 @@ qla25xx_create_rsp_que(struct qla_hw_data *ha, uint16_t options,
 	}
 	set_bit(que_id, ha->rsp_qid_map);
 
-	if (ha->flags.msix_enabled)
-		rsp->msix = &ha->msix_entries[que_id + 1];
-	else
+	if (ha->flags.msix_enabled) {
+		/* Take the first vector not used by another rsp_que */
+		for (i = 0; i < ha->msix_count; i++) {
+			if (ha->msix_entries[i].in_use)
+				continue;
+			rsp->msix = &ha->msix_entries[i];
+			rsp->msix->in_use = 1;
+			break;
+		}
+		if (!rsp->msix) {
+			clear_bit(que_id, ha->rsp_qid_map);
+			mutex_unlock(&ha->vport_lock);
+			ql_log(ql_log_warn, base_vha, 0x00e3,
+			    "No MSI-X vector for additional response queue.\n");
+			goto que_failed;
+		}
+	} else
 		ql_log(ql_log_warn, base_vha, 0x00e3,
 		    "MSIX not enabled.\n");
 
@@ -803,6 +816,9 @@ qla25xx_create_rsp_que(struct qla_hw_data *ha, uint16_t options,
 	rsp->rid = rid;
 	rsp->vp_idx = vp_idx;
 	rsp->hw = ha;
+	rsp->qpair = qpair;
+	/* Only the queue pair's own commands complete on its rsp_que */
+	rsp->lock = qpair ? &qpair->qp_lock : &ha->hardware_lock;
 	ql_dbg(ql_dbg_init, base_vha, 0x00e4,
 	    "queue_id=%d rid=%d vp_idx=%d hw=%p.\n",
 	    que_id, rsp->rid, rsp->vp_idx, rsp->hw);
@@ -832,6 +848,10 @@ qla25xx_create_rsp_que(struct qla_hw_data *ha, uint16_t options,
 	    rsp->options, rsp->id, rsp->rsp_q_in,
 	    rsp->rsp_q_out);
 
+	/* The vector may fire as soon as it is requested */
+	qla2x00_init_response_q_entries(rsp);
+	qla24xx_rsp_poll_init(rsp);
+
 	ret = qla25xx_request_irq(rsp);
 	if (ret)
 		goto que_failed;
@@ -850,9 +870,6 @@ qla25xx_create_rsp_que(struct qla_hw_data *ha, uint16_t options,
 	else
 		rsp->req = NULL;
 
-	qla2x00_init_response_q_entries(rsp);
-	if (rsp->hw->wq)
-		INIT_WORK(&rsp->q_work, qla_do_work);
 	return rsp->id;
 
 que_failed:
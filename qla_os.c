@@ -13,7 +13,7 @@
 #include <linux/mutex.h>
 #include <linux/kobject.h>
 #include <linux/slab.h>
-#include <linux/blk-mq-pci.h>
+#include <linux/blk-mq.h>
 #include <scsi/scsi_tcq.h>
 #include <scsi/scsicam.h>
 #include <scsi/scsi_transport.h>
@@ -33,10 +33,6 @@ static int apidev_major;
  */
 struct kmem_cache *srb_cachep;
 
-/*
- * CT6 CTX allocation cache
- */
-static struct kmem_cache *ctx_cachep;
 /*
  * error level for logging
  */
@@ -255,7 +251,7 @@ static int qla2xxx_eh_host_reset(struct scsi_cmnd *);
 static void qla2x00_clear_drv_active(struct qla_hw_data *);
 static void qla2x00_free_device(scsi_qla_host_t *);
 static void qla83xx_disable_laser(scsi_qla_host_t *vha);
-static int qla2xxx_map_queues(struct Scsi_Host *shost);
+static void qla2xxx_map_queues(struct Scsi_Host *shost);
 
 struct scsi_host_template qla2xxx_driver_template = {
 	.module			= THIS_MODULE,
@@ -278,14 +274,14 @@ struct scsi_host_template qla2xxx_driver_template = {
 	.map_queues             = qla2xxx_map_queues,
 	.this_id		= -1,
 	.cmd_per_lun		= 3,
-	.use_clustering		= ENABLE_CLUSTERING,
 	.sg_tablesize		= SG_ALL,
 
 	.max_sectors		= 0xFFFF,
-	.shost_attrs		= qla2x00_host_attrs,
+	.shost_groups		= qla2x00_host_groups,
 
 	.supported_mode		= MODE_INITIATOR,
 	.track_queue_depth	= 1,
+	.cmd_size		= sizeof(struct qla_cmd_priv),
 };
 
 static struct scsi_transport_template *qla2xxx_transport_template = NULL;
@@ -297,12 +293,10 @@ struct scsi_transport_template *qla2xxx_transport_vport_template = NULL;
  */
 
 __inline__ void
-qla2x00_start_timer(scsi_qla_host_t *vha, void *func, unsigned long interval)
+qla2x00_start_timer(scsi_qla_host_t *vha, unsigned long interval)
 {
-	init_timer(&vha->timer);
+	timer_setup(&vha->timer, qla2x00_timer, 0);
 	vha->timer.expires = jiffies + interval * HZ;
-	vha->timer.data = (unsigned long)vha;
-	vha->timer.function = (void (*)(unsigned long))func;
 	add_timer(&vha->timer);
 	vha->timer_active = 1;
 }
@@ -411,8 +405,10 @@ static void qla2x00_free_req_que(struct qla_hw_data *ha, struct req_que *req)
 		(req->length + 1) * sizeof(request_t),
 		req->ring, req->dma);
 
-	if (req)
+	if (req) {
 		kfree(req->outstanding_cmds);
+		kfree(req->outstanding_map);
+	}
 
 	kfree(req);
 	req = NULL;
@@ -476,6 +472,11 @@ static void qla2x00_free_queues(struct qla_hw_data *ha)
 
 	kfree(ha->rsp_q_map);
 	ha->rsp_q_map = NULL;
+
+	kfree(ha->base_qpair);
+	ha->base_qpair = NULL;
+	kfree(ha->queue_pair_map);
+	ha->queue_pair_map = NULL;
 }
 
 static char *
@@ -644,12 +645,10 @@ qla2x00_sp_free_dma(void *vha, void *ptr)
 		list_splice(&ctx1->dsd_list, &ha->gbl_dsd_list);
 		ha->gbl_dsd_inuse -= ctx1->dsd_use_cnt;
 		ha->gbl_dsd_avail += ctx1->dsd_use_cnt;
-		mempool_free(ctx1, ha->ctx_mempool);
-		ctx1 = NULL;
 	}
 
 	CMD_SP(cmd) = NULL;
-	qla2x00_rel_sp(sp->fcport->vha, sp);
+	qla2x00_rel_cmd_sp(sp->fcport->vha, sp);
 }
 
 void
@@ -673,7 +672,7 @@ qla2x00_sp_compl(void *data, void *ptr, int res)
 		return;
 
 	qla2x00_sp_free_dma(ha, sp);
-	cmd->scsi_done(cmd);
+	scsi_done(cmd);
 }
 
 void
@@ -715,7 +714,6 @@ qla2xxx_qpair_sp_free_dma(void *vha, void *ptr)
 		list_splice(&ctx1->dsd_list, &ha->gbl_dsd_list);
 		ha->gbl_dsd_inuse -= ctx1->dsd_use_cnt;
 		ha->gbl_dsd_avail += ctx1->dsd_use_cnt;
-		mempool_free(ctx1, ha->ctx_mempool);
 	}
 
 	CMD_SP(cmd) = NULL;
@@ -742,7 +740,27 @@ qla2xxx_qpair_sp_compl(void *data, void *ptr, int res)
 		return;
 
 	qla2xxx_qpair_sp_free_dma(sp->fcport->vha, sp);
-	cmd->scsi_done(cmd);
+	scsi_done(cmd);
+}
+
+/*
+ * Queue pair a command is queued to, the one of its blk-mq hardware context.
+ * NULL if the command goes to the base queue.  The caller holds
+ * rcu_read_lock() until the command has taken its queue pair reference.
+ */
+static struct qla_qpair *
+qla2xxx_cmd_qpair(scsi_qla_host_t *vha, struct scsi_cmnd *cmd)
+{
+	struct qla_hw_data *ha = vha->hw;
+	uint32_t tag;
+	uint16_t hwq;
+
+	if (!ha->mqenable || !ha->queue_pair_map)
+		return NULL;
+
+	tag = blk_mq_unique_tag(scsi_cmd_to_rq(cmd));
+	hwq = blk_mq_unique_tag_to_hwq(tag);
+	return rcu_dereference(ha->queue_pair_map[hwq]);
 }
 
 /* If we are SP1 here, we need to still take and release the host_lock as SP1
@@ -758,27 +776,21 @@ qla2xxx_queuecommand(struct Scsi_Host *host, struct scsi_cmnd *cmd)
 	struct scsi_qla_host *base_vha = pci_get_drvdata(ha->pdev);
 	srb_t *sp;
 	int rval;
-	struct qla_qpair *qpair = NULL;
-	uint32_t tag;
-	uint16_t hwq;
+	struct qla_qpair *qpair;
 
 	if (unlikely(test_bit(UNLOADING, &base_vha->dpc_flags))) {
 		cmd->result = DID_NO_CONNECT << 16;
 		goto qc24_fail_command;
 	}
 
-	if (ha->mqenable) {
-		if (shost_use_blk_mq(vha->host)) {
-			tag = blk_mq_unique_tag(cmd->request);
-			hwq = blk_mq_unique_tag_to_hwq(tag);
-			qpair = ha->queue_pair_map[hwq];
-		} else if (vha->vp_idx && vha->qpair) {
-			qpair = vha->qpair;
-		}
-
-		if (qpair)
-			return qla2xxx_mqueuecommand(host, cmd, qpair);
+	rcu_read_lock();
+	qpair = qla2xxx_cmd_qpair(vha, cmd);
+	if (qpair) {
+		rval = qla2xxx_mqueuecommand(host, cmd, qpair);
+		rcu_read_unlock();
+		return rval;
 	}
+	rcu_read_unlock();
 
 	if (ha->flags.eeh_busy) {
 		if (ha->flags.pci_channel_io_perm_failure) {
@@ -841,14 +853,10 @@ qla2xxx_queuecommand(struct Scsi_Host *host, struct scsi_cmnd *cmd)
 	else
 		goto qc24_target_busy;
 
-	sp = qla2x00_get_sp(vha, fcport, GFP_ATOMIC);
+	sp = qla2x00_get_cmd_sp(vha, fcport, cmd);
 	if (!sp)
 		goto qc24_host_busy;
 
-	sp->u.scmd.cmd = cmd;
-	sp->type = SRB_SCSI_CMD;
-	atomic_set(&sp->ref_count, 1);
-	CMD_SP(cmd) = (void *)sp;
 	sp->free = qla2x00_sp_free_dma;
 	sp->done = qla2x00_sp_compl;
 
@@ -871,7 +879,7 @@ qc24_target_busy:
 	return SCSI_MLQUEUE_TARGET_BUSY;
 
 qc24_fail_command:
-	cmd->scsi_done(cmd);
+	scsi_done(cmd);
 
 	return 0;
 }
@@ -889,6 +897,13 @@ qla2xxx_mqueuecommand(struct Scsi_Host *host, struct scsi_cmnd *cmd,
 	srb_t *sp;
 	int rval;
 
+	/* Cleared by the DPC thread while the PCI channel is unusable */
+	if (!qpair->online) {
+		cmd->result = ha->flags.pci_channel_io_perm_failure ?
+		    DID_NO_CONNECT << 16 : DID_REQUEUE << 16;
+		goto qc24_fail_command;
+	}
+
 	rval = fc_remote_port_chkready(rport);
 	if (rval) {
 		cmd->result = rval;
@@ -898,6 +913,12 @@ qla2xxx_mqueuecommand(struct Scsi_Host *host, struct scsi_cmnd *cmd,
 		goto qc24_fail_command;
 	}
 
+	if (!qpair->difdix_supported &&
+	    scsi_get_prot_op(cmd) != SCSI_PROT_NORMAL) {
+		cmd->result = DID_NO_CONNECT << 16;
+		goto qc24_fail_command;
+	}
+
 	if (!fcport) {
 		cmd->result = DID_NO_CONNECT << 16;
 		goto qc24_fail_command;
@@ -927,17 +948,12 @@ qla2xxx_mqueuecommand(struct Scsi_Host *host, struct scsi_cmnd *cmd,
 	else
 		goto qc24_target_busy;
 
-	sp = qla2xxx_get_qpair_sp(qpair, fcport, GFP_ATOMIC);
+	sp = qla2xxx_get_qpair_sp(qpair, fcport, cmd);
 	if (!sp)
 		goto qc24_host_busy;
 
-	sp->u.scmd.cmd = cmd;
-	sp->type = SRB_SCSI_CMD;
-	atomic_set(&sp->ref_count, 1);
-	CMD_SP(cmd) = (void *)sp;
 	sp->free = qla2xxx_qpair_sp_free_dma;
 	sp->done = qla2xxx_qpair_sp_compl;
-	sp->qpair = qpair;
 
 	rval = ha->isp_ops->start_scsi_mq(sp);
 	if (rval != QLA_SUCCESS) {
@@ -960,7 +976,7 @@ qc24_target_busy:
 	return SCSI_MLQUEUE_TARGET_BUSY;
 
 qc24_fail_command:
-	cmd->scsi_done(cmd);
+	scsi_done(cmd);
 
 	return 0;
 }
@@ -1155,13 +1171,15 @@ qla2xxx_eh_abort(struct scsi_cmnd *cmd)
 	unsigned long flags;
 	int rval, wait = 0;
 	struct qla_hw_data *ha = vha->hw;
+	spinlock_t *lock;
 
 	if (qla2x00_isp_reg_stat(ha)) {
 		ql_log(ql_log_info, vha, 0x8042,
 		    "PCI/Register disconnect, exiting.\n");
 		return FAILED;
 	}
-	if (!CMD_SP(cmd))
+	sp = (srb_t *) CMD_SP(cmd);
+	if (!sp)
 		return SUCCESS;
 
 	ret = fc_block_scsi_eh(cmd);
@@ -1169,13 +1187,16 @@ qla2xxx_eh_abort(struct scsi_cmnd *cmd)
 		return ret;
 	ret = SUCCESS;
 
+	/* The srb lives in the command, its queue pair was set when started */
+	lock = sp->qpair ? &sp->qpair->qp_lock : &ha->hardware_lock;
+
 	id = cmd->device->id;
 	lun = cmd->device->lun;
 
-	spin_lock_irqsave(&ha->hardware_lock, flags);
+	spin_lock_irqsave(lock, flags);
 	sp = (srb_t *) CMD_SP(cmd);
 	if (!sp) {
-		spin_unlock_irqrestore(&ha->hardware_lock, flags);
+		spin_unlock_irqrestore(lock, flags);
 		return SUCCESS;
 	}
 
@@ -1186,7 +1207,7 @@ qla2xxx_eh_abort(struct scsi_cmnd *cmd)
 	/* Get a reference to the sp and drop the lock.*/
 	sp_get(sp);
 
-	spin_unlock_irqrestore(&ha->hardware_lock, flags);
+	spin_unlock_irqrestore(lock, flags);
 	rval = ha->isp_ops->abort_command(sp);
 	if (rval) {
 		if (rval == QLA_FUNCTION_PARAMETER_ERROR)
@@ -1202,9 +1223,9 @@ qla2xxx_eh_abort(struct scsi_cmnd *cmd)
 		wait = 1;
 	}
 
-	spin_lock_irqsave(&ha->hardware_lock, flags);
+	spin_lock_irqsave(lock, flags);
 	sp->done(ha, sp, 0);
-	spin_unlock_irqrestore(&ha->hardware_lock, flags);
+	spin_unlock_irqrestore(lock, flags);
 
 	/* Did the command return during mailbox execution? */
 	if (ret == FAILED && !CMD_SP(cmd))
@@ -1226,21 +1247,19 @@ qla2xxx_eh_abort(struct scsi_cmnd *cmd)
 	return ret;
 }
 
-int
-qla2x00_eh_wait_for_pending_commands(scsi_qla_host_t *vha, unsigned int t,
-	uint64_t l, enum nexus_wait_type type)
+static int
+__qla2x00_eh_wait_for_pending_commands(scsi_qla_host_t *vha,
+	struct req_que *req, spinlock_t *lock, unsigned int t, uint64_t l,
+	enum nexus_wait_type type)
 {
 	int cnt, match, status;
 	unsigned long flags;
-	struct qla_hw_data *ha = vha->hw;
-	struct req_que *req;
 	srb_t *sp;
 	struct scsi_cmnd *cmd;
 
 	status = QLA_SUCCESS;
 
-	spin_lock_irqsave(&ha->hardware_lock, flags);
-	req = vha->req;
+	spin_lock_irqsave(lock, flags);
 	for (cnt = 1; status == QLA_SUCCESS &&
 		cnt < req->num_outstanding_cmds; cnt++) {
 		sp = req->outstanding_cmds[cnt];
@@ -1267,11 +1286,38 @@ qla2x00_eh_wait_for_pending_commands(scsi_qla_host_t *vha, unsigned int t,
 		if (!match)
 			continue;
 
-		spin_unlock_irqrestore(&ha->hardware_lock, flags);
+		spin_unlock_irqrestore(lock, flags);
 		status = qla2x00_eh_wait_on_command(cmd);
-		spin_lock_irqsave(&ha->hardware_lock, flags);
+		spin_lock_irqsave(lock, flags);
 	}
-	spin_unlock_irqrestore(&ha->hardware_lock, flags);
+	spin_unlock_irqrestore(lock, flags);
+
+	return status;
+}
+
+int
+qla2x00_eh_wait_for_pending_commands(scsi_qla_host_t *vha, unsigned int t,
+	uint64_t l, enum nexus_wait_type type)
+{
+	int status;
+	struct qla_hw_data *ha = vha->hw;
+	struct scsi_qla_host *base_vha = pci_get_drvdata(ha->pdev);
+	struct qla_qpair *qpair;
+
+	status = __qla2x00_eh_wait_for_pending_commands(vha, vha->req,
+	    &ha->hardware_lock, t, l, type);
+	if (status != QLA_SUCCESS)
+		return status;
+
+	/* Commands queued to queue pairs are outstanding on their req_que */
+	mutex_lock(&ha->mq_lock);
+	list_for_each_entry(qpair, &base_vha->qp_list, qp_list_elem) {
+		status = __qla2x00_eh_wait_for_pending_commands(vha,
+		    qpair->req, &qpair->qp_lock, t, l, type);
+		if (status != QLA_SUCCESS)
+			break;
+	}
+	mutex_unlock(&ha->mq_lock);
 
 	return status;
 }
@@ -1310,8 +1356,8 @@ __qla2xxx_eh_generic_reset(char *name, enum nexus_wait_type type,
 		goto eh_reset_failed;
 	}
 	err = 2;
-	if (do_reset(fcport, cmd->device->lun, cmd->request->cpu + 1)
-		!= QLA_SUCCESS) {
+	if (do_reset(fcport, cmd->device->lun,
+		blk_mq_rq_cpu(scsi_cmd_to_rq(cmd)) + 1) != QLA_SUCCESS) {
 		ql_log(ql_log_warn, vha, 0x800c,
 		    "do_reset failed for cmd=%p.\n", cmd);
 		goto eh_reset_failed;
@@ -1501,9 +1547,6 @@ qla2xxx_eh_host_reset(struct scsi_cmnd *cmd)
 			}
 			/* fall thru if ctx reset failed */
 		}
-		if (ha->wq)
-			flush_workqueue(ha->wq);
-
 		set_bit(ABORT_ISP_ACTIVE, &base_vha->dpc_flags);
 		if (ha->isp_ops->abort_isp(base_vha)) {
 			clear_bit(ABORT_ISP_ACTIVE, &base_vha->dpc_flags);
@@ -1600,16 +1643,18 @@ qla2x00_abort_all_cmds(scsi_qla_host_t *vha, int res)
 	srb_t *sp;
 	struct qla_hw_data *ha = vha->hw;
 	struct req_que *req;
+	spinlock_t *lock;
 
 	qlt_host_reset_handler(ha);
 
-	spin_lock_irqsave(&ha->hardware_lock, flags);
 	for (que = 0; que < ha->max_req_queues; que++) {
 		req = ha->req_q_map[que];
 		if (!req)
 			continue;
 		if (!req->outstanding_cmds)
 			continue;
+		lock = qla2x00_req_lock(ha, req);
+		spin_lock_irqsave(lock, flags);
 		for (cnt = 1; cnt < req->num_outstanding_cmds; cnt++) {
 			sp = req->outstanding_cmds[cnt];
 			if (sp) {
@@ -1623,16 +1668,16 @@ qla2x00_abort_all_cmds(scsi_qla_host_t *vha, int res)
 					 * ends the SCSI command (with result 'res').
 					 */
 					sp_get(sp);
-					spin_unlock_irqrestore(&ha->hardware_lock, flags);
+					spin_unlock_irqrestore(lock, flags);
 					qla2xxx_eh_abort(GET_CMD_SP(sp));
-					spin_lock_irqsave(&ha->hardware_lock, flags);
+					spin_lock_irqsave(lock, flags);
 				}
-				req->outstanding_cmds[cnt] = NULL;
+				qla2x00_clear_outstanding(req, cnt);
 				sp->done(vha, sp, res);
 			}
 		}
+		spin_unlock_irqrestore(lock, flags);
 	}
-	spin_unlock_irqrestore(&ha->hardware_lock, flags);
 }
 
 static int
@@ -1683,7 +1728,7 @@ qla2x00_config_dma_addressing(struct qla_hw_data *ha)
 	if (!dma_set_mask(&ha->pdev->dev, DMA_BIT_MASK(64))) {
 		/* Any upper-dword bits set? */
 		if (MSD(dma_get_required_mask(&ha->pdev->dev)) &&
-		    !pci_set_consistent_dma_mask(ha->pdev, DMA_BIT_MASK(64))) {
+		    !dma_set_coherent_mask(&ha->pdev->dev, DMA_BIT_MASK(64))) {
 			/* Ok, a 64bit DMA mask is applicable. */
 			ha->flags.enable_64bit_addressing = 1;
 			ha->isp_ops->calc_req_entries = qla2x00_calc_iocbs_64;
@@ -1693,7 +1738,7 @@ qla2x00_config_dma_addressing(struct qla_hw_data *ha)
 	}
 
 	dma_set_mask(&ha->pdev->dev, DMA_BIT_MASK(32));
-	pci_set_consistent_dma_mask(ha->pdev, DMA_BIT_MASK(32));
+	dma_set_coherent_mask(&ha->pdev->dev, DMA_BIT_MASK(32));
 }
 
 static void
@@ -2581,9 +2626,6 @@ qla2x00_probe_one(struct pci_dev *pdev, const struct pci_device_id *id)
 			goto probe_out;
 	}
 
-	/* This may fail but that's ok */
-	pci_enable_pcie_error_reporting(pdev);
-
 	ha = kzalloc(sizeof(struct qla_hw_data), GFP_KERNEL);
 	if (!ha) {
 		ql_log_pci(ql_log_fatal, pdev, 0x0009,
@@ -2912,7 +2954,7 @@ qla2x00_probe_one(struct pci_dev *pdev, const struct pci_device_id *id)
 		goto probe_init_failed;
 	}
 
-	if (ha->mqenable && shost_use_blk_mq(host)) {
+	if (ha->mqenable && ha->queue_pair_map) {
 		/* number of hardware queues supported by blk/scsi-mq*/
 		host->nr_hw_queues = ha->max_qpairs;
 
@@ -3014,9 +3056,8 @@ qla2x00_probe_one(struct pci_dev *pdev, const struct pci_device_id *id)
 	    base_vha->mgmt_svr_loop_id, host->sg_tablesize);
 
 	if (ha->mqenable && qla_ini_mode_enabled(base_vha)) {
-		ha->wq = alloc_workqueue("qla2xxx_wq", WQ_MEM_RECLAIM, 1);
 		/* Create start of day qpairs for Block MQ */
-		if (shost_use_blk_mq(host)) {
+		if (ha->queue_pair_map) {
 			for (i = 0; i < ha->max_qpairs; i++)
 				qla2xxx_create_qpair(base_vha, 5, 0);
 		}
@@ -3068,7 +3109,7 @@ skip_dpc:
 	base_vha->host->irq = ha->pdev->irq;
 
 	/* Initialized the timer */
-	qla2x00_start_timer(base_vha, qla2x00_timer, WATCH_INTERVAL);
+	qla2x00_start_timer(base_vha, WATCH_INTERVAL);
 	ql_dbg(ql_dbg_init, base_vha, 0x00ef,
 	    "Started qla2x00_timer with "
 	    "interval=%d.\n", WATCH_INTERVAL);
@@ -3252,7 +3293,6 @@ qla2x00_shutdown(struct pci_dev *pdev)
 
 	qla2x00_free_fw_dump(ha);
 
-	pci_disable_pcie_error_reporting(pdev);
 	pci_disable_device(pdev);
 }
 
@@ -3447,8 +3487,6 @@ qla2x00_remove_one(struct pci_dev *pdev)
 	kfree(ha);
 	ha = NULL;
 
-	pci_disable_pcie_error_reporting(pdev);
-
 	pci_disable_device(pdev);
 }
 
@@ -3486,14 +3524,6 @@ qla2x00_free_device(scsi_qla_host_t *vha)
 
 	qla2x00_free_irqs(vha);
 
-	/* Flush the work queue and remove it */
-	if (ha->wq) {
-		flush_workqueue(ha->wq);
-		destroy_workqueue(ha->wq);
-		ha->wq = NULL;
-	}
-
-
 	qla2x00_mem_free(ha);
 
 	qla82xx_md_free(vha);
@@ -3505,6 +3535,7 @@ void qla2x00_free_fcports(struct scsi_qla_host *vha)
 {
 	fc_port_t *fcport, *tfcport;
 
+	qla2x00_ip_unhash_fcports(vha);
 	list_for_each_entry_safe(fcport, tfcport, &vha->vp_fcports, list) {
 		list_del(&fcport->list);
 		qla2x00_clear_loop_id(fcport);
@@ -3655,28 +3686,10 @@ qla2x00_mem_alloc(struct qla_hw_data *ha, uint16_t req_len, uint16_t rsp_len,
 	if (!ha->srb_mempool)
 		goto fail_free_gid_list;
 
-	if (IS_P3P_TYPE(ha)) {
-		/* Allocate cache for CT6 Ctx. */
-		if (!ctx_cachep) {
-			ctx_cachep = kmem_cache_create("qla2xxx_ctx",
-				sizeof(struct ct6_dsd), 0,
-				SLAB_HWCACHE_ALIGN, NULL);
-			if (!ctx_cachep)
-				goto fail_free_gid_list;
-		}
-		ha->ctx_mempool = mempool_create_slab_pool(SRB_MIN_REQ,
-			ctx_cachep);
-		if (!ha->ctx_mempool)
-			goto fail_free_srb_mempool;
-		ql_dbg_pci(ql_dbg_init, ha->pdev, 0x0021,
-		    "ctx_cachep=%p ctx_mempool=%p.\n",
-		    ctx_cachep, ha->ctx_mempool);
-	}
-
 	/* Get memory for cached NVRAM */
 	ha->nvram = kzalloc(MAX_NVRAM_SIZE, GFP_KERNEL);
 	if (!ha->nvram)
-		goto fail_free_ctx_mempool;
+		goto fail_free_srb_mempool;
 
 	snprintf(name, sizeof(name), "%s_%d", QLA2XXX_DRIVER_NAME,
 		ha->pdev->device);
@@ -3759,6 +3772,7 @@ qla2x00_mem_alloc(struct qla_hw_data *ha, uint16_t req_len, uint16_t rsp_len,
 		goto fail_rsp;
 	}
 	(*rsp)->hw = ha;
+	(*rsp)->lock = &ha->hardware_lock;
 	(*rsp)->length = rsp_len;
 	(*rsp)->ring = dma_alloc_coherent(&ha->pdev->dev,
 		((*rsp)->length + 1) * sizeof(response_t),
@@ -3867,9 +3881,6 @@ fail_s_dma_pool:
 fail_free_nvram:
 	kfree(ha->nvram);
 	ha->nvram = NULL;
-fail_free_ctx_mempool:
-	mempool_destroy(ha->ctx_mempool);
-	ha->ctx_mempool = NULL;
 fail_free_srb_mempool:
 	mempool_destroy(ha->srb_mempool);
 	ha->srb_mempool = NULL;
@@ -4138,9 +4149,6 @@ qla2x00_mem_free(struct qla_hw_data *ha)
 	if (ha->fcp_cmnd_dma_pool)
 		dma_pool_destroy(ha->fcp_cmnd_dma_pool);
 
-	if (ha->ctx_mempool)
-		mempool_destroy(ha->ctx_mempool);
-
 	qlt_mem_free(ha);
 
 	if (ha->init_cb)
@@ -4153,7 +4161,6 @@ qla2x00_mem_free(struct qla_hw_data *ha)
 	kfree(ha->loop_id_map);
 
 	ha->srb_mempool = NULL;
-	ha->ctx_mempool = NULL;
 	ha->sns_cmd = NULL;
 	ha->sns_cmd_dma = 0;
 	ha->ct_sns = NULL;
@@ -4201,6 +4208,8 @@ struct scsi_qla_host *qla2x00_create_host(struct scsi_host_template *sht,
 	vha->hw = ha;
 
 	INIT_LIST_HEAD(&vha->vp_fcports);
+	hash_init(vha->ip.fcport_hash);
+	INIT_LIST_HEAD(&vha->ip.pending_q);
 	INIT_LIST_HEAD(&vha->work_list);
 	INIT_LIST_HEAD(&vha->list);
 	INIT_LIST_HEAD(&vha->qla_cmd_list);
@@ -5221,7 +5230,6 @@ qla2x00_disable_board_on_pci_error(struct work_struct *work)
 	qla2x00_unmap_iobases(ha);
 
 	pci_release_selected_regions(ha->pdev, ha->bars);
-	pci_disable_pcie_error_reporting(pdev);
 	pci_disable_device(pdev);
 
 	/*
@@ -5594,8 +5602,9 @@ qla2x00_rst_aen(scsi_qla_host_t *vha)
 * Context: Interrupt
 ***************************************************************************/
 void
-qla2x00_timer(scsi_qla_host_t *vha)
+qla2x00_timer(struct timer_list *t)
 {
+	scsi_qla_host_t *vha = from_timer(vha, t, timer);
 	unsigned long	cpu_flags = 0;
 	int		start_dpc = 0;
 	int		index;
@@ -5634,6 +5643,9 @@ qla2x00_timer(scsi_qla_host_t *vha)
 	if (!vha->vp_idx && IS_QLAFX00(ha))
 		qlafx00_timer_routine(vha);
 
+	/* Retry or expire IP packets awaiting a port login */
+	qla2x00_ip_timer(vha);
+
 	/* Loop down handler. */
 	if (atomic_read(&vha->loop_down_timer) > 0 &&
 	    !(test_bit(ABORT_ISP_ACTIVE, &vha->dpc_flags)) &&
@@ -6133,8 +6145,6 @@ qla2xxx_pci_resume(struct pci_dev *pdev)
 		    "The device failed to resume I/O from slot/link_reset.\n");
 	}
 
-	pci_cleanup_aer_uncorrect_error_status(pdev);
-
 	ha->flags.eeh_busy = 0;
 }
 
@@ -6164,11 +6174,40 @@ qla83xx_disable_laser(scsi_qla_host_t *vha)
 	qla83xx_wr_reg(vha, reg, data);
 }
 
-static int qla2xxx_map_queues(struct Scsi_Host *shost)
+/*
+ * Map each CPU onto the hardware context of the queue pair whose vector is
+ * affine to it, so commands complete on the CPU that submitted them.  The
+ * default, base and ATIO vectors come first, so hardware context N is not
+ * PCI vector N as blk_mq_pci_map_queues() would assume.
+ */
+static void qla2xxx_map_queues(struct Scsi_Host *shost)
 {
 	scsi_qla_host_t *vha = (scsi_qla_host_t *)shost->hostdata;
+	struct qla_hw_data *ha = vha->hw;
+	struct blk_mq_queue_map *qmap = &shost->tag_set.map[HCTX_TYPE_DEFAULT];
+	const struct cpumask *mask;
+	struct qla_qpair *qpair;
+	unsigned int queue, cpu;
+
+	/* CPUs no queue pair vector is affine to keep the default spread */
+	blk_mq_map_queues(qmap);
+	if (!ha->queue_pair_map)
+		return;
 
-	return blk_mq_pci_map_queues(&shost->tag_set, vha->hw->pdev);
+	rcu_read_lock();
+	for (queue = 0; queue < qmap->nr_queues; queue++) {
+		qpair = rcu_dereference(ha->queue_pair_map[queue]);
+		if (!qpair || !qpair->msix)
+			continue;
+
+		mask = pci_irq_get_affinity(ha->pdev, qpair->msix->entry);
+		if (!mask)
+			continue;
+
+		for_each_cpu(cpu, mask)
+			qmap->mq_map[cpu] = qmap->queue_offset + queue;
+	}
+	rcu_read_unlock();
 }
 
 static const struct pci_error_handlers qla2xxx_err_handler = {
@@ -6297,7 +6336,13 @@ qla2x00_module_init(void)
 		ql_log(ql_log_fatal, NULL, 0x0006,
 		    "pci_register_driver failed...ret=%d Failing load!.\n",
 		    ret);
+		return ret;
 	}
+
+	if (qla2x00_ip_emu_init())
+		ql_log(ql_log_warn, NULL, 0x0,
+		    "Unable to create software-emulated IP adapters.\n");
+
 	return ret;
 }
 
@@ -6307,13 +6352,12 @@ qla2x00_module_init(void)
 static void __exit
 qla2x00_module_exit(void)
 {
+	qla2x00_ip_emu_exit();
 	unregister_chrdev(apidev_major, QLA2XXX_APIDEV);
 	pci_unregister_driver(&qla2xxx_pci_driver);
 	qla2x00_release_firmware();
 	kmem_cache_destroy(srb_cachep);
 	qlt_exit();
-	if (ctx_cachep)
-		kmem_cache_destroy(ctx_cachep);
 	fc_release_transport(qla2xxx_transport_template);
 	fc_release_transport(qla2xxx_transport_vport_template);
 }
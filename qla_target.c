@@ -605,7 +605,7 @@ static struct qla_tgt_sess *qlt_create_sess(
 			if (sess->deleted)
 				qlt_undelete_sess(sess);
 
-			kref_get(&sess->se_sess->sess_kref);
+			kref_get(&sess->sess_kref);
 			ha->tgt.tgt_ops->update_sess(sess, fcport->d_id, fcport->loop_id,
 						(fcport->flags & FCF_CONF_COMP_SUPPORTED));
 
@@ -632,6 +632,9 @@ static struct qla_tgt_sess *qlt_create_sess(
 	sess->s_id = fcport->d_id;
 	sess->loop_id = fcport->loop_id;
 	sess->local = local;
+	kref_init(&sess->sess_kref);
+	spin_lock_init(&sess->cmd_list_lock);
+	INIT_LIST_HEAD(&sess->cmd_list);
 
 	ql_dbg(ql_dbg_tgt_mgt, vha, 0xf006,
 	    "Adding sess %p to tgt %p via ->check_initiator_node_acl()\n",
@@ -655,7 +658,7 @@ static struct qla_tgt_sess *qlt_create_sess(
 	 * Take an extra reference to ->sess_kref here to handle qla_tgt_sess
 	 * access across ->hardware_lock reaquire.
 	 */
-	kref_get(&sess->se_sess->sess_kref);
+	kref_get(&sess->sess_kref);
 
 	sess->conf_compl_supported = (fcport->flags & FCF_CONF_COMP_SUPPORTED);
 	BUILD_BUG_ON(sizeof(sess->port_name) != sizeof(fcport->port_name));
@@ -707,7 +710,7 @@ void qlt_fc_port_added(struct scsi_qla_host *vha, fc_port_t *fcport)
 
 		spin_lock_irqsave(&ha->hardware_lock, flags);
 	} else {
-		kref_get(&sess->se_sess->sess_kref);
+		kref_get(&sess->sess_kref);
 
 		if (sess->deleted) {
 			qlt_undelete_sess(sess);
@@ -820,7 +823,7 @@ void qlt_stop_phase1(struct qla_tgt *tgt)
 	spin_lock_irqsave(&tgt->sess_work_lock, flags);
 	while (!list_empty(&tgt->sess_works_list)) {
 		spin_unlock_irqrestore(&tgt->sess_work_lock, flags);
-		flush_scheduled_work();
+		flush_work(&tgt->sess_work);
 		spin_lock_irqsave(&tgt->sess_work_lock, flags);
 	}
 	spin_unlock_irqrestore(&tgt->sess_work_lock, flags);
@@ -1112,24 +1115,21 @@ static int __qlt_24xx_handle_abts(struct scsi_qla_host *vha,
 	struct abts_recv_from_24xx *abts, struct qla_tgt_sess *sess)
 {
 	struct qla_hw_data *ha = vha->hw;
-	struct se_session *se_sess = sess->se_sess;
 	struct qla_tgt_mgmt_cmd *mcmd;
-	struct se_cmd *se_cmd;
+	struct qla_tgt_cmd *cmd;
 	u32 lun = 0;
 	int rc;
 	bool found_lun = false;
 
-	spin_lock(&se_sess->sess_cmd_lock);
-	list_for_each_entry(se_cmd, &se_sess->sess_cmd_list, se_cmd_list) {
-		struct qla_tgt_cmd *cmd =
-			container_of(se_cmd, struct qla_tgt_cmd, se_cmd);
+	spin_lock(&sess->cmd_list_lock);
+	list_for_each_entry(cmd, &sess->cmd_list, cmd_list) {
 		if (cmd->tag == abts->exchange_addr_to_abort) {
 			lun = cmd->unpacked_lun;
 			found_lun = true;
 			break;
 		}
 	}
-	spin_unlock(&se_sess->sess_cmd_lock);
+	spin_unlock(&sess->cmd_list_lock);
 
 	if (!found_lun)
 		return -ENOENT;
@@ -1322,7 +1322,7 @@ static int qlt_pci_map_calc_cnt(struct qla_tgt_prm *prm)
 	BUG_ON(cmd->sg_cnt == 0);
 
 	prm->sg = (struct scatterlist *)cmd->sg;
-	prm->seg_cnt = pci_map_sg(prm->tgt->ha->pdev, cmd->sg,
+	prm->seg_cnt = dma_map_sg(&prm->tgt->ha->pdev->dev, cmd->sg,
 	    cmd->sg_cnt, cmd->dma_data_direction);
 	if (unlikely(prm->seg_cnt == 0))
 		goto out_err;
@@ -1354,7 +1354,8 @@ static inline void qlt_unmap_sg(struct scsi_qla_host *vha,
 	struct qla_hw_data *ha = vha->hw;
 
 	BUG_ON(!cmd->sg_mapped);
-	pci_unmap_sg(ha->pdev, cmd->sg, cmd->sg_cnt, cmd->dma_data_direction);
+	dma_unmap_sg(&ha->pdev->dev, cmd->sg, cmd->sg_cnt,
+	    cmd->dma_data_direction);
 	cmd->sg_mapped = 0;
 }
 
@@ -2144,8 +2145,17 @@ done:
 
 void qlt_free_cmd(struct qla_tgt_cmd *cmd)
 {
+	struct qla_tgt_sess *sess = cmd->sess;
+	unsigned long flags;
+
 	BUG_ON(cmd->sg_mapped);
 
+	if (sess) {
+		spin_lock_irqsave(&sess->cmd_list_lock, flags);
+		list_del(&cmd->cmd_list);
+		spin_unlock_irqrestore(&sess->cmd_list_lock, flags);
+	}
+
 	if (unlikely(cmd->free_sg))
 		kfree(cmd->sg);
 	kmem_cache_free(qla_tgt_cmd_cachep, cmd);
@@ -2490,7 +2500,7 @@ static void qlt_do_work(struct work_struct *work)
 	    atio->u.isp24.fcp_hdr.s_id);
 	/* Do kref_get() before dropping qla_hw_data->hardware_lock. */
 	if (sess)
-		kref_get(&sess->se_sess->sess_kref);
+		kref_get(&sess->sess_kref);
 	spin_unlock_irqrestore(&ha->hardware_lock, flags);
 
 	if (unlikely(!sess)) {
@@ -2546,10 +2556,19 @@ static void qlt_do_work(struct work_struct *work)
 	    "qla_target: START qla command: %p lun: 0x%04x (tag %d)\n",
 	    cmd, cmd->unpacked_lun, cmd->tag);
 
+	/* Looked up by ABTS, the target core keeps no command list for us */
+	spin_lock_irqsave(&sess->cmd_list_lock, flags);
+	list_add_tail(&cmd->cmd_list, &sess->cmd_list);
+	spin_unlock_irqrestore(&sess->cmd_list_lock, flags);
+
 	ret = vha->hw->tgt.tgt_ops->handle_cmd(vha, cmd, cdb, data_length,
 	    fcp_task_attr, data_dir, bidi);
-	if (ret != 0)
+	if (ret != 0) {
+		spin_lock_irqsave(&sess->cmd_list_lock, flags);
+		list_del_init(&cmd->cmd_list);
+		spin_unlock_irqrestore(&sess->cmd_list_lock, flags);
 		goto out_term;
+	}
 	/*
 	 * Drop extra session reference from qla_tgt_handle_cmd_for_atio*(
 	 */
@@ -4008,7 +4027,7 @@ static void qlt_abort_work(struct qla_tgt *tgt,
 		if (!sess)
 			goto out_term;
 	} else {
-		kref_get(&sess->se_sess->sess_kref);
+		kref_get(&sess->sess_kref);
 	}
 
 	if (tgt->tgt_stop)
@@ -4062,7 +4081,7 @@ static void qlt_tmr_work(struct qla_tgt *tgt,
 		if (!sess)
 			goto out_term;
 	} else {
-		kref_get(&sess->se_sess->sess_kref);
+		kref_get(&sess->sess_kref);
 	}
 
 	iocb = a;
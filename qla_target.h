@@ -820,6 +820,13 @@ struct qla_tgt_sess {
 	struct scsi_qla_host *vha;
 	struct qla_tgt *tgt;
 
+	/* Session references, dropped through ->put_sess() */
+	struct kref sess_kref;
+
+	/* Commands handed to the target core, looked up by ABTS */
+	spinlock_t cmd_list_lock;
+	struct list_head cmd_list;
+
 	struct list_head sess_list_entry;
 	unsigned long expires;
 	struct list_head del_list_entry;